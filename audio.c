@@ -0,0 +1,131 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "audio.h"
+#include "spu.h"
+#include "ring.h"
+
+#include <SDL2/SDL.h>
+
+// SPU batches are resampled into a wait-free ring that the SDL callback
+// drains. The emulated and host clocks never quite agree, so the resampling
+// ratio is nudged by up to AUDIO_MAX_DELTA to hold the ring near
+// AUDIO_TARGET_MS. The pitch change is inaudible and the buffering stays
+// small without underruns. Without a device the output goes nowhere, -A
+// records it to WAV either way.
+#define AUDIO_TARGET_MS   32
+#define AUDIO_MAX_DELTA   0.005
+#define AUDIO_DRIFT_GAIN  0.0002
+#define AUDIO_RING_SIZE   (32 * 1024)
+#define AUDIO_DEVICE_FRAMES 512
+
+int audio_disabled;
+int audio_running;
+uint64_t audio_underruns;
+uint64_t audio_overruns;
+
+uint8_t audio_ring_data[AUDIO_RING_SIZE];
+ring_t audio_ring;
+SDL_AudioDeviceID audio_device;
+
+// Slow correction for a steady clock mismatch, on top of the proportional term
+double audio_drift;
+// Output starts once the ring first reaches the target
+_Atomic int audio_primed;
+
+// Resampler position relative to audio_last, the final frame of the last batch
+double audio_position;
+int16_t audio_last[2];
+
+void audio_callback(void *userdata, uint8_t *stream, int length) {
+  if(!atomic_load(&audio_primed)) {
+    memset(stream, 0, length);
+    return;
+  }
+  uint32_t got = ring_read(&audio_ring, stream, length);
+  if(got < (uint32_t)length) {
+    memset(stream + got, 0, length - got);
+    audio_underruns++;
+  }
+}
+
+void audio_start() {
+  ring_init(&audio_ring, audio_ring_data, AUDIO_RING_SIZE);
+  audio_position = 0;
+  audio_drift = 0;
+  atomic_store(&audio_primed, 0);
+  memset(audio_last, 0, sizeof(audio_last));
+  audio_running = 1;
+}
+
+void audio_init() {
+  if(audio_disabled) return;
+  if(SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+    printf("Audio unavailable: %s\n", SDL_GetError());
+    return;
+  }
+  SDL_AudioSpec want = {
+    .freq = SPU_RATE,
+    .format = AUDIO_S16SYS,
+    .channels = 2,
+    .samples = AUDIO_DEVICE_FRAMES,
+    .callback = audio_callback,
+  };
+  audio_device = SDL_OpenAudioDevice(0, 0, &want, 0, 0);
+  if(!audio_device) {
+    printf("Audio unavailable: %s\n", SDL_GetError());
+    return;
+  }
+  audio_start();
+  SDL_PauseAudioDevice(audio_device, 0);
+  atexit(audio_close);
+}
+
+void audio_close() {
+  if(!audio_device) return;
+  SDL_CloseAudioDevice(audio_device);
+  audio_device = 0;
+  audio_running = 0;
+  if(audio_underruns || audio_overruns)
+    printf("Audio underruns %lu, overruns %lu\n", audio_underruns, audio_overruns);
+}
+
+// Input frames consumed per output frame, for a ring holding fill frames.
+// Called once per SPU batch.
+double audio_rate(uint32_t fill) {
+  double target = SPU_RATE * AUDIO_TARGET_MS / 1000.0;
+  double error = (fill - target) / target;
+  if(error > 1) error = 1;
+  if(error < -1) error = -1;
+  audio_drift += AUDIO_MAX_DELTA * AUDIO_DRIFT_GAIN * error;
+  if(audio_drift > AUDIO_MAX_DELTA) audio_drift = AUDIO_MAX_DELTA;
+  if(audio_drift < -AUDIO_MAX_DELTA) audio_drift = -AUDIO_MAX_DELTA;
+  return(1.0 + AUDIO_MAX_DELTA * error + audio_drift);
+}
+
+void audio_output(const int16_t *frames, uint32_t count) {
+  if(!audio_running || !count) return;
+  int16_t out[SPU_RATE / 100 * 2];
+  uint32_t produced = 0;
+  uint32_t fill = ring_used(&audio_ring) / 4;
+  if(fill >= SPU_RATE * AUDIO_TARGET_MS / 1000) atomic_store(&audio_primed, 1);
+  double step = audio_rate(fill);
+  // Linear interpolation over audio_last followed by this batch
+  while(audio_position < count && produced < sizeof(out) / 4) {
+    uint32_t index = audio_position;
+    double fraction = audio_position - index;
+    const int16_t *a = index ? frames + (index - 1) * 2 : audio_last;
+    const int16_t *b = frames + index * 2;
+    out[produced * 2] = a[0] + (b[0] - a[0]) * fraction;
+    out[produced * 2 + 1] = a[1] + (b[1] - a[1]) * fraction;
+    produced++;
+    audio_position += step;
+  }
+  audio_position -= count;
+  if(audio_position < 0) audio_position = 0;
+  memcpy(audio_last, frames + (count - 1) * 2, sizeof(audio_last));
+  if(ring_write(&audio_ring, out, produced * 4) < produced * 4)
+    audio_overruns++;
+}
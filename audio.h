@@ -0,0 +1,13 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <stdint.h>
+
+extern int audio_disabled;
+
+void audio_init();
+void audio_close();
+void audio_output(const int16_t *frames, uint32_t count);
+double audio_rate(uint32_t fill);
+
+#endif
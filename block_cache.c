@@ -0,0 +1,302 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "block_cache.h"
+#include "cpu.h"
+#include "memory.h"
+#include "hash.h"
+#include "timing.h"
+
+#define BLOCK_CACHE_MAX_OPS 64
+#define BLOCK_CACHE_MAGIC   0x43424350
+// Bump whenever blocks are cut, decoded or stored differently, older files are then ignored
+#define BLOCK_CACHE_VERSION 3
+
+#define BLOCK_CACHE_RAM_SLOTS (0x200000 / 4)
+#define BLOCK_CACHE_ROM_SLOTS (0x80000 / 4)
+
+typedef struct __attribute__((packed)) block_cache_header_t {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t count;
+  uint32_t reserved;
+} block_cache_header_t;
+
+// Followed by count ops
+typedef struct __attribute__((packed)) block_cache_record_t {
+  uint32_t address;
+  uint32_t count;
+  uint64_t hash;
+} block_cache_record_t;
+
+typedef struct block_t {
+  // Physical
+  uint32_t address;
+  uint32_t count;
+  cpu_op_t *ops;
+  // The write count of the block's page when it was last known to match
+  // memory, the BIOS never changes so its blocks stay at 0
+  uint32_t generation;
+  uint8_t checked;
+  // Ops allocated here rather than mapped from the file
+  uint8_t owned;
+} block_t;
+
+extern uint8_t ram[];
+extern uint8_t rom[];
+extern uint32_t memory_control_cache;
+
+// One slot per word of RAM and the BIOS, whichever mirror the code runs from
+block_t **block_cache_ram, **block_cache_rom;
+char *block_cache_path;
+uint8_t *block_cache_map;
+size_t block_cache_map_size;
+uint32_t block_cache_blocks, block_cache_loaded, block_cache_translated;
+uint64_t block_cache_lookups, block_cache_misses;
+
+uint64_t block_cache_hash(const cpu_op_t *ops, uint32_t count) {
+  return(hash_bytes(ops, count * sizeof(cpu_op_t), HASH_SEED ^ BLOCK_CACHE_VERSION));
+}
+
+block_t **block_cache_slot(uint32_t address) {
+  if(address < 0x200000) return(&block_cache_ram[address / 4]);
+  if(address >= 0x1fc00000 && address < 0x1fc80000) return(&block_cache_rom[(address - 0x1fc00000) / 4]);
+  return(0);
+}
+
+void block_cache_init() {
+  if(block_cache_ram) return;
+  block_cache_ram = calloc(BLOCK_CACHE_RAM_SLOTS, sizeof(block_t *));
+  block_cache_rom = calloc(BLOCK_CACHE_ROM_SLOTS, sizeof(block_t *));
+}
+
+block_t *block_cache_insert(block_t **slot, uint32_t address, uint32_t count, cpu_op_t *ops, int owned) {
+  block_t *block = *slot;
+  if(!block) {
+    block = calloc(1, sizeof(block_t));
+    *slot = block;
+    block_cache_blocks++;
+  } else if(block->owned) {
+    free(block->ops);
+  }
+  block->address = address;
+  block->count = count;
+  block->ops = ops;
+  block->generation = 0;
+  block->checked = 0;
+  block->owned = owned;
+  return(block);
+}
+
+void block_cache_load() {
+  int fd = open(block_cache_path, O_RDONLY);
+  if(fd < 0) return;
+  struct stat st;
+  if(fstat(fd, &st) || st.st_size < (off_t)sizeof(block_cache_header_t)) {
+    close(fd);
+    return;
+  }
+  uint8_t *map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) return;
+  block_cache_header_t *header = (block_cache_header_t *)map;
+  if(header->magic != BLOCK_CACHE_MAGIC || header->version != BLOCK_CACHE_VERSION) {
+    printf("Block cache %s is from another version, starting afresh\n", block_cache_path);
+    munmap(map, st.st_size);
+    return;
+  }
+  block_cache_map = map;
+  block_cache_map_size = st.st_size;
+  size_t offset = sizeof(block_cache_header_t);
+  for(uint32_t n = 0; n < header->count; n++) {
+    if(offset + sizeof(block_cache_record_t) > (size_t)st.st_size) break;
+    block_cache_record_t *record = (block_cache_record_t *)(map + offset);
+    uint32_t count = record->count;
+    cpu_op_t *ops = (cpu_op_t *)(map + offset + sizeof(block_cache_record_t));
+    offset += sizeof(block_cache_record_t) + (size_t)count * sizeof(cpu_op_t);
+    if(!count || count > BLOCK_CACHE_MAX_OPS || offset > (size_t)st.st_size) break;
+    // A damaged record is dropped, it would only ever fail its check anyway
+    block_t **slot = block_cache_slot(record->address);
+    if(!slot || block_cache_hash(ops, count) != record->hash) continue;
+    // Handlers and registers are indices, never trust them blindly
+    uint32_t valid = 0;
+    while(valid < count && cpu_op_valid(&ops[valid])) valid++;
+    if(valid < count) continue;
+    block_cache_insert(slot, record->address, count, ops, 0);
+    block_cache_loaded++;
+  }
+}
+
+void block_cache_open(const char *path) {
+  block_cache_init();
+  block_cache_path = strdup(path);
+  block_cache_load();
+  atexit(block_cache_close);
+}
+
+// Whether the block must end after this instruction, and if so after its delay slot
+int block_cache_ends(uint32_t instruction, int *delay_slot) {
+  uint32_t operation = instruction >> 26;
+  uint32_t function = instruction & 0x3f;
+  *delay_slot = 1;
+  if(operation >= 1 && operation <= 7) return(1);
+  if(operation == 0 && (function == 0x08 || function == 0x09)) return(1);
+  *delay_slot = 0;
+  if(operation == 0 && (function == 0x0c || function == 0x0d)) return(1);
+  return(0);
+}
+
+uint32_t block_cache_cut(cpu_op_t *ops, const uint8_t *source, uint32_t available) {
+  uint32_t count = 0;
+  int delay_slot;
+  while(count < available && count < BLOCK_CACHE_MAX_OPS) {
+    uint32_t instruction;
+    memcpy(&instruction, source + count * 4, 4);
+    cpu_decode(instruction, &ops[count++]);
+    if(block_cache_ends(instruction, &delay_slot)) {
+      if(delay_slot && count < available) {
+        memcpy(&instruction, source + count * 4, 4);
+        cpu_decode(instruction, &ops[count++]);
+      }
+      break;
+    }
+  }
+  return(count);
+}
+
+// Whether the block still holds the code in memory
+int block_cache_matches(block_t *block, const uint8_t *source) {
+  for(uint32_t n = 0; n < block->count; n++) {
+    uint32_t instruction;
+    memcpy(&instruction, source + n * 4, 4);
+    if(block->ops[n].instruction != instruction) return(0);
+  }
+  return(1);
+}
+
+// Finds the block for the code at pc as it is in memory now, decoding a
+// new one if there isn't one. Only RAM and the BIOS are cached, pages
+// holding a breakpoint don't fetch from them directly and so run
+// interpreted.
+block_t *block_cache_lookup(uint32_t pc) {
+  if(pc % 4) return(0);
+  memory_accessor_t *device = memory_fetch_pages[pc >> MEMORY_PAGE_BITS];
+  uint32_t address = pc & 0x1fffffff;
+  const uint8_t *source;
+  uint32_t generation = 0;
+  if(device == &ram_accessor && address < 0x200000) {
+    source = ram + address;
+    generation = ram_generation[address >> RAM_PAGE_BITS];
+  } else if(device == &rom_accessor) {
+    source = rom + address - 0x1fc00000;
+  } else {
+    return(0);
+  }
+  block_cache_lookups++;
+
+  block_t **slot = block_cache_slot(address);
+  block_t *block = *slot;
+  if(block && block->checked && block->generation == generation) return(block);
+  // The page was written, most often not where the code is
+  if(block && block_cache_matches(block, source)) {
+    block->checked = 1;
+    block->generation = generation;
+    return(block);
+  }
+
+  block_cache_misses++;
+  block_cache_translated++;
+  // Blocks stop at the end of a RAM page, whose write count covers them,
+  // which also keeps them within a page the breakpoints route
+  uint32_t available = ((1 << RAM_PAGE_BITS) - (address & ((1 << RAM_PAGE_BITS) - 1))) / 4;
+  cpu_op_t *ops = malloc(BLOCK_CACHE_MAX_OPS * sizeof(cpu_op_t));
+  uint32_t count = block_cache_cut(ops, source, available);
+  block = block_cache_insert(slot, address, count, ops, 1);
+  block->checked = 1;
+  block->generation = generation;
+  return(block);
+}
+
+uint32_t block_cache_run(uint32_t limit) {
+  block_cache_init();
+  uint32_t count = 0;
+  while(count < limit) {
+    block_t *block = block_cache_lookup(cpu.pc);
+    if(!block) {
+      cpu_execute(memory_fetch_32(cpu.pc));
+      count++;
+      if(cpu_block_done()) break;
+      continue;
+    }
+    // A store into the block being run isn't seen until it's next entered
+    const cpu_op_t *op = block->ops;
+    const cpu_op_t *end = op + block->count;
+    if(timing_enabled) {
+      // Once a cache line has been fetched the rest of it hits, so cached
+      // code is only looked up in the instruction cache once per line
+      int uncached = cpu.pc >= 0xa0000000 || !(memory_control_cache & (1 << 11));
+      for(int first = 1; op < end && count < limit; first = 0) {
+        if(first || uncached || !(cpu.pc & 15))
+          scheduler_cycles += timing_fetch(cpu.pc);
+        cpu_execute_op(op++);
+        count++;
+        if(cpu_block_done()) goto done;
+      }
+    } else {
+      while(op < end && count < limit) {
+        cpu_execute_op(op++);
+        count++;
+        if(cpu_block_done()) goto done;
+      }
+    }
+  }
+done:
+  cpu_block_break = 0;
+  return(count);
+}
+
+// Written through a temporary file, the old one is still mapped
+void block_cache_save() {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s.tmp", block_cache_path);
+  FILE *file = fopen(path, "wb");
+  if(!file) {
+    printf("Failed to write block cache: %s\n", path);
+    return;
+  }
+  block_cache_header_t header = {BLOCK_CACHE_MAGIC, BLOCK_CACHE_VERSION, block_cache_blocks, 0};
+  fwrite(&header, sizeof(header), 1, file);
+  block_t **tables[2] = {block_cache_ram, block_cache_rom};
+  uint32_t slots[2] = {BLOCK_CACHE_RAM_SLOTS, BLOCK_CACHE_ROM_SLOTS};
+  for(int table = 0; table < 2; table++) {
+    for(uint32_t n = 0; n < slots[table]; n++) {
+      block_t *block = tables[table][n];
+      if(!block) continue;
+      block_cache_record_t record = {block->address, block->count, block_cache_hash(block->ops, block->count)};
+      fwrite(&record, sizeof(record), 1, file);
+      fwrite(block->ops, sizeof(cpu_op_t), block->count, file);
+    }
+  }
+  if(fclose(file)) {
+    printf("Failed to write block cache: %s\n", path);
+    unlink(path);
+    return;
+  }
+  rename(path, block_cache_path);
+}
+
+void block_cache_close() {
+  if(!block_cache_path) return;
+  printf("Block cache: %u blocks loaded, %u decoded, %.1f%% of %lu lookups hit\n",
+    block_cache_loaded, block_cache_translated,
+    block_cache_lookups ? 100.0 * (block_cache_lookups - block_cache_misses) / block_cache_lookups : 0.0,
+    block_cache_lookups);
+  if(block_cache_translated) block_cache_save();
+  free(block_cache_path);
+  block_cache_path = 0;
+}
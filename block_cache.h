@@ -0,0 +1,19 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <stdint.h>
+
+// The block engine runs code kept already decoded, in blocks running from
+// an address up to the delay slot of the first branch. Running a block
+// skips fetching and decoding its instructions, only the handler for each
+// is called. A block in RAM stays in use while its page's write count is
+// unchanged, and is compared against memory only once the page has been
+// written, so code loaded or patched by the guest is decoded again. With
+// -c the decoded blocks are kept in a file and mapped back in on the next
+// run, so they needn't be decoded again, after checking each against
+// memory the first time it's used.
+void block_cache_open(const char *path);
+uint32_t block_cache_run(uint32_t limit);
+void block_cache_close();
+
+#endif
@@ -0,0 +1,214 @@
+#include <stdint.h>
+#include <string.h>
+#include "cdaudio.h"
+#include "disc.h"
+#include "ring.h"
+
+// Decoded XA-ADPCM and CD-DA sectors are queued for the SPU in a lock-free
+// ring, so the consumer is free to move to another thread.
+#define CDAUDIO_RING_SIZE (64 * 1024)
+// 18 sound groups of 8 four bit mono units of 28 samples, doubled at 18.9 kHz
+#define CDAUDIO_XA_SAMPLES (18 * 8 * 28 * 2)
+#define CDAUDIO_XA_FRAMES  (CDAUDIO_XA_SAMPLES * 7 / 6 + 7)
+
+typedef int32_t cdaudio_v4 __attribute__((vector_size(16)));
+typedef int32_t cdaudio_v8 __attribute__((vector_size(32)));
+typedef int16_t cdaudio_h8 __attribute__((vector_size(16)));
+
+int cdaudio_mute;
+uint64_t cdaudio_dropped;
+
+uint8_t cdaudio_ring_data[CDAUDIO_RING_SIZE];
+ring_t cdaudio_ring;
+
+// ADPCM filter history and zig-zag resampler state per channel. Each
+// resampler input is stored twice, 32 apart, so the 29 samples behind any
+// position are contiguous.
+int32_t xa_old[2], xa_older[2];
+int16_t xa_history[2][64];
+uint32_t xa_position[2];
+int xa_sixstep[2];
+
+static const int32_t xa_filter_pos[4] = {0, 60, 115, 98};
+static const int32_t xa_filter_neg[4] = {0, 0, -52, -55};
+
+// The seven interpolation tables of the 37.8 to 44.1 kHz resampler, tap 1
+// applies to the newest sample
+static const int16_t xa_zigzag[7][29] = {
+  {0, 0, 0, 0, 0, -0x0002, +0x000a, -0x0022,
+   +0x0041, -0x0054, +0x0034, +0x0009, -0x010a, +0x0400, -0x0a78, +0x234c,
+   +0x6794, -0x1780, +0x0bcd, -0x0623, +0x0350, -0x016d, +0x006b, +0x000a,
+   -0x0010, +0x0011, -0x0008, +0x0003, -0x0001},
+  {0, 0, 0, -0x0002, 0, +0x0003, -0x0013, +0x003c,
+   -0x004b, +0x00a2, -0x00e3, +0x0132, -0x0043, -0x0267, +0x0c9d, +0x74bb,
+   -0x11b4, +0x09b8, -0x05bf, +0x0372, -0x01a8, +0x00a6, -0x001b, +0x0005,
+   +0x0006, -0x0008, +0x0003, -0x0001, 0},
+  {0, 0, -0x0001, +0x0003, -0x0002, -0x0005, +0x001f, -0x004a,
+   +0x00b3, -0x0192, +0x02b1, -0x039e, +0x04f8, -0x05a6, +0x7939, -0x05a6,
+   +0x04f8, -0x039e, +0x02b1, -0x0192, +0x00b3, -0x004a, +0x001f, -0x0005,
+   -0x0002, +0x0003, -0x0001, 0, 0},
+  {0, -0x0001, +0x0003, -0x0008, +0x0006, +0x0005, -0x001b, +0x00a6,
+   -0x01a8, +0x0372, -0x05bf, +0x09b8, -0x11b4, +0x74bb, +0x0c9d, -0x0267,
+   -0x0043, +0x0132, -0x00e3, +0x00a2, -0x004b, +0x003c, -0x0013, +0x0003,
+   0, -0x0002, 0, 0, 0},
+  {-0x0001, +0x0003, -0x0008, +0x0011, -0x0010, +0x000a, +0x006b, -0x016d,
+   +0x0350, -0x0623, +0x0bcd, -0x1780, +0x6794, +0x234c, -0x0a78, +0x0400,
+   -0x010a, +0x0009, +0x0034, -0x0054, +0x0041, -0x0022, +0x000a, -0x0001,
+   0, +0x0001, 0, 0, 0},
+  {+0x0002, -0x0008, +0x0010, -0x0023, +0x002b, +0x001a, -0x00eb, +0x027b,
+   -0x0548, +0x0afa, -0x16fa, +0x53e0, +0x3c07, -0x1249, +0x080e, -0x0347,
+   +0x015b, -0x0044, -0x0017, +0x0046, -0x0023, +0x0011, -0x0005, 0,
+   0, 0, 0, 0, 0},
+  {-0x0005, +0x0011, -0x0023, +0x0046, -0x0017, -0x0044, +0x015b, -0x0347,
+   +0x080e, -0x1249, +0x3c07, +0x53e0, -0x16fa, +0x0afa, -0x0548, +0x027b,
+   -0x00eb, +0x001a, +0x002b, -0x0023, +0x0010, -0x0008, +0x0002, 0,
+   0, 0, 0, 0, 0},
+};
+// The same taps reversed to line up with the oldest sample first, padded to 32
+int16_t xa_taps[7][32] __attribute__((aligned(32)));
+
+void cdaudio_reset() {
+  ring_init(&cdaudio_ring, cdaudio_ring_data, CDAUDIO_RING_SIZE);
+  memset(xa_old, 0, sizeof(xa_old));
+  memset(xa_older, 0, sizeof(xa_older));
+  memset(xa_history, 0, sizeof(xa_history));
+  memset(xa_position, 0, sizeof(xa_position));
+  xa_sixstep[0] = xa_sixstep[1] = 6;
+  cdaudio_mute = 0;
+  for(int t = 0; t < 7; t++)
+    for(int n = 0; n < 29; n++)
+      xa_taps[t][28 - n] = xa_zigzag[t][n];
+}
+
+static inline int16_t cdaudio_clamp(int32_t sample) {
+  if(sample > 32767) return(32767);
+  if(sample < -32768) return(-32768);
+  return(sample);
+}
+
+// Expands the 28 samples of one sound unit. The words holding a unit's
+// samples are 4 bytes apart, so the nibble or byte extraction and scaling
+// run 4 samples per vector. The filter is recursive and stays scalar.
+void cdaudio_xa_unit(const uint8_t *group, int unit, int eight_bit, int channel, int16_t *out) {
+  uint8_t header = group[4 + unit];
+  int shift = header & 0xf;
+  if(shift > 12) shift = 9;
+  int filter = (header >> 4) & 3;
+  // Move the sample to the top of the word, then shift it back down to
+  // 16 bits so it is sign extended
+  int position = eight_bit ? 24 - unit * 8 : 28 - unit * 4;
+  int32_t mask = eight_bit ? 0xff000000 : 0xf0000000;
+  int down = (eight_bit ? 24 - 8 : 28 - 12) + shift;
+
+  int32_t samples[28];
+  for(int n = 0; n < 28; n += 4) {
+    cdaudio_v4 words;
+    memcpy(&words, group + 16 + n * 4, 16);
+    words = ((words << position) & mask) >> down;
+    memcpy(samples + n, &words, 16);
+  }
+
+  int32_t old = xa_old[channel], older = xa_older[channel];
+  int32_t pos = xa_filter_pos[filter], neg = xa_filter_neg[filter];
+  for(int n = 0; n < 28; n++) {
+    int32_t sample = cdaudio_clamp(samples[n] + ((old * pos + older * neg + 32) >> 6));
+    older = old;
+    old = sample;
+    out[n] = sample;
+  }
+  xa_old[channel] = old;
+  xa_older[channel] = older;
+}
+
+// All seven outputs of one resampler step, the window is loaded once and
+// dotted with each table
+__attribute__((target_clones("avx2", "default")))
+void cdaudio_zigzag(const int16_t *window, int16_t *out) {
+  cdaudio_v8 samples[4];
+  for(int n = 0; n < 4; n++) {
+    cdaudio_h8 h;
+    memcpy(&h, window + n * 8, 16);
+    samples[n] = __builtin_convertvector(h, cdaudio_v8);
+  }
+  for(int t = 0; t < 7; t++) {
+    cdaudio_v8 sum = {0};
+    for(int n = 0; n < 4; n++) {
+      cdaudio_h8 h;
+      memcpy(&h, xa_taps[t] + n * 8, 16);
+      sum += samples[n] * __builtin_convertvector(h, cdaudio_v8);
+    }
+    int32_t total = sum[0] + sum[1] + sum[2] + sum[3] + sum[4] + sum[5] + sum[6] + sum[7];
+    out[t] = cdaudio_clamp(total >> 15);
+  }
+}
+
+// Feeds 37.8 kHz samples through the resampler, 7 outputs for every 6 inputs
+uint32_t cdaudio_resample(int channel, const int16_t *in, uint32_t count, int16_t *out) {
+  int16_t *history = xa_history[channel];
+  uint32_t produced = 0;
+  for(uint32_t n = 0; n < count; n++) {
+    uint32_t p = xa_position[channel]++ & 31;
+    history[p] = in[n];
+    history[p + 32] = in[n];
+    if(--xa_sixstep[channel] == 0) {
+      xa_sixstep[channel] = 6;
+      cdaudio_zigzag(history + ((p + 4) & 31), out + produced);
+      produced += 7;
+    }
+  }
+  return(produced);
+}
+
+void cdaudio_write(const int16_t *frames, uint32_t count) {
+  if(cdaudio_mute) return;
+  uint32_t bytes = count * 4;
+  cdaudio_dropped += bytes - ring_write(&cdaudio_ring, frames, bytes);
+}
+
+void cdaudio_xa_sector(const uint8_t *sector) {
+  static int16_t decoded[2][CDAUDIO_XA_SAMPLES];
+  static int16_t resampled[2][CDAUDIO_XA_FRAMES];
+  static int16_t frames[CDAUDIO_XA_FRAMES * 2];
+  uint8_t coding = sector[19];
+  int stereo = (coding & 3) == 1;
+  int half_rate = (coding >> 2) & 1;
+  int eight_bit = (coding >> 4) & 1;
+  int units = eight_bit ? 4 : 8;
+
+  uint32_t count[2] = {0, 0};
+  for(int g = 0; g < 18; g++) {
+    const uint8_t *group = sector + 24 + g * 128;
+    for(int unit = 0; unit < units; unit++) {
+      int channel = stereo ? unit & 1 : 0;
+      cdaudio_xa_unit(group, unit, eight_bit, channel, decoded[channel] + count[channel]);
+      count[channel] += 28;
+    }
+  }
+
+  int channels = stereo ? 2 : 1;
+  uint32_t produced = 0;
+  for(int c = 0; c < channels; c++) {
+    if(half_rate) {
+      // 18.9 kHz, each sample is fed to the resampler twice
+      for(int n = count[c] - 1; n >= 0; n--)
+        decoded[c][n * 2] = decoded[c][n * 2 + 1] = decoded[c][n];
+      count[c] *= 2;
+    }
+    produced = cdaudio_resample(c, decoded[c], count[c], resampled[c]);
+  }
+  for(uint32_t n = 0; n < produced; n++) {
+    frames[n * 2] = resampled[0][n];
+    frames[n * 2 + 1] = resampled[stereo][n];
+  }
+  cdaudio_write(frames, produced);
+}
+
+// Raw CD-DA sectors are already 44.1 kHz little endian stereo
+void cdaudio_cdda_sector(const uint8_t *sector) {
+  cdaudio_write((const int16_t *)sector, DISC_SECTOR_SIZE / 4);
+}
+
+// Consumer side, returns the number of stereo frames copied
+uint32_t cdaudio_read(int16_t *frames, uint32_t count) {
+  return(ring_read(&cdaudio_ring, frames, count * 4) / 4);
+}
@@ -0,0 +1,17 @@
+#ifndef CDAUDIO_H
+#define CDAUDIO_H
+
+#include <stdint.h>
+
+// CD audio reaches the SPU as 44.1 kHz interleaved stereo
+#define CDAUDIO_RATE 44100
+
+extern int cdaudio_mute;
+extern uint64_t cdaudio_dropped;
+
+void cdaudio_reset();
+void cdaudio_xa_sector(const uint8_t *sector);
+void cdaudio_cdda_sector(const uint8_t *sector);
+uint32_t cdaudio_read(int16_t *frames, uint32_t count);
+
+#endif
@@ -1,11 +1,446 @@
 #include <stdint.h>
+#include <string.h>
 #include "memory.h"
+#include "cdrom.h"
+#include "disc.h"
+#include "cdaudio.h"
+#include "interrupt.h"
+#include "scheduler.h"
+
+#define CDROM_INT_DATA     1
+#define CDROM_INT_COMPLETE 2
+#define CDROM_INT_ACK      3
+#define CDROM_INT_ERROR    5
+
+#define CDROM_STAT_ERROR   0x01
+#define CDROM_STAT_MOTOR   0x02
+#define CDROM_STAT_SHELL   0x10
+#define CDROM_STAT_READING 0x20
+#define CDROM_STAT_PLAYING 0x80
+
+#define CDROM_MODE_SPEED   0x80
+#define CDROM_MODE_XA      0x40
+#define CDROM_MODE_SIZE    0x20
+#define CDROM_MODE_FILTER  0x08
+
+// Approximate controller timings in CPU cycles
+#define CDROM_ACK_CYCLES   25000
+#define CDROM_ID_CYCLES    19000
+#define CDROM_INIT_CYCLES  80000
+#define CDROM_SEEK_CYCLES  100000
+
+#define CDROM_RESPONSES    8
+
+// Responses wait in a queue until the previous interrupt is acknowledged,
+// then arrive after their delay. Data responses carry their sector.
+typedef struct cdrom_response_t {
+  uint8_t type;
+  uint8_t length;
+  uint8_t data[16];
+  uint32_t delay;
+  uint8_t sector[DISC_SECTOR_SIZE];
+} cdrom_response_t;
+
+struct {
+  uint8_t index;
+  uint8_t interrupt_enable;
+  uint8_t interrupt_flag;
+  uint8_t parameters[16];
+  uint8_t parameter_count;
+  uint8_t response[16];
+  uint8_t response_length;
+  uint8_t response_position;
+  int busy;
+  uint8_t mode;
+  uint8_t filter_file;
+  uint8_t filter_channel;
+  uint32_t setloc_lba;
+  int setloc_pending;
+  uint32_t position;
+  int reading;
+  int playing;
+  uint8_t sector[DISC_SECTOR_SIZE];
+  uint8_t read_buffer[DISC_SECTOR_SIZE];
+  uint8_t data[DISC_SECTOR_SIZE];
+  uint32_t data_length;
+  uint32_t data_position;
+  cdrom_response_t queue[CDROM_RESPONSES];
+  int queued;
+  int delivering;
+} cdrom;
+
+static inline uint8_t cdrom_from_bcd(uint8_t value) {
+  return((value >> 4) * 10 + (value & 0xf));
+}
+
+static inline uint8_t cdrom_to_bcd(uint8_t value) {
+  return(((value / 10) << 4) | (value % 10));
+}
+
+// Absolute MSF with the two second lead-in
+void cdrom_msf(uint32_t lba, uint8_t *msf) {
+  lba += 150;
+  msf[0] = cdrom_to_bcd(lba / (60 * 75));
+  msf[1] = cdrom_to_bcd((lba / 75) % 60);
+  msf[2] = cdrom_to_bcd(lba % 75);
+}
+
+uint8_t cdrom_stat() {
+  if(!disc_loaded) return(CDROM_STAT_SHELL);
+  return(CDROM_STAT_MOTOR | (cdrom.reading ? CDROM_STAT_READING : 0) | (cdrom.playing ? CDROM_STAT_PLAYING : 0));
+}
+
+void cdrom_deliver() {
+  cdrom.delivering = 0;
+  cdrom_response_t response = cdrom.queue[0];
+  cdrom.queued--;
+  memmove(cdrom.queue, cdrom.queue + 1, cdrom.queued * sizeof(cdrom_response_t));
+  if(response.type == CDROM_INT_DATA)
+    memcpy(cdrom.sector, response.sector, DISC_SECTOR_SIZE);
+  memcpy(cdrom.response, response.data, response.length);
+  cdrom.response_length = response.length;
+  cdrom.response_position = 0;
+  cdrom.interrupt_flag = response.type;
+  cdrom.busy = 0;
+  if(cdrom.interrupt_flag & cdrom.interrupt_enable)
+    interrupt_request(IRQ_CDROM);
+}
+
+void cdrom_schedule() {
+  if((cdrom.interrupt_flag & 7) || !cdrom.queued || cdrom.delivering) return;
+  cdrom.delivering = 1;
+  scheduler_schedule(SCHEDULER_CDROM, scheduler_cycles + cdrom.queue[0].delay, cdrom_deliver);
+}
+
+cdrom_response_t *cdrom_respond(uint8_t type, uint32_t delay, const uint8_t *data, uint8_t length) {
+  // A full queue overwrites its newest entry, like an overrun sector buffer
+  if(cdrom.queued < CDROM_RESPONSES) cdrom.queued++;
+  cdrom_response_t *response = &cdrom.queue[cdrom.queued - 1];
+  response->type = type;
+  response->delay = delay;
+  response->length = length;
+  memcpy(response->data, data, length);
+  return(response);
+}
+
+void cdrom_respond_stat(uint8_t type, uint32_t delay) {
+  uint8_t stat = cdrom_stat();
+  cdrom_respond(type, delay, &stat, 1);
+}
+
+void cdrom_error(uint8_t code) {
+  uint8_t error[2] = {cdrom_stat() | CDROM_STAT_ERROR, code};
+  cdrom_respond(CDROM_INT_ERROR, CDROM_ACK_CYCLES, error, 2);
+}
+
+uint32_t cdrom_sector_cycles() {
+  return(CPU_CLOCK / (cdrom.mode & CDROM_MODE_SPEED ? 150 : 75));
+}
+
+void cdrom_read_sector() {
+  scheduler_schedule(SCHEDULER_CDROM_READ, scheduler_cycles + cdrom_sector_cycles(), cdrom_read_sector);
+  uint8_t *sector = cdrom.read_buffer;
+  disc_read(cdrom.position++, sector);
+  if(cdrom.playing) {
+    cdaudio_cdda_sector(sector);
+    return;
+  }
+  // XA audio sectors go to the decoder instead of the CPU, the filter
+  // picks one file and channel out of an interleaved stream
+  if((cdrom.mode & CDROM_MODE_XA) && (sector[18] & 0x04)) {
+    if(!(cdrom.mode & CDROM_MODE_FILTER) || (sector[16] == cdrom.filter_file && sector[17] == cdrom.filter_channel))
+      cdaudio_xa_sector(sector);
+    return;
+  }
+  // A sector that has not been delivered yet is replaced by the new one
+  cdrom_response_t *last = cdrom.queued ? &cdrom.queue[cdrom.queued - 1] : 0;
+  if(!last || last->type != CDROM_INT_DATA) {
+    uint8_t stat = cdrom_stat();
+    last = cdrom_respond(CDROM_INT_DATA, 0, &stat, 1);
+  }
+  memcpy(last->sector, sector, DISC_SECTOR_SIZE);
+  cdrom_schedule();
+}
+
+void cdrom_stop_reading() {
+  cdrom.reading = 0;
+  cdrom.playing = 0;
+  scheduler_cancel(SCHEDULER_CDROM_READ);
+  // Drop sectors that have not been delivered, unless one is already on its way
+  int keep = cdrom.delivering;
+  for(int n = keep; n < cdrom.queued; n++)
+    if(cdrom.queue[n].type != CDROM_INT_DATA)
+      cdrom.queue[keep++] = cdrom.queue[n];
+  cdrom.queued = keep;
+}
+
+void cdrom_seek() {
+  if(cdrom.setloc_pending) cdrom.position = cdrom.setloc_lba;
+  cdrom.setloc_pending = 0;
+  disc_seek(cdrom.position);
+}
+
+// The region string in the license sector decides the GetID response
+void cdrom_get_id() {
+  static const uint8_t no_disc[8] = {0x08, 0x40};
+  if(!disc_loaded) {
+    cdrom_respond(CDROM_INT_ERROR, CDROM_ID_CYCLES, no_disc, 8);
+    return;
+  }
+  uint8_t sector[DISC_SECTOR_SIZE + 1];
+  disc_copy(4, sector);
+  sector[DISC_SECTOR_SIZE] = 0;
+  const char *region = "SCEI";
+  for(int n = 0; n < DISC_SECTOR_SIZE; n++) {
+    if(!strncmp((char *)sector + n, "Amer", 4)) region = "SCEA";
+    if(!strncmp((char *)sector + n, "Euro", 4)) region = "SCEE";
+  }
+  uint8_t id[8] = {cdrom_stat(), 0x00, 0x20, 0x00};
+  memcpy(id + 4, region, 4);
+  cdrom_respond(CDROM_INT_COMPLETE, CDROM_ID_CYCLES, id, 8);
+}
+
+void cdrom_get_loc_p() {
+  int track = 1;
+  while(track < disc_track_count && cdrom.position >= disc_track_start[track + 1]) track++;
+  uint8_t loc[8] = {cdrom_to_bcd(track), 1};
+  cdrom_msf(cdrom.position - disc_track_start[track] - 150, loc + 2);
+  cdrom_msf(cdrom.position, loc + 5);
+  cdrom_respond(CDROM_INT_ACK, CDROM_ACK_CYCLES, loc, 8);
+}
+
+void cdrom_command(uint8_t command) {
+  uint8_t *p = cdrom.parameters;
+  cdrom.busy = 1;
+  switch(command) {
+    case 0x01: // Getstat
+      cdrom_respond_stat(CDROM_INT_ACK, CDROM_ACK_CYCLES);
+      break;
+    case 0x02: // Setloc
+      cdrom.setloc_lba = (cdrom_from_bcd(p[0]) * 60 + cdrom_from_bcd(p[1])) * 75 + cdrom_from_bcd(p[2]) - 150;
+      cdrom.setloc_pending = 1;
+      // Start prefetching now, the read command usually follows
+      disc_seek(cdrom.setloc_lba);
+      cdrom_respond_stat(CDROM_INT_ACK, CDROM_ACK_CYCLES);
+      break;
+    case 0x03: // Play, from the given track or the Setloc position
+      if(!disc_loaded) {
+        cdrom_error(0x80);
+        break;
+      }
+      cdrom_stop_reading();
+      if(cdrom.parameter_count && p[0]) {
+        uint8_t track = cdrom_from_bcd(p[0]);
+        if(track <= disc_track_count) {
+          cdrom.setloc_lba = disc_track_start[track];
+          cdrom.setloc_pending = 1;
+        }
+      }
+      cdrom_seek();
+      cdrom.playing = 1;
+      cdrom_respond_stat(CDROM_INT_ACK, CDROM_ACK_CYCLES);
+      scheduler_schedule(SCHEDULER_CDROM_READ, scheduler_cycles + CDROM_SEEK_CYCLES + cdrom_sector_cycles(), cdrom_read_sector);
+      break;
+    case 0x06: // ReadN
+    case 0x1b: // ReadS
+      if(!disc_loaded) {
+        cdrom_error(0x80);
+        break;
+      }
+      cdrom_stop_reading();
+      cdrom_seek();
+      cdrom.reading = 1;
+      cdrom_respond_stat(CDROM_INT_ACK, CDROM_ACK_CYCLES);
+      scheduler_schedule(SCHEDULER_CDROM_READ, scheduler_cycles + CDROM_SEEK_CYCLES + cdrom_sector_cycles(), cdrom_read_sector);
+      break;
+    case 0x07: // MotorOn
+      cdrom_respond_stat(CDROM_INT_ACK, CDROM_ACK_CYCLES);
+      cdrom_respond_stat(CDROM_INT_COMPLETE, CDROM_INIT_CYCLES);
+      break;
+    case 0x08: // Stop
+    case 0x09: // Pause
+      cdrom_respond_stat(CDROM_INT_ACK, CDROM_ACK_CYCLES);
+      cdrom_stop_reading();
+      cdrom_respond_stat(CDROM_INT_COMPLETE, cdrom_sector_cycles());
+      break;
+    case 0x0a: // Init
+      cdrom_respond_stat(CDROM_INT_ACK, CDROM_ACK_CYCLES);
+      cdrom_stop_reading();
+      cdrom.mode = CDROM_MODE_SIZE;
+      cdrom.setloc_pending = 0;
+      cdrom_respond_stat(CDROM_INT_COMPLETE, CDROM_INIT_CYCLES);
+      break;
+    case 0x0b: // Mute
+    case 0x0c: // Demute
+      cdaudio_mute = command == 0x0b;
+      cdrom_respond_stat(CDROM_INT_ACK, CDROM_ACK_CYCLES);
+      break;
+    case 0x0d: // Setfilter
+      cdrom.filter_file = p[0];
+      cdrom.filter_channel = p[1];
+      cdrom_respond_stat(CDROM_INT_ACK, CDROM_ACK_CYCLES);
+      break;
+    case 0x0e: // Setmode
+      cdrom.mode = p[0];
+      cdrom_respond_stat(CDROM_INT_ACK, CDROM_ACK_CYCLES);
+      break;
+    case 0x10: // GetlocL, the header of the last sector read
+      cdrom_respond(CDROM_INT_ACK, CDROM_ACK_CYCLES, cdrom.sector + 12, 8);
+      break;
+    case 0x11: // GetlocP
+      cdrom_get_loc_p();
+      break;
+    case 0x13: { // GetTN
+      uint8_t tn[3] = {cdrom_stat(), 0x01, cdrom_to_bcd(disc_track_count)};
+      cdrom_respond(CDROM_INT_ACK, CDROM_ACK_CYCLES, tn, 3);
+      break;
+    }
+    case 0x14: { // GetTD
+      uint8_t track = cdrom_from_bcd(p[0]);
+      if(track > disc_track_count) {
+        cdrom_error(0x10);
+        break;
+      }
+      uint8_t td[4] = {cdrom_stat()};
+      cdrom_msf(track ? disc_track_start[track] : disc_sectors, td + 1);
+      cdrom_respond(CDROM_INT_ACK, CDROM_ACK_CYCLES, td, 3);
+      break;
+    }
+    case 0x15: // SeekL
+    case 0x16: // SeekP
+      cdrom_stop_reading();
+      cdrom_seek();
+      cdrom_respond_stat(CDROM_INT_ACK, CDROM_ACK_CYCLES);
+      cdrom_respond_stat(CDROM_INT_COMPLETE, CDROM_SEEK_CYCLES);
+      break;
+    case 0x19: // Test
+      if(p[0] == 0x20) {
+        // Controller version
+        static const uint8_t version[4] = {0x94, 0x09, 0x19, 0xc0};
+        cdrom_respond(CDROM_INT_ACK, CDROM_ACK_CYCLES, version, 4);
+      } else {
+        cdrom_error(0x10);
+      }
+      break;
+    case 0x1a: // GetID
+      cdrom_respond_stat(CDROM_INT_ACK, CDROM_ACK_CYCLES);
+      cdrom_get_id();
+      break;
+    default:
+      cdrom_error(0x40);
+  }
+  cdrom.parameter_count = 0;
+  cdrom_schedule();
+}
+
+void cdrom_request(uint8_t value) {
+  if(!(value & 0x80)) {
+    cdrom.data_length = 0;
+    cdrom.data_position = 0;
+    return;
+  }
+  if(cdrom.data_position < cdrom.data_length) return;
+  // Whole 2340 byte sectors after the sync pattern, or the 2048 bytes of
+  // user data after the mode 2 subheader
+  if(cdrom.mode & CDROM_MODE_SIZE) {
+    memcpy(cdrom.data, cdrom.sector + 12, 2340);
+    cdrom.data_length = 2340;
+  } else {
+    memcpy(cdrom.data, cdrom.sector + 24, 2048);
+    cdrom.data_length = 2048;
+  }
+  cdrom.data_position = 0;
+}
+
+uint8_t cdrom_data_read() {
+  if(cdrom.data_position < cdrom.data_length)
+    return(cdrom.data[cdrom.data_position++]);
+  return(0);
+}
+
+uint32_t cdrom_dma_read() {
+  uint32_t word = cdrom_data_read();
+  word |= cdrom_data_read() << 8;
+  word |= cdrom_data_read() << 16;
+  word |= cdrom_data_read() << 24;
+  return(word);
+}
+
+void cdrom_reset() {
+  memset(&cdrom, 0, sizeof(cdrom));
+  cdrom.mode = CDROM_MODE_SIZE;
+  cdaudio_reset();
+  scheduler_cancel(SCHEDULER_CDROM);
+  scheduler_cancel(SCHEDULER_CDROM_READ);
+}
+
+uint8_t cdrom_load_8(uint32_t address) {
+  switch(address & 3) {
+    case 0:
+      return(cdrom.index |
+        (cdrom.parameter_count == 0) << 3 |
+        (cdrom.parameter_count < 16) << 4 |
+        (cdrom.response_position < cdrom.response_length) << 5 |
+        (cdrom.data_position < cdrom.data_length) << 6 |
+        cdrom.busy << 7);
+    case 1:
+      if(cdrom.response_position < cdrom.response_length)
+        return(cdrom.response[cdrom.response_position++]);
+      return(0);
+    case 2:
+      return(cdrom_data_read());
+    default:
+      if(cdrom.index & 1)
+        return(cdrom.interrupt_flag | 0xe0);
+      return(cdrom.interrupt_enable | 0xe0);
+  }
+}
+uint16_t cdrom_load_16(uint32_t address) {
+  return(cdrom_load_8(address) | cdrom_load_8(address) << 8);
+}
+uint32_t cdrom_load_32(uint32_t address) {
+  return(cdrom_load_16(address) | cdrom_load_16(address) << 16);
+}
+
+void cdrom_store_8(uint32_t address, uint8_t value) {
+  // Registers 1 to 3 are banked by the index in register 0, the audio
+  // volume registers are ignored
+  switch(((address & 3) << 2) | cdrom.index) {
+    case 0x0: case 0x1: case 0x2: case 0x3:
+      cdrom.index = value & 3;
+      break;
+    case 0x4:
+      cdrom_command(value);
+      break;
+    case 0x8:
+      if(cdrom.parameter_count < 16)
+        cdrom.parameters[cdrom.parameter_count++] = value;
+      break;
+    case 0x9:
+      cdrom.interrupt_enable = value & 0x1f;
+      break;
+    case 0xc:
+      cdrom_request(value);
+      break;
+    case 0xd:
+      cdrom.interrupt_flag &= ~(value & 0x1f);
+      if(value & 0x40) cdrom.parameter_count = 0;
+      cdrom_schedule();
+      break;
+  }
+}
+void cdrom_store_16(uint32_t address, uint16_t value) {
+  cdrom_store_8(address, value);
+}
+void cdrom_store_32(uint32_t address, uint32_t value) {
+  cdrom_store_8(address, value);
+}
 
  memory_accessor_t cdrom_accessor = {
-  .load_32 = memory_dummy_load_32,
-  .load_16 = memory_dummy_load_16,
-  .load_8 = memory_dummy_load_8,
-  .store_32 = memory_dummy_store_32,
-  .store_16 = memory_dummy_store_16,
-  .store_8 = memory_dummy_store_8,
+  .load_32 = cdrom_load_32,
+  .load_16 = cdrom_load_16,
+  .load_8 = cdrom_load_8,
+  .store_32 = cdrom_store_32,
+  .store_16 = cdrom_store_16,
+  .store_8 = cdrom_store_8,
 };
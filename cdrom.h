@@ -0,0 +1,9 @@
+#ifndef CDROM_H
+#define CDROM_H
+
+#include <stdint.h>
+
+void cdrom_reset();
+uint32_t cdrom_dma_read();
+
+#endif
@@ -1,8 +1,17 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "cpu.h"
 #include "memory.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "stats.h"
+#include "block_cache.h"
+#include "timing.h"
+
+// Average cost of an instruction when timing isn't modelled (-w)
+#define CPU_CYCLES_PER_INSTRUCTION 2
 
 const char register_names[32][3] = {
   "r0", "at", "v0", "v1", "a0", "a1", "a2", "a3",
@@ -22,14 +31,59 @@ const char cop_register_names[64][9] = {
   "TagLo",    "TagHi",    "ErrorEPC", "*RES*"
 };
 
+// Primary opcodes, and the function field of the SPECIAL ones
+const char *opcode_names[64] = {
+  "special","bcondz","j",  "jal",  "beq",  "bne",  "blez", "bgtz",
+  "addi", "addiu", "slti", "sltiu","andi", "ori",  "xori", "lui",
+  "cop0", "cop1",  "cop2", "cop3", 0,      0,      0,      0,
+  0,      0,       0,      0,      0,      0,      0,      0,
+  "lb",   "lh",    "lwl",  "lw",   "lbu",  "lhu",  "lwr",  0,
+  "sb",   "sh",    "swl",  "sw",   0,      0,      "swr",  0,
+  "lwc0", "lwc1",  "lwc2", "lwc3", 0,      0,      0,      0,
+  "swc0", "swc1",  "swc2", "swc3", 0,      0,      0,      0,
+};
+
+const char *special_opcode_names[64] = {
+  "sll",  0,      "srl",  "sra",  "sllv",  0,       "srlv", "srav",
+  "jr",   "jalr", 0,      0,      "syscall","break", 0,      0,
+  "mfhi", "mthi", "mflo", "mtlo", 0,       0,       0,      0,
+  "mult", "multu","div",  "divu", 0,       0,       0,      0,
+  "add",  "addu", "sub",  "subu", "and",   "or",    "xor",  "nor",
+  0,      0,      "slt",  "sltu",
+};
+
 cpu_t cpu;
+// Set when an interrupt should be taken before the next instruction
+int cpu_irq_pending;
+// Set by the lockstep harness when a block must end after this instruction
+int cpu_block_break;
+// Set by -e, the interpreter runs one instruction at a time otherwise
+cpu_engine_t *cpu_engine;
+uint64_t cpu_instructions;
 
 void cpu_set_reg(uint8_t r, uint32_t v) {
   // Multiplying by !!r causes zero to always be written to r0
   cpu.reg[r] = v * !!r;
+  TRACE_EVENT(TRACE_REGISTER, r, 0, v);
+}
+
+// IEc enabled and an unmasked bit in cause IP
+void cpu_update_interrupts() {
+  uint32_t sr = cpu.cop0_registers.sr;
+  cpu_irq_pending = (sr & 1) && (sr & cpu.cop0_registers.cause & 0xff00);
+}
+
+// Hardware interrupt line from the interrupt controller, cause bit 10
+void cpu_set_interrupt_line(int active) {
+  if(active)
+    cpu.cop0_registers.cause |= 1 << 10;
+  else
+    cpu.cop0_registers.cause &= ~(1 << 10);
+  cpu_update_interrupts();
 }
 
 void cpu_exception(uint32_t cause) {
+  STATS_COUNT(exceptions[cause & 31]);
   uint32_t handler;
   if(cpu.cop0_registers.sr & (1<<22)) {
     handler = 0xbfc00180;
@@ -42,373 +96,507 @@ void cpu_exception(uint32_t cause) {
   cpu.cop0_registers.sr &= ~0x3F;
   cpu.cop0_registers.sr |= mode;
 
-  cpu.cop0_registers.cause = cause << 2;
+  // The interrupt pending bits are live state, keep them
+  cpu.cop0_registers.cause = (cpu.cop0_registers.cause & 0xff00) | (cause << 2);
   cpu.cop0_registers.epc = cpu.current_pc;
   // This is a hack to guess whether we're in a branch delay slot
   if(cpu.pc != cpu.current_pc + 4) cpu.cop0_registers.epc = cpu.current_pc - 4;
 
   cpu.pc = handler;
   cpu.next_pc = handler + 4;
+  TRACE_EVENT(TRACE_EXCEPTION, cause, cpu.cop0_registers.epc, handler);
+  cpu_update_interrupts();
 }
 
-void decode_and_execute(uint32_t instruction) {
-  if(instruction == 0) return;
+// Taken between instructions, as if the next instruction had been fetched
+// and raised the exception itself so EPC points at it
+void cpu_interrupt() {
+  cpu.current_pc = cpu.pc;
+  cpu.pc = cpu.next_pc;
+  cpu_exception(0);
+}
 
-  if(cpu.current_pc % 4) {
-    cpu_exception(4);
-    return;
-  }
+// Instructions are decoded once into a cpu_op_t and run by one handler per
+// operation, so the block engine can keep the decoded form and skip this
+// step whenever it runs the same code again. The block cache file stores
+// these numbers, so changing them means bumping BLOCK_CACHE_VERSION.
+enum {
+  CPU_OP_UNKNOWN,
+  CPU_OP_NOP,
+  CPU_OP_SLL, CPU_OP_SRL, CPU_OP_SRA, CPU_OP_SLLV, CPU_OP_SRLV, CPU_OP_SRAV,
+  CPU_OP_JR, CPU_OP_JALR, CPU_OP_SYSCALL,
+  CPU_OP_MFHI, CPU_OP_MTHI, CPU_OP_MFLO, CPU_OP_MTLO,
+  CPU_OP_MULTU, CPU_OP_DIV, CPU_OP_DIVU,
+  CPU_OP_ADD, CPU_OP_ADDU, CPU_OP_SUBU, CPU_OP_AND, CPU_OP_OR, CPU_OP_XOR, CPU_OP_NOR,
+  CPU_OP_SLT, CPU_OP_SLTU,
+  CPU_OP_BLTZ, CPU_OP_BGEZ, CPU_OP_BLTZAL, CPU_OP_BGEZAL,
+  CPU_OP_J, CPU_OP_JAL, CPU_OP_BEQ, CPU_OP_BNE, CPU_OP_BLEZ, CPU_OP_BGTZ,
+  CPU_OP_ADDI, CPU_OP_ADDIU, CPU_OP_SLTI, CPU_OP_SLTIU, CPU_OP_ANDI, CPU_OP_ORI, CPU_OP_LUI,
+  CPU_OP_MFC0, CPU_OP_MTC0, CPU_OP_RFE,
+  CPU_OP_LB, CPU_OP_LH, CPU_OP_LWL, CPU_OP_LW, CPU_OP_LBU, CPU_OP_LHU, CPU_OP_LWR,
+  CPU_OP_SB, CPU_OP_SH, CPU_OP_SWL, CPU_OP_SW, CPU_OP_SWR,
+  CPU_OPS,
+};
 
+static inline __attribute__((always_inline)) void cpu_decode_inline(uint32_t instruction, cpu_op_t *op) {
   uint8_t operation = instruction >> 26;
   uint8_t operation_b = instruction & 0x3F;
-  uint8_t rs = (instruction >> 21) & 0x1F;
-  uint8_t rt = (instruction >> 16) & 0x1F;
-  uint8_t rd = (instruction >> 11) & 0x1F;
-  uint32_t imm26 = (instruction & 0x3FFFFFF);
   uint16_t imm = (instruction & 0xFFFF);
-  uint8_t imm5 = (instruction >> 6) & 0x1F;
-  //printf("%08x ", cpu.current_pc);
-  //printf("%08x: ", instruction);
 
-  uint32_t location;
-  uint32_t aligned_word;
+  op->instruction = instruction;
+  op->rs = (instruction >> 21) & 0x1F;
+  op->rt = (instruction >> 16) & 0x1F;
+  op->rd = (instruction >> 11) & 0x1F;
+  // Sign extended, most instructions want it that way
+  op->imm = (int16_t)imm;
+  op->handler = CPU_OP_UNKNOWN;
+  if(instruction == 0) {
+    op->handler = CPU_OP_NOP;
+    return;
+  }
 
   switch(operation) {
     case 0x00:
+      op->imm = (instruction >> 6) & 0x1F;
       switch(operation_b) {
-        case 0x00:
-          //printf("sll    $%s(%08x), $%s(%08x), 0x%02x", register_names[rd], cpu.reg[rd], register_names[rt], cpu.reg[rt], imm5);
-          cpu_set_reg(rd, cpu.reg[rt] << imm5);
-          break;
-        case 0x02:
-          //printf("srl    $%s(%08x), $%s(%08x), 0x%02x", register_names[rd], cpu.reg[rd], register_names[rt], cpu.reg[rt], imm5);
-          cpu_set_reg(rd, cpu.reg[rt] >> imm5);
-          break;
-        case 0x03:
-          //printf("sra    $%s(%08x), $%s(%08x), 0x%02x", register_names[rd], cpu.reg[rd], register_names[rt], cpu.reg[rt], imm5);
-          cpu_set_reg(rd, (int32_t)cpu.reg[rt] >> imm5);
-          break;
-        case 0x04:
-          //printf("sllv   ");
-          cpu_set_reg(rd, cpu.reg[rt] << (cpu.reg[rs] & 0x1F));
-          break;
-        case 0x06:
-          //printf("srlv   ");
-          cpu_set_reg(rd, cpu.reg[rt] >> (cpu.reg[rs] & 0x1F));
-          break;
-        case 0x07:
-          //printf("srav   ");
-          cpu_set_reg(rd, (int32_t)cpu.reg[rt] >> (cpu.reg[rs] & 0x1F));
-          break;
-        case 0x08:
-          //printf("jr     $%s(%08x)", register_names[rs], cpu.reg[rs]);
-          cpu.next_pc = cpu.reg[rs];
-          break;
-        case 0x09:
-          //printf("jalr   $%s(%08x), $%s(%08x)", register_names[rs], cpu.reg[rs], register_names[rd], cpu.reg[rd]);
-          cpu_set_reg(rd, cpu.pc + 4);
-          cpu.next_pc = cpu.reg[rs];
-          break;
-        case 0x0c:
-          //printf("syscall");
-          cpu_exception(8);
-          break;
-        case 0x10:
-          //printf("mfhi   $%s(%08x), $hi(%08x)", register_names[rd], cpu.reg[rd], cpu.hi);
-          cpu_set_reg(rd, cpu.hi);
-          break;
-        case 0x11:
-          //printf("mthi   $hi(%08x), $%s(%08x)", cpu.hi, register_names[rs], cpu.reg[rs]);
-          cpu.hi = cpu.reg[rs];
-          break;
-        case 0x12:
-          //printf("mflo   $%s(%08x), $lo(%08x)", register_names[rd], cpu.reg[rd], cpu.lo);
-          cpu_set_reg(rd, cpu.lo);
-          break;
-        case 0x13:
-          //printf("mtlo   $lo(%08x), $%s(%08x)", cpu.lo, register_names[rs], cpu.reg[rs]);
-          cpu.lo = cpu.reg[rs];
-          break;
-        case 0x1a:
-          //printf("div    $%s(%08x), $%s(%08x)", register_names[rs], cpu.reg[rs], register_names[rt], cpu.reg[rt]);
-          if(cpu.reg[rt]) {
-            cpu.lo = (int32_t)cpu.reg[rs] / (int32_t)cpu.reg[rt];
-            cpu.hi = (int32_t)cpu.reg[rs] % (int32_t)cpu.reg[rt];
-          } else {
-            // Divide by zero
-            cpu.hi = cpu.reg[rs];
-            if((int32_t)rs >= 0)
-              cpu.lo = -1;
-            else
-              cpu.lo = 1;
-          }
-          break;
-        case 0x19:;
-          //printf("multu");
-          uint64_t result = (uint64_t)cpu.reg[rs] * (uint64_t)cpu.reg[rt];
-          cpu.hi = result >> 32;
-          cpu.lo = result;
-          break;
-        case 0x1b:
-          //printf("divu   ");
-          if(cpu.reg[rt]) {
-            cpu.lo = cpu.reg[rs] / cpu.reg[rt];
-            cpu.hi = cpu.reg[rs] % cpu.reg[rt];
-          } else {
-            // Divide by zero
-            cpu.hi = cpu.reg[rs];
-            cpu.lo = -1;
-          }
-          break;
-        case 0x20:
-          //printf("add    $%s(%08x), $%s(%08x), $%s(%08x)", register_names[rd], cpu.reg[rd], register_names[rs], cpu.reg[rs], register_names[rt], cpu.reg[rt]);
-          if ((int32_t)cpu.reg[rs] >= 0) {
-              if ((int32_t)cpu.reg[rt] > (INT32_MAX - (int32_t)cpu.reg[rs])) {
-                  //printf("  OVERFLOW!");
-                  cpu_exception(0xC);
-                  break;
-              }
-          } else {
-              if ((int32_t)cpu.reg[rt] < (INT32_MIN - (int32_t)cpu.reg[rs])) {
-                  //printf("  OVERFLOW!");
-                  cpu_exception(0xC);
-                  break;
-              }
-          }
-          cpu_set_reg(rd, (int32_t)cpu.reg[rs] + (int32_t)cpu.reg[rt]);
-          break;
-        case 0x21:
-          //printf("addu   $%s(%08x), $%s(%08x), $%s(%08x)", register_names[rd], cpu.reg[rd], register_names[rs], cpu.reg[rs], register_names[rt], cpu.reg[rt]);
-          cpu_set_reg(rd, cpu.reg[rs] + cpu.reg[rt]);
-          break;
-        case 0x23:
-          //printf("subu   $%s(%08x), $%s(%08x), $%s(%08x)", register_names[rd], cpu.reg[rd], register_names[rs], cpu.reg[rs], register_names[rt], cpu.reg[rt]);
-          cpu_set_reg(rd, cpu.reg[rs] - cpu.reg[rt]);
-          break;
-        case 0x24:
-          //printf("and    $%s(%08x), $%s(%08x), $%s(%08x)", register_names[rd], cpu.reg[rd], register_names[rs], cpu.reg[rs], register_names[rt], cpu.reg[rt]);
-          cpu_set_reg(rd, cpu.reg[rs] & cpu.reg[rt]);
-          break;
-        case 0x25:
-          //printf("or     $%s(%08x), $%s(%08x), $%s(%08x)", register_names[rd], cpu.reg[rd], register_names[rs], cpu.reg[rs], register_names[rt], cpu.reg[rt]);
-          cpu_set_reg(rd, cpu.reg[rs] | cpu.reg[rt]);
-          break;
-        case 0x26:
-          //printf("xor    $%s(%08x), $%s(%08x), $%s(%08x)", register_names[rd], cpu.reg[rd], register_names[rs], cpu.reg[rs], register_names[rt], cpu.reg[rt]);
-          cpu_set_reg(rd, cpu.reg[rs] ^ cpu.reg[rt]);
-          break;
-        case 0x27:
-          //printf("nor    $%s(%08x), $%s(%08x), $%s(%08x)", register_names[rd], cpu.reg[rd], register_names[rs], cpu.reg[rs], register_names[rt], cpu.reg[rt]);
-          cpu_set_reg(rd, ~(cpu.reg[rs] | cpu.reg[rt]));
-          break;
-        case 0x2A:
-          //printf("slt    $%s(%08x), $%s(%08x), $%s(%08x)", register_names[rd], cpu.reg[rd], register_names[rs], cpu.reg[rs], register_names[rt], cpu.reg[rt]);
-          cpu_set_reg(rd, (int32_t)cpu.reg[rs] < (int32_t)cpu.reg[rt]);
-          break;
-        case 0x2B:
-          //printf("sltu   $%s(%08x), $%s(%08x), $%s(%08x)", register_names[rd], cpu.reg[rd], register_names[rs], cpu.reg[rs], register_names[rt], cpu.reg[rt]);
-          cpu_set_reg(rd, cpu.reg[rs] < cpu.reg[rt]);
-          break;
-        default:
-          printf("Unknown operation 0x%08X OP:0x%02X/0x%02X RS:0x%02X RT:0x%02X RD:0x%02X\n", instruction, operation, operation_b, rs, rt, rd);
-          exit(1);
+        case 0x00: op->handler = CPU_OP_SLL; break;
+        case 0x02: op->handler = CPU_OP_SRL; break;
+        case 0x03: op->handler = CPU_OP_SRA; break;
+        case 0x04: op->handler = CPU_OP_SLLV; break;
+        case 0x06: op->handler = CPU_OP_SRLV; break;
+        case 0x07: op->handler = CPU_OP_SRAV; break;
+        case 0x08: op->handler = CPU_OP_JR; break;
+        case 0x09: op->handler = CPU_OP_JALR; break;
+        case 0x0c: op->handler = CPU_OP_SYSCALL; break;
+        case 0x10: op->handler = CPU_OP_MFHI; break;
+        case 0x11: op->handler = CPU_OP_MTHI; break;
+        case 0x12: op->handler = CPU_OP_MFLO; break;
+        case 0x13: op->handler = CPU_OP_MTLO; break;
+        case 0x19: op->handler = CPU_OP_MULTU; break;
+        case 0x1a: op->handler = CPU_OP_DIV; break;
+        case 0x1b: op->handler = CPU_OP_DIVU; break;
+        case 0x20: op->handler = CPU_OP_ADD; break;
+        case 0x21: op->handler = CPU_OP_ADDU; break;
+        case 0x23: op->handler = CPU_OP_SUBU; break;
+        case 0x24: op->handler = CPU_OP_AND; break;
+        case 0x25: op->handler = CPU_OP_OR; break;
+        case 0x26: op->handler = CPU_OP_XOR; break;
+        case 0x27: op->handler = CPU_OP_NOR; break;
+        case 0x2A: op->handler = CPU_OP_SLT; break;
+        case 0x2B: op->handler = CPU_OP_SLTU; break;
       }
       break;
     case 0x01:;
       int bgez_instruction = (instruction >> 16) & 1;
-      if(bgez_instruction) {
-        //printf("bgez   $%s(%08x), 0x%08x", register_names[rs], cpu.reg[rs], cpu.pc + (int16_t)imm * 4);
-      } else {
-        //printf("bltz   $%s(%08x), 0x%08x", register_names[rs], cpu.reg[rs], cpu.pc + (int16_t)imm * 4);
-      }
       int link_instruction = ((instruction >> 17) & 0xf) == 8;
-      int result = (int32_t)cpu.reg[rs] < 0;
-      result ^= bgez_instruction;
-      if(link_instruction) cpu_set_reg(31, cpu.pc + 4);
-      if(result) cpu.next_pc = cpu.pc + (int16_t)imm * 4;
+      op->handler = link_instruction ? (bgez_instruction ? CPU_OP_BGEZAL : CPU_OP_BLTZAL) : (bgez_instruction ? CPU_OP_BGEZ : CPU_OP_BLTZ);
+      op->imm = (int16_t)imm * 4;
       break;
     case 0x02:
-      //printf("j      0x%08x", (cpu.pc & 0xF0000000) | ( imm26 << 2));
-      cpu.next_pc = (cpu.pc & 0xF0000000) | ( imm26 << 2);
-      break;
     case 0x03:
-      //printf("jal    0x%08x", (cpu.pc & 0xF0000000) | ( imm26 << 2));
-      cpu_set_reg(31, cpu.pc + 4);
-      cpu.next_pc = (cpu.pc & 0xF0000000) | ( imm26 << 2);
-      break;
-    case 0x04:
-      //printf("beq    $%s(%08x), $%s(%08x), 0x%08x", register_names[rs], cpu.reg[rs], register_names[rt], cpu.reg[rt], cpu.pc + (int16_t)imm * 4);
-      if(cpu.reg[rs] == cpu.reg[rt]) cpu.next_pc = cpu.pc + (int16_t)imm * 4;
-      break;
-    case 0x05:
-      //printf("bne    $%s(%08x), $%s(%08x), 0x%08x", register_names[rs], cpu.reg[rs], register_names[rt], cpu.reg[rt], cpu.pc + (int16_t)imm * 4);
-      if(cpu.reg[rs] != cpu.reg[rt]) cpu.next_pc = cpu.pc + (int16_t)imm * 4;
-      break;
-    case 0x06:
-      //printf("blez   $%s(%08x), 0x%08x", register_names[rs], cpu.reg[rs], cpu.pc + (int16_t)imm * 4);
-      if((int32_t)cpu.reg[rs] <= 0) cpu.next_pc = cpu.pc + (int16_t)imm * 4;
-      break;
-    case 0x07:
-      //printf("bgtz   $%s(%08x), 0x%08x", register_names[rs], cpu.reg[rs], cpu.pc + (int16_t)imm * 4);
-      if((int32_t)cpu.reg[rs] > 0) cpu.next_pc = cpu.pc + (int16_t)imm * 4;
-      break;
-    case 0x08:
-      //printf("addi   $%s(%08x), $%s(%08x), 0x%04x", register_names[rt], cpu.reg[rt], register_names[rs], cpu.reg[rs], imm);
-      if ((int32_t)cpu.reg[rs] >= 0) {
-          if ((int16_t)imm > (INT32_MAX - (int32_t)cpu.reg[rs])) {
-            //printf("  OVERFLOW!");
-            cpu_exception(0xC);
-            break;
-          }
-      } else {
-          if ((int16_t)imm < (INT32_MIN - (int32_t)cpu.reg[rs])) {
-            //printf("  OVERFLOW!");
-            cpu_exception(0xC);
-            break;
-          }
-      }
-      cpu_set_reg(rt, (int32_t)cpu.reg[rs] + (int16_t)imm);
-      break;
-    case 0x09:
-      //printf("addiu  $%s(%08x), $%s(%08x), 0x%04x", register_names[rt], cpu.reg[rt], register_names[rs], cpu.reg[rs], imm);
-      cpu_set_reg(rt, (int32_t)cpu.reg[rs] + (int16_t)imm);
-      break;
-    case 0x0A:
-      //printf("slti   $%s(%08x), $%s(%08x), 0x%04x", register_names[rt], cpu.reg[rt], register_names[rs], cpu.reg[rs], imm);
-      cpu_set_reg(rt, (int32_t)cpu.reg[rs] < (int16_t)imm);
-      break;
-    case 0x0B:
-      //printf("sltiu  $%s(%08x), $%s(%08x), 0x%04x", register_names[rt], cpu.reg[rt], register_names[rs], cpu.reg[rs], imm);
-      cpu_set_reg(rt, cpu.reg[rs] < (int16_t)imm);
-      break;
-    case 0x0C:
-      //printf("andi   $%s(%08x), $%s(%08x), 0x%04x", register_names[rt], cpu.reg[rt], register_names[rs], cpu.reg[rs], imm);
-      cpu_set_reg(rt, cpu.reg[rs] & imm);
-      break;
-    case 0x0D:
-      //printf("ori    $%s(%08x), $%s(%08x), 0x%04x", register_names[rt], cpu.reg[rt], register_names[rs], cpu.reg[rs], imm);
-      cpu_set_reg(rt, cpu.reg[rs] | imm);
-      break;
-    case 0x0F:
-      //printf("lui    $%s(%08x), 0x%04x", register_names[rt], cpu.reg[rt], imm);
-      cpu_set_reg(rt, imm << 16);
+      op->handler = operation == 0x02 ? CPU_OP_J : CPU_OP_JAL;
+      op->imm = (instruction & 0x3FFFFFF) << 2;
       break;
+    case 0x04: op->handler = CPU_OP_BEQ; op->imm = (int16_t)imm * 4; break;
+    case 0x05: op->handler = CPU_OP_BNE; op->imm = (int16_t)imm * 4; break;
+    case 0x06: op->handler = CPU_OP_BLEZ; op->imm = (int16_t)imm * 4; break;
+    case 0x07: op->handler = CPU_OP_BGTZ; op->imm = (int16_t)imm * 4; break;
+    case 0x08: op->handler = CPU_OP_ADDI; break;
+    case 0x09: op->handler = CPU_OP_ADDIU; break;
+    case 0x0A: op->handler = CPU_OP_SLTI; break;
+    case 0x0B: op->handler = CPU_OP_SLTIU; break;
+    case 0x0C: op->handler = CPU_OP_ANDI; op->imm = imm; break;
+    case 0x0D: op->handler = CPU_OP_ORI; op->imm = imm; break;
+    case 0x0F: op->handler = CPU_OP_LUI; op->imm = (uint32_t)imm << 16; break;
     case 0x10:
-      switch(rs) {
-        case 0x00:
-          //printf("mfc0   $%s(%08x), $%s(%08x)", register_names[rt], cpu.reg[rt], cop_register_names[rd], cpu.cop0_reg[rd]);
-          cpu_set_reg(rt, cpu.cop0_reg[rd]);
-          break;
-        case 0x04:
-          //printf("mtc0   $%s(%08x), $%s(%08x)", cop_register_names[rd], cpu.cop0_reg[rd], register_names[rt], cpu.reg[rt]);
-          cpu.cop0_reg[rd] = cpu.reg[rt];
-          break;
-        case 0x10:;
-          //printf("rfe    ");
-          if(operation_b != 0x10) {
-            printf("Unknown coprocessor operation 0x%08X RS:0x%02X &0x3F:%02X\n", instruction, rs, operation_b);
-            exit(1);
-          }
-          uint32_t mode = cpu.cop0_registers.sr & 0x3F;
-          cpu.cop0_registers.sr &= ~0x3F;
-          cpu.cop0_registers.sr |= (mode >> 2);
-          break;
-        default:
-          printf("Unknown operation 0x%08X OP:0x%02X RS:0x%02X RT:0x%02X RD:0x%02X\n", instruction, operation, rs, rt, rd);
-          exit(1);
-      }
-      break;
-    case 0x20:
-      location = cpu.reg[rs] + (int16_t)imm;
-      //printf("lb     $%s(%08x), %i(%s)([%08x] = %02x)", register_names[rt], cpu.reg[rt], (int16_t)imm, register_names[rs], location, (int8_t)memory_load_8(location));
-      cpu_set_reg(rt, (int8_t)memory_load_8(location));
+      if(op->rs == 0x00) op->handler = CPU_OP_MFC0;
+      if(op->rs == 0x04) op->handler = CPU_OP_MTC0;
+      if(op->rs == 0x10 && operation_b == 0x10) op->handler = CPU_OP_RFE;
       break;
-    case 0x21:
-      location = cpu.reg[rs] + (int16_t)imm;
-      //printf("lh     $%s(%08x), %i(%s)([%08x] = %04x)", register_names[rt], cpu.reg[rt], (int16_t)imm, register_names[rs], location, (int16_t)memory_load_16(location));
-      cpu_set_reg(rt, (int16_t)memory_load_16(location));
-      break;
-    case 0x22:
-      // lwl
-      location = cpu.reg[rs] + (int16_t)imm;
-      aligned_word = memory_load_32(location & ~3);
-      switch(location & 3) {
-        case 0: cpu.reg[rt] = (cpu.reg[rt] & 0x00ffffff) | (aligned_word << 24); break;
-        case 1: cpu.reg[rt] = (cpu.reg[rt] & 0x0000ffff) | (aligned_word << 16); break;
-        case 2: cpu.reg[rt] = (cpu.reg[rt] & 0x000000ff) | (aligned_word << 8); break;
-        case 3: cpu.reg[rt] = (cpu.reg[rt] & 0x00000000) | (aligned_word << 0); break;
+    case 0x20: op->handler = CPU_OP_LB; break;
+    case 0x21: op->handler = CPU_OP_LH; break;
+    case 0x22: op->handler = CPU_OP_LWL; break;
+    case 0x23: op->handler = CPU_OP_LW; break;
+    case 0x24: op->handler = CPU_OP_LBU; break;
+    case 0x25: op->handler = CPU_OP_LHU; break;
+    case 0x26: op->handler = CPU_OP_LWR; break;
+    case 0x28: op->handler = CPU_OP_SB; break;
+    case 0x29: op->handler = CPU_OP_SH; break;
+    case 0x2a: op->handler = CPU_OP_SWL; break;
+    case 0x2B: op->handler = CPU_OP_SW; break;
+    case 0x2e: op->handler = CPU_OP_SWR; break;
+  }
+}
+
+void cpu_decode(uint32_t instruction, cpu_op_t *op) {
+  cpu_decode_inline(instruction, op);
+}
+
+// Whether an op, say one read back from a file, is one cpu_decode could have made
+int cpu_op_valid(const cpu_op_t *op) {
+  return(op->handler < CPU_OPS && op->rs < 32 && op->rt < 32 && op->rd < 32);
+}
+
+// Decoding never fails, an instruction that can't be run only stops
+// emulation if it's actually reached
+static inline void cpu_op_unknown(const cpu_op_t *op) {
+  uint32_t instruction = op->instruction;
+  uint8_t operation = instruction >> 26;
+  uint8_t operation_b = instruction & 0x3F;
+  if(operation == 0x00)
+    printf("Unknown operation 0x%08X OP:0x%02X/0x%02X RS:0x%02X RT:0x%02X RD:0x%02X\n", instruction, operation, operation_b, op->rs, op->rt, op->rd);
+  else if(operation == 0x10 && op->rs == 0x10)
+    printf("Unknown coprocessor operation 0x%08X RS:0x%02X &0x3F:%02X\n", instruction, op->rs, operation_b);
+  else if(operation == 0x10)
+    printf("Unknown operation 0x%08X OP:0x%02X RS:0x%02X RT:0x%02X RD:0x%02X\n", instruction, operation, op->rs, op->rt, op->rd);
+  else
+    printf("Unknown operation 0x%08X OP:0x%02X RS:0x%02X RT:0x%02X RD:0x%02X IMM:0x%04X\n", instruction, operation, op->rs, op->rt, op->rd, instruction & 0xFFFF);
+  exit(1);
+}
+
+static inline void cpu_op_nop(const cpu_op_t *op) {
+}
+
+static inline void cpu_op_sll(const cpu_op_t *op) {
+  cpu_set_reg(op->rd, cpu.reg[op->rt] << op->imm);
+}
+static inline void cpu_op_srl(const cpu_op_t *op) {
+  cpu_set_reg(op->rd, cpu.reg[op->rt] >> op->imm);
+}
+static inline void cpu_op_sra(const cpu_op_t *op) {
+  cpu_set_reg(op->rd, (int32_t)cpu.reg[op->rt] >> op->imm);
+}
+static inline void cpu_op_sllv(const cpu_op_t *op) {
+  cpu_set_reg(op->rd, cpu.reg[op->rt] << (cpu.reg[op->rs] & 0x1F));
+}
+static inline void cpu_op_srlv(const cpu_op_t *op) {
+  cpu_set_reg(op->rd, cpu.reg[op->rt] >> (cpu.reg[op->rs] & 0x1F));
+}
+static inline void cpu_op_srav(const cpu_op_t *op) {
+  cpu_set_reg(op->rd, (int32_t)cpu.reg[op->rt] >> (cpu.reg[op->rs] & 0x1F));
+}
+static inline void cpu_op_jr(const cpu_op_t *op) {
+  cpu.next_pc = cpu.reg[op->rs];
+}
+static inline void cpu_op_jalr(const cpu_op_t *op) {
+  cpu_set_reg(op->rd, cpu.pc + 4);
+  cpu.next_pc = cpu.reg[op->rs];
+}
+static inline void cpu_op_syscall(const cpu_op_t *op) {
+  cpu_exception(8);
+}
+static inline void cpu_op_mfhi(const cpu_op_t *op) {
+  if(timing_enabled) timing_muldiv_wait();
+  cpu_set_reg(op->rd, cpu.hi);
+}
+static inline void cpu_op_mthi(const cpu_op_t *op) {
+  cpu.hi = cpu.reg[op->rs];
+  TRACE_EVENT(TRACE_HILO, 0, cpu.hi, cpu.lo);
+}
+static inline void cpu_op_mflo(const cpu_op_t *op) {
+  if(timing_enabled) timing_muldiv_wait();
+  cpu_set_reg(op->rd, cpu.lo);
+}
+static inline void cpu_op_mtlo(const cpu_op_t *op) {
+  cpu.lo = cpu.reg[op->rs];
+  TRACE_EVENT(TRACE_HILO, 0, cpu.hi, cpu.lo);
+}
+static inline void cpu_op_multu(const cpu_op_t *op) {
+  if(timing_enabled) timing_multiply(cpu.reg[op->rs]);
+  uint64_t result = (uint64_t)cpu.reg[op->rs] * (uint64_t)cpu.reg[op->rt];
+  cpu.hi = result >> 32;
+  cpu.lo = result;
+  TRACE_EVENT(TRACE_HILO, 0, cpu.hi, cpu.lo);
+}
+static inline void cpu_op_div(const cpu_op_t *op) {
+  if(timing_enabled) timing_divide();
+  if(cpu.reg[op->rt]) {
+    cpu.lo = (int32_t)cpu.reg[op->rs] / (int32_t)cpu.reg[op->rt];
+    cpu.hi = (int32_t)cpu.reg[op->rs] % (int32_t)cpu.reg[op->rt];
+  } else {
+    // Divide by zero
+    cpu.hi = cpu.reg[op->rs];
+    if((int32_t)op->rs >= 0)
+      cpu.lo = -1;
+    else
+      cpu.lo = 1;
+  }
+  TRACE_EVENT(TRACE_HILO, 0, cpu.hi, cpu.lo);
+}
+static inline void cpu_op_divu(const cpu_op_t *op) {
+  if(timing_enabled) timing_divide();
+  if(cpu.reg[op->rt]) {
+    cpu.lo = cpu.reg[op->rs] / cpu.reg[op->rt];
+    cpu.hi = cpu.reg[op->rs] % cpu.reg[op->rt];
+  } else {
+    // Divide by zero
+    cpu.hi = cpu.reg[op->rs];
+    cpu.lo = -1;
+  }
+  TRACE_EVENT(TRACE_HILO, 0, cpu.hi, cpu.lo);
+}
+static inline void cpu_op_add(const cpu_op_t *op) {
+  if ((int32_t)cpu.reg[op->rs] >= 0) {
+      if ((int32_t)cpu.reg[op->rt] > (INT32_MAX - (int32_t)cpu.reg[op->rs])) {
+          cpu_exception(0xC);
+          return;
       }
-      break;
-    case 0x23:;
-      location = cpu.reg[rs] + (int16_t)imm;
-      //printf("lw     $%s(%08x), %i(%s)([%08x] = %08x)", register_names[rt], cpu.reg[rt], (int16_t)imm, register_names[rs], location, memory_load_32(location));
-      cpu_set_reg(rt, memory_load_32(location));
-      break;
-    case 0x24:
-      location = cpu.reg[rs] + (int16_t)imm;
-      //printf("lbu    $%s(%08x), %i(%s)([%08x] = %02x)", register_names[rt], cpu.reg[rt], (int16_t)imm, register_names[rs], location, memory_load_8(location));
-      cpu_set_reg(rt, memory_load_8(location));
-      break;
-    case 0x25:
-      location = cpu.reg[rs] + (int16_t)imm;
-      //printf("lhu    $%s(%08x), %i(%s)([%08x] = %04x)", register_names[rt], cpu.reg[rt], (int16_t)imm, register_names[rs], location, memory_load_16(location));
-      cpu_set_reg(rt, (uint16_t)memory_load_16(location));
-      break;
-    case 0x26:
-      // lwr
-      location = cpu.reg[rs] + (int16_t)imm;
-      aligned_word = memory_load_32(location & ~3);
-      switch(location & 3) {
-        case 0: cpu.reg[rt] = (cpu.reg[rt] & 0x00000000) | (aligned_word >> 0); break;
-        case 1: cpu.reg[rt] = (cpu.reg[rt] & 0xff000000) | (aligned_word >> 8); break;
-        case 2: cpu.reg[rt] = (cpu.reg[rt] & 0xffff0000) | (aligned_word >> 16); break;
-        case 3: cpu.reg[rt] = (cpu.reg[rt] & 0xffffff00) | (aligned_word >> 24); break;
+  } else {
+      if ((int32_t)cpu.reg[op->rt] < (INT32_MIN - (int32_t)cpu.reg[op->rs])) {
+          cpu_exception(0xC);
+          return;
       }
-      break;
-    case 0x28:
-      location = cpu.reg[rs] + (int16_t)imm;
-      //printf("sb     $%s(%08x), %i(%s)([%08x] = %02x)", register_names[rt], cpu.reg[rt], (int16_t)imm, register_names[rs], location, memory_load_8(location));
-      memory_store_8(location, (uint8_t)cpu.reg[rt]);
-      break;
-    case 0x29:
-      location = cpu.reg[rs] + (int16_t)imm;
-      //printf("sh     $%s(%08x), %i(%s)([%08x] = %04x)", register_names[rt], cpu.reg[rt], (int16_t)imm, register_names[rs], location, memory_load_16(location));
-      memory_store_16(location, (uint16_t)cpu.reg[rt]);
-      break;
-    case 0x2a:
-      location = cpu.reg[rs] + (int16_t)imm;
-      //printf("swl");
-      aligned_word = memory_load_32(location & ~3);
-      switch(location & 3) {
-        case 0: aligned_word = (aligned_word & 0xffffff00) | (cpu.reg[rt] >> 24); break;
-        case 1: aligned_word = (aligned_word & 0xffff0000) | (cpu.reg[rt] >> 16); break;
-        case 2: aligned_word = (aligned_word & 0xff000000) | (cpu.reg[rt] >> 8); break;
-        case 3: aligned_word = (aligned_word & 0x00000000) | (cpu.reg[rt] >> 0); break;
+  }
+  cpu_set_reg(op->rd, (int32_t)cpu.reg[op->rs] + (int32_t)cpu.reg[op->rt]);
+}
+static inline void cpu_op_addu(const cpu_op_t *op) {
+  cpu_set_reg(op->rd, cpu.reg[op->rs] + cpu.reg[op->rt]);
+}
+static inline void cpu_op_subu(const cpu_op_t *op) {
+  cpu_set_reg(op->rd, cpu.reg[op->rs] - cpu.reg[op->rt]);
+}
+static inline void cpu_op_and(const cpu_op_t *op) {
+  cpu_set_reg(op->rd, cpu.reg[op->rs] & cpu.reg[op->rt]);
+}
+static inline void cpu_op_or(const cpu_op_t *op) {
+  cpu_set_reg(op->rd, cpu.reg[op->rs] | cpu.reg[op->rt]);
+}
+static inline void cpu_op_xor(const cpu_op_t *op) {
+  cpu_set_reg(op->rd, cpu.reg[op->rs] ^ cpu.reg[op->rt]);
+}
+static inline void cpu_op_nor(const cpu_op_t *op) {
+  cpu_set_reg(op->rd, ~(cpu.reg[op->rs] | cpu.reg[op->rt]));
+}
+static inline void cpu_op_slt(const cpu_op_t *op) {
+  cpu_set_reg(op->rd, (int32_t)cpu.reg[op->rs] < (int32_t)cpu.reg[op->rt]);
+}
+static inline void cpu_op_sltu(const cpu_op_t *op) {
+  cpu_set_reg(op->rd, cpu.reg[op->rs] < cpu.reg[op->rt]);
+}
+
+// The link register is written whether or not the branch is taken
+static inline void cpu_op_bltz(const cpu_op_t *op) {
+  if((int32_t)cpu.reg[op->rs] < 0) cpu.next_pc = cpu.pc + op->imm;
+}
+static inline void cpu_op_bgez(const cpu_op_t *op) {
+  if((int32_t)cpu.reg[op->rs] >= 0) cpu.next_pc = cpu.pc + op->imm;
+}
+static inline void cpu_op_bltzal(const cpu_op_t *op) {
+  int result = (int32_t)cpu.reg[op->rs] < 0;
+  cpu_set_reg(31, cpu.pc + 4);
+  if(result) cpu.next_pc = cpu.pc + op->imm;
+}
+static inline void cpu_op_bgezal(const cpu_op_t *op) {
+  int result = (int32_t)cpu.reg[op->rs] >= 0;
+  cpu_set_reg(31, cpu.pc + 4);
+  if(result) cpu.next_pc = cpu.pc + op->imm;
+}
+static inline void cpu_op_j(const cpu_op_t *op) {
+  cpu.next_pc = (cpu.pc & 0xF0000000) | op->imm;
+}
+static inline void cpu_op_jal(const cpu_op_t *op) {
+  cpu_set_reg(31, cpu.pc + 4);
+  cpu.next_pc = (cpu.pc & 0xF0000000) | op->imm;
+}
+static inline void cpu_op_beq(const cpu_op_t *op) {
+  if(cpu.reg[op->rs] == cpu.reg[op->rt]) cpu.next_pc = cpu.pc + op->imm;
+}
+static inline void cpu_op_bne(const cpu_op_t *op) {
+  if(cpu.reg[op->rs] != cpu.reg[op->rt]) cpu.next_pc = cpu.pc + op->imm;
+}
+static inline void cpu_op_blez(const cpu_op_t *op) {
+  if((int32_t)cpu.reg[op->rs] <= 0) cpu.next_pc = cpu.pc + op->imm;
+}
+static inline void cpu_op_bgtz(const cpu_op_t *op) {
+  if((int32_t)cpu.reg[op->rs] > 0) cpu.next_pc = cpu.pc + op->imm;
+}
+static inline void cpu_op_addi(const cpu_op_t *op) {
+  if ((int32_t)cpu.reg[op->rs] >= 0) {
+      if ((int32_t)op->imm > (INT32_MAX - (int32_t)cpu.reg[op->rs])) {
+        cpu_exception(0xC);
+        return;
       }
-      memory_store_32(location & ~3, aligned_word);
-      break;
-    case 0x2B:;
-      location = cpu.reg[rs] + (int16_t)imm;
-      //printf("sw     $%s(%08x), %i(%s)([%08x] = %08x)", register_names[rt], cpu.reg[rt], (int16_t)imm, register_names[rs], location, memory_load_32(location));
-      memory_store_32(location, cpu.reg[rt]);
-      break;
-    case 0x2e:
-      location = cpu.reg[rs] + (int16_t)imm;
-      //printf("swr");
-      aligned_word = memory_load_32(location & ~3);
-      switch(location & 3) {
-        case 0: aligned_word = (aligned_word & 0x00000000) | (cpu.reg[rt] << 0); break;
-        case 1: aligned_word = (aligned_word & 0x000000ff) | (cpu.reg[rt] << 8); break;
-        case 2: aligned_word = (aligned_word & 0x0000ffff) | (cpu.reg[rt] << 16); break;
-        case 3: aligned_word = (aligned_word & 0x00ffffff) | (cpu.reg[rt] << 24); break;
+  } else {
+      if ((int32_t)op->imm < (INT32_MIN - (int32_t)cpu.reg[op->rs])) {
+        cpu_exception(0xC);
+        return;
       }
-      memory_store_32(location & ~3, aligned_word);
-      break;
-    default:
-      printf("Unknown operation 0x%08X OP:0x%02X RS:0x%02X RT:0x%02X RD:0x%02X IMM:0x%04X\n", instruction, operation, rs, rt, rd, imm);
-      exit(1);
   }
-  //printf("\n");
+  cpu_set_reg(op->rt, cpu.reg[op->rs] + op->imm);
+}
+static inline void cpu_op_addiu(const cpu_op_t *op) {
+  cpu_set_reg(op->rt, cpu.reg[op->rs] + op->imm);
+}
+static inline void cpu_op_slti(const cpu_op_t *op) {
+  cpu_set_reg(op->rt, (int32_t)cpu.reg[op->rs] < (int32_t)op->imm);
+}
+static inline void cpu_op_sltiu(const cpu_op_t *op) {
+  cpu_set_reg(op->rt, cpu.reg[op->rs] < op->imm);
+}
+static inline void cpu_op_andi(const cpu_op_t *op) {
+  cpu_set_reg(op->rt, cpu.reg[op->rs] & op->imm);
+}
+static inline void cpu_op_ori(const cpu_op_t *op) {
+  cpu_set_reg(op->rt, cpu.reg[op->rs] | op->imm);
+}
+static inline void cpu_op_lui(const cpu_op_t *op) {
+  cpu_set_reg(op->rt, op->imm);
+}
+static inline void cpu_op_mfc0(const cpu_op_t *op) {
+  cpu_set_reg(op->rt, cpu.cop0_reg[op->rd]);
+}
+static inline void cpu_op_mtc0(const cpu_op_t *op) {
+  uint8_t rd = op->rd;
+  if(rd == 13) {
+    // Only the software interrupt bits of cause are writable
+    cpu.cop0_registers.cause = (cpu.cop0_registers.cause & ~0x300) | (cpu.reg[op->rt] & 0x300);
+  } else {
+    cpu.cop0_reg[rd] = cpu.reg[op->rt];
+  }
+  TRACE_EVENT(TRACE_COP0, rd, 0, cpu.cop0_reg[rd]);
+  if(rd == 12 || rd == 13) cpu_update_interrupts();
+}
+static inline void cpu_op_rfe(const cpu_op_t *op) {
+  uint32_t mode = cpu.cop0_registers.sr & 0x3F;
+  cpu.cop0_registers.sr &= ~0x3F;
+  cpu.cop0_registers.sr |= (mode >> 2);
+  cpu_update_interrupts();
+}
+
+static inline void cpu_op_lb(const cpu_op_t *op) {
+  cpu_set_reg(op->rt, (int8_t)memory_load_8(cpu.reg[op->rs] + op->imm));
+}
+static inline void cpu_op_lh(const cpu_op_t *op) {
+  cpu_set_reg(op->rt, (int16_t)memory_load_16(cpu.reg[op->rs] + op->imm));
+}
+static inline void cpu_op_lwl(const cpu_op_t *op) {
+  uint32_t location = cpu.reg[op->rs] + op->imm;
+  uint32_t aligned_word = memory_load_32(location & ~3);
+  uint8_t rt = op->rt;
+  switch(location & 3) {
+    case 0: cpu.reg[rt] = (cpu.reg[rt] & 0x00ffffff) | (aligned_word << 24); break;
+    case 1: cpu.reg[rt] = (cpu.reg[rt] & 0x0000ffff) | (aligned_word << 16); break;
+    case 2: cpu.reg[rt] = (cpu.reg[rt] & 0x000000ff) | (aligned_word << 8); break;
+    case 3: cpu.reg[rt] = (cpu.reg[rt] & 0x00000000) | (aligned_word << 0); break;
+  }
+}
+static inline void cpu_op_lw(const cpu_op_t *op) {
+  cpu_set_reg(op->rt, memory_load_32(cpu.reg[op->rs] + op->imm));
+}
+static inline void cpu_op_lbu(const cpu_op_t *op) {
+  cpu_set_reg(op->rt, memory_load_8(cpu.reg[op->rs] + op->imm));
+}
+static inline void cpu_op_lhu(const cpu_op_t *op) {
+  cpu_set_reg(op->rt, (uint16_t)memory_load_16(cpu.reg[op->rs] + op->imm));
+}
+static inline void cpu_op_lwr(const cpu_op_t *op) {
+  uint32_t location = cpu.reg[op->rs] + op->imm;
+  uint32_t aligned_word = memory_load_32(location & ~3);
+  uint8_t rt = op->rt;
+  switch(location & 3) {
+    case 0: cpu.reg[rt] = (cpu.reg[rt] & 0x00000000) | (aligned_word >> 0); break;
+    case 1: cpu.reg[rt] = (cpu.reg[rt] & 0xff000000) | (aligned_word >> 8); break;
+    case 2: cpu.reg[rt] = (cpu.reg[rt] & 0xffff0000) | (aligned_word >> 16); break;
+    case 3: cpu.reg[rt] = (cpu.reg[rt] & 0xffffff00) | (aligned_word >> 24); break;
+  }
+}
+static inline void cpu_op_sb(const cpu_op_t *op) {
+  memory_store_8(cpu.reg[op->rs] + op->imm, (uint8_t)cpu.reg[op->rt]);
+}
+static inline void cpu_op_sh(const cpu_op_t *op) {
+  memory_store_16(cpu.reg[op->rs] + op->imm, (uint16_t)cpu.reg[op->rt]);
+}
+static inline void cpu_op_swl(const cpu_op_t *op) {
+  uint32_t location = cpu.reg[op->rs] + op->imm;
+  uint32_t aligned_word = memory_load_32(location & ~3);
+  uint32_t value = cpu.reg[op->rt];
+  switch(location & 3) {
+    case 0: aligned_word = (aligned_word & 0xffffff00) | (value >> 24); break;
+    case 1: aligned_word = (aligned_word & 0xffff0000) | (value >> 16); break;
+    case 2: aligned_word = (aligned_word & 0xff000000) | (value >> 8); break;
+    case 3: aligned_word = (aligned_word & 0x00000000) | (value >> 0); break;
+  }
+  memory_store_32(location & ~3, aligned_word);
+}
+static inline void cpu_op_sw(const cpu_op_t *op) {
+  memory_store_32(cpu.reg[op->rs] + op->imm, cpu.reg[op->rt]);
+}
+static inline void cpu_op_swr(const cpu_op_t *op) {
+  uint32_t location = cpu.reg[op->rs] + op->imm;
+  uint32_t aligned_word = memory_load_32(location & ~3);
+  uint32_t value = cpu.reg[op->rt];
+  switch(location & 3) {
+    case 0: aligned_word = (aligned_word & 0x00000000) | (value << 0); break;
+    case 1: aligned_word = (aligned_word & 0x000000ff) | (value << 8); break;
+    case 2: aligned_word = (aligned_word & 0x0000ffff) | (value << 16); break;
+    case 3: aligned_word = (aligned_word & 0x00ffffff) | (value << 24); break;
+  }
+  memory_store_32(location & ~3, aligned_word);
+}
+
+// A switch rather than a table of pointers, so every handler is inlined into it
+static inline __attribute__((always_inline)) void cpu_dispatch(const cpu_op_t *op) {
+  switch(op->handler) {
+    case CPU_OP_UNKNOWN: cpu_op_unknown(op); break;
+    case CPU_OP_NOP: cpu_op_nop(op); break;
+    case CPU_OP_SLL: cpu_op_sll(op); break;
+    case CPU_OP_SRL: cpu_op_srl(op); break;
+    case CPU_OP_SRA: cpu_op_sra(op); break;
+    case CPU_OP_SLLV: cpu_op_sllv(op); break;
+    case CPU_OP_SRLV: cpu_op_srlv(op); break;
+    case CPU_OP_SRAV: cpu_op_srav(op); break;
+    case CPU_OP_JR: cpu_op_jr(op); break;
+    case CPU_OP_JALR: cpu_op_jalr(op); break;
+    case CPU_OP_SYSCALL: cpu_op_syscall(op); break;
+    case CPU_OP_MFHI: cpu_op_mfhi(op); break;
+    case CPU_OP_MTHI: cpu_op_mthi(op); break;
+    case CPU_OP_MFLO: cpu_op_mflo(op); break;
+    case CPU_OP_MTLO: cpu_op_mtlo(op); break;
+    case CPU_OP_MULTU: cpu_op_multu(op); break;
+    case CPU_OP_DIV: cpu_op_div(op); break;
+    case CPU_OP_DIVU: cpu_op_divu(op); break;
+    case CPU_OP_ADD: cpu_op_add(op); break;
+    case CPU_OP_ADDU: cpu_op_addu(op); break;
+    case CPU_OP_SUBU: cpu_op_subu(op); break;
+    case CPU_OP_AND: cpu_op_and(op); break;
+    case CPU_OP_OR: cpu_op_or(op); break;
+    case CPU_OP_XOR: cpu_op_xor(op); break;
+    case CPU_OP_NOR: cpu_op_nor(op); break;
+    case CPU_OP_SLT: cpu_op_slt(op); break;
+    case CPU_OP_SLTU: cpu_op_sltu(op); break;
+    case CPU_OP_BLTZ: cpu_op_bltz(op); break;
+    case CPU_OP_BGEZ: cpu_op_bgez(op); break;
+    case CPU_OP_BLTZAL: cpu_op_bltzal(op); break;
+    case CPU_OP_BGEZAL: cpu_op_bgezal(op); break;
+    case CPU_OP_J: cpu_op_j(op); break;
+    case CPU_OP_JAL: cpu_op_jal(op); break;
+    case CPU_OP_BEQ: cpu_op_beq(op); break;
+    case CPU_OP_BNE: cpu_op_bne(op); break;
+    case CPU_OP_BLEZ: cpu_op_blez(op); break;
+    case CPU_OP_BGTZ: cpu_op_bgtz(op); break;
+    case CPU_OP_ADDI: cpu_op_addi(op); break;
+    case CPU_OP_ADDIU: cpu_op_addiu(op); break;
+    case CPU_OP_SLTI: cpu_op_slti(op); break;
+    case CPU_OP_SLTIU: cpu_op_sltiu(op); break;
+    case CPU_OP_ANDI: cpu_op_andi(op); break;
+    case CPU_OP_ORI: cpu_op_ori(op); break;
+    case CPU_OP_LUI: cpu_op_lui(op); break;
+    case CPU_OP_MFC0: cpu_op_mfc0(op); break;
+    case CPU_OP_MTC0: cpu_op_mtc0(op); break;
+    case CPU_OP_RFE: cpu_op_rfe(op); break;
+    case CPU_OP_LB: cpu_op_lb(op); break;
+    case CPU_OP_LH: cpu_op_lh(op); break;
+    case CPU_OP_LWL: cpu_op_lwl(op); break;
+    case CPU_OP_LW: cpu_op_lw(op); break;
+    case CPU_OP_LBU: cpu_op_lbu(op); break;
+    case CPU_OP_LHU: cpu_op_lhu(op); break;
+    case CPU_OP_LWR: cpu_op_lwr(op); break;
+    case CPU_OP_SB: cpu_op_sb(op); break;
+    case CPU_OP_SH: cpu_op_sh(op); break;
+    case CPU_OP_SWL: cpu_op_swl(op); break;
+    case CPU_OP_SW: cpu_op_sw(op); break;
+    case CPU_OP_SWR: cpu_op_swr(op); break;
+  }
 }
 
 void cpu_reset() {
@@ -418,14 +606,59 @@ void cpu_reset() {
   cpu.reg[0] = 0;
 }
 
-uint32_t fetch_next_instruction() {
-  uint32_t instruction = memory_load_32(cpu.pc);
+// Runs a decoded instruction as though it had just been fetched from cpu.pc
+static inline __attribute__((always_inline)) void cpu_run_op(const cpu_op_t *op) {
   cpu.current_pc = cpu.pc;
   cpu.pc = cpu.next_pc;
   cpu.next_pc = cpu.pc + 4;
-  return instruction;
+  TRACE_EVENT(TRACE_INSTRUCTION, 0, cpu.current_pc, op->instruction);
+  if(op->handler == CPU_OP_NOP) {
+    STATS_COUNT(nops);
+  } else {
+    STATS_COUNT(opcodes[op->instruction >> 26]);
+    if(!(op->instruction >> 26)) STATS_COUNT(special_opcodes[op->instruction & 0x3F]);
+  }
+  cpu_dispatch(op);
+  scheduler_cycles += timing_enabled ? 1 : CPU_CYCLES_PER_INSTRUCTION;
+  cpu_instructions++;
+}
+
+void cpu_execute_op(const cpu_op_t *op) {
+  cpu_run_op(op);
+}
+
+void cpu_execute(uint32_t instruction) {
+  cpu_op_t op;
+  cpu_decode_inline(instruction, &op);
+  cpu_run_op(&op);
 }
 
 void cpu_fetch_execute() {
-  decode_and_execute(fetch_next_instruction());
+  if(cpu_irq_pending) cpu_interrupt();
+  cpu_execute(memory_fetch_32(cpu.pc));
+}
+
+// The interpreter as a block engine, the reference for the others
+uint32_t cpu_run_block(uint32_t limit) {
+  uint32_t count = 0;
+  while(count < limit) {
+    cpu_execute(memory_fetch_32(cpu.pc));
+    count++;
+    if(cpu_block_done()) break;
+  }
+  cpu_block_break = 0;
+  return(count);
+}
+
+cpu_engine_t cpu_engines[] = {
+  {"interpreter", cpu_run_block},
+  {"block", block_cache_run},
+  {0, 0},
+};
+
+cpu_engine_t *cpu_find_engine(const char *name) {
+  for(cpu_engine_t *engine = cpu_engines; engine->name; engine++)
+    if(!strcmp(engine->name, name)) return(engine);
+  printf("Unknown CPU engine: %s\n", name);
+  exit(1);
 }
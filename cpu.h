@@ -2,6 +2,7 @@
 #define CPU_H
 
 #include <stdint.h>
+#include "scheduler.h"
 
 // CPU data structure
 typedef struct cpu_t {
@@ -32,10 +33,53 @@ typedef struct cpu_t {
   };
 } cpu_t;
 
+// An instruction decoded for cpu_execute_op, as the block engine keeps it
+typedef struct cpu_op_t {
+  uint8_t handler;
+  uint8_t rs, rt, rd;
+  // Extended as the instruction uses it, pre-scaled for branches and
+  // jumps, or the shift amount
+  uint32_t imm;
+  uint32_t instruction;
+} cpu_op_t;
+
+// A CPU engine runs straight-line code from cpu.pc, stopping after at most
+// limit instructions, after the delay slot of a taken branch or an
+// exception, once cpu_irq_pending or cpu_block_break is set, or when the
+// scheduler deadline is reached. It returns the number of instructions run
+// and clears cpu_block_break. Interrupts are taken by the caller between
+// blocks.
+typedef struct cpu_engine_t {
+  const char *name;
+  uint32_t (*run_block)(uint32_t limit);
+} cpu_engine_t;
+
 extern cpu_t cpu;
+extern int cpu_irq_pending;
+extern int cpu_block_break;
+extern uint64_t cpu_instructions;
+extern cpu_engine_t cpu_engines[];
+extern cpu_engine_t *cpu_engine;
+extern const char register_names[32][3];
+extern const char cop_register_names[64][9];
+extern const char *opcode_names[64];
+extern const char *special_opcode_names[64];
 
 void cpu_fetch_execute();
 void cpu_exception(uint32_t cause);
+void cpu_set_interrupt_line(int active);
 void cpu_reset();
+void cpu_interrupt();
+void cpu_execute(uint32_t instruction);
+void cpu_decode(uint32_t instruction, cpu_op_t *op);
+int cpu_op_valid(const cpu_op_t *op);
+void cpu_execute_op(const cpu_op_t *op);
+uint32_t cpu_run_block(uint32_t limit);
+cpu_engine_t *cpu_find_engine(const char *name);
+
+// Whether an engine must end its block after the instruction just run
+static inline int cpu_block_done() {
+  return(cpu.pc != cpu.current_pc + 4 || cpu_irq_pending || cpu_block_break || scheduler_cycles >= scheduler_deadline);
+}
 
 #endif
\ No newline at end of file
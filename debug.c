@@ -0,0 +1,284 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include "debug.h"
+#include "cpu.h"
+#include "memory.h"
+#include "unix_socket.h"
+
+#define DEBUG_PEEK_MAX 256
+
+typedef struct debug_point_t {
+  // Physical, so every mirror of it matches
+  uint32_t address;
+  uint32_t length;
+  int kinds;
+} debug_point_t;
+
+debug_point_t debug_points[DEBUG_POINTS];
+uint32_t debug_point_count;
+int debug_paused;
+
+// The control thread hands over one command at a time and waits for the
+// emulation thread to run it between frames, or while paused
+char debug_socket_path[108];
+int debug_socket = -1;
+int debug_client = -1;
+pthread_t debug_thread;
+sem_t debug_wake, debug_done;
+_Atomic int debug_pending;
+_Atomic int debug_stop;
+char debug_request[256];
+char *debug_response;
+size_t debug_response_length;
+
+void debug_wait();
+
+void debug_hit(int kind, uint32_t address, uint32_t value) {
+  if(kind == DEBUG_EXECUTE)
+    printf("Debug: breakpoint at %08x\n", address);
+  else
+    printf("Debug: %s %08x = %08x at pc %08x\n", kind == DEBUG_READ ? "read" : "write", address, value, cpu.current_pc);
+  fflush(stdout);
+  if(debug_socket < 0) return;
+  debug_paused = 1;
+  debug_wait();
+}
+
+void debug_check(uint32_t address, uint32_t size, int kind, uint32_t value) {
+  uint32_t physical = address & 0x1fffffff;
+  for(uint32_t n = 0; n < debug_point_count; n++) {
+    debug_point_t *point = &debug_points[n];
+    if((point->kinds & kind) && physical < point->address + point->length && point->address < physical + size) {
+      debug_hit(kind, address, value);
+      return;
+    }
+  }
+}
+
+uint32_t debug_load_32(uint32_t address) {
+  uint32_t value = memory_decode_device(address)->load_32(address);
+  debug_check(address, 4, DEBUG_READ, value);
+  return(value);
+}
+uint16_t debug_load_16(uint32_t address) {
+  uint16_t value = memory_decode_device(address)->load_16(address);
+  debug_check(address, 2, DEBUG_READ, value);
+  return(value);
+}
+uint8_t debug_load_8(uint32_t address) {
+  uint8_t value = memory_decode_device(address)->load_8(address);
+  debug_check(address, 1, DEBUG_READ, value);
+  return(value);
+}
+void debug_store_32(uint32_t address, uint32_t value) {
+  debug_check(address, 4, DEBUG_WRITE, value);
+  memory_decode_device(address)->store_32(address, value);
+}
+void debug_store_16(uint32_t address, uint16_t value) {
+  debug_check(address, 2, DEBUG_WRITE, value);
+  memory_decode_device(address)->store_16(address, value);
+}
+void debug_store_8(uint32_t address, uint8_t value) {
+  debug_check(address, 1, DEBUG_WRITE, value);
+  memory_decode_device(address)->store_8(address, value);
+}
+
+// Only ever reached through the fetch page table
+uint32_t debug_fetch_32(uint32_t address) {
+  debug_check(address, 4, DEBUG_EXECUTE, 0);
+  return(memory_decode_device(address)->load_32(address));
+}
+
+ memory_accessor_t debug_accessor = {
+  .load_32 = debug_load_32,
+  .load_16 = debug_load_16,
+  .load_8 = debug_load_8,
+  .store_32 = debug_store_32,
+  .store_16 = debug_store_16,
+  .store_8 = debug_store_8,
+};
+
+ memory_accessor_t debug_fetch_accessor = {
+  .load_32 = debug_fetch_32,
+};
+
+// Rebuilds the page tables, sending every page a point touches, in every
+// segment, through the checking accessors
+void debug_route() {
+  memory_reset();
+  uint32_t segments[3] = {0x00000000, 0x80000000, 0xA0000000};
+  for(uint32_t n = 0; n < debug_point_count; n++) {
+    debug_point_t *point = &debug_points[n];
+    for(int segment = 0; segment < 3; segment++) {
+      uint32_t first = (segments[segment] + point->address) >> MEMORY_PAGE_BITS;
+      uint32_t last = (segments[segment] + point->address + point->length - 1) >> MEMORY_PAGE_BITS;
+      for(uint32_t page = first; page <= last; page++) {
+        if(point->kinds & DEBUG_EXECUTE) memory_fetch_pages[page] = &debug_fetch_accessor;
+        if(point->kinds & (DEBUG_READ | DEBUG_WRITE)) memory_pages[page] = &debug_accessor;
+      }
+    }
+  }
+}
+
+int debug_add(uint32_t address, uint32_t length, int kinds) {
+  if(debug_point_count == DEBUG_POINTS || !length || length > 0x200000) return(0);
+  debug_points[debug_point_count++] = (debug_point_t){address & 0x1fffffff, length, kinds};
+  debug_route();
+  return(1);
+}
+
+void debug_delete(uint32_t address) {
+  uint32_t kept = 0;
+  for(uint32_t n = 0; n < debug_point_count; n++)
+    if(debug_points[n].address != (address & 0x1fffffff))
+      debug_points[kept++] = debug_points[n];
+  debug_point_count = kept;
+  debug_route();
+}
+
+void debug_break(uint32_t address) {
+  if(!debug_add(address, 4, DEBUG_EXECUTE)) {
+    printf("Too many breakpoints\n");
+    exit(1);
+  }
+}
+
+void debug_registers(FILE *out) {
+  fprintf(out, "pc %08x hi %08x lo %08x sr %08x cause %08x epc %08x\n", cpu.pc, cpu.hi, cpu.lo,
+    cpu.cop0_registers.sr, cpu.cop0_registers.cause, cpu.cop0_registers.epc);
+  for(int r = 0; r < 32; r++)
+    fprintf(out, "%-2s %08x%s", register_names[r], cpu.reg[r], r % 4 == 3 ? "\n" : "  ");
+}
+
+// Device registers can change when read, only memory is shown
+memory_accessor_t *debug_memory(uint32_t address) {
+  switch(address & 0x1fffffff) {
+    case 0x00000000 ... 0x001FFFFF: return(&ram_accessor);
+    case 0x1F800000 ... 0x1F8003FF: return(&scratchpad_accessor);
+    case 0x1FC00000 ... 0x1FC7FFFF: return(&rom_accessor);
+  }
+  return(0);
+}
+
+int debug_peek(FILE *out, uint32_t address, uint32_t length) {
+  if(length > DEBUG_PEEK_MAX) length = DEBUG_PEEK_MAX;
+  for(uint32_t n = 0; n < length; n++) {
+    memory_accessor_t *device = debug_memory(address + n);
+    if(!device) return(0);
+    if(n % 16 == 0) fprintf(out, "%s%08x:", n ? "\n" : "", address + n);
+    fprintf(out, " %02x", device->load_8(address + n));
+  }
+  fprintf(out, "\n");
+  return(1);
+}
+
+// Runs one command line, writing the reply to out
+void debug_command(const char *line, FILE *out) {
+  char command[16] = "", access[8] = "rw";
+  uint32_t address = 0, length = 4;
+  int fields = sscanf(line, "%15s %x %u %7s", command, &address, &length, access);
+  int ok = 1;
+  if(!strcmp(command, "break") && fields >= 2) {
+    ok = debug_add(address, 4, DEBUG_EXECUTE);
+  } else if(!strcmp(command, "watch") && fields >= 2) {
+    int kinds = (strchr(access, 'r') ? DEBUG_READ : 0) | (strchr(access, 'w') ? DEBUG_WRITE : 0);
+    ok = kinds && debug_add(address, length, kinds);
+  } else if(!strcmp(command, "delete") && fields >= 2) {
+    debug_delete(address);
+  } else if(!strcmp(command, "list")) {
+    for(uint32_t n = 0; n < debug_point_count; n++) {
+      debug_point_t *point = &debug_points[n];
+      fprintf(out, "%08x %u %s%s%s\n", point->address, point->length, point->kinds & DEBUG_EXECUTE ? "x" : "",
+        point->kinds & DEBUG_READ ? "r" : "", point->kinds & DEBUG_WRITE ? "w" : "");
+    }
+  } else if(!strcmp(command, "pause")) {
+    debug_paused = 1;
+  } else if(!strcmp(command, "continue")) {
+    debug_paused = 0;
+  } else if(!strcmp(command, "regs")) {
+    debug_registers(out);
+  } else if(!strcmp(command, "peek") && fields >= 2) {
+    ok = debug_peek(out, address, fields >= 3 ? length : 16);
+  } else {
+    ok = 0;
+  }
+  fprintf(out, ok ? "ok\n" : "error\n");
+}
+
+// Runs a command handed over by the control thread, if there is one
+void debug_poll() {
+  if(!atomic_load_explicit(&debug_pending, memory_order_acquire)) return;
+  FILE *out = open_memstream(&debug_response, &debug_response_length);
+  debug_command(debug_request, out);
+  fclose(out);
+  atomic_store_explicit(&debug_pending, 0, memory_order_release);
+  sem_post(&debug_done);
+}
+
+void debug_wait() {
+  printf("Debug: paused at %08x\n", cpu.pc);
+  fflush(stdout);
+  while(debug_paused && !atomic_load(&debug_stop)) {
+    while(sem_wait(&debug_wake) && !atomic_load(&debug_stop));
+    debug_poll();
+  }
+}
+
+// Called once per VBlank
+void debug_frame() {
+  if(debug_socket < 0) return;
+  debug_poll();
+  if(debug_paused) debug_wait();
+}
+
+void *debug_server(void *arg) {
+  while(!atomic_load(&debug_stop)) {
+    int client = accept(debug_socket, 0, 0);
+    if(client < 0) continue;
+    debug_client = client;
+    FILE *in = fdopen(client, "r");
+    char line[256];
+    while(!atomic_load(&debug_stop) && fgets(line, sizeof(line), in)) {
+      snprintf(debug_request, sizeof(debug_request), "%s", line);
+      atomic_store_explicit(&debug_pending, 1, memory_order_release);
+      sem_post(&debug_wake);
+      while(sem_wait(&debug_done));
+      if(atomic_load(&debug_stop)) break;
+      unix_socket_send(client, debug_response, debug_response_length);
+      free(debug_response);
+      debug_response = 0;
+    }
+    debug_client = -1;
+    fclose(in);
+  }
+  return(0);
+}
+
+void debug_open(const char *path) {
+  debug_socket = unix_socket_listen(path, 1, "debug");
+  snprintf(debug_socket_path, sizeof(debug_socket_path), "%s", path);
+  sem_init(&debug_wake, 0, 0);
+  sem_init(&debug_done, 0, 0);
+  pthread_create(&debug_thread, 0, debug_server, 0);
+  atexit(debug_close);
+}
+
+void debug_close() {
+  if(debug_socket < 0) return;
+  atomic_store(&debug_stop, 1);
+  // Wakes the server out of accept(), a read or a wait for a reply
+  shutdown(debug_socket, SHUT_RDWR);
+  if(debug_client >= 0) shutdown(debug_client, SHUT_RDWR);
+  sem_post(&debug_done);
+  pthread_join(debug_thread, 0);
+  close(debug_socket);
+  debug_socket = -1;
+  unlink(debug_socket_path);
+}
@@ -0,0 +1,32 @@
+#ifndef DEBUG_H
+#define DEBUG_H
+
+#include <stdint.h>
+
+// Breakpoints and watchpoints. The pages holding one have their entries in
+// the page tables pointed at the accessors here, which check the address
+// before passing the access on, so nothing else pays for them. They're set
+// at startup with -b or at any time through a control socket (-d path),
+// one command per line:
+//
+//   break 80010000           stop before the instruction there runs
+//   watch 800a1234 4 rw      stop on reads and/or writes of a range
+//   delete 80010000          remove what's set at an address
+//   list, pause, continue, regs, peek 800a1234 64
+//
+// With a socket open a hit pauses emulation until continue, without one
+// it's only logged.
+#define DEBUG_POINTS 64
+
+enum {
+  DEBUG_EXECUTE = 1,
+  DEBUG_READ = 2,
+  DEBUG_WRITE = 4,
+};
+
+void debug_open(const char *path);
+void debug_break(uint32_t address);
+void debug_frame();
+void debug_close();
+
+#endif
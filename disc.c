@@ -0,0 +1,297 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <lzma.h>
+#include "disc.h"
+#include "disc_cache.h"
+#include "ring.h"
+#include "hash.h"
+
+// Images are mapped, never read with read(). A read-ahead thread copies the
+// sectors following the current read position into a ring, so the page
+// faults land on that thread. The emulation thread only falls back to the
+// mapping itself after a seek the read-ahead has not caught up with.
+// Packed images go through the shared hunk cache, so the read-ahead is also
+// what decompresses hunks ahead of the read position.
+#define DISC_MAX_FILES  DISC_MAX_TRACKS
+#define DISC_ENTRY_SIZE (4 + DISC_SECTOR_SIZE)
+#define DISC_RING_SIZE  (256 * 1024)
+
+int disc_loaded;
+uint32_t disc_sectors;
+int disc_track_count;
+uint32_t disc_track_start[DISC_MAX_TRACKS + 1];
+uint8_t disc_track_audio[DISC_MAX_TRACKS + 1];
+// Sectors that had to be copied on the emulation thread
+uint64_t disc_stalls;
+
+typedef struct disc_file_t {
+  uint8_t *data;
+  size_t size;
+  uint32_t first_lba;
+  uint32_t sectors;
+  // Packed images only
+  disc_packed_header_t *header;
+  disc_packed_hunk_t *hunks;
+  uint64_t image;
+} disc_file_t;
+
+disc_file_t disc_files[DISC_MAX_FILES];
+int disc_file_count;
+
+uint8_t *disc_ring_data;
+ring_t disc_ring;
+pthread_t disc_thread;
+sem_t disc_wake;
+_Atomic int disc_stop;
+_Atomic uint32_t disc_request_lba;
+_Atomic uint32_t disc_generation;
+
+void disc_map(const char *path) {
+  if(disc_file_count == DISC_MAX_FILES) {
+    printf("Too many files in disc image\n");
+    exit(1);
+  }
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if(fd < 0 || fstat(fd, &st) < 0 || st.st_size < DISC_SECTOR_SIZE) {
+    printf("Failed to open disc image: %s\n", path);
+    exit(1);
+  }
+  uint8_t *data = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED) {
+    printf("Failed to map disc image: %s\n", path);
+    exit(1);
+  }
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+  disc_file_t *file = &disc_files[disc_file_count++];
+  file->data = data;
+  file->size = st.st_size;
+  file->first_lba = disc_sectors;
+  file->sectors = st.st_size / DISC_SECTOR_SIZE;
+  disc_packed_header_t *header = (disc_packed_header_t *)data;
+  if(header->magic == DISC_PACKED_MAGIC) {
+    // The hunk table has to fit in the file and cover every sector
+    if(header->version != DISC_PACKED_VERSION || !header->hunk_sectors || header->track_count > DISC_MAX_TRACKS ||
+       sizeof(disc_packed_header_t) + (uint64_t)header->hunk_count * sizeof(disc_packed_hunk_t) > file->size ||
+       header->sectors > (uint64_t)header->hunk_count * header->hunk_sectors) {
+      printf("Unsupported packed disc image: %s\n", path);
+      exit(1);
+    }
+    file->header = header;
+    file->hunks = (disc_packed_hunk_t *)(header + 1);
+    file->sectors = header->sectors;
+    // Keyed by the file itself so every open of the same image shares hunks
+    uint64_t id[2] = {st.st_dev, st.st_ino};
+    file->image = hash_bytes(id, sizeof(id), HASH_SEED);
+    madvise(data, st.st_size, MADV_RANDOM);
+  }
+  disc_sectors += file->sectors;
+}
+
+void disc_decompress(disc_file_t *file, uint32_t hunk, uint8_t *out, uint32_t size) {
+  disc_packed_hunk_t *entry = &file->hunks[hunk];
+  int ok = hunk < file->header->hunk_count && entry->offset <= file->size && entry->length <= file->size - entry->offset;
+  if(ok) {
+    const uint8_t *in = file->data + entry->offset;
+    switch(entry->codec) {
+      case DISC_CODEC_STORED:
+        ok = entry->length == size;
+        if(ok) memcpy(out, in, size);
+        break;
+      case DISC_CODEC_ZLIB: {
+        uLongf length = size;
+        ok = uncompress(out, &length, in, entry->length) == Z_OK && length == size;
+        break;
+      }
+      case DISC_CODEC_LZMA: {
+        uint64_t limit = UINT64_MAX;
+        size_t in_position = 0, out_position = 0;
+        ok = lzma_stream_buffer_decode(&limit, 0, 0, in, &in_position, entry->length, out, &out_position, size) == LZMA_OK && out_position == size;
+        break;
+      }
+      default:
+        ok = 0;
+    }
+  }
+  if(!ok) {
+    printf("Corrupt hunk %u in packed disc image\n", hunk);
+    exit(1);
+  }
+}
+
+void disc_copy_packed(disc_file_t *file, uint32_t index, uint8_t *sector) {
+  uint32_t hunk_sectors = file->header->hunk_sectors;
+  uint32_t hunk = index / hunk_sectors;
+  uint32_t offset = (index % hunk_sectors) * DISC_SECTOR_SIZE;
+  if(index >= file->sectors || hunk >= file->header->hunk_count) {
+    printf("Sector %u is outside the packed disc image\n", index);
+    exit(1);
+  }
+  if(disc_cache_read(file->image, hunk, offset, DISC_SECTOR_SIZE, sector)) return;
+  // The last hunk may be short
+  uint32_t sectors = file->sectors - hunk * hunk_sectors;
+  if(sectors > hunk_sectors) sectors = hunk_sectors;
+  uint8_t *data = malloc(sectors * DISC_SECTOR_SIZE);
+  disc_decompress(file, hunk, data, sectors * DISC_SECTOR_SIZE);
+  memcpy(sector, data + offset, DISC_SECTOR_SIZE);
+  disc_cache_insert(file->image, hunk, data, sectors * DISC_SECTOR_SIZE);
+}
+
+// Enough of the CUE format for PlayStation rips: FILE, TRACK and INDEX 01
+void disc_parse_cue(const char *path) {
+  FILE *cue = fopen(path, "r");
+  if(!cue) {
+    printf("Failed to open cue sheet: %s\n", path);
+    exit(1);
+  }
+  char directory[4096] = "";
+  const char *slash = strrchr(path, '/');
+  if(slash) snprintf(directory, sizeof(directory), "%.*s", (int)(slash - path + 1), path);
+
+  char line[4096];
+  while(fgets(line, sizeof(line), cue)) {
+    char *p = line;
+    while(isspace(*p)) p++;
+    if(!strncmp(p, "FILE", 4)) {
+      char name[2048], full[8192];
+      char *start = strchr(p, '"');
+      char *end = start ? strchr(start + 1, '"') : 0;
+      if(start && end)
+        snprintf(name, sizeof(name), "%.*s", (int)(end - start - 1), start + 1);
+      else if(sscanf(p + 4, "%2047s", name) != 1)
+        continue;
+      snprintf(full, sizeof(full), "%s%s", name[0] == '/' ? "" : directory, name);
+      disc_map(full);
+    } else if(!strncmp(p, "TRACK", 5)) {
+      int track;
+      char mode[32];
+      if(sscanf(p + 5, "%d %31s", &track, mode) != 2 || track < 1 || track > DISC_MAX_TRACKS) continue;
+      if(strcmp(mode, "AUDIO") && !strstr(mode, "/2352")) {
+        printf("Unsupported track mode in cue sheet: %s\n", mode);
+        exit(1);
+      }
+      disc_track_count = track;
+      disc_track_audio[track] = !strcmp(mode, "AUDIO");
+    } else if(!strncmp(p, "INDEX", 5) && disc_file_count) {
+      int index, m, s, f;
+      if(sscanf(p + 5, "%d %d:%d:%d", &index, &m, &s, &f) != 4 || index != 1) continue;
+      disc_track_start[disc_track_count] = disc_files[disc_file_count - 1].first_lba + (m * 60 + s) * 75 + f;
+    }
+  }
+  fclose(cue);
+  if(!disc_file_count || !disc_track_count) {
+    printf("No tracks in cue sheet: %s\n", path);
+    exit(1);
+  }
+}
+
+// Safe to call from any thread
+void disc_copy(uint32_t lba, uint8_t *sector) {
+  for(int n = 0; n < disc_file_count; n++) {
+    disc_file_t *file = &disc_files[n];
+    if(lba >= file->first_lba && lba < file->first_lba + file->sectors) {
+      if(file->header)
+        disc_copy_packed(file, lba - file->first_lba, sector);
+      else
+        memcpy(sector, file->data + (size_t)(lba - file->first_lba) * DISC_SECTOR_SIZE, DISC_SECTOR_SIZE);
+      return;
+    }
+  }
+  memset(sector, 0, DISC_SECTOR_SIZE);
+}
+
+void *disc_read_ahead(void *arg) {
+  uint8_t sector[DISC_SECTOR_SIZE];
+  uint32_t generation = ~0u;
+  uint32_t lba = 0;
+  while(!atomic_load(&disc_stop)) {
+    uint32_t current = atomic_load(&disc_generation);
+    if(current != generation) {
+      generation = current;
+      lba = atomic_load(&disc_request_lba);
+    }
+    if(lba < disc_sectors && ring_free(&disc_ring) >= DISC_ENTRY_SIZE) {
+      disc_copy(lba, sector);
+      // The consumer only reads whole entries, so two writes are fine
+      ring_write(&disc_ring, &lba, 4);
+      ring_write(&disc_ring, sector, DISC_SECTOR_SIZE);
+      lba++;
+      continue;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += 100000000;
+    if(ts.tv_nsec >= 1000000000) { ts.tv_sec++; ts.tv_nsec -= 1000000000; }
+    sem_timedwait(&disc_wake, &ts);
+  }
+  return(0);
+}
+
+void disc_open(const char *path) {
+  size_t length = strlen(path);
+  if(length > 4 && !strcasecmp(path + length - 4, ".cue")) {
+    disc_parse_cue(path);
+  } else {
+    disc_map(path);
+    disc_packed_header_t *header = disc_files[0].header;
+    if(header) {
+      disc_track_count = header->track_count;
+      memcpy(disc_track_start, header->track_start, sizeof(disc_track_start));
+      memcpy(disc_track_audio, header->track_audio, sizeof(disc_track_audio));
+    } else {
+      // A bare image is treated as a single data track
+      disc_track_count = 1;
+      disc_track_start[1] = 0;
+    }
+  }
+  disc_ring_data = malloc(DISC_RING_SIZE);
+  ring_init(&disc_ring, disc_ring_data, DISC_RING_SIZE);
+  sem_init(&disc_wake, 0, 0);
+  pthread_create(&disc_thread, 0, disc_read_ahead, 0);
+  disc_loaded = 1;
+  atexit(disc_close);
+}
+
+// Point the read-ahead at a new position, entries already queued for the
+// old position are discarded as they are read
+void disc_seek(uint32_t lba) {
+  if(!disc_loaded) return;
+  atomic_store(&disc_request_lba, lba);
+  atomic_fetch_add(&disc_generation, 1);
+  sem_post(&disc_wake);
+}
+
+void disc_read(uint32_t lba, uint8_t *sector) {
+  uint32_t entry;
+  while(ring_used(&disc_ring) >= DISC_ENTRY_SIZE) {
+    ring_read(&disc_ring, &entry, 4);
+    ring_read(&disc_ring, sector, DISC_SECTOR_SIZE);
+    sem_post(&disc_wake);
+    if(entry == lba) return;
+  }
+  // Not prefetched yet, copy it here and restart the read-ahead behind it
+  disc_stalls++;
+  disc_copy(lba, sector);
+  disc_seek(lba + 1);
+}
+
+void disc_close() {
+  if(!disc_loaded) return;
+  atomic_store(&disc_stop, 1);
+  sem_post(&disc_wake);
+  pthread_join(disc_thread, 0);
+  disc_loaded = 0;
+}
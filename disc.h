@@ -0,0 +1,49 @@
+#ifndef DISC_H
+#define DISC_H
+
+#include <stdint.h>
+
+#define DISC_SECTOR_SIZE 2352
+#define DISC_MAX_TRACKS  99
+
+// Packed images: a header, an index with one entry per hunk of
+// hunk_sectors raw sectors, then the hunks, each compressed on its own
+#define DISC_PACKED_MAGIC   0x5a535031
+#define DISC_PACKED_VERSION 1
+
+#define DISC_CODEC_STORED 0
+#define DISC_CODEC_ZLIB   1
+#define DISC_CODEC_LZMA   2
+
+typedef struct __attribute__((packed)) disc_packed_header_t {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t sectors;
+  uint32_t hunk_sectors;
+  uint32_t hunk_count;
+  uint32_t track_count;
+  uint32_t track_start[DISC_MAX_TRACKS + 1];
+  uint8_t track_audio[DISC_MAX_TRACKS + 1];
+} disc_packed_header_t;
+
+typedef struct __attribute__((packed)) disc_packed_hunk_t {
+  uint64_t offset;
+  uint32_t length;
+  uint32_t codec;
+} disc_packed_hunk_t;
+
+extern int disc_loaded;
+extern uint32_t disc_sectors;
+extern int disc_track_count;
+// Track start LBAs, indexed from 1, LBA 0 is MSF 00:02:00
+extern uint32_t disc_track_start[DISC_MAX_TRACKS + 1];
+extern uint8_t disc_track_audio[DISC_MAX_TRACKS + 1];
+extern uint64_t disc_stalls;
+
+void disc_open(const char *path);
+void disc_seek(uint32_t lba);
+void disc_read(uint32_t lba, uint8_t *sector);
+void disc_copy(uint32_t lba, uint8_t *sector);
+void disc_close();
+
+#endif
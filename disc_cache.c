@@ -0,0 +1,116 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "disc_cache.h"
+
+// Decompressed hunks, shared by every image open in the process. Images are
+// identified by the file rather than by whoever opened them, so instances
+// playing the same disc share hunks. A single lock covers the table and the
+// LRU list, hits only hold it for the copy out.
+#define DISC_CACHE_BUCKETS 4096
+
+typedef struct disc_cache_entry_t {
+  uint64_t image;
+  uint32_t hunk;
+  uint32_t size;
+  uint8_t *data;
+  struct disc_cache_entry_t *hash_next;
+  struct disc_cache_entry_t *lru_prev, *lru_next;
+} disc_cache_entry_t;
+
+disc_cache_entry_t *disc_cache_table[DISC_CACHE_BUCKETS];
+// Most recently used at the head
+disc_cache_entry_t *disc_cache_head, *disc_cache_tail;
+size_t disc_cache_bytes;
+size_t disc_cache_max = DISC_CACHE_DEFAULT;
+pthread_mutex_t disc_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+uint64_t disc_cache_hits;
+uint64_t disc_cache_misses;
+
+uint32_t disc_cache_bucket(uint64_t image, uint32_t hunk) {
+  uint64_t key = (image ^ hunk) * 0x9e3779b97f4a7c15ull;
+  return(key >> 52);
+}
+
+void disc_cache_unlink(disc_cache_entry_t *entry) {
+  if(entry->lru_prev) entry->lru_prev->lru_next = entry->lru_next;
+  else disc_cache_head = entry->lru_next;
+  if(entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+  else disc_cache_tail = entry->lru_prev;
+}
+
+void disc_cache_push(disc_cache_entry_t *entry) {
+  entry->lru_prev = 0;
+  entry->lru_next = disc_cache_head;
+  if(disc_cache_head) disc_cache_head->lru_prev = entry;
+  else disc_cache_tail = entry;
+  disc_cache_head = entry;
+}
+
+disc_cache_entry_t *disc_cache_find(uint64_t image, uint32_t hunk) {
+  disc_cache_entry_t *entry = disc_cache_table[disc_cache_bucket(image, hunk)];
+  while(entry && (entry->image != image || entry->hunk != hunk))
+    entry = entry->hash_next;
+  return(entry);
+}
+
+void disc_cache_evict() {
+  while(disc_cache_bytes > disc_cache_max && disc_cache_tail) {
+    disc_cache_entry_t *entry = disc_cache_tail;
+    disc_cache_unlink(entry);
+    disc_cache_entry_t **link = &disc_cache_table[disc_cache_bucket(entry->image, entry->hunk)];
+    while(*link != entry) link = &(*link)->hash_next;
+    *link = entry->hash_next;
+    disc_cache_bytes -= entry->size;
+    free(entry->data);
+    free(entry);
+  }
+}
+
+void disc_cache_limit(size_t bytes) {
+  pthread_mutex_lock(&disc_cache_lock);
+  disc_cache_max = bytes;
+  disc_cache_evict();
+  pthread_mutex_unlock(&disc_cache_lock);
+}
+
+// Copies part of a cached hunk, returns 0 if the hunk is not cached
+int disc_cache_read(uint64_t image, uint32_t hunk, uint32_t offset, uint32_t length, uint8_t *dest) {
+  pthread_mutex_lock(&disc_cache_lock);
+  disc_cache_entry_t *entry = disc_cache_find(image, hunk);
+  if(entry) {
+    memcpy(dest, entry->data + offset, length);
+    disc_cache_unlink(entry);
+    disc_cache_push(entry);
+    disc_cache_hits++;
+  } else {
+    disc_cache_misses++;
+  }
+  pthread_mutex_unlock(&disc_cache_lock);
+  return(entry != 0);
+}
+
+// Takes ownership of data, which must come from malloc
+void disc_cache_insert(uint64_t image, uint32_t hunk, uint8_t *data, uint32_t size) {
+  pthread_mutex_lock(&disc_cache_lock);
+  if(disc_cache_find(image, hunk)) {
+    // Another thread decompressed the same hunk first
+    pthread_mutex_unlock(&disc_cache_lock);
+    free(data);
+    return;
+  }
+  disc_cache_entry_t *entry = malloc(sizeof(disc_cache_entry_t));
+  entry->image = image;
+  entry->hunk = hunk;
+  entry->size = size;
+  entry->data = data;
+  uint32_t bucket = disc_cache_bucket(image, hunk);
+  entry->hash_next = disc_cache_table[bucket];
+  disc_cache_table[bucket] = entry;
+  disc_cache_push(entry);
+  disc_cache_bytes += size;
+  disc_cache_evict();
+  pthread_mutex_unlock(&disc_cache_lock);
+}
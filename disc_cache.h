@@ -0,0 +1,16 @@
+#ifndef DISC_CACHE_H
+#define DISC_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DISC_CACHE_DEFAULT (64 * 1024 * 1024)
+
+extern uint64_t disc_cache_hits;
+extern uint64_t disc_cache_misses;
+
+void disc_cache_limit(size_t bytes);
+int disc_cache_read(uint64_t image, uint32_t hunk, uint32_t offset, uint32_t length, uint8_t *dest);
+void disc_cache_insert(uint64_t image, uint32_t hunk, uint8_t *data, uint32_t size);
+
+#endif
@@ -4,9 +4,18 @@
 #include "dma.h"
 #include "memory.h"
 #include "gpu.h"
+#include "interrupt.h"
+#include "cdrom.h"
+#include "spu.h"
+#include "mdec.h"
+#include "trace.h"
+#include "telemetry.h"
 
 extern uint8_t ram[];
 
+// Bytes moved per channel, for telemetry
+uint64_t dma_bytes[DMA_CHANNELS];
+
 struct __attribute__((packed)) {
   struct __attribute__((packed)) {
     uint32_t base_address;
@@ -87,37 +96,78 @@ void dma_reset() {
   dma.control_32 = 0x07654321;
 }
 
+// The master flag is derived from the others, the IRQ fires on its rising edge
+void dma_update_irq() {
+  uint32_t enabled = (dma.interrupt_32 >> 16) & 0x7f;
+  uint32_t flags = (dma.interrupt_32 >> 24) & 0x7f;
+  int master = dma.interrupt.force_irq || (dma.interrupt.irq_master_enable && (enabled & flags));
+  if(master && !dma.interrupt.irq_master_flag)
+    interrupt_request(IRQ_DMA);
+  dma.interrupt.irq_master_flag = master;
+}
+
+void dma_complete(int channel) {
+  dma.channels[channel].control.start_trigger = 0;
+  dma.channels[channel].control.start_busy = 0;
+  if(dma.interrupt_32 & (1 << (16 + channel))) {
+    dma.interrupt_32 |= 1 << (24 + channel);
+    dma_update_irq();
+  }
+}
+
+void mdec_in_dma_transfer() {
+  uint32_t address = dma.channels[0].base_address & 0x1ffffc;
+  uint32_t words = dma.channels[0].blocksize;
+  if(dma.channels[0].control.sync_mode == 1)
+    words *= dma.channels[0].blocks;
+  else if(words == 0)
+    words = 0x10000;
+  dma_bytes[0] += words * 4;
+  while(words--) {
+    mdec_write(*(uint32_t*)(ram + address));
+    address = (address + 4) & 0x1ffffc;
+  }
+  mdec_flush();
+  dma_complete(0);
+}
+
+// Completed by the MDEC once the decoded data has been copied out
+void mdec_out_dma_transfer() {
+  uint32_t words = dma.channels[1].blocksize;
+  if(dma.channels[1].control.sync_mode == 1)
+    words *= dma.channels[1].blocks;
+  else if(words == 0)
+    words = 0x10000;
+  dma_bytes[1] += words * 4;
+  mdec_dma_out(dma.channels[1].base_address & 0x1ffffc, words);
+}
+
 void otc_dma_transfer() {
   if(dma.channels[6].control_32 == 0x11000002) {
-    //printf("DMA OTC transfer starting!\n");
     uint32_t words = dma.channels[6].words - 1;
+    dma_bytes[6] += (words + 1) * 4;
     uint32_t address = dma.channels[6].base_address & 0x1fffff;
     uint32_t end_address = address - words * 4;
+    ram_written(end_address, (words + 1) * 4);
     while(address > end_address) {
       *(uint32_t*)(ram + address) = address - 4;
-      //printf("Setting %08x to %08x\n", address, address-4);
       address -= 4;
     }
     *(uint32_t*)(ram + address) = 0xffffff;
-    //printf("Setting %08x to %08x\n", address, 0xffffff);
   } else {
     printf("Unexpected DMA options for OTC transfer!\n");
     exit(1);
   }
-  dma.channels[6].control.start_trigger = 0;
-  dma.channels[6].control.start_busy = 0;
-  //printf("dma transfer complete!\n");
+  dma_complete(6);
 }
 
 void gpu_dma_transfer() {
   if(dma.channels[2].control_32 == 0x01000401) {
-    //printf("DMA GPU (linked list) transfer starting!\n");
     uint32_t address = dma.channels[2].base_address & 0x1fffff;
-    //printf("Base: %08x\n", address);
     while(1) {
       uint32_t header = *(uint32_t*)(ram + address);
-      //printf("Address: %08x Header: %08x\n", address, header);
       uint32_t packet_size = header >> 24;
+      dma_bytes[2] += (packet_size + 1) * 4;
       for(uint32_t n=0; n<packet_size*4; n+=4) {
         uint32_t command = *(uint32_t*)(ram + address + n + 4);
         gpu_gp0(command);
@@ -127,11 +177,10 @@ void gpu_dma_transfer() {
       address = header & 0x1fffff;
     }
   } else if (dma.channels[2].control_32 == 0x01000201) {
-    //printf("DMA GPU (sequential) transfer starting!\n");
     uint32_t address = dma.channels[2].base_address & 0x1fffff;
     uint32_t words = dma.channels[2].blocksize * dma.channels[2].blocks;
+    dma_bytes[2] += words * 4;
     uint32_t end_address = address + words * 4;
-    //printf("info: %08x %08x\n", words, address);
     while(address < end_address) {
       uint32_t command = *(uint32_t*)(ram + address);
       gpu_gp0(command);
@@ -141,9 +190,46 @@ void gpu_dma_transfer() {
     printf("Unexpected DMA options for GPU transfer: %08x\n", dma.channels[2].control_32);
     exit(1);
   }
-  dma.channels[2].control.start_trigger = 0;
-  dma.channels[2].control.start_busy = 0;
-  //printf("dma transfer complete!\n");
+  dma_complete(2);
+}
+
+void cdrom_dma_transfer() {
+  if(dma.channels[3].control.direction) {
+    printf("Unexpected DMA options for CDROM transfer: %08x\n", dma.channels[3].control_32);
+    exit(1);
+  }
+  uint32_t address = dma.channels[3].base_address & 0x1ffffc;
+  uint32_t words = dma.channels[3].blocksize;
+  if(dma.channels[3].control.sync_mode == 1)
+    words *= dma.channels[3].blocks;
+  else if(words == 0)
+    words = 0x10000;
+  dma_bytes[3] += words * 4;
+  ram_written(address, words * 4);
+  while(words--) {
+    *(uint32_t*)(ram + address) = cdrom_dma_read();
+    address = (address + 4) & 0x1ffffc;
+  }
+  dma_complete(3);
+}
+
+void spu_dma_transfer() {
+  uint32_t address = dma.channels[4].base_address & 0x1ffffc;
+  uint32_t words = dma.channels[4].blocksize;
+  if(dma.channels[4].control.sync_mode == 1)
+    words *= dma.channels[4].blocks;
+  else if(words == 0)
+    words = 0x10000;
+  dma_bytes[4] += words * 4;
+  if(!dma.channels[4].control.direction) ram_written(address, words * 4);
+  while(words--) {
+    if(dma.channels[4].control.direction)
+      spu_dma_write(*(uint32_t*)(ram + address));
+    else
+      *(uint32_t*)(ram + address) = spu_dma_read();
+    address = (address + 4) & 0x1ffffc;
+  }
+  dma_complete(4);
 }
 
 void dummy_dma_transfer() {
@@ -152,35 +238,36 @@ void dummy_dma_transfer() {
 }
 
 void (*dma_transfer[256])() = {
-  dummy_dma_transfer,
-  dummy_dma_transfer,
+  mdec_in_dma_transfer,
+  mdec_out_dma_transfer,
   gpu_dma_transfer,
-  dummy_dma_transfer,
-  dummy_dma_transfer,
+  cdrom_dma_transfer,
+  spu_dma_transfer,
   dummy_dma_transfer,
   otc_dma_transfer
 };
 
 void dma_store_32(uint32_t address, uint32_t value) {
   uint32_t reg = address - 0x1F801080;
+  if(reg == 0x74) {
+    // Writing 1 to a DICR flag acknowledges it
+    uint32_t flags = (dma.interrupt_32 & ~value) & 0x7f000000;
+    dma.interrupt_32 = (dma.interrupt_32 & 0x80000000) | (value & 0x00ff803f) | flags;
+    dma_update_irq();
+    return;
+  }
   *(uint32_t*)((uint8_t*)&dma + reg) = value;
 
-  // printf("Writing %08X to offset %02X\n", value, reg);
-  // for(int i=0; i<8; i++) {
-  //   for(int j=0; j<4; j++) {
-  //     printf("%08X ", ((uint32_t*)&dma)[i*4+j]);
-  //   }
-  //   printf("\n");
-  // }
-  // printf("\n");
-
   uint8_t channel = reg >> 4;
   if(channel < 7) {
     uint8_t trigger = dma.channels[channel].control.start_trigger;
     uint8_t enabled = dma.channels[channel].control.start_busy;
     uint8_t sync_mode = dma.channels[channel].control.sync_mode;
     if(enabled && (trigger || sync_mode)) {
+      TRACE_EVENT(TRACE_DMA, channel, dma.channels[channel].base_address, dma.channels[channel].control_32);
+      uint64_t start = telemetry_now();
       dma_transfer[channel]();
+      telemetry_dma_ns += telemetry_now() - start;
     }
   }
 }
@@ -1,6 +1,13 @@
 #ifndef DMA_H
 #define DMA_H
 
+#include <stdint.h>
+
+#define DMA_CHANNELS 7
+
+extern uint64_t dma_bytes[DMA_CHANNELS];
+
 void dma_reset();
+void dma_complete(int channel);
 
 #endif
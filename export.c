@@ -0,0 +1,68 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "export.h"
+#include "gpu.h"
+
+int exporting;
+
+export_header_t *export_header;
+uint8_t *export_base;
+char export_name[256];
+
+void export_close() {
+  shm_unlink(export_name);
+}
+
+// Moves vram into a POSIX shared memory segment so other processes can map it
+void export_open(const char *name) {
+  snprintf(export_name, sizeof(export_name), "%s%s", name[0] == '/' ? "" : "/", name);
+  int fd = shm_open(export_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0 || ftruncate(fd, EXPORT_SIZE) < 0) {
+    printf("Failed to create shared memory export: %s\n", export_name);
+    exit(1);
+  }
+  export_base = mmap(0, EXPORT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(export_base == MAP_FAILED) {
+    printf("Failed to map shared memory export: %s\n", export_name);
+    exit(1);
+  }
+  atexit(export_close);
+
+  export_header = (export_header_t *)export_base;
+  export_header->version = EXPORT_VERSION;
+  export_header->vram_offset = EXPORT_HEADER_SIZE;
+  export_header->frame_offset[0] = EXPORT_HEADER_SIZE + EXPORT_VRAM_SIZE;
+  export_header->frame_offset[1] = EXPORT_HEADER_SIZE + EXPORT_VRAM_SIZE + EXPORT_FRAME_SIZE;
+  export_header->frame_size = EXPORT_FRAME_SIZE;
+  atomic_store(&export_header->sequence, 0);
+
+  memcpy(export_base + EXPORT_HEADER_SIZE, vram, EXPORT_VRAM_SIZE);
+  vram = export_base + EXPORT_HEADER_SIZE;
+  // Publish the magic last so readers never see a half initialised header
+  atomic_thread_fence(memory_order_release);
+  export_header->magic = EXPORT_MAGIC;
+  exporting = 1;
+}
+
+// The back buffer, which readers never look at until export_end_frame flips it
+uint8_t *export_begin_frame() {
+  return(export_base + export_header->frame_offset[export_header->frame_index ^ 1]);
+}
+
+void export_end_frame(uint32_t width, uint32_t height, uint32_t format) {
+  uint32_t sequence = atomic_load_explicit(&export_header->sequence, memory_order_relaxed);
+  atomic_store_explicit(&export_header->sequence, sequence + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  export_header->frame_index ^= 1;
+  export_header->frame_width = width;
+  export_header->frame_height = height;
+  export_header->frame_format = format;
+  export_header->frame_number++;
+  atomic_store_explicit(&export_header->sequence, sequence + 2, memory_order_release);
+}
@@ -0,0 +1,47 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Shared memory layout for external viewers. The segment starts with this
+// header, followed by the live 1 MB VRAM and two display frame buffers.
+//
+// The display frame is published with a seqlock: read sequence (retry while
+// odd), read frame_index and the frame, then re-read sequence and retry if
+// it changed. VRAM is the emulator's own working copy, so it is always live;
+// sequence only tells a reader whether a frame boundary passed meanwhile.
+#define EXPORT_MAGIC   0x58505331 // "1SPX"
+#define EXPORT_VERSION 1
+
+#define EXPORT_VRAM_SIZE  (1024 * 1024)
+#define EXPORT_FRAME_SIZE (1024 * 1024)
+
+#define EXPORT_FORMAT_RGB555 0
+#define EXPORT_FORMAT_RGB888 1
+
+typedef struct export_header_t {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t vram_offset;
+  uint32_t frame_offset[2];
+  uint32_t frame_size;
+  _Atomic uint32_t sequence;
+  uint32_t frame_index;
+  uint32_t frame_width;
+  uint32_t frame_height;
+  uint32_t frame_format;
+  uint32_t reserved;
+  uint64_t frame_number;
+} export_header_t;
+
+#define EXPORT_HEADER_SIZE 4096
+#define EXPORT_SIZE (EXPORT_HEADER_SIZE + EXPORT_VRAM_SIZE + 2 * EXPORT_FRAME_SIZE)
+
+extern int exporting;
+
+void export_open(const char *name);
+uint8_t *export_begin_frame();
+void export_end_frame(uint32_t width, uint32_t height, uint32_t format);
+
+#endif
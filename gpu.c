@@ -1,9 +1,29 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include "memory.h"
+#include "gpu.h"
+#include "gpu_raster.h"
+#include "gpu_capture.h"
+#include "scheduler.h"
+#include "pacing.h"
+#include "record.h"
+#include "export.h"
+#include "interrupt.h"
+#include "timers.h"
+#include "audio.h"
+#include "input.h"
+#include "movie.h"
+#include "trace.h"
+#include "telemetry.h"
+#include "gpu_stats.h"
+#include "latency.h"
+#include "search.h"
+#include "debug.h"
+#include "hash.h"
 
 #include <GL/glew.h>
 #include <SDL2/SDL.h>
@@ -118,18 +138,12 @@ void gpu_reset() {
   gpu.draw_pixels         = 0;
 }
 
-struct __attribute__((packed)) vertex {
-  uint32_t position;
-  uint32_t color;
-  uint32_t texture_uv;
-  uint16_t texpage;
-  uint16_t clut;
-};
-
 struct vertex vertices[1024 * 1024];
 uint32_t vertices_count;
 
-uint8_t vram[1024*1024];
+uint8_t gpu_vram[1024*1024];
+// Points at gpu_vram, or into a shared memory segment when exported
+uint8_t *vram = gpu_vram;
 char vertex_shader_source[1024*1024];
 char fragment_shader_source[1024*1024];
 
@@ -140,6 +154,9 @@ GLuint program;
 
 SDL_Window *Window;
 
+// Headless instances have no window and draw into vram with the software rasterizer
+int gpu_headless;
+
 void printStatus(const char *step, GLuint context, GLuint status)
 {
   GLint result = GL_FALSE;
@@ -165,13 +182,49 @@ void printLinkStatus(const char *step, GLuint context)
   printStatus(step, context, GL_LINK_STATUS);
 }
 
+// Video timing in GPU clocks, the GPU runs at 11/7 of the CPU clock
+#define GPU_NTSC_LINES       263
+#define GPU_NTSC_LINE_CLOCKS 3413
+#define GPU_PAL_LINES        314
+#define GPU_PAL_LINE_CLOCKS  3406
+
+uint64_t gpu_vblank_cycles;
+
+uint64_t gpu_frame_cycles() {
+  if(gpu.video_mode)
+    return((uint64_t)GPU_PAL_LINES * GPU_PAL_LINE_CLOCKS * 7 / 11);
+  return((uint64_t)GPU_NTSC_LINES * GPU_NTSC_LINE_CLOCKS * 7 / 11);
+}
+
+// GPU clocks per scanline, the hblank source for root counter 1
+uint32_t gpu_line_clocks() {
+  return(gpu.video_mode ? GPU_PAL_LINE_CLOCKS : GPU_NTSC_LINE_CLOCKS);
+}
+
+// GPU clocks per dot at the current horizontal resolution, for root counter 0
+uint32_t gpu_dotclock_divider() {
+  static const uint8_t dividers[4] = { 10, 8, 5, 4 };
+  return(gpu.horz_res_2 ? 7 : dividers[gpu.horz_res_1]);
+}
+
 void gpu_init() {
   // for(int n=0; n<1024*1024; n++)
   //   vram[n] = rand();
 
+  raster_init();
+  gpu_vblank_cycles = scheduler_cycles + gpu_frame_cycles();
+  scheduler_schedule(SCHEDULER_VBLANK, gpu_vblank_cycles, gpu_vblank);
+  if(gpu_headless) {
+    gpu_reset();
+    return;
+  }
+
   uint32_t WindowFlags = SDL_WINDOW_OPENGL;
   Window = SDL_CreateWindow("OpenGL Test", 0, 0, 1280, 960, WindowFlags);
   SDL_GL_CreateContext(Window);
+  // Pacing is done against emulated VBlank, not the host display
+  SDL_GL_SetSwapInterval(0);
+  audio_init();
 
   glewExperimental = GL_TRUE;
   glewInit();
@@ -246,8 +299,212 @@ uint8_t gp0_offset;
 
 extern SDL_Window *Window;
 
+// Running totals for telemetry
+uint64_t gpu_gp0_words;
+uint64_t gpu_primitives;
+uint64_t gpu_vram_upload_bytes;
+
+// Called once per completed primitive
+void gpu_rasterize(uint32_t count) {
+  gpu_primitives++;
+  gpu_stats_primitive(gp0_buffer[0], count);
+  if(!gpu_headless || pacing_skip) return;
+  raster_state_t state = {
+    .draw_area_left      = gpu.draw_area_left,
+    .draw_area_top       = gpu.draw_area_top,
+    .draw_area_right     = gpu.draw_area_right,
+    .draw_area_bottom    = gpu.draw_area_bottom,
+    .draw_offset_x       = (int16_t)(gpu.draw_offset_x << 5) >> 5,
+    .draw_offset_y       = (int16_t)(gpu.draw_offset_y << 5) >> 5,
+    .semi_transparency   = gpu.semi_transparency,
+    .dither              = gpu.dither_24_15,
+    .set_mask_bit        = gpu.set_mask_bit,
+    .check_mask_bit      = gpu.draw_pixels,
+    .tex_window_mask_x   = gpu.tex_window_mask_x,
+    .tex_window_mask_y   = gpu.tex_window_mask_y,
+    .tex_window_offset_x = gpu.tex_window_offset_x,
+    .tex_window_offset_y = gpu.tex_window_offset_y,
+  };
+  for(uint32_t n = 0; n < count; n += 3)
+    raster_triangle(&state, gp0_buffer[0], &vertices[vertices_count + n]);
+}
+
+uint32_t gpu_display_width() {
+  static const uint16_t widths[4] = { 256, 320, 512, 640 };
+  return(gpu.horz_res_2 ? 368 : widths[gpu.horz_res_1]);
+}
+
+uint32_t gpu_display_height() {
+  return(gpu.vert_res && gpu.vert_interlace ? 480 : 240);
+}
+
+// Copy the display area out of vram, packed at 2 or 3 bytes per pixel
+void gpu_copy_display(uint8_t *buffer) {
+  uint32_t height = gpu_display_height();
+  uint32_t bytes = gpu_display_width() * (gpu.color_depth ? 3 : 2);
+  uint32_t x = gpu.start_display_x * 2;
+  uint32_t first = x + bytes > 2048 ? 2048 - x : bytes;
+  for(uint32_t y = 0; y < height; y++) {
+    uint8_t *row = vram + ((gpu.start_display_y + y) & 511) * 2048;
+    memcpy(buffer + y * bytes, row + x, first);
+    memcpy(buffer + y * bytes + first, row, bytes - first);
+  }
+}
+
+// The window is read back through a ring of pixel buffers, so each read
+// runs on the GPU while the next frame is emulated and is only mapped and
+// copied out a frame later
+#define GPU_RECORD_BUFFERS 2
+#define GPU_RECORD_BYTES (RECORD_MAX_WIDTH * RECORD_MAX_HEIGHT * 4)
+
+GLuint gpu_record_buffers[GPU_RECORD_BUFFERS];
+uint64_t gpu_record_ns[GPU_RECORD_BUFFERS];
+uint32_t gpu_record_reads, gpu_record_copies;
+
+// Hand the oldest pending read to the writer thread
+void gpu_record_copy() {
+  uint32_t n = gpu_record_copies++ % GPU_RECORD_BUFFERS;
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, gpu_record_buffers[n]);
+  uint8_t *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, GPU_RECORD_BYTES, GL_MAP_READ_BIT);
+  if(pixels) {
+    uint8_t *buffer = record_begin_frame(RECORD_MAX_WIDTH, RECORD_MAX_HEIGHT, RECORD_RGBA_FLIP, gpu_record_ns[n]);
+    if(buffer) {
+      memcpy(buffer, pixels, GPU_RECORD_BYTES);
+      record_end_frame();
+    }
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+// Copy out every pending read, before a repeated frame and at exit
+void gpu_record_flush() {
+  while(gpu_record_copies != gpu_record_reads) gpu_record_copy();
+}
+
+// Copy the displayed frame into a recording buffer, the writer thread does the rest
+void gpu_record() {
+  uint64_t frame_ns = gpu_frame_cycles() * 1000000000 / CPU_CLOCK;
+  if(!gpu_headless) {
+    if(!gpu_record_buffers[0]) {
+      glGenBuffers(GPU_RECORD_BUFFERS, gpu_record_buffers);
+      for(int n = 0; n < GPU_RECORD_BUFFERS; n++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, gpu_record_buffers[n]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, GPU_RECORD_BYTES, 0, GL_STREAM_READ);
+      }
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      // Runs before record_close, registered earlier
+      atexit(gpu_record_flush);
+    }
+    uint32_t n = gpu_record_reads++ % GPU_RECORD_BUFFERS;
+    gpu_record_ns[n] = frame_ns;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, gpu_record_buffers[n]);
+    glReadPixels(0, 0, RECORD_MAX_WIDTH, RECORD_MAX_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    // The previous frame's read has had a whole frame to finish
+    if(gpu_record_reads - gpu_record_copies > 1) gpu_record_copy();
+    return;
+  }
+  uint8_t *buffer = record_begin_frame(gpu_display_width(), gpu_display_height(), gpu.color_depth ? RECORD_RGB888 : RECORD_RGB555, frame_ns);
+  if(!buffer) return;
+  gpu_copy_display(buffer);
+  record_end_frame();
+}
+
+// What is on screen: the display area of VRAM when headless, otherwise the
+// frame's geometry, as the window is drawn without going through VRAM
+uint64_t gpu_display_hash() {
+  uint64_t hash = HASH_SEED;
+  if(!gpu_headless) {
+    hash = hash_bytes(vertices, vertices_count * sizeof(struct vertex), hash);
+    return(hash_bytes(&gpu.start_display_x, 4, hash));
+  }
+  uint32_t height = gpu_display_height();
+  uint32_t bytes = gpu_display_width() * (gpu.color_depth ? 3 : 2);
+  uint32_t x = gpu.start_display_x * 2;
+  if(x + bytes > 2048) bytes = 2048 - x;
+  for(uint32_t y = 0; y < height; y++)
+    hash = hash_bytes(vram + ((gpu.start_display_y + y) & 511) * 2048 + x, bytes, hash);
+  return(hash);
+}
+
+void gpu_export() {
+  gpu_copy_display(export_begin_frame());
+  export_end_frame(gpu_display_width(), gpu_display_height(), gpu.color_depth ? EXPORT_FORMAT_RGB888 : EXPORT_FORMAT_RGB555);
+}
+
+void gpu_poll_events() {
+  SDL_Event Event;
+  while (SDL_PollEvent(&Event)) {
+    if (Event.type == SDL_QUIT) exit(0);
+    if (Event.type == SDL_KEYDOWN && Event.key.keysym.sym == SDLK_F3)
+      gpu_stats_overlay = !gpu_stats_overlay;
+    else if (Event.type == SDL_KEYDOWN || Event.type == SDL_KEYUP)
+      input_key(Event.key.keysym.sym, Event.type == SDL_KEYDOWN);
+  }
+}
+
+void gpu_present() {
+  if(gpu_capturing) gpu_capture_frame();
+  if(!gpu_headless) {
+    if(!pacing_skip) {
+      // DRAW!
+      glClear(GL_COLOR_BUFFER_BIT);
+      uint64_t start = telemetry_now();
+      glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_DYNAMIC_DRAW);
+      gpu_stats.buffer_ns += telemetry_now() - start;
+      glDrawArrays(GL_TRIANGLES, 0, vertices_count);
+      gpu_stats.draw_calls++;
+      if(recording_video) gpu_record();
+      if(gpu_stats_overlay) {
+        // Drawn after recording so videos don't include it
+        uint32_t count = gpu_stats_draw_overlay(&vertices[vertices_count]);
+        glBufferSubData(GL_ARRAY_BUFFER, vertices_count * sizeof(struct vertex), count * sizeof(struct vertex), &vertices[vertices_count]);
+        glDrawArrays(GL_TRIANGLES, vertices_count, count);
+      }
+      start = telemetry_now();
+      SDL_GL_SwapWindow(Window);
+      gpu_stats.swap_ns += telemetry_now() - start;
+    } else if(recording_video) {
+      gpu_record_flush();
+      record_repeat_frame();
+    }
+  } else {
+    if(recording_video) gpu_record();
+    if(exporting) gpu_export();
+  }
+  if(latency_enabled && !pacing_skip) latency_frame();
+  vertices_count = 0;
+  gpu_stats_frame();
+}
+
+void gpu_vblank() {
+  uint64_t frame_cycles = gpu_frame_cycles();
+  gpu_vblank_cycles += frame_cycles;
+  scheduler_schedule(SCHEDULER_VBLANK, gpu_vblank_cycles, gpu_vblank);
+  interrupt_request(IRQ_VBLANK);
+  timers_vblank();
+  // Keys pressed since the last VBlank are latched for this frame, the same
+  // state a movie records
+  if(!gpu_headless) gpu_poll_events();
+  input_frame();
+  movie_frame();
+  search_frame();
+  debug_frame();
+  uint64_t start = telemetry_now();
+  gpu_present();
+  uint64_t presented = telemetry_now();
+  pacing_vblank(frame_cycles * 1000000000 / CPU_CLOCK);
+  uint64_t paced = telemetry_now();
+  telemetry_gpu_ns += presented - start;
+  telemetry_idle_ns += paced - presented;
+  telemetry_frame();
+}
+
 void gpu_gp0(uint32_t command) {
-  //printf("GP0: Command %08x!\n", command);
+  TRACE_EVENT(TRACE_GP0, 0, 0, command);
+  gpu_gp0_words++;
+  if(gpu_capturing) gpu_capture_gp0(command);
   gp0_buffer[gp0_offset] = command;
   switch(gp0_buffer[0] & 0xff000000) {
     case 0x0: // Nop
@@ -255,6 +512,7 @@ void gpu_gp0(uint32_t command) {
     case 0x01000000: // Cache clear, meh
       break;
     case 0x28000000:
+    case 0x2a000000:
       // Solid rectangle
       switch(gp0_offset) {
         case 0:
@@ -287,6 +545,7 @@ void gpu_gp0(uint32_t command) {
         case 4:
           vertices[vertices_count+5].position = command;
 
+          gpu_rasterize(6);
           gp0_offset = -1;
           vertices_count += 6;
           break;
@@ -294,10 +553,10 @@ void gpu_gp0(uint32_t command) {
       gp0_offset++;
       break;
     case 0x2c000000:
+    case 0x2e000000:
       // Textured rectangle
       switch(gp0_offset) {
         case 0:
-          //printf("Drawing textured rectangle.\n");
           // Set base color
           vertices[vertices_count+0].color = command;
           vertices[vertices_count+1].color = command;
@@ -307,11 +566,9 @@ void gpu_gp0(uint32_t command) {
           vertices[vertices_count+5].color = command;
           break;
         case 1:
-          //printf("  %08x", command);
           vertices[vertices_count+0].position = command;
           break;
         case 2:
-          //printf("  %04x\n", command >> 16);
           // CLUT comes from here
           vertices[vertices_count+0].clut = (command >> 16);
           vertices[vertices_count+1].clut = (command >> 16);
@@ -323,12 +580,10 @@ void gpu_gp0(uint32_t command) {
           vertices[vertices_count+0].texture_uv = command;
           break;
         case 3:
-          //printf("  %08x", command);
           vertices[vertices_count+1].position = command;
           vertices[vertices_count+3].position = command;
           break;
         case 4:
-          //printf("  %04x (%04x)\n", command & 0xffff, command>>16);
           // Texture mode comes from texpage here
           vertices[vertices_count+0].texpage = (1<<15) | (command >> 16);
           vertices[vertices_count+1].texpage = (1<<15) | (command >> 16);
@@ -341,22 +596,19 @@ void gpu_gp0(uint32_t command) {
           vertices[vertices_count+3].texture_uv = command;
           break;
         case 5:
-          //printf("  %08x", command);
           vertices[vertices_count+2].position = command;
           vertices[vertices_count+4].position = command;
           break;
         case 6:
-          //printf("  %04x\n", command & 0xffff);
           vertices[vertices_count+2].texture_uv = command;
           vertices[vertices_count+4].texture_uv = command;
           break;
         case 7:
-          //printf("  %08x", command);
           vertices[vertices_count+5].position = command;
           break;
         case 8:
-          //printf("  %04x\n", command & 0xffff);
           vertices[vertices_count+5].texture_uv = command;
+          gpu_rasterize(6);
           gp0_offset = -1;
           vertices_count += 6;
           break;
@@ -364,6 +616,7 @@ void gpu_gp0(uint32_t command) {
       gp0_offset++;
       break;
     case 0x30000000:
+    case 0x32000000:
       // Shaded triangle
       switch(gp0_offset) {
         case 0:
@@ -391,6 +644,7 @@ void gpu_gp0(uint32_t command) {
         case 5:
           vertices[vertices_count+2].position = command;
 
+          gpu_rasterize(3);
           gp0_offset = -1;
           vertices_count += 3;
           break;
@@ -398,6 +652,7 @@ void gpu_gp0(uint32_t command) {
       gp0_offset++;
       break;
     case 0x38000000:
+    case 0x3a000000:
       // Shaded rectangle
       switch(gp0_offset) {
         case 0:
@@ -434,6 +689,7 @@ void gpu_gp0(uint32_t command) {
         case 7:
           vertices[vertices_count+5].position = command;
 
+          gpu_rasterize(6);
           gp0_offset = -1;
           vertices_count += 6;
           break;
@@ -442,22 +698,24 @@ void gpu_gp0(uint32_t command) {
       break;
     case 0xa0000000:
       if(gp0_offset == 2) {
-        //printf("load data.\n");
-        //printf("destination %08x dimensions %08x\n", gp0_buffer[1], gp0_buffer[2]);
         gp0_offset++;
         gp0_data_offset = 0;
       } else if(gp0_offset == 3) {
         uint32_t pixels = gp0_data_offset * 2;
         uint32_t coord = pixels / (gp0_buffer[2] & 0xffff) * 1024 + pixels % (gp0_buffer[2] & 0xffff) + (gp0_buffer[1] >> 16) * 1024 + (gp0_buffer[1] & 0xffff);
-        //printf("%08x = %04x\n", coord, command >> 16);
-        //printf("%08x = %04x\n", coord+1, command & 0xffff);
         ((uint16_t*)vram)[coord] = command & 0xffff;
         ((uint16_t*)vram)[coord+1] = command >> 16;
         gp0_data_offset++;
+        gpu_vram_upload_bytes += 4;
+        gpu_stats.vram_upload_bytes += 4;
         if(gp0_data_offset == ((gp0_buffer[2] >> 16) * (gp0_buffer[2] & 0xffff) + 1 ) / 2) {
-          //printf("load data end\n");
-          glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, 1024, 512, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, vram);
-          glGenerateMipmap(GL_TEXTURE_2D);
+          if(!gpu_headless) {
+            uint64_t start = telemetry_now();
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, 1024, 512, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, vram);
+            glGenerateMipmap(GL_TEXTURE_2D);
+            gpu_stats.texture_ns += telemetry_now() - start;
+            gpu_stats.texture_uploads++;
+          }
           gp0_offset = 0;
         }
       } else {
@@ -499,16 +757,6 @@ void gpu_gp0(uint32_t command) {
     case 0xe5000000:
       gpu.draw_offset_x    = (command >> 0)   & 0x7ff;
       gpu.draw_offset_y    = (command >> 11)  & 0x7ff;
-      SDL_Event Event;
-      while (SDL_PollEvent(&Event))
-        if (Event.type == SDL_QUIT) exit(0);
-      // DRAW!
-      //printf("FRAME!\n");
-      glClear(GL_COLOR_BUFFER_BIT);
-      glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_DYNAMIC_DRAW);
-      glDrawArrays(GL_TRIANGLES, 0, vertices_count);
-      vertices_count = 0;
-      SDL_GL_SwapWindow(Window);
       break;
     case 0xe6000000:
       gpu.set_mask_bit     = (command >> 0)   & 0x1;
@@ -521,6 +769,8 @@ void gpu_gp0(uint32_t command) {
 }
 
 void gpu_gp1(uint32_t command) {
+  TRACE_EVENT(TRACE_GP1, 0, 0, command);
+  if(gpu_capturing) gpu_capture_gp1(command);
   switch (command & 0xff000000)
   {
   case 0x0:
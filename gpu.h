@@ -1,5 +1,29 @@
+#ifndef GPU_H
+#define GPU_H
+
 #include <stdint.h>
 
+struct __attribute__((packed)) vertex {
+  uint32_t position;
+  uint32_t color;
+  uint32_t texture_uv;
+  uint16_t texpage;
+  uint16_t clut;
+};
+
+extern uint8_t *vram;
+extern int gpu_headless;
+extern uint64_t gpu_gp0_words;
+extern uint64_t gpu_primitives;
+extern uint64_t gpu_vram_upload_bytes;
+
 void gpu_gp0(uint32_t command);
 void gpu_gp1(uint32_t command);
 void gpu_init();
+void gpu_present();
+void gpu_vblank();
+uint32_t gpu_line_clocks();
+uint32_t gpu_dotclock_divider();
+uint64_t gpu_display_hash();
+
+#endif
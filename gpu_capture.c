@@ -0,0 +1,85 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "gpu_capture.h"
+
+#define GPU_CAPTURE_RUN 4096
+
+int gpu_capturing;
+
+FILE *capture_file;
+uint64_t capture_start;
+uint32_t capture_run[GPU_CAPTURE_RUN];
+uint32_t capture_run_length;
+uint8_t capture_run_type;
+uint64_t capture_run_timestamp;
+
+uint64_t gpu_capture_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec - capture_start);
+}
+
+void gpu_capture_record(uint8_t type, uint32_t *words, uint32_t count, uint64_t timestamp) {
+  gpu_capture_record_t record = {
+    .tag = (type << 24) | count,
+    .timestamp = timestamp,
+  };
+  fwrite(&record, sizeof(record), 1, capture_file);
+  if(count) fwrite(words, sizeof(uint32_t), count, capture_file);
+}
+
+void gpu_capture_flush() {
+  if(capture_run_length)
+    gpu_capture_record(capture_run_type, capture_run, capture_run_length, capture_run_timestamp);
+  capture_run_length = 0;
+}
+
+void gpu_capture_word(uint8_t type, uint32_t word) {
+  if(capture_run_type != type || capture_run_length == GPU_CAPTURE_RUN) {
+    gpu_capture_flush();
+    capture_run_type = type;
+  }
+  if(capture_run_length == 0)
+    capture_run_timestamp = gpu_capture_now();
+  capture_run[capture_run_length++] = word;
+}
+
+void gpu_capture_gp0(uint32_t word) {
+  gpu_capture_word(GPU_CAPTURE_GP0, word);
+}
+
+void gpu_capture_gp1(uint32_t word) {
+  gpu_capture_word(GPU_CAPTURE_GP1, word);
+}
+
+void gpu_capture_frame() {
+  gpu_capture_flush();
+  gpu_capture_record(GPU_CAPTURE_FRAME, 0, 0, gpu_capture_now());
+}
+
+void gpu_capture_open(const char *path) {
+  capture_file = fopen(path, "wb");
+  if(!capture_file) {
+    printf("Failed to open GPU capture file: %s\n", path);
+    exit(1);
+  }
+  setvbuf(capture_file, 0, _IOFBF, 1024*1024);
+  gpu_capture_header_t header = {
+    .magic = GPU_CAPTURE_MAGIC,
+    .version = GPU_CAPTURE_VERSION,
+  };
+  fwrite(&header, sizeof(header), 1, capture_file);
+  capture_start = 0;
+  capture_start = gpu_capture_now();
+  gpu_capturing = 1;
+  atexit(gpu_capture_close);
+}
+
+void gpu_capture_close() {
+  if(!gpu_capturing) return;
+  gpu_capture_flush();
+  fclose(capture_file);
+  gpu_capturing = 0;
+}
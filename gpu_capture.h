@@ -0,0 +1,35 @@
+#ifndef GPU_CAPTURE_H
+#define GPU_CAPTURE_H
+
+#include <stdint.h>
+
+// Dump layout: a header followed by records. Each record is a 32-bit tag
+// (type << 24 | word count), a 64-bit timestamp in nanoseconds since the
+// capture started, then the payload words. Consecutive GP0 or GP1 words
+// are batched into a single record.
+#define GPU_CAPTURE_MAGIC   0x50435047 // "GPCP"
+#define GPU_CAPTURE_VERSION 1
+
+#define GPU_CAPTURE_GP0   1
+#define GPU_CAPTURE_GP1   2
+#define GPU_CAPTURE_FRAME 3
+
+typedef struct __attribute__((packed)) gpu_capture_header_t {
+  uint32_t magic;
+  uint32_t version;
+} gpu_capture_header_t;
+
+typedef struct __attribute__((packed)) gpu_capture_record_t {
+  uint32_t tag;
+  uint64_t timestamp;
+} gpu_capture_record_t;
+
+extern int gpu_capturing;
+
+void gpu_capture_open(const char *path);
+void gpu_capture_gp0(uint32_t word);
+void gpu_capture_gp1(uint32_t word);
+void gpu_capture_frame();
+void gpu_capture_close();
+
+#endif
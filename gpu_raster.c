@@ -0,0 +1,205 @@
+#include <stdint.h>
+#include <string.h>
+#include "gpu.h"
+#include "gpu_raster.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// One horizontal run of pixels, attributes are 16.16 fixed point at the first pixel
+typedef struct span_t {
+  uint16_t *dst;
+  int32_t x, count;
+  int32_t r, g, b, u, v;
+  int32_t drdx, dgdx, dbdx, dudx, dvdx;
+  const int32_t *dither;
+  int32_t tex_x, tex_y, clut;
+  int32_t u_and, u_or, v_and, v_or;
+  int32_t mask_or, mask_check;
+} span_t;
+
+typedef void (*span_fn)(const span_t *span);
+
+#define SPAN_ISA scalar
+#define SPAN_LANES 1
+#define SPAN_TARGET
+#define SPAN_GATHER 0
+#include "gpu_span.h"
+#undef SPAN_ISA
+#undef SPAN_LANES
+#undef SPAN_TARGET
+#undef SPAN_GATHER
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SPAN_ISA sse41
+#define SPAN_LANES 4
+#define SPAN_TARGET __attribute__((target("sse4.1")))
+#define SPAN_GATHER 0
+#include "gpu_span.h"
+#undef SPAN_ISA
+#undef SPAN_LANES
+#undef SPAN_TARGET
+#undef SPAN_GATHER
+
+#define SPAN_ISA avx2
+#define SPAN_LANES 8
+#define SPAN_TARGET __attribute__((target("avx2")))
+#define SPAN_GATHER 1
+#include "gpu_span.h"
+#undef SPAN_ISA
+#undef SPAN_LANES
+#undef SPAN_TARGET
+#undef SPAN_GATHER
+#endif
+
+static span_fn (*span_kernels)[2][5] = span_kernels_scalar;
+static const char *span_isa = "scalar";
+
+const int32_t dither_matrix[4][4] = {
+  { -4,  0, -3,  1 },
+  {  2, -2,  3, -1 },
+  { -3,  1, -4,  0 },
+  {  3, -1,  2, -2 },
+};
+const int32_t dither_none[4] = { 0, 0, 0, 0 };
+
+void raster_init() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")) {
+    span_kernels = span_kernels_avx2;
+    span_isa = "avx2";
+  } else if(__builtin_cpu_supports("sse4.1")) {
+    span_kernels = span_kernels_sse41;
+    span_isa = "sse4.1";
+  }
+#endif
+}
+
+const char *raster_isa() {
+  return(span_isa);
+}
+
+// Vertex coordinates are signed 11-bit values
+#define VERTEX_X(v) ((int32_t)((v)->position << 21) >> 21)
+#define VERTEX_Y(v) ((int32_t)((v)->position << 5) >> 21)
+
+// Plane equation for one attribute across the triangle, in 16.16
+static void raster_gradient(int32_t *a, int32_t *x, int32_t *y, int64_t area, int32_t *ddx, int32_t *ddy) {
+  int32_t da1 = a[1] - a[0], da2 = a[2] - a[0];
+  int32_t dx1 = x[1] - x[0], dx2 = x[2] - x[0];
+  int32_t dy1 = y[1] - y[0], dy2 = y[2] - y[0];
+  *ddx = ((int64_t)(da1 * dy2 - da2 * dy1) << 16) / area;
+  *ddy = ((int64_t)(dx1 * da2 - dx2 * da1) << 16) / area;
+}
+
+void raster_triangle(raster_state_t *state, uint32_t command, struct vertex *v) {
+  int textured = (command >> 26) & 1;
+  int shaded = (command >> 28) & 1;
+  int semi = (command >> 25) & 1;
+  int raw = textured && ((command >> 24) & 1);
+
+  // Sort by y so we can walk the long edge against the two short ones
+  struct vertex *p[3] = { &v[0], &v[1], &v[2] };
+  struct vertex *t;
+  if(VERTEX_Y(p[1]) < VERTEX_Y(p[0])) { t = p[0]; p[0] = p[1]; p[1] = t; }
+  if(VERTEX_Y(p[2]) < VERTEX_Y(p[1])) { t = p[1]; p[1] = p[2]; p[2] = t; }
+  if(VERTEX_Y(p[1]) < VERTEX_Y(p[0])) { t = p[0]; p[0] = p[1]; p[1] = t; }
+
+  int32_t x[3], y[3], r[3], g[3], b[3], tu[3], tv[3];
+  for(int n = 0; n < 3; n++) {
+    x[n] = VERTEX_X(p[n]) + state->draw_offset_x;
+    y[n] = VERTEX_Y(p[n]) + state->draw_offset_y;
+    r[n] = (p[n]->color >> 0) & 0xff;
+    g[n] = (p[n]->color >> 8) & 0xff;
+    b[n] = (p[n]->color >> 16) & 0xff;
+    tu[n] = (p[n]->texture_uv >> 0) & 0xff;
+    tv[n] = (p[n]->texture_uv >> 8) & 0xff;
+  }
+
+  int64_t area = (int64_t)(x[1] - x[0]) * (y[2] - y[0]) - (int64_t)(x[2] - x[0]) * (y[1] - y[0]);
+  if(area == 0) return;
+  // Hardware drops polygons too large to rasterize
+  int32_t xmin = x[0], xmax = x[0];
+  for(int n = 1; n < 3; n++) {
+    if(x[n] < xmin) xmin = x[n];
+    if(x[n] > xmax) xmax = x[n];
+  }
+  if(xmax - xmin > 1023 || y[2] - y[0] > 511) return;
+
+  span_t s;
+  int32_t drdy = 0, dgdy = 0, dbdy = 0, dudy = 0, dvdy = 0;
+  s.drdx = s.dgdx = s.dbdx = s.dudx = s.dvdx = 0;
+  if(shaded) {
+    raster_gradient(r, x, y, area, &s.drdx, &drdy);
+    raster_gradient(g, x, y, area, &s.dgdx, &dgdy);
+    raster_gradient(b, x, y, area, &s.dbdx, &dbdy);
+  }
+  if(raw) {
+    r[0] = g[0] = b[0] = 128;
+  }
+
+  int texture = 0, blend = 0;
+  uint16_t texpage = p[0]->texpage;
+  if(textured) {
+    raster_gradient(tu, x, y, area, &s.dudx, &dudy);
+    raster_gradient(tv, x, y, area, &s.dvdx, &dvdy);
+    switch((texpage >> 7) & 3) {
+      case 0: texture = 1; break;
+      case 1: texture = 2; break;
+      default: texture = 3; break;
+    }
+    s.tex_x = (texpage & 0xf) * 64;
+    s.tex_y = ((texpage >> 4) & 1) * 256;
+    s.clut = (p[0]->clut >> 6) * 1024 + (p[0]->clut & 0x3f) * 16;
+    s.u_and = ~(state->tex_window_mask_x * 8) & 0xff;
+    s.u_or = (state->tex_window_offset_x & state->tex_window_mask_x) * 8;
+    s.v_and = ~(state->tex_window_mask_y * 8) & 0xff;
+    s.v_or = (state->tex_window_offset_y & state->tex_window_mask_y) * 8;
+  }
+  if(semi)
+    blend = 1 + (textured ? (texpage >> 5) & 3 : state->semi_transparency);
+  s.mask_or = state->set_mask_bit ? 0x8000 : 0;
+  s.mask_check = state->check_mask_bit ? 0x8000 : 0;
+  int dither = state->dither && (shaded || (textured && !raw));
+  span_fn kernel = span_kernels[texture][shaded][blend];
+
+  int32_t top = state->draw_area_top, bottom = state->draw_area_bottom;
+  int32_t left = state->draw_area_left, right = state->draw_area_right;
+  if(bottom > 511) bottom = 511;
+  if(right > 1023) right = 1023;
+  int32_t ystart = y[0] > top ? y[0] : top;
+  int32_t yend = y[2] < bottom + 1 ? y[2] : bottom + 1;
+
+  int64_t long_slope = ((int64_t)(x[2] - x[0]) << 16) / (y[2] - y[0]);
+  int64_t top_slope = y[1] != y[0] ? ((int64_t)(x[1] - x[0]) << 16) / (y[1] - y[0]) : 0;
+  int64_t bottom_slope = y[2] != y[1] ? ((int64_t)(x[2] - x[1]) << 16) / (y[2] - y[1]) : 0;
+
+  for(int32_t row = ystart; row < yend; row++) {
+    int64_t xa = ((int64_t)x[0] << 16) + (row - y[0]) * long_slope;
+    int64_t xb;
+    if(row < y[1])
+      xb = ((int64_t)x[0] << 16) + (row - y[0]) * top_slope;
+    else
+      xb = ((int64_t)x[1] << 16) + (row - y[1]) * bottom_slope;
+    if(xa > xb) { int64_t tmp = xa; xa = xb; xb = tmp; }
+    int32_t xs = (xa + 0xffff) >> 16;
+    int32_t xe = (xb + 0xffff) >> 16;
+    if(xs < left) xs = left;
+    if(xe > right + 1) xe = right + 1;
+    if(xs >= xe) continue;
+
+    int32_t ox = xs - x[0], oy = row - y[0];
+    s.dst = (uint16_t *)vram + row * 1024 + xs;
+    s.x = xs;
+    s.count = xe - xs;
+    s.dither = dither ? dither_matrix[row & 3] : dither_none;
+    s.r = (r[0] << 16) + ox * s.drdx + oy * drdy + 0x8000;
+    s.g = (g[0] << 16) + ox * s.dgdx + oy * dgdy + 0x8000;
+    s.b = (b[0] << 16) + ox * s.dbdx + oy * dbdy + 0x8000;
+    s.u = (tu[0] << 16) + ox * s.dudx + oy * dudy;
+    s.v = (tv[0] << 16) + ox * s.dvdx + oy * dvdy;
+    kernel(&s);
+  }
+}
@@ -0,0 +1,29 @@
+#ifndef GPU_RASTER_H
+#define GPU_RASTER_H
+
+#include <stdint.h>
+#include "gpu.h"
+
+// Render state captured from GP0 0xE1-0xE6 at the time a primitive is drawn
+typedef struct raster_state_t {
+  uint16_t draw_area_left;
+  uint16_t draw_area_top;
+  uint16_t draw_area_right;
+  uint16_t draw_area_bottom;
+  int16_t draw_offset_x;
+  int16_t draw_offset_y;
+  uint8_t semi_transparency;
+  uint8_t dither;
+  uint8_t set_mask_bit;
+  uint8_t check_mask_bit;
+  uint8_t tex_window_mask_x;
+  uint8_t tex_window_mask_y;
+  uint8_t tex_window_offset_x;
+  uint8_t tex_window_offset_y;
+} raster_state_t;
+
+void raster_init();
+void raster_triangle(raster_state_t *state, uint32_t command, struct vertex *v);
+const char *raster_isa();
+
+#endif
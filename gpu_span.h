@@ -0,0 +1,193 @@
+// Span kernel template, included by gpu_raster.c once per instruction set.
+// The includer defines SPAN_ISA (name suffix), SPAN_LANES (pixels per step),
+// SPAN_TARGET (function attribute) and SPAN_GATHER (1 to use AVX2 gathers).
+//
+// Every kernel variant is the same always_inline body instantiated with
+// constant texture/shading/blend arguments, so the per-pixel loop compiles
+// down to straight-line vector code with no branches on render state.
+// Per-pixel conditions (transparent texels, mask bit, texel semi bit) are
+// applied as lane masks.
+
+#define SPAN_JOIN2(a, b) a##_##b
+#define SPAN_JOIN(a, b) SPAN_JOIN2(a, b)
+#define SPAN_FN(name) SPAN_JOIN(name, SPAN_ISA)
+
+typedef int32_t SPAN_FN(vi) __attribute__((vector_size(4 * SPAN_LANES)));
+typedef uint16_t SPAN_FN(vh) __attribute__((vector_size(2 * SPAN_LANES)));
+
+static inline __attribute__((always_inline)) SPAN_TARGET
+SPAN_FN(vi) SPAN_FN(span_fetch)(SPAN_FN(vi) index) {
+  SPAN_FN(vi) texel;
+  index &= 0x7ffff;
+#if SPAN_GATHER
+  // Gather the aligned 32-bit word holding each texel so we never read past the end of vram
+  SPAN_FN(vi) words = (SPAN_FN(vi))_mm256_i32gather_epi32((const int *)vram, (__m256i)(index >> 1), 4);
+  texel = (words >> ((index & 1) << 4)) & 0xffff;
+#else
+  const uint16_t *vram16 = (const uint16_t *)vram;
+  for(int i = 0; i < SPAN_LANES; i++)
+    texel[i] = vram16[index[i]];
+#endif
+  return(texel);
+}
+
+static inline __attribute__((always_inline)) SPAN_TARGET
+SPAN_FN(vi) SPAN_FN(span_clamp)(SPAN_FN(vi) c) {
+  c &= ~(c >> 31);
+  c |= (255 - c) >> 31;
+  return(c & 255);
+}
+
+static inline __attribute__((always_inline)) SPAN_TARGET
+SPAN_FN(vi) SPAN_FN(span_blend)(SPAN_FN(vi) b, SPAN_FN(vi) f, const int blend) {
+  SPAN_FN(vi) c;
+  switch(blend) {
+    case 1: return((b + f) >> 1);
+    case 2: c = b + f; break;
+    case 3: c = b - f; break;
+    default: c = b + (f >> 2); break;
+  }
+  c &= ~(c >> 31);
+  c |= (31 - c) >> 31;
+  return(c & 31);
+}
+
+static inline __attribute__((always_inline)) SPAN_TARGET
+SPAN_FN(vh) SPAN_FN(span_pixels)(const span_t *s, SPAN_FN(vh) old16,
+    SPAN_FN(vi) r, SPAN_FN(vi) g, SPAN_FN(vi) b, SPAN_FN(vi) u, SPAN_FN(vi) v,
+    SPAN_FN(vi) dither, const int texture, const int blend) {
+  typedef SPAN_FN(vi) vi;
+  vi old = __builtin_convertvector(old16, vi);
+  vi cr = r >> 16, cg = g >> 16, cb = b >> 16;
+  vi write = (old & 0) == 0;
+  vi semi = write;
+  vi mask_bit = old & 0;
+
+  if(texture) {
+    vi tu = ((u >> 16) & s->u_and) | s->u_or;
+    vi tv = ((v >> 16) & s->v_and) | s->v_or;
+    vi row = ((s->tex_y + tv) & 511) << 10;
+    vi texel;
+    if(texture == 1) {
+      vi word = SPAN_FN(span_fetch)(row | ((s->tex_x + (tu >> 2)) & 1023));
+      texel = SPAN_FN(span_fetch)(s->clut + ((word >> ((tu & 3) << 2)) & 0xf));
+    } else if(texture == 2) {
+      vi word = SPAN_FN(span_fetch)(row | ((s->tex_x + (tu >> 1)) & 1023));
+      texel = SPAN_FN(span_fetch)(s->clut + ((word >> ((tu & 1) << 3)) & 0xff));
+    } else {
+      texel = SPAN_FN(span_fetch)(row | ((s->tex_x + tu) & 1023));
+    }
+    write = texel != 0;
+    semi = (texel << 16) >> 31;
+    mask_bit = texel & 0x8000;
+    // Modulate: texel * color / 128, done in the 8-bit domain so dithering sees the low bits
+    cr = ((texel & 0x1f) * cr) >> 4;
+    cg = (((texel >> 5) & 0x1f) * cg) >> 4;
+    cb = (((texel >> 10) & 0x1f) * cb) >> 4;
+  }
+
+  cr = SPAN_FN(span_clamp)(cr + dither) >> 3;
+  cg = SPAN_FN(span_clamp)(cg + dither) >> 3;
+  cb = SPAN_FN(span_clamp)(cb + dither) >> 3;
+
+  if(blend) {
+    vi br = SPAN_FN(span_blend)(old & 0x1f, cr, blend);
+    vi bg = SPAN_FN(span_blend)((old >> 5) & 0x1f, cg, blend);
+    vi bb = SPAN_FN(span_blend)((old >> 10) & 0x1f, cb, blend);
+    cr = (br & semi) | (cr & ~semi);
+    cg = (bg & semi) | (cg & ~semi);
+    cb = (bb & semi) | (cb & ~semi);
+  }
+
+  vi pixel = cr | (cg << 5) | (cb << 10) | mask_bit | s->mask_or;
+  write &= (old & s->mask_check) == 0;
+  return(__builtin_convertvector((pixel & write) | (old & ~write), SPAN_FN(vh)));
+}
+
+static inline __attribute__((always_inline)) SPAN_TARGET
+void SPAN_FN(span_generic)(const span_t *s, const int texture, const int shaded, const int blend) {
+  typedef SPAN_FN(vi) vi;
+  typedef SPAN_FN(vh) vh;
+  vi lane, dither;
+  for(int i = 0; i < SPAN_LANES; i++) {
+    lane[i] = i;
+    // When SPAN_LANES is a multiple of the matrix width the pattern is fixed for the span
+    dither[i] = s->dither[(s->x + i) & 3];
+  }
+
+  vi r = s->r + lane * s->drdx;
+  vi g = s->g + lane * s->dgdx;
+  vi b = s->b + lane * s->dbdx;
+  vi u = s->u + lane * s->dudx;
+  vi v = s->v + lane * s->dvdx;
+  if(!shaded) {
+    r = lane * 0 + s->r;
+    g = lane * 0 + s->g;
+    b = lane * 0 + s->b;
+  }
+  const int32_t step = SPAN_LANES;
+
+  uint16_t *dst = s->dst;
+  int32_t n = s->count;
+  int32_t i = 0;
+  vh old;
+  for(; i + SPAN_LANES <= n; i += SPAN_LANES) {
+#if SPAN_LANES % 4
+    for(int l = 0; l < SPAN_LANES; l++)
+      dither[l] = s->dither[(s->x + i + l) & 3];
+#endif
+    memcpy(&old, dst + i, sizeof(old));
+    old = SPAN_FN(span_pixels)(s, old, r, g, b, u, v, dither, texture, blend);
+    memcpy(dst + i, &old, sizeof(old));
+    if(shaded) {
+      r += s->drdx * step;
+      g += s->dgdx * step;
+      b += s->dbdx * step;
+    }
+    if(texture) {
+      u += s->dudx * step;
+      v += s->dvdx * step;
+    }
+  }
+  if(i < n) {
+#if SPAN_LANES % 4
+    for(int l = 0; l < SPAN_LANES; l++)
+      dither[l] = s->dither[(s->x + i + l) & 3];
+#endif
+    // Run the tail through a full vector so we never touch pixels outside the span
+    memcpy(&old, dst + i, (n - i) * sizeof(uint16_t));
+    old = SPAN_FN(span_pixels)(s, old, r, g, b, u, v, dither, texture, blend);
+    memcpy(dst + i, &old, (n - i) * sizeof(uint16_t));
+  }
+}
+
+#define SPAN_VARIANT(t, s, b) \
+  static void SPAN_TARGET SPAN_FN(span_##t##_##s##_##b)(const span_t *span) { \
+    SPAN_FN(span_generic)(span, t, s, b); \
+  }
+#define SPAN_ENTRY(t, s, b) SPAN_FN(span_##t##_##s##_##b),
+#define SPAN_BLENDS(X, t, s) { X(t, s, 0) X(t, s, 1) X(t, s, 2) X(t, s, 3) X(t, s, 4) }
+#define SPAN_SHADES(X, t) { SPAN_BLENDS(X, t, 0), SPAN_BLENDS(X, t, 1) }
+
+#define SPAN_DEFINE_BLENDS(t, s) \
+  SPAN_VARIANT(t, s, 0) SPAN_VARIANT(t, s, 1) SPAN_VARIANT(t, s, 2) SPAN_VARIANT(t, s, 3) SPAN_VARIANT(t, s, 4)
+SPAN_DEFINE_BLENDS(0, 0) SPAN_DEFINE_BLENDS(0, 1)
+SPAN_DEFINE_BLENDS(1, 0) SPAN_DEFINE_BLENDS(1, 1)
+SPAN_DEFINE_BLENDS(2, 0) SPAN_DEFINE_BLENDS(2, 1)
+SPAN_DEFINE_BLENDS(3, 0) SPAN_DEFINE_BLENDS(3, 1)
+
+static span_fn SPAN_FN(span_kernels)[4][2][5] = {
+  SPAN_SHADES(SPAN_ENTRY, 0),
+  SPAN_SHADES(SPAN_ENTRY, 1),
+  SPAN_SHADES(SPAN_ENTRY, 2),
+  SPAN_SHADES(SPAN_ENTRY, 3),
+};
+
+#undef SPAN_DEFINE_BLENDS
+#undef SPAN_SHADES
+#undef SPAN_BLENDS
+#undef SPAN_ENTRY
+#undef SPAN_VARIANT
+#undef SPAN_FN
+#undef SPAN_JOIN
+#undef SPAN_JOIN2
@@ -0,0 +1,109 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gpu_stats.h"
+#include "telemetry.h"
+
+// The overlay is a bar per frame along the bottom of the window, stacked
+// from the bottom: emulation and everything else (green), vertex upload
+// (red), VRAM texture upload (yellow) and swap (blue). The white line is
+// the 60Hz frame budget.
+#define GPU_STATS_BAR_WIDTH  4
+#define GPU_STATS_PX_PER_MS  4
+#define GPU_STATS_BOTTOM     478
+#define GPU_STATS_BUDGET_NS  16683333
+
+gpu_frame_stats_t gpu_stats;
+int gpu_stats_overlay;
+
+FILE *gpu_stats_file;
+gpu_frame_stats_t gpu_stats_history[GPU_STATS_HISTORY];
+uint32_t gpu_stats_head;
+uint64_t gpu_stats_frames, gpu_stats_last_ns;
+
+void gpu_stats_open_csv(const char *path) {
+  gpu_stats_file = fopen(path, "w");
+  if(!gpu_stats_file) {
+    printf("Failed to open GPU stats log: %s\n", path);
+    exit(1);
+  }
+  fprintf(gpu_stats_file, "frame,solid_rect,textured_rect,shaded_triangle,shaded_rect,other,vertices,"
+    "vram_upload_bytes,draw_calls,texture_uploads,buffer_us,texture_us,swap_us,frame_us\n");
+  atexit(gpu_stats_close);
+}
+
+void gpu_stats_primitive(uint32_t command, uint32_t vertices) {
+  int type;
+  switch(command >> 24) {
+    case 0x28: case 0x2a: type = GPU_STATS_SOLID_RECT; break;
+    case 0x2c: case 0x2e: type = GPU_STATS_TEXTURED_RECT; break;
+    case 0x30: case 0x32: type = GPU_STATS_SHADED_TRIANGLE; break;
+    case 0x38: case 0x3a: type = GPU_STATS_SHADED_RECT; break;
+    default: type = GPU_STATS_OTHER;
+  }
+  gpu_stats.primitives[type]++;
+  gpu_stats.vertices += vertices;
+}
+
+// Called after each presented frame
+void gpu_stats_frame() {
+  uint64_t now = telemetry_now();
+  if(gpu_stats_last_ns) gpu_stats.frame_ns = now - gpu_stats_last_ns;
+  gpu_stats_last_ns = now;
+  if(gpu_stats_file) {
+    gpu_frame_stats_t *s = &gpu_stats;
+    fprintf(gpu_stats_file, "%lu,%u,%u,%u,%u,%u,%u,%u,%u,%u,%lu,%lu,%lu,%lu\n", gpu_stats_frames,
+      s->primitives[0], s->primitives[1], s->primitives[2], s->primitives[3], s->primitives[4],
+      s->vertices, s->vram_upload_bytes, s->draw_calls, s->texture_uploads,
+      s->buffer_ns / 1000, s->texture_ns / 1000, s->swap_ns / 1000, s->frame_ns / 1000);
+  }
+  gpu_stats_history[gpu_stats_head++ % GPU_STATS_HISTORY] = gpu_stats;
+  gpu_stats_frames++;
+  memset(&gpu_stats, 0, sizeof(gpu_stats));
+}
+
+uint32_t gpu_stats_rect(struct vertex *out, uint32_t left, uint32_t top, uint32_t right, uint32_t bottom, uint32_t color) {
+  uint32_t corners[6][2] = {
+    {left, top}, {right, top}, {left, bottom},
+    {right, top}, {left, bottom}, {right, bottom},
+  };
+  for(int n = 0; n < 6; n++) {
+    out[n].position = corners[n][0] | corners[n][1] << 16;
+    out[n].color = color;
+    out[n].texture_uv = 0;
+    out[n].texpage = 0;
+    out[n].clut = 0;
+  }
+  return(6);
+}
+
+// Appends the overlay to the frame's vertices, returns how many it added
+uint32_t gpu_stats_draw_overlay(struct vertex *out) {
+  uint32_t count = 0;
+  uint32_t frames = gpu_stats_head < GPU_STATS_HISTORY ? gpu_stats_head : GPU_STATS_HISTORY;
+  for(uint32_t n = 0; n < frames; n++) {
+    gpu_frame_stats_t *s = &gpu_stats_history[(gpu_stats_head - frames + n) % GPU_STATS_HISTORY];
+    uint64_t other = s->frame_ns - s->buffer_ns - s->texture_ns - s->swap_ns;
+    if(s->frame_ns < s->buffer_ns + s->texture_ns + s->swap_ns) other = 0;
+    uint64_t parts[4] = { other, s->buffer_ns, s->texture_ns, s->swap_ns };
+    uint32_t colors[4] = { 0x00c000, 0x0000e0, 0x00e0e0, 0xe06000 };
+    uint32_t x = 2 + n * GPU_STATS_BAR_WIDTH, y = GPU_STATS_BOTTOM;
+    for(int part = 0; part < 4; part++) {
+      uint32_t height = parts[part] * GPU_STATS_PX_PER_MS / 1000000;
+      if(height > y - 2) height = y - 2;
+      if(!height) continue;
+      count += gpu_stats_rect(out + count, x, y - height, x + GPU_STATS_BAR_WIDTH - 1, y, colors[part]);
+      y -= height;
+    }
+  }
+  uint32_t budget = GPU_STATS_BOTTOM - (uint64_t)GPU_STATS_BUDGET_NS * GPU_STATS_PX_PER_MS / 1000000;
+  count += gpu_stats_rect(out + count, 2, budget, 2 + GPU_STATS_HISTORY * GPU_STATS_BAR_WIDTH, budget + 1, 0xffffff);
+  return(count);
+}
+
+void gpu_stats_close() {
+  if(!gpu_stats_file) return;
+  fclose(gpu_stats_file);
+  gpu_stats_file = 0;
+}
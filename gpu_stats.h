@@ -0,0 +1,42 @@
+#ifndef GPU_STATS_H
+#define GPU_STATS_H
+
+#include <stdint.h>
+#include "gpu.h"
+
+// What the GPU did between two presented frames, and where the host time
+// went. Kept for the last GPU_STATS_HISTORY frames for the overlay, and
+// optionally logged as one CSV row per frame.
+#define GPU_STATS_HISTORY 128
+
+enum {
+  GPU_STATS_SOLID_RECT,
+  GPU_STATS_TEXTURED_RECT,
+  GPU_STATS_SHADED_TRIANGLE,
+  GPU_STATS_SHADED_RECT,
+  GPU_STATS_OTHER,
+  GPU_STATS_TYPES,
+};
+
+typedef struct gpu_frame_stats_t {
+  uint32_t primitives[GPU_STATS_TYPES];
+  uint32_t vertices;
+  uint32_t vram_upload_bytes;
+  uint32_t draw_calls;
+  uint32_t texture_uploads;
+  uint64_t buffer_ns;
+  uint64_t texture_ns;
+  uint64_t swap_ns;
+  uint64_t frame_ns;
+} gpu_frame_stats_t;
+
+extern gpu_frame_stats_t gpu_stats;
+extern int gpu_stats_overlay;
+
+void gpu_stats_open_csv(const char *path);
+void gpu_stats_primitive(uint32_t command, uint32_t vertices);
+void gpu_stats_frame();
+uint32_t gpu_stats_draw_overlay(struct vertex *out);
+void gpu_stats_close();
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define HASH_SEED 0xcbf29ce484222325ull
+
+// FNV-1a over 64-bit words, cheap enough to run on the whole of vram every frame
+static inline uint64_t hash_bytes(const void *data, size_t size, uint64_t hash) {
+  const uint8_t *bytes = data;
+  size_t n = 0;
+  for(; n + 8 <= size; n += 8) {
+    uint64_t word;
+    memcpy(&word, bytes + n, 8);
+    hash = (hash ^ word) * 0x100000001b3ull;
+  }
+  for(; n < size; n++)
+    hash = (hash ^ bytes[n]) * 0x100000001b3ull;
+  return(hash);
+}
+
+#endif
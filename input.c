@@ -0,0 +1,106 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "input.h"
+#include "latency.h"
+
+#include <SDL2/SDL.h>
+
+// Scripts drive the pad in headless runs. Each line is a frame number, the
+// pressed buttons in hex and optionally four analog axes, which switch the
+// pad to analog mode. The state holds until the next line, frames count
+// VBlanks from power-on and lines must be in order. # starts a comment.
+typedef struct input_step_t {
+  uint64_t frame;
+  uint16_t buttons;
+  uint8_t axes[4];
+  int analog;
+} input_step_t;
+
+uint16_t input_buttons;
+// Keyboard state, only latched into input_buttons at VBlank so a movie
+// records each change at the same point replay applies it
+uint16_t input_keys;
+uint8_t input_axes[4] = {0x80, 0x80, 0x80, 0x80};
+int input_analog;
+
+input_step_t *input_script;
+uint32_t input_script_length, input_script_position;
+uint64_t input_frames;
+
+const struct {
+  int key;
+  uint16_t button;
+} input_keymap[] = {
+  {SDLK_UP, INPUT_UP},
+  {SDLK_DOWN, INPUT_DOWN},
+  {SDLK_LEFT, INPUT_LEFT},
+  {SDLK_RIGHT, INPUT_RIGHT},
+  {SDLK_RETURN, INPUT_START},
+  {SDLK_BACKSPACE, INPUT_SELECT},
+  {SDLK_z, INPUT_CROSS},
+  {SDLK_x, INPUT_CIRCLE},
+  {SDLK_a, INPUT_SQUARE},
+  {SDLK_s, INPUT_TRIANGLE},
+  {SDLK_q, INPUT_L1},
+  {SDLK_w, INPUT_R1},
+  {SDLK_1, INPUT_L2},
+  {SDLK_2, INPUT_R2},
+};
+
+void input_key(int key, int down) {
+  if(input_script) return;
+  for(uint32_t n = 0; n < sizeof(input_keymap) / sizeof(input_keymap[0]); n++) {
+    if(input_keymap[n].key != key) continue;
+    uint16_t keys = input_keys;
+    if(down) input_keys |= input_keymap[n].button;
+    else input_keys &= ~input_keymap[n].button;
+    if(input_keys != keys) latency_input();
+  }
+}
+
+void input_open_script(const char *path) {
+  FILE *file = fopen(path, "r");
+  if(!file) {
+    printf("Failed to open input script: %s\n", path);
+    exit(1);
+  }
+  char line[256];
+  uint32_t capacity = 0, number = 0;
+  while(fgets(line, sizeof(line), file)) {
+    number++;
+    input_step_t step = {0};
+    unsigned int axes[4];
+    int fields = sscanf(line, "%lu %hx %u %u %u %u", &step.frame, &step.buttons, &axes[0], &axes[1], &axes[2], &axes[3]);
+    if(fields <= 0 || line[0] == '#') continue;
+    if(fields != 2 && fields != 6) {
+      printf("Bad input script line %u: %s", number, line);
+      exit(1);
+    }
+    step.analog = fields == 6;
+    for(int n = 0; n < 4; n++)
+      step.axes[n] = step.analog ? axes[n] : 0x80;
+    if(input_script_length == capacity) {
+      capacity = capacity ? capacity * 2 : 256;
+      input_script = realloc(input_script, capacity * sizeof(input_step_t));
+    }
+    input_script[input_script_length++] = step;
+  }
+  fclose(file);
+  if(!input_script)
+    input_script = malloc(sizeof(input_step_t));
+}
+
+// Called once per VBlank
+void input_frame() {
+  input_frames++;
+  if(!input_script) input_buttons = input_keys;
+  while(input_script_position < input_script_length && input_script[input_script_position].frame <= input_frames) {
+    input_step_t *step = &input_script[input_script_position++];
+    if(input_buttons != step->buttons) latency_input();
+    input_buttons = step->buttons;
+    input_analog = step->analog;
+    for(int n = 0; n < 4; n++)
+      input_axes[n] = step->axes[n];
+  }
+}
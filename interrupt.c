@@ -1,11 +1,66 @@
 #include <stdint.h>
+#include "cpu.h"
 #include "memory.h"
+#include "interrupt.h"
+#include "trace.h"
+
+uint32_t interrupt_stat;
+uint32_t interrupt_mask;
+
+// The controller drives a single line into COP0 cause bit 10
+void interrupt_update() {
+  cpu_set_interrupt_line((interrupt_stat & interrupt_mask) != 0);
+}
+
+void interrupt_request(int irq) {
+  TRACE_EVENT(TRACE_IRQ, irq, 0, 0);
+  interrupt_stat |= 1 << irq;
+  interrupt_update();
+}
+
+uint32_t interrupt_load_32(uint32_t address) {
+  switch(address & 0xf) {
+    case 0x0: return(interrupt_stat);
+    case 0x4: return(interrupt_mask);
+    default: return(0);
+  }
+}
+uint16_t interrupt_load_16(uint32_t address) {
+  return(interrupt_load_32(address & ~3) >> ((address & 2) * 8));
+}
+uint8_t interrupt_load_8(uint32_t address) {
+  return(interrupt_load_32(address & ~3) >> ((address & 3) * 8));
+}
+
+void interrupt_store_32(uint32_t address, uint32_t value) {
+  switch(address & 0xf) {
+    case 0x0:
+      // Writing 0 to a bit acknowledges it
+      interrupt_stat &= value;
+      break;
+    case 0x4:
+      interrupt_mask = value & 0x7ff;
+      break;
+  }
+  interrupt_update();
+}
+void interrupt_store_16(uint32_t address, uint16_t value) {
+  if(address & 2) return;
+  interrupt_store_32(address, value | 0xffff0000);
+}
+void interrupt_store_8(uint32_t address, uint8_t value) {
+  if(address & 3) return;
+  // Pad I_STAT with 1 bits so nothing else is acknowledged, but keep the
+  // rest of I_MASK
+  if(address & 4) interrupt_store_32(address, (interrupt_mask & ~0xff) | value);
+  else interrupt_store_32(address, value | 0xffffff00);
+}
 
  memory_accessor_t interrupt_accessor = {
-  .load_32 = memory_dummy_load_32,
-  .load_16 = memory_dummy_load_16,
-  .load_8 = memory_dummy_load_8,
-  .store_32 = memory_dummy_store_32,
-  .store_16 = memory_dummy_store_16,
-  .store_8 = memory_dummy_store_8,
+  .load_32 = interrupt_load_32,
+  .load_16 = interrupt_load_16,
+  .load_8 = interrupt_load_8,
+  .store_32 = interrupt_store_32,
+  .store_16 = interrupt_store_16,
+  .store_8 = interrupt_store_8,
 };
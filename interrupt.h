@@ -0,0 +1,18 @@
+#ifndef INTERRUPT_H
+#define INTERRUPT_H
+
+#define IRQ_VBLANK    0
+#define IRQ_GPU       1
+#define IRQ_CDROM     2
+#define IRQ_DMA       3
+#define IRQ_TIMER0    4
+#define IRQ_TIMER1    5
+#define IRQ_TIMER2    6
+#define IRQ_PERIPHERAL 7
+#define IRQ_SIO       8
+#define IRQ_SPU       9
+#define IRQ_LIGHTPEN  10
+
+void interrupt_request(int irq);
+
+#endif
@@ -0,0 +1,128 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "latency.h"
+#include "gpu.h"
+#include "telemetry.h"
+
+#define LATENCY_PENDING 32
+// Events that change nothing on screen, a button release say, give up
+#define LATENCY_TIMEOUT_FRAMES 120
+
+typedef struct latency_event_t {
+  uint64_t input_ns;
+  uint64_t read_ns;
+  uint64_t input_frame;
+  int read;
+} latency_event_t;
+
+typedef struct latency_sample_t {
+  double read_ms;
+  double photon_ms;
+  uint32_t frames;
+} latency_sample_t;
+
+int latency_enabled;
+latency_event_t latency_pending[LATENCY_PENDING];
+uint32_t latency_pending_count;
+uint64_t latency_baseline;
+int latency_has_baseline;
+uint64_t latency_frames, latency_dropped, latency_unanswered;
+
+latency_sample_t *latency_samples;
+uint32_t latency_sample_count, latency_sample_capacity;
+
+void latency_open() {
+  latency_enabled = 1;
+  atexit(latency_close);
+}
+
+// Called whenever the pad state changes
+void latency_input() {
+  if(!latency_enabled) return;
+  if(latency_pending_count == LATENCY_PENDING) {
+    latency_dropped++;
+    return;
+  }
+  latency_event_t *event = &latency_pending[latency_pending_count++];
+  event->input_ns = telemetry_now();
+  event->input_frame = latency_frames;
+  event->read = 0;
+}
+
+// Called when the guest reads the pad buttons
+void latency_read() {
+  if(!latency_pending_count) return;
+  uint64_t now = telemetry_now();
+  for(uint32_t n = 0; n < latency_pending_count; n++) {
+    if(latency_pending[n].read) continue;
+    latency_pending[n].read = 1;
+    latency_pending[n].read_ns = now;
+  }
+}
+
+void latency_record(latency_event_t *event, uint64_t now) {
+  if(latency_sample_count == latency_sample_capacity) {
+    latency_sample_capacity = latency_sample_capacity ? latency_sample_capacity * 2 : 1024;
+    latency_samples = realloc(latency_samples, latency_sample_capacity * sizeof(latency_sample_t));
+  }
+  latency_sample_t *sample = &latency_samples[latency_sample_count++];
+  sample->read_ms = (event->read_ns - event->input_ns) / 1e6;
+  sample->photon_ms = (now - event->input_ns) / 1e6;
+  sample->frames = latency_frames - event->input_frame;
+}
+
+// Called after every presented frame
+void latency_frame() {
+  latency_frames++;
+  if(!latency_pending_count) {
+    latency_has_baseline = 0;
+    return;
+  }
+  uint64_t now = telemetry_now();
+  uint64_t hash = gpu_display_hash();
+  int changed = latency_has_baseline && hash != latency_baseline;
+  uint32_t kept = 0;
+  for(uint32_t n = 0; n < latency_pending_count; n++) {
+    latency_event_t *event = &latency_pending[n];
+    if(event->read && changed)
+      latency_record(event, now);
+    else if(latency_frames - event->input_frame > LATENCY_TIMEOUT_FRAMES)
+      latency_unanswered++;
+    else
+      latency_pending[kept++] = *event;
+  }
+  latency_pending_count = kept;
+  latency_baseline = hash;
+  latency_has_baseline = 1;
+}
+
+int latency_compare(const void *a, const void *b) {
+  double x = *(double *)a, y = *(double *)b;
+  return((x > y) - (x < y));
+}
+
+void latency_percentiles(const char *name, double *values, uint32_t count) {
+  qsort(values, count, sizeof(double), latency_compare);
+  printf("  %-16s p50 %7.2fms  p90 %7.2fms  p99 %7.2fms  max %7.2fms\n", name,
+    values[count * 50 / 100], values[count * 90 / 100], values[count * 99 / 100], values[count - 1]);
+}
+
+void latency_close() {
+  if(!latency_enabled) return;
+  latency_enabled = 0;
+  printf("Input latency: %u events measured", latency_sample_count);
+  if(latency_unanswered) printf(", %lu with no visible response", latency_unanswered);
+  if(latency_dropped) printf(", %lu dropped", latency_dropped);
+  printf("\n");
+  if(!latency_sample_count) return;
+  double *values = malloc(latency_sample_count * sizeof(double));
+  for(uint32_t n = 0; n < latency_sample_count; n++) values[n] = latency_samples[n].read_ms;
+  latency_percentiles("input to read", values, latency_sample_count);
+  for(uint32_t n = 0; n < latency_sample_count; n++) values[n] = latency_samples[n].photon_ms;
+  latency_percentiles("input to photon", values, latency_sample_count);
+  double frames = 0;
+  for(uint32_t n = 0; n < latency_sample_count; n++) frames += latency_samples[n].frames;
+  printf("  %.2f frames on average\n", frames / latency_sample_count);
+  free(values);
+}
@@ -0,0 +1,19 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+// Input-to-photon latency. An input event is timestamped when it reaches
+// the pad state, tagged when the guest next reads the pad, and completed
+// by the first presented frame that differs from the one before it. Games
+// that animate constantly complete events early, menus and other still
+// screens give exact figures.
+extern int latency_enabled;
+
+void latency_open();
+void latency_input();
+void latency_read();
+void latency_frame();
+void latency_close();
+
+#endif
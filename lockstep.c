@@ -0,0 +1,221 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lockstep.h"
+#include "cpu.h"
+#include "memory.h"
+#include "scheduler.h"
+#include "timing.h"
+
+// Runs a candidate CPU engine against the interpreter one block at a time.
+// The interpreter goes first against the real devices while its data
+// accesses are logged, then the CPU is rewound and the candidate runs the
+// same number of instructions with its loads answered from the log and its
+// stores checked against it. Registers, COP0 and the cycle count must then
+// agree, and the run continues from the interpreter's state. A store
+// outside RAM and the scratchpad ends the block, so device effects on the
+// CPU (the interrupt line) land between blocks. RAM stores are undone
+// while the candidate runs, so an engine that reads code ahead of time sees
+// what the interpreter fetched.
+#define LOCKSTEP_BLOCK 256
+#define LOCKSTEP_LOG   (LOCKSTEP_BLOCK * 2)
+
+enum {LOCKSTEP_OFF, LOCKSTEP_LOG_ACCESS, LOCKSTEP_REPLAY};
+
+typedef struct lockstep_access_t {
+  uint32_t address;
+  uint32_t value;
+  // What a RAM store overwrote
+  uint32_t previous;
+  uint8_t size;
+  uint8_t store;
+} lockstep_access_t;
+
+int lockstep_enabled;
+cpu_engine_t *lockstep_engine;
+uint32_t lockstep_interval = 1;
+uint64_t lockstep_blocks, lockstep_checked;
+
+int lockstep_mode;
+lockstep_access_t lockstep_log[LOCKSTEP_LOG];
+uint32_t lockstep_log_length, lockstep_log_position;
+char lockstep_error[256];
+
+void lockstep_open(const char *spec) {
+  char name[64];
+  snprintf(name, sizeof(name), "%s", spec);
+  char *interval = strchr(name, ':');
+  if(interval) {
+    *interval++ = 0;
+    lockstep_interval = atoi(interval);
+    if(!lockstep_interval) lockstep_interval = 1;
+  }
+  lockstep_engine = cpu_find_engine(name);
+  lockstep_enabled = 1;
+}
+
+void lockstep_fail(const char *format, lockstep_access_t *expected, lockstep_access_t *got) {
+  if(lockstep_error[0]) return;
+  snprintf(lockstep_error, sizeof(lockstep_error), format,
+    expected->store ? "store" : "load", expected->size, expected->address, expected->value,
+    got->store ? "store" : "load", got->size, got->address, got->value);
+}
+
+uint32_t lockstep_access(uint32_t address, uint32_t value, uint8_t size, uint8_t store) {
+  lockstep_access_t access = {address, value, 0, size, store};
+  memory_accessor_t *device = memory_decode_device(address);
+  if(store && device != &ram_accessor && device != &scratchpad_accessor)
+    cpu_block_break = 1;
+
+  if(lockstep_mode == LOCKSTEP_REPLAY) {
+    if(lockstep_log_position == lockstep_log_length) {
+      lockstep_access_t none = {0};
+      lockstep_fail("access log ended, expected %s%u [%08x] = %08x, got %s%u [%08x] = %08x", &none, &access);
+      return(0);
+    }
+    lockstep_access_t *expected = &lockstep_log[lockstep_log_position++];
+    if(expected->address != address || expected->size != size || expected->store != store || (store && expected->value != value))
+      lockstep_fail("expected %s%u [%08x] = %08x, got %s%u [%08x] = %08x", expected, &access);
+    return(expected->value);
+  }
+
+  if(store && device == &ram_accessor) {
+    switch(size) {
+      case 8: access.previous = device->load_8(address); break;
+      case 16: access.previous = device->load_16(address); break;
+      case 32: access.previous = device->load_32(address); break;
+    }
+  }
+  switch(size * 2 + store) {
+    case 16: access.value = device->load_8(address); break;
+    case 17: device->store_8(address, value); break;
+    case 32: access.value = device->load_16(address); break;
+    case 33: device->store_16(address, value); break;
+    case 64: access.value = device->load_32(address); break;
+    case 65: device->store_32(address, value); break;
+  }
+  if(lockstep_log_length < LOCKSTEP_LOG)
+    lockstep_log[lockstep_log_length++] = access;
+  return(access.value);
+}
+
+uint32_t lockstep_load_32(uint32_t address) { return(lockstep_access(address, 0, 32, 0)); }
+uint16_t lockstep_load_16(uint32_t address) { return(lockstep_access(address, 0, 16, 0)); }
+uint8_t lockstep_load_8(uint32_t address) { return(lockstep_access(address, 0, 8, 0)); }
+void lockstep_store_32(uint32_t address, uint32_t value) { lockstep_access(address, value, 32, 1); }
+void lockstep_store_16(uint32_t address, uint16_t value) { lockstep_access(address, value, 16, 1); }
+void lockstep_store_8(uint32_t address, uint8_t value) { lockstep_access(address, value, 8, 1); }
+
+ memory_accessor_t lockstep_accessor = {
+  .load_32 = lockstep_load_32,
+  .load_16 = lockstep_load_16,
+  .load_8 = lockstep_load_8,
+  .store_32 = lockstep_store_32,
+  .store_16 = lockstep_store_16,
+  .store_8 = lockstep_store_8,
+};
+
+// Takes the interpreter's RAM stores back out, or puts them back in
+void lockstep_rewind_ram(int undo) {
+  for(uint32_t n = 0; n < lockstep_log_length; n++) {
+    lockstep_access_t *access = &lockstep_log[undo ? lockstep_log_length - 1 - n : n];
+    if(!access->store || memory_decode_device(access->address) != &ram_accessor) continue;
+    uint32_t value = undo ? access->previous : access->value;
+    switch(access->size) {
+      case 8: ram_accessor.store_8(access->address, value); break;
+      case 16: ram_accessor.store_16(access->address, value); break;
+      case 32: ram_accessor.store_32(access->address, value); break;
+    }
+  }
+}
+
+void lockstep_dump_state(const char *title, cpu_t *state, cpu_t *other, uint64_t cycles) {
+  printf("%s:\n", title);
+  printf("  pc %08x next %08x hi %08x lo %08x cycles %lu\n", state->pc, state->next_pc, state->hi, state->lo, cycles);
+  for(int r = 0; r < 32; r++)
+    printf("  r%-2d %08x%c%s", r, state->reg[r], state->reg[r] != other->reg[r] ? '*' : ' ', r % 4 == 3 ? "\n" : "");
+  for(int r = 0; r < 64; r++)
+    if(state->cop0_reg[r] || other->cop0_reg[r])
+      printf("  cop0r%d %08x%c\n", r, state->cop0_reg[r], state->cop0_reg[r] != other->cop0_reg[r] ? '*' : ' ');
+}
+
+void lockstep_report(uint32_t start, uint32_t count, cpu_t *before, uint64_t before_cycles, cpu_t *reference, uint64_t reference_cycles, cpu_t *candidate, uint64_t candidate_cycles) {
+  printf("Lockstep divergence in block %lu at %08x, %s against the interpreter\n", lockstep_blocks, start, lockstep_engine->name);
+  if(lockstep_error[0]) printf("  %s\n", lockstep_error);
+  printf("Block, %u instructions:\n", count);
+  for(uint32_t n = 0; n < count; n++)
+    printf("  %08x: %08x\n", start + n * 4, memory_fetch_32(start + n * 4));
+  printf("Accesses:\n");
+  for(uint32_t n = 0; n < lockstep_log_length; n++)
+    printf("  %c%-2u [%08x] = %08x%s\n", lockstep_log[n].store ? 'W' : 'R', lockstep_log[n].size, lockstep_log[n].address, lockstep_log[n].value, n == lockstep_log_position ? " <- candidate stopped here" : "");
+  lockstep_dump_state("Before", before, before, before_cycles);
+  lockstep_dump_state("Interpreter", reference, candidate, reference_cycles);
+  lockstep_dump_state(lockstep_engine->name, candidate, reference, candidate_cycles);
+  exit(1);
+}
+
+// Differences an engine can't be blamed for: the interrupt line is driven
+// by devices the candidate never touches
+int lockstep_compare(cpu_t *a, cpu_t *b) {
+  cpu_t x = *a, y = *b;
+  x.cop0_registers.cause &= ~(1 << 10);
+  y.cop0_registers.cause &= ~(1 << 10);
+  return(memcmp(&x, &y, sizeof(cpu_t)));
+}
+
+void lockstep_block() {
+  lockstep_blocks++;
+  if(lockstep_blocks % lockstep_interval) {
+    lockstep_engine->run_block(LOCKSTEP_BLOCK);
+    return;
+  }
+  lockstep_checked++;
+  cpu_t before = cpu;
+  int irq_before = cpu_irq_pending;
+  uint64_t cycles_before = scheduler_cycles;
+  timing_state_t timing_before = timing_state;
+
+  lockstep_mode = LOCKSTEP_LOG_ACCESS;
+  lockstep_log_length = 0;
+  memory_lockstep = 1;
+  uint32_t count = cpu_run_block(LOCKSTEP_BLOCK);
+  lockstep_rewind_ram(1);
+  cpu_t reference = cpu;
+  int irq_reference = cpu_irq_pending;
+  uint64_t cycles_reference = scheduler_cycles;
+  timing_state_t timing_reference = timing_state;
+
+  cpu = before;
+  cpu_irq_pending = irq_before;
+  scheduler_cycles = cycles_before;
+  timing_state = timing_before;
+  lockstep_mode = LOCKSTEP_REPLAY;
+  lockstep_log_position = 0;
+  lockstep_error[0] = 0;
+  uint32_t candidate_count = lockstep_engine->run_block(count);
+  memory_lockstep = 0;
+  lockstep_mode = LOCKSTEP_OFF;
+  lockstep_rewind_ram(0);
+
+  if(candidate_count != count && !lockstep_error[0])
+    snprintf(lockstep_error, sizeof(lockstep_error), "ran %u instructions, expected %u", candidate_count, count);
+  if(lockstep_log_position != lockstep_log_length && !lockstep_error[0])
+    snprintf(lockstep_error, sizeof(lockstep_error), "made %u of %u data accesses", lockstep_log_position, lockstep_log_length);
+  if(lockstep_error[0] || lockstep_compare(&cpu, &reference) || scheduler_cycles != cycles_reference)
+    lockstep_report(before.pc, count, &before, cycles_before, &reference, cycles_reference, &cpu, scheduler_cycles);
+
+  cpu = reference;
+  cpu_irq_pending = irq_reference;
+  scheduler_cycles = cycles_reference;
+  timing_state = timing_reference;
+}
+
+void lockstep_run() {
+  printf("Lockstep: %s against the interpreter, checking 1 block in %u\n", lockstep_engine->name, lockstep_interval);
+  while(1) {
+    if(cpu_irq_pending) cpu_interrupt();
+    lockstep_block();
+    if(scheduler_cycles >= scheduler_deadline) scheduler_run();
+  }
+}
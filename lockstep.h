@@ -0,0 +1,9 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+extern int lockstep_enabled;
+
+void lockstep_open(const char *spec);
+void lockstep_run();
+
+#endif
@@ -0,0 +1,425 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "mdec.h"
+#include "memory.h"
+#include "dma.h"
+#include "scheduler.h"
+#include "ring.h"
+
+// The emulation thread only parses commands far enough to know which words
+// are parameters. The word stream goes to a worker thread in batches, which
+// decodes each macroblock as soon as its data is complete and queues the
+// pixels for DMA1. DMA1 finishes a fixed number of emulated cycles per word
+// after it starts, so timing never depends on the host, and the emulation
+// thread only waits if the worker is still behind at that point.
+#define MDEC_IN_RING     (1 << 20)
+#define MDEC_OUT_RING    (1 << 21)
+#define MDEC_BATCH       1024
+#define MDEC_RESET       0x80000000
+#define MDEC_CYCLES_PER_WORD 16
+// Retry interval for a DMA1 waiting on data the game hasn't sent yet
+#define MDEC_RETRY       (CPU_CLOCK / 10000)
+
+#define MDEC_STATUS_EMPTY   0x80000000
+#define MDEC_STATUS_BUSY    0x20000000
+#define MDEC_STATUS_IN_REQ  0x10000000
+#define MDEC_STATUS_OUT_REQ 0x08000000
+
+typedef int32_t mdec_v8 __attribute__((vector_size(32)));
+
+extern uint8_t ram[];
+
+const uint8_t mdec_zagzig[64] = {
+   0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+  12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+  58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// Emulation thread
+uint32_t mdec_status;
+uint32_t mdec_control;
+uint32_t mdec_remaining;
+uint32_t mdec_batch[MDEC_BATCH + 1];
+uint32_t mdec_batch_length;
+uint32_t mdec_dma_address, mdec_dma_words;
+int mdec_dma_pending;
+uint64_t mdec_stalls;
+
+// Shared
+uint8_t *mdec_in_data, *mdec_out_data;
+ring_t mdec_in, mdec_out;
+_Atomic uint32_t mdec_generation;
+_Atomic uint32_t mdec_acknowledged;
+_Atomic int mdec_idle;
+_Atomic int mdec_stop;
+int mdec_running;
+pthread_t mdec_thread;
+sem_t mdec_wake;
+
+// Worker thread
+uint32_t mdec_worker_generation;
+uint32_t mdec_command;
+uint32_t mdec_params;
+uint16_t mdec_data[0x20000];
+uint32_t mdec_data_length, mdec_data_position;
+uint8_t mdec_quant_luma[64], mdec_quant_chroma[64];
+mdec_v8 mdec_scale[8];
+
+static inline int32_t mdec_signed10(uint16_t n) {
+  return((int32_t)((uint32_t)n << 22) >> 22);
+}
+
+// Run-length decodes one block. Returns the position after it, or -1 if the
+// data received so far ends first.
+int32_t mdec_rle(int32_t *block, uint32_t position, const uint8_t *quant) {
+  memset(block, 0, 64 * sizeof(int32_t));
+  while(position < mdec_data_length && mdec_data[position] == 0xfe00)
+    position++;
+  if(position >= mdec_data_length) return(-1);
+  uint16_t n = mdec_data[position++];
+  int32_t q_scale = n >> 10;
+  int32_t value = mdec_signed10(n) * quant[0];
+  uint32_t k = 0;
+  while(1) {
+    if(!q_scale) value = mdec_signed10(n) * 2;
+    if(value < -0x400) value = -0x400;
+    if(value > 0x3ff) value = 0x3ff;
+    block[q_scale ? mdec_zagzig[k] : k] = value;
+    if(position >= mdec_data_length) return(-1);
+    n = mdec_data[position++];
+    k += (n >> 10) + 1;
+    if(k > 63) return(position);
+    value = (mdec_signed10(n) * quant[k] * q_scale + 4) / 8;
+  }
+}
+
+// Two passes of a transposing multiply by the scale table, one output row
+// per vector
+static inline void mdec_idct(int32_t *block) {
+  int32_t temp[64];
+  int32_t *src = block, *dst = temp;
+  for(int pass = 0; pass < 2; pass++) {
+    for(int y = 0; y < 8; y++) {
+      mdec_v8 sum = {0};
+      for(int z = 0; z < 8; z++)
+        sum += ((mdec_v8){} + src[y + z * 8]) * mdec_scale[z];
+      sum = (sum + 0x1000) >> 13;
+      memcpy(dst + y * 8, &sum, sizeof(sum));
+    }
+    src = dst;
+    dst = block;
+  }
+}
+
+// Clamps to a signed byte and converts to unsigned if the command asks for it
+static inline void mdec_clamp(mdec_v8 *v, int32_t flip) {
+  mdec_v8 low = (mdec_v8){} - 128, high = (mdec_v8){} + 127;
+  mdec_v8 under = *v < low, over = *v > high;
+  *v = (*v & ~under) | (low & under);
+  *v = ((*v & ~over) | (high & over)) ^ flip;
+}
+
+void mdec_output(const void *data, uint32_t bytes) {
+  while(1) {
+    // A reset drops whatever is still being decoded
+    if(atomic_load(&mdec_generation) != mdec_worker_generation) return;
+    uint32_t written = ring_write(&mdec_out, data, bytes);
+    data = (const uint8_t *)data + written;
+    bytes -= written;
+    if(!bytes) return;
+    struct timespec ts = {0, 200000};
+    nanosleep(&ts, 0);
+  }
+}
+
+// Converts decoded blocks (Cr, Cb, Y1-Y4, or a single Y) to output pixels
+__attribute__((target_clones("avx2", "default")))
+uint32_t mdec_pixels(int32_t blocks[6][64], int count, uint8_t *out) {
+  int depth = (mdec_command >> 27) & 3;
+  int32_t flip = mdec_command & (1 << 26) ? 0 : 0x80;
+  for(int b = 0; b < count; b++)
+    mdec_idct(blocks[b]);
+
+  if(count == 1) {
+    for(int row = 0; row < 8; row++) {
+      mdec_v8 y;
+      memcpy(&y, blocks[0] + row * 8, sizeof(y));
+      mdec_clamp(&y, flip);
+      for(int x = 0; x < 8; x++) {
+        if(depth == 0)
+          out[row * 4 + x / 2] = x & 1 ? out[row * 4 + x / 2] | (y[x] & 0xf0) : (y[x] & 0xff) >> 4;
+        else
+          out[row * 8 + x] = y[x];
+      }
+    }
+    return(depth == 0 ? 32 : 64);
+  }
+
+  uint16_t bit15 = mdec_command & (1 << 25) ? 0x8000 : 0;
+  for(int b = 0; b < 4; b++) {
+    int bx = (b & 1) * 8, by = (b >> 1) * 8;
+    mdec_v8 pick = {0, 0, 1, 1, 2, 2, 3, 3};
+    pick += bx / 2;
+    for(int row = 0; row < 8; row++) {
+      mdec_v8 y, cr, cb;
+      memcpy(&y, blocks[2 + b] + row * 8, sizeof(y));
+      memcpy(&cr, blocks[0] + (by + row) / 2 * 8, sizeof(cr));
+      memcpy(&cb, blocks[1] + (by + row) / 2 * 8, sizeof(cb));
+      cr = __builtin_shuffle(cr, pick);
+      cb = __builtin_shuffle(cb, pick);
+      mdec_v8 r = y + ((cr * 359) >> 8);
+      mdec_v8 g = y - ((cb * 88 + cr * 183) >> 8);
+      mdec_v8 bl = y + ((cb * 454) >> 8);
+      mdec_clamp(&r, flip);
+      mdec_clamp(&g, flip);
+      mdec_clamp(&bl, flip);
+      uint32_t pixel = (by + row) * 16 + bx;
+      for(int x = 0; x < 8; x++) {
+        if(depth == 2) {
+          out[(pixel + x) * 3] = r[x];
+          out[(pixel + x) * 3 + 1] = g[x];
+          out[(pixel + x) * 3 + 2] = bl[x];
+        } else {
+          uint16_t rgb = ((r[x] & 0xff) >> 3) | ((g[x] & 0xff) >> 3) << 5 | ((bl[x] & 0xff) >> 3) << 10 | bit15;
+          memcpy(out + (pixel + x) * 2, &rgb, 2);
+        }
+      }
+    }
+  }
+  return(depth == 2 ? 768 : 512);
+}
+
+// Decodes every macroblock whose data has arrived
+void mdec_decode() {
+  int depth = (mdec_command >> 27) & 3;
+  int count = depth < 2 ? 1 : 6;
+  int32_t blocks[6][64];
+  uint8_t out[768];
+  while(1) {
+    int32_t position = mdec_data_position;
+    for(int b = 0; b < count && position >= 0; b++)
+      position = mdec_rle(blocks[b], position, count == 6 && b < 2 ? mdec_quant_chroma : mdec_quant_luma);
+    if(position < 0) return;
+    mdec_data_position = position;
+    mdec_output(out, mdec_pixels(blocks, count, out));
+  }
+}
+
+void mdec_process(uint32_t word) {
+  if(!mdec_params) {
+    mdec_command = word;
+    mdec_data_length = mdec_data_position = 0;
+    switch(word >> 29) {
+      case 1: mdec_params = word & 0xffff; break;
+      case 2: mdec_params = word & 1 ? 32 : 16; break;
+      case 3: mdec_params = 32; break;
+    }
+    return;
+  }
+  mdec_params--;
+  mdec_data[mdec_data_length++] = word;
+  mdec_data[mdec_data_length++] = word >> 16;
+  if(mdec_params) return;
+  if(mdec_command >> 29 == 2) {
+    memcpy(mdec_quant_luma, mdec_data, 64);
+    if(mdec_command & 1) memcpy(mdec_quant_chroma, (uint8_t *)mdec_data + 64, 64);
+  } else if(mdec_command >> 29 == 3) {
+    for(int z = 0; z < 8; z++)
+      for(int x = 0; x < 8; x++)
+        mdec_scale[z][x] = (int16_t)mdec_data[z * 8 + x] >> 3;
+  }
+}
+
+void *mdec_worker(void *arg) {
+  uint32_t header, words[MDEC_BATCH];
+  while(!atomic_load(&mdec_stop)) {
+    if(ring_used(&mdec_in) < 4) {
+      atomic_store(&mdec_idle, 1);
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_nsec += 100000000;
+      if(ts.tv_nsec >= 1000000000) { ts.tv_sec++; ts.tv_nsec -= 1000000000; }
+      sem_timedwait(&mdec_wake, &ts);
+      continue;
+    }
+    atomic_store(&mdec_idle, 0);
+    // Messages are written in one piece, so the payload is always complete
+    ring_read(&mdec_in, &header, 4);
+    uint32_t count = header & 0xffff;
+    ring_read(&mdec_in, words, count * 4);
+    if(header & MDEC_RESET) {
+      mdec_worker_generation = words[0];
+      mdec_command = 0;
+      mdec_params = 0;
+      mdec_data_length = mdec_data_position = 0;
+      atomic_store(&mdec_acknowledged, mdec_worker_generation);
+      continue;
+    }
+    if(atomic_load(&mdec_generation) != mdec_worker_generation) continue;
+    for(uint32_t n = 0; n < count; n++) {
+      mdec_process(words[n]);
+      // Decode at the end of each batch, and when the last parameter
+      // arrives before the next command clears the data
+      if(mdec_command >> 29 == 1 && (!mdec_params || n == count - 1))
+        mdec_decode();
+    }
+  }
+  return(0);
+}
+
+void mdec_send(uint32_t header, const uint32_t *words, uint32_t count) {
+  uint32_t message[MDEC_BATCH + 1];
+  message[0] = header | count;
+  memcpy(message + 1, words, count * 4);
+  // Only fills up if the game sends far more than it reads back
+  while(ring_free(&mdec_in) < (count + 1) * 4)
+    sched_yield();
+  ring_write(&mdec_in, message, (count + 1) * 4);
+  sem_post(&mdec_wake);
+}
+
+void mdec_flush() {
+  if(!mdec_batch_length) return;
+  mdec_send(0, mdec_batch, mdec_batch_length);
+  mdec_batch_length = 0;
+}
+
+void mdec_write(uint32_t word) {
+  if(mdec_remaining) {
+    mdec_remaining--;
+  } else {
+    // Command bits 25-28 show up in status bits 23-26
+    mdec_status = (word >> 2) & 0x07800000;
+    switch(word >> 29) {
+      case 1: mdec_remaining = word & 0xffff; break;
+      case 2: mdec_remaining = word & 1 ? 32 : 16; break;
+      case 3: mdec_remaining = 32; break;
+      default: printf("Unknown MDEC command: %08x\n", word);
+    }
+  }
+  mdec_batch[mdec_batch_length++] = word;
+  if(mdec_batch_length == MDEC_BATCH) mdec_flush();
+}
+
+void mdec_discard() {
+  uint8_t buffer[4096];
+  while(ring_read(&mdec_out, buffer, sizeof(buffer)));
+}
+
+// Waits for the worker to discard everything queued before the reset
+void mdec_abort() {
+  mdec_batch_length = 0;
+  uint32_t generation = atomic_fetch_add(&mdec_generation, 1) + 1;
+  mdec_send(MDEC_RESET, &generation, 1);
+  while(atomic_load(&mdec_acknowledged) != generation) {
+    mdec_discard();
+    sched_yield();
+  }
+  mdec_discard();
+  mdec_remaining = 0;
+  mdec_status = 0;
+}
+
+void mdec_dma_event() {
+  while(mdec_dma_words) {
+    uint32_t available = ring_used(&mdec_out) / 4;
+    if(!available) {
+      mdec_flush();
+      // Checked in this order, the worker marks itself idle after emptying the ring
+      if(!ring_used(&mdec_in) && atomic_load(&mdec_idle)) {
+        scheduler_schedule(SCHEDULER_MDEC, scheduler_cycles + MDEC_RETRY, mdec_dma_event);
+        return;
+      }
+      mdec_stalls++;
+      sched_yield();
+      continue;
+    }
+    if(available > mdec_dma_words) available = mdec_dma_words;
+    if(available > (0x200000 - mdec_dma_address) / 4) available = (0x200000 - mdec_dma_address) / 4;
+    ring_read(&mdec_out, ram + mdec_dma_address, available * 4);
+    ram_written(mdec_dma_address, available * 4);
+    mdec_dma_address = (mdec_dma_address + available * 4) & 0x1ffffc;
+    mdec_dma_words -= available;
+  }
+  mdec_dma_pending = 0;
+  dma_complete(1);
+}
+
+void mdec_dma_out(uint32_t address, uint32_t words) {
+  if(mdec_dma_pending) return;
+  mdec_flush();
+  mdec_dma_address = address;
+  mdec_dma_words = words;
+  mdec_dma_pending = 1;
+  scheduler_schedule(SCHEDULER_MDEC, scheduler_cycles + words * MDEC_CYCLES_PER_WORD, mdec_dma_event);
+}
+
+void mdec_reset() {
+  if(!mdec_running) {
+    mdec_in_data = malloc(MDEC_IN_RING);
+    mdec_out_data = malloc(MDEC_OUT_RING);
+    ring_init(&mdec_in, mdec_in_data, MDEC_IN_RING);
+    ring_init(&mdec_out, mdec_out_data, MDEC_OUT_RING);
+    sem_init(&mdec_wake, 0, 0);
+    pthread_create(&mdec_thread, 0, mdec_worker, 0);
+    mdec_running = 1;
+    atexit(mdec_close);
+  }
+  mdec_abort();
+  mdec_control = 0;
+}
+
+void mdec_close() {
+  if(!mdec_running) return;
+  atomic_store(&mdec_stop, 1);
+  sem_post(&mdec_wake);
+  pthread_join(mdec_thread, 0);
+  mdec_running = 0;
+}
+
+uint32_t mdec_load_32(uint32_t address) {
+  if(address & 4) {
+    int busy = mdec_remaining || mdec_dma_pending;
+    uint32_t status = mdec_status | (4 << 16) | ((mdec_remaining - 1) & 0xffff);
+    if(busy) status |= MDEC_STATUS_BUSY;
+    else status |= MDEC_STATUS_EMPTY;
+    if(mdec_control & 0x40000000) status |= MDEC_STATUS_IN_REQ;
+    if(mdec_control & 0x20000000) status |= MDEC_STATUS_OUT_REQ;
+    return(status);
+  }
+  // Reading the data port directly, rarely used outside of DMA1
+  uint32_t word = 0;
+  mdec_flush();
+  while(ring_used(&mdec_out) < 4) {
+    if(!ring_used(&mdec_in) && atomic_load(&mdec_idle)) return(0);
+    sched_yield();
+  }
+  ring_read(&mdec_out, &word, 4);
+  return(word);
+}
+
+void mdec_store_32(uint32_t address, uint32_t value) {
+  if(address & 4) {
+    if(value & 0x80000000) mdec_abort();
+    mdec_control = value & 0x60000000;
+    return;
+  }
+  mdec_write(value);
+  mdec_flush();
+}
+
+ memory_accessor_t mdec_accessor = {
+  .load_32 = mdec_load_32,
+  .load_16 = memory_dummy_load_16,
+  .load_8 = memory_dummy_load_8,
+  .store_32 = mdec_store_32,
+  .store_16 = memory_dummy_store_16,
+  .store_8 = memory_dummy_store_8,
+};
@@ -0,0 +1,14 @@
+#ifndef MDEC_H
+#define MDEC_H
+
+#include <stdint.h>
+
+extern uint64_t mdec_stalls;
+
+void mdec_reset();
+void mdec_close();
+void mdec_write(uint32_t word);
+void mdec_flush();
+void mdec_dma_out(uint32_t address, uint32_t words);
+
+#endif
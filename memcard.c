@@ -0,0 +1,206 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "memcard.h"
+
+// Cards are mapped straight from their files, so a completed write only
+// touches memory. A background thread msyncs the pages holding dirty
+// sectors soon after, and everything is synced again on exit, so the guest
+// never waits on the disk.
+#define MEMCARD_FLAG_NEW 0x08
+
+typedef struct memcard_t {
+  uint8_t *data;
+  int fd;
+  uint8_t flag;
+  uint8_t command;
+  uint32_t step;
+  uint16_t sector;
+  uint8_t checksum;
+  uint8_t previous;
+  uint8_t result;
+  uint8_t buffer[MEMCARD_SECTOR];
+  // One bit per sector, one word per 4 KB of card
+  _Atomic uint32_t dirty[MEMCARD_SECTORS / 32];
+} memcard_t;
+
+memcard_t memcards[MEMCARD_SLOTS];
+int memcard_count;
+
+pthread_t memcard_thread;
+sem_t memcard_wake;
+_Atomic int memcard_stop;
+
+void memcard_sync(memcard_t *card, uint32_t offset, uint32_t length) {
+  uintptr_t page = sysconf(_SC_PAGESIZE);
+  uintptr_t start = ((uintptr_t)card->data + offset) & ~(page - 1);
+  uintptr_t end = (uintptr_t)card->data + offset + length;
+  if(msync((void *)start, end - start, MS_SYNC))
+    perror("Memory card sync failed");
+}
+
+void *memcard_flusher(void *arg) {
+  while(!atomic_load(&memcard_stop)) {
+    sem_wait(&memcard_wake);
+    for(int slot = 0; slot < memcard_count; slot++) {
+      memcard_t *card = &memcards[slot];
+      for(uint32_t n = 0; n < MEMCARD_SECTORS / 32; n++)
+        if(atomic_exchange(&card->dirty[n], 0))
+          memcard_sync(card, n * 32 * MEMCARD_SECTOR, 32 * MEMCARD_SECTOR);
+    }
+  }
+  return(0);
+}
+
+void memcard_open(const char *path) {
+  if(memcard_count == MEMCARD_SLOTS) {
+    printf("Only %d memory cards can be inserted\n", MEMCARD_SLOTS);
+    exit(1);
+  }
+  memcard_t *card = &memcards[memcard_count];
+  card->fd = open(path, O_RDWR | O_CREAT, 0644);
+  struct stat st;
+  if(card->fd < 0 || fstat(card->fd, &st)) {
+    printf("Failed to open memory card: %s\n", path);
+    exit(1);
+  }
+  if(st.st_size > MEMCARD_SIZE) {
+    printf("Memory card %s is not a raw 128 KB image\n", path);
+    exit(1);
+  }
+  // A new or short file is padded out to an unformatted card
+  if(st.st_size < MEMCARD_SIZE && ftruncate(card->fd, MEMCARD_SIZE)) {
+    printf("Failed to resize memory card: %s\n", path);
+    exit(1);
+  }
+  card->data = mmap(0, MEMCARD_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, card->fd, 0);
+  if(card->data == MAP_FAILED) {
+    printf("Failed to map memory card: %s\n", path);
+    exit(1);
+  }
+  card->flag = MEMCARD_FLAG_NEW;
+  if(!memcard_count++) {
+    sem_init(&memcard_wake, 0, 0);
+    pthread_create(&memcard_thread, 0, memcard_flusher, 0);
+    atexit(memcard_close);
+  }
+}
+
+int memcard_present(int slot) {
+  return(slot < memcard_count);
+}
+
+// The card was addressed with 81h, start a new command
+void memcard_select(int slot) {
+  memcards[slot].step = 0;
+}
+
+uint8_t memcard_read(memcard_t *card, uint32_t step, uint8_t byte, int *ack) {
+  switch(step) {
+    case 4:
+      card->sector = byte << 8;
+      return(0x00);
+    case 5:
+      card->sector |= byte;
+      card->checksum = (card->sector >> 8) ^ byte;
+      return(card->previous);
+    case 6: return(0x5c);
+    case 7: return(0x5d);
+    case 8:
+      if(card->sector >= MEMCARD_SECTORS) {
+        *ack = 0;
+        return(0xff);
+      }
+      return(card->sector >> 8);
+    case 9: return(card->sector);
+    case 138: return(card->checksum);
+    case 139:
+      *ack = 0;
+      return(0x47);
+  }
+  uint8_t value = card->data[card->sector * MEMCARD_SECTOR + step - 10];
+  card->checksum ^= value;
+  return(value);
+}
+
+uint8_t memcard_write(memcard_t *card, uint32_t step, uint8_t byte, int *ack) {
+  switch(step) {
+    case 4:
+      card->sector = byte << 8;
+      return(0x00);
+    case 5:
+      card->sector |= byte;
+      card->checksum = (card->sector >> 8) ^ byte;
+      return(card->previous);
+    case 134:
+      if(card->sector >= MEMCARD_SECTORS) {
+        card->result = 0xff;
+      } else if(byte != card->checksum) {
+        card->result = 0x4e;
+      } else {
+        memcpy(card->data + card->sector * MEMCARD_SECTOR, card->buffer, MEMCARD_SECTOR);
+        atomic_fetch_or(&card->dirty[card->sector / 32], 1u << (card->sector % 32));
+        card->flag &= ~MEMCARD_FLAG_NEW;
+        card->result = 0x47;
+        sem_post(&memcard_wake);
+      }
+      return(card->previous);
+    case 135: return(0x5c);
+    case 136: return(0x5d);
+    case 137:
+      *ack = 0;
+      return(card->result);
+  }
+  card->buffer[step - 6] = byte;
+  card->checksum ^= byte;
+  return(card->previous);
+}
+
+// Exchanges one byte of a command, clears ack after the last one
+uint8_t memcard_transfer(int slot, uint8_t byte, int *ack) {
+  memcard_t *card = &memcards[slot];
+  uint32_t step = ++card->step;
+  uint8_t response = 0xff;
+  *ack = 1;
+  if(step == 1) {
+    card->command = byte;
+    if(byte != 'R' && byte != 'W' && byte != 'S') *ack = 0;
+    response = card->flag;
+  } else if(step == 2) {
+    response = 0x5a;
+  } else if(step == 3) {
+    response = 0x5d;
+  } else if(card->command == 'R') {
+    response = memcard_read(card, step, byte, ack);
+  } else if(card->command == 'W') {
+    response = memcard_write(card, step, byte, ack);
+  } else {
+    // Get ID, the card size and sector size
+    const uint8_t id[] = {0x5c, 0x5d, 0x04, 0x00, 0x00, 0x80};
+    response = id[step - 4];
+    if(step == 9) *ack = 0;
+  }
+  card->previous = byte;
+  return(response);
+}
+
+void memcard_close() {
+  if(!memcard_count) return;
+  atomic_store(&memcard_stop, 1);
+  sem_post(&memcard_wake);
+  pthread_join(memcard_thread, 0);
+  for(int slot = 0; slot < memcard_count; slot++) {
+    memcard_sync(&memcards[slot], 0, MEMCARD_SIZE);
+    munmap(memcards[slot].data, MEMCARD_SIZE);
+    close(memcards[slot].fd);
+  }
+  memcard_count = 0;
+}
@@ -0,0 +1,19 @@
+#ifndef MEMCARD_H
+#define MEMCARD_H
+
+#include <stdint.h>
+
+#define MEMCARD_SLOTS   2
+#define MEMCARD_SIZE    (128 * 1024)
+#define MEMCARD_SECTOR  128
+#define MEMCARD_SECTORS (MEMCARD_SIZE / MEMCARD_SECTOR)
+
+extern int memcard_count;
+
+void memcard_open(const char *path);
+int memcard_present(int slot);
+void memcard_select(int slot);
+uint8_t memcard_transfer(int slot, uint8_t byte, int *ack);
+void memcard_close();
+
+#endif
@@ -1,10 +1,23 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "cpu.h"
 #include "memory.h"
+#include "trace.h"
+#include "stats.h"
+#include "timing.h"
 
-memory_accessor_t * memory_decode_address(uint32_t address) {
+// Set while the lockstep harness logs or replays data accesses
+int memory_lockstep;
+// Accessors by 64KB page, for data accesses and for instruction fetches.
+// Pages wholly inside RAM or the BIOS go straight to them, the rest are
+// decoded on every access. The debugger points the pages holding its
+// breakpoints and watchpoints elsewhere.
+memory_accessor_t *memory_pages[MEMORY_PAGES];
+memory_accessor_t *memory_fetch_pages[MEMORY_PAGES];
+
+memory_accessor_t * memory_decode_device(uint32_t address) {
   switch(address) {
     case 0x00000000 ... 0x001FFFFF:;
     case 0x80000000 ... 0x801FFFFF:;
@@ -27,54 +40,138 @@ memory_accessor_t * memory_decode_address(uint32_t address) {
       return(&memory_control_accessor);
     case 0x1F801C00 ... 0x1F801FFF:;
       return(&spu_accessor);
+    case 0x1F801040 ... 0x1F80105F:;
+      return(&peripheral_accessor);
     case 0x1F801070 ... 0x1F801077:;
       return(&interrupt_accessor);
     case 0x1F801080 ... 0x1F8010FF:;
       return(&dma_accessor);
     case 0x1F801100 ... 0x1F80112F:;
       return(&timers_accessor);
+    case 0x1F801800 ... 0x1F801803:;
+      return(&cdrom_accessor);
     case 0x1F801810 ... 0x1F801817:;
       return(&gpu_accessor);
+    case 0x1F801820 ... 0x1F801827:;
+      return(&mdec_accessor);
     default:
       printf("Invalid memory access: 0x%08x\n", address);
       exit(1);
   }
 }
 
+uint32_t memory_decode_load_32(uint32_t address) { return(memory_decode_device(address)->load_32(address)); }
+uint16_t memory_decode_load_16(uint32_t address) { return(memory_decode_device(address)->load_16(address)); }
+uint8_t memory_decode_load_8(uint32_t address) { return(memory_decode_device(address)->load_8(address)); }
+void memory_decode_store_32(uint32_t address, uint32_t value) { memory_decode_device(address)->store_32(address, value); }
+void memory_decode_store_16(uint32_t address, uint16_t value) { memory_decode_device(address)->store_16(address, value); }
+void memory_decode_store_8(uint32_t address, uint8_t value) { memory_decode_device(address)->store_8(address, value); }
+
+ memory_accessor_t memory_decode_accessor = {
+  .load_32 = memory_decode_load_32,
+  .load_16 = memory_decode_load_16,
+  .load_8 = memory_decode_load_8,
+  .store_32 = memory_decode_store_32,
+  .store_16 = memory_decode_store_16,
+  .store_8 = memory_decode_store_8,
+};
+
+void memory_map(uint32_t start, uint32_t size, memory_accessor_t *accessor) {
+  for(uint32_t page = start >> MEMORY_PAGE_BITS; page < (start + size) >> MEMORY_PAGE_BITS; page++)
+    memory_pages[page] = accessor;
+}
+
+void memory_reset() {
+  for(uint32_t page = 0; page < MEMORY_PAGES; page++)
+    memory_pages[page] = &memory_decode_accessor;
+  uint32_t segments[3] = {0x00000000, 0x80000000, 0xA0000000};
+  for(int n = 0; n < 3; n++) {
+    memory_map(segments[n], 1024 * 2048, &ram_accessor);
+    memory_map(segments[n] + 0x1FC00000, 1024 * 512, &rom_accessor);
+  }
+  memcpy(memory_fetch_pages, memory_pages, sizeof(memory_pages));
+}
+
+memory_accessor_t * memory_decode_address(uint32_t address) {
+  if(memory_lockstep) return(&lockstep_accessor);
+  return(memory_pages[address >> MEMORY_PAGE_BITS]);
+}
+
+// Instruction fetches bypass the lockstep log, engines may fetch whenever they like
+uint32_t memory_fetch_32(uint32_t address) {
+  if(address % 4) {
+    STATS_COUNT(unaligned[STATS_FETCH]);
+    cpu_exception(4);
+    return(0);
+  }
+  if(timing_enabled) scheduler_cycles += timing_fetch(address);
+  memory_accessor_t *accessor = memory_fetch_pages[address >> MEMORY_PAGE_BITS];
+  STATS_MEMORY(memory_decode_device(address), STATS_FETCH, STATS_32);
+  return accessor->load_32(address);
+}
+
 uint32_t memory_load_32(uint32_t address) {
   if(address % 4) {
+    STATS_COUNT(unaligned[STATS_LOAD]);
     cpu_exception(4);
     return(0);
   }
-  return memory_decode_address(address)->load_32(address);
+  if(timing_enabled) scheduler_cycles += timing_load(address, 4);
+  memory_accessor_t *accessor = memory_decode_address(address);
+  STATS_MEMORY(memory_decode_device(address), STATS_LOAD, STATS_32);
+  uint32_t value = accessor->load_32(address);
+  TRACE_EVENT(TRACE_LOAD, 32, address, value);
+  return(value);
 }
 uint16_t memory_load_16(uint32_t address) {
   if(address % 2) {
+    STATS_COUNT(unaligned[STATS_LOAD]);
     cpu_exception(4);
     return(0);
   }
-  return memory_decode_address(address)->load_16(address);
+  if(timing_enabled) scheduler_cycles += timing_load(address, 2);
+  memory_accessor_t *accessor = memory_decode_address(address);
+  STATS_MEMORY(memory_decode_device(address), STATS_LOAD, STATS_16);
+  uint16_t value = accessor->load_16(address);
+  TRACE_EVENT(TRACE_LOAD, 16, address, value);
+  return(value);
 }
 uint8_t memory_load_8(uint32_t address) {
-  return memory_decode_address(address)->load_8(address);
+  if(timing_enabled) scheduler_cycles += timing_load(address, 1);
+  memory_accessor_t *accessor = memory_decode_address(address);
+  STATS_MEMORY(memory_decode_device(address), STATS_LOAD, STATS_8);
+  uint8_t value = accessor->load_8(address);
+  TRACE_EVENT(TRACE_LOAD, 8, address, value);
+  return(value);
 }
 
 void memory_store_32(uint32_t address, uint32_t value) {
   if(address % 4) {
+    STATS_COUNT(unaligned[STATS_STORE]);
     cpu_exception(5);
     return;
   }
-  return memory_decode_address(address)->store_32(address, value);
+  TRACE_EVENT(TRACE_STORE, 32, address, value);
+  memory_accessor_t *accessor = memory_decode_address(address);
+  STATS_MEMORY(memory_decode_device(address), STATS_STORE, STATS_32);
+  accessor->store_32(address, value);
 }
 void memory_store_16(uint32_t address, uint16_t value) {
   if(address % 2) {
+    STATS_COUNT(unaligned[STATS_STORE]);
     cpu_exception(5);
     return;
   }
-  return memory_decode_address(address)->store_16(address, value);
+  TRACE_EVENT(TRACE_STORE, 16, address, value);
+  memory_accessor_t *accessor = memory_decode_address(address);
+  STATS_MEMORY(memory_decode_device(address), STATS_STORE, STATS_16);
+  accessor->store_16(address, value);
 }
 void memory_store_8(uint32_t address, uint8_t value) {
-  return memory_decode_address(address)->store_8(address, value);
+  TRACE_EVENT(TRACE_STORE, 8, address, value);
+  memory_accessor_t *accessor = memory_decode_address(address);
+  STATS_MEMORY(memory_decode_device(address), STATS_STORE, STATS_8);
+  accessor->store_8(address, value);
 }
 
 uint32_t memory_dummy_load_32(uint32_t address) {
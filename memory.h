@@ -23,7 +23,29 @@ extern memory_accessor_t timers_accessor;
 extern memory_accessor_t cdrom_accessor;
 extern memory_accessor_t gpu_accessor;
 extern memory_accessor_t spu_accessor;
+extern memory_accessor_t mdec_accessor;
+extern memory_accessor_t peripheral_accessor;
+extern memory_accessor_t lockstep_accessor;
 
+#define MEMORY_PAGE_BITS 16
+#define MEMORY_PAGES     (1 << (32 - MEMORY_PAGE_BITS))
+
+// RAM pages each carry a count of the writes to them, bumped by CPU stores
+// and DMA alike, so code caches can tell a page is unchanged without
+// comparing it
+#define RAM_PAGE_BITS 12
+#define RAM_PAGES     (0x200000 >> RAM_PAGE_BITS)
+
+extern uint32_t ram_generation[RAM_PAGES];
+void ram_written(uint32_t address, uint32_t bytes);
+
+extern int memory_lockstep;
+extern memory_accessor_t *memory_pages[MEMORY_PAGES];
+extern memory_accessor_t *memory_fetch_pages[MEMORY_PAGES];
+
+void memory_reset();
+memory_accessor_t * memory_decode_device(uint32_t address);
+uint32_t memory_fetch_32(uint32_t address);
 uint32_t memory_load_32(uint32_t address);
 uint16_t memory_load_16(uint32_t address);
 uint8_t memory_load_8(uint32_t address);
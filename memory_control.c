@@ -1,11 +1,66 @@
 #include <stdint.h>
 #include "memory.h"
+#include "timing.h"
 
+// Expansion base addresses, then the delay/size of EXP1, EXP3, BIOS, SPU,
+// CDROM and EXP2, then COM_DELAY, as the BIOS leaves them
+uint32_t memory_control[9] = {
+  0x1f000000, 0x1f802000, 0x0013243f, 0x00003022,
+  0x0013243f, 0x200931e1, 0x00020843, 0x00070777,
+  0x00031125,
+};
+uint32_t memory_control_ram_size = 0x00000b88;
+uint32_t memory_control_cache = 0x0001e988;
+
+uint32_t memory_control_read(uint32_t address) {
+  switch(address) {
+    case 0x1F801000 ... 0x1F801023:
+      return(memory_control[(address - 0x1F801000) / 4]);
+    case 0x1F801060 ... 0x1F801063:
+      return(memory_control_ram_size);
+    default:
+      return(memory_control_cache);
+  }
+}
+// The guest only reads the registers back with -w, without it emulation is
+// as it was when they read as 0
+uint32_t memory_control_load_32(uint32_t address) {
+  return(timing_enabled ? memory_control_read(address) : 0);
+}
+uint16_t memory_control_load_16(uint32_t address) {
+  return(memory_control_load_32(address & ~3) >> (address & 2) * 8);
+}
+uint8_t memory_control_load_8(uint32_t address) {
+  return(memory_control_load_32(address & ~3) >> (address & 3) * 8);
+}
+void memory_control_store_32(uint32_t address, uint32_t value) {
+  switch(address) {
+    case 0x1F801000 ... 0x1F801023:
+      memory_control[(address - 0x1F801000) / 4] = value;
+      timing_update();
+      break;
+    case 0x1F801060 ... 0x1F801063:
+      memory_control_ram_size = value;
+      break;
+    default:
+      memory_control_cache = value;
+  }
+}
+void memory_control_store_16(uint32_t address, uint16_t value) {
+  uint32_t shift = (address & 2) * 8;
+  uint32_t word = memory_control_read(address & ~3) & ~(0xffff << shift);
+  memory_control_store_32(address & ~3, word | value << shift);
+}
+void memory_control_store_8(uint32_t address, uint8_t value) {
+  uint32_t shift = (address & 3) * 8;
+  uint32_t word = memory_control_read(address & ~3) & ~(0xff << shift);
+  memory_control_store_32(address & ~3, word | value << shift);
+}
  memory_accessor_t memory_control_accessor = {
-  .load_32 = memory_dummy_load_32,
-  .load_16 = memory_dummy_load_16,
-  .load_8 = memory_dummy_load_8,
-  .store_32 = memory_dummy_store_32,
-  .store_16 = memory_dummy_store_16,
-  .store_8 = memory_dummy_store_8,
+  .load_32 = memory_control_load_32,
+  .load_16 = memory_control_load_16,
+  .load_8 = memory_control_load_8,
+  .store_32 = memory_control_store_32,
+  .store_16 = memory_control_store_16,
+  .store_8 = memory_control_store_8,
 };
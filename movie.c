@@ -0,0 +1,162 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "movie.h"
+#include "input.h"
+#include "cpu.h"
+#include "gpu.h"
+#include "disc.h"
+#include "scheduler.h"
+#include "hash.h"
+
+// Every frame can also be reduced to a line of hashes over VRAM and the CPU
+// registers plus the cycle count. Two runs of the same movie, from
+// different builds or CPU cores, then agree line for line up to the first
+// frame where they diverge, which -K reports directly.
+extern uint8_t rom[];
+
+int movie_recording;
+int movie_replaying;
+FILE *movie_file, *movie_hash_file, *movie_reference;
+movie_header_t movie_header;
+movie_frame_t *movie_frames;
+uint64_t movie_position;
+
+uint64_t movie_bios_hash() {
+  return(hash_bytes(rom, 512 * 1024, HASH_SEED));
+}
+
+void movie_record(const char *path) {
+  movie_file = fopen(path, "wb");
+  if(!movie_file) {
+    printf("Failed to open movie: %s\n", path);
+    exit(1);
+  }
+  movie_recording = 1;
+  atexit(movie_close);
+}
+
+void movie_replay(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if(!file || fread(&movie_header, sizeof(movie_header), 1, file) != 1) {
+    printf("Failed to open movie: %s\n", path);
+    exit(1);
+  }
+  if(movie_header.magic != MOVIE_MAGIC || movie_header.version != MOVIE_VERSION) {
+    printf("Not a movie file: %s\n", path);
+    exit(1);
+  }
+  movie_frames = malloc(movie_header.frames * sizeof(movie_frame_t) + 1);
+  if(fread(movie_frames, sizeof(movie_frame_t), movie_header.frames, file) != movie_header.frames) {
+    printf("Movie is truncated: %s\n", path);
+    exit(1);
+  }
+  fclose(file);
+  movie_replaying = 1;
+}
+
+void movie_write_hashes(const char *path) {
+  movie_hash_file = fopen(path, "w");
+  if(!movie_hash_file) {
+    printf("Failed to open hash log: %s\n", path);
+    exit(1);
+  }
+  atexit(movie_close);
+}
+
+void movie_check_hashes(const char *path) {
+  movie_reference = fopen(path, "r");
+  if(!movie_reference) {
+    printf("Failed to open reference hash log: %s\n", path);
+    exit(1);
+  }
+}
+
+// The BIOS is loaded and the disc inserted by the first VBlank
+void movie_start() {
+  if(movie_recording) {
+    movie_header = (movie_header_t) {
+      .magic = MOVIE_MAGIC,
+      .version = MOVIE_VERSION,
+      .bios_hash = movie_bios_hash(),
+      .disc_sectors = disc_sectors,
+    };
+    fwrite(&movie_header, sizeof(movie_header), 1, movie_file);
+  }
+  if(movie_replaying) {
+    if(movie_header.bios_hash != movie_bios_hash()) {
+      printf("Movie was recorded with a different BIOS\n");
+      exit(1);
+    }
+    if(movie_header.disc_sectors != disc_sectors) {
+      printf("Movie was recorded with a different disc\n");
+      exit(1);
+    }
+  }
+}
+
+void movie_hash() {
+  uint64_t vram_hash = hash_bytes(vram, 1024 * 1024, HASH_SEED);
+  uint64_t cpu_hash = hash_bytes(&cpu, sizeof(cpu), HASH_SEED);
+  if(movie_hash_file)
+    fprintf(movie_hash_file, "%lu %016lx %016lx %lu\n", movie_position, vram_hash, cpu_hash, scheduler_cycles);
+  if(movie_reference) {
+    uint64_t frame, vram_expected, cpu_expected, cycles_expected;
+    if(fscanf(movie_reference, "%lu %lx %lx %lu", &frame, &vram_expected, &cpu_expected, &cycles_expected) != 4) {
+      printf("Matched the reference for all %lu frames\n", movie_position);
+      fclose(movie_reference);
+      movie_reference = 0;
+      return;
+    }
+    if(vram_hash != vram_expected || cpu_hash != cpu_expected || scheduler_cycles != cycles_expected) {
+      printf("Diverged from the reference at frame %lu:%s%s%s\n", frame,
+        vram_hash != vram_expected ? " vram" : "",
+        cpu_hash != cpu_expected ? " cpu" : "",
+        scheduler_cycles != cycles_expected ? " cycles" : "");
+      exit(1);
+    }
+  }
+}
+
+// Called once per VBlank, after the input script
+void movie_frame() {
+  if(!movie_position) movie_start();
+  if(movie_replaying) {
+    if(movie_position == movie_header.frames) {
+      printf("Replayed %u frames\n", movie_header.frames);
+      if(movie_reference) printf("Matched the reference for all %lu frames\n", movie_position);
+      exit(0);
+    }
+    movie_frame_t *frame = &movie_frames[movie_position];
+    input_buttons = frame->buttons;
+    input_analog = frame->analog;
+    for(int n = 0; n < 4; n++)
+      input_axes[n] = frame->axes[n];
+  }
+  if(movie_recording) {
+    movie_frame_t frame = {
+      .buttons = input_buttons,
+      .analog = input_analog,
+    };
+    for(int n = 0; n < 4; n++)
+      frame.axes[n] = input_axes[n];
+    fwrite(&frame, sizeof(frame), 1, movie_file);
+    movie_header.frames++;
+  }
+  if(movie_hash_file || movie_reference) movie_hash();
+  movie_position++;
+}
+
+void movie_close() {
+  if(movie_recording) {
+    fseek(movie_file, 0, SEEK_SET);
+    fwrite(&movie_header, sizeof(movie_header), 1, movie_file);
+    fclose(movie_file);
+    printf("Recorded %u frames of input\n", movie_header.frames);
+    movie_recording = 0;
+  }
+  if(movie_hash_file) {
+    fclose(movie_hash_file);
+    movie_hash_file = 0;
+  }
+}
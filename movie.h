@@ -0,0 +1,36 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdint.h>
+
+// Input movies hold the pad state for every VBlank from power-on. There are
+// no save states, so the BIOS and disc are all the starting state there is
+// and both are checked on replay.
+#define MOVIE_MAGIC   0x4d565350 // "PSVM"
+#define MOVIE_VERSION 1
+
+typedef struct __attribute__((packed)) movie_header_t {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t bios_hash;
+  uint32_t disc_sectors;
+  uint32_t frames;
+} movie_header_t;
+
+typedef struct __attribute__((packed)) movie_frame_t {
+  uint16_t buttons;
+  uint8_t analog;
+  uint8_t axes[4];
+  uint8_t reserved;
+} movie_frame_t;
+
+extern int movie_replaying;
+
+void movie_record(const char *path);
+void movie_replay(const char *path);
+void movie_write_hashes(const char *path);
+void movie_check_hashes(const char *path);
+void movie_frame();
+void movie_close();
+
+#endif
@@ -0,0 +1,57 @@
+#include <stdint.h>
+#include <time.h>
+#include "pacing.h"
+
+// Skip at most this many frames in a row so the display never freezes
+#define PACING_MAX_SKIP 4
+// Give up catching up and resynchronise when this far behind
+#define PACING_MAX_LAG 8
+
+int pacing_mode = PACING_REALTIME;
+int pacing_frameskip;
+// Set while the current frame should not be rendered
+int pacing_skip;
+
+uint64_t pacing_deadline;
+uint32_t pacing_skipped;
+
+uint64_t pacing_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+void pacing_sleep_until(uint64_t deadline) {
+  struct timespec ts = {
+    .tv_sec = deadline / 1000000000,
+    .tv_nsec = deadline % 1000000000,
+  };
+  while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0));
+}
+
+// Called at every emulated VBlank after the frame has been presented (or
+// skipped). Throttles to real time if required and decides whether the
+// next frame gets rendered.
+void pacing_vblank(uint64_t frame_ns) {
+  uint64_t now = pacing_now();
+  if(!pacing_deadline) pacing_deadline = now;
+  int skip;
+
+  if(pacing_mode == PACING_REALTIME) {
+    pacing_deadline += frame_ns;
+    if(now < pacing_deadline) {
+      pacing_sleep_until(pacing_deadline);
+    } else if(now - pacing_deadline > frame_ns * PACING_MAX_LAG) {
+      pacing_deadline = now;
+    }
+    // Drop the next frame when more than a frame behind
+    skip = now > pacing_deadline + frame_ns && pacing_skipped < PACING_MAX_SKIP;
+  } else {
+    // Uncapped: render one frame per real-time frame period, skip the rest
+    skip = now < pacing_deadline;
+    if(!skip) pacing_deadline = now + frame_ns;
+  }
+
+  pacing_skip = pacing_frameskip && skip;
+  pacing_skipped = pacing_skip ? pacing_skipped + 1 : 0;
+}
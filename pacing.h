@@ -0,0 +1,15 @@
+#ifndef PACING_H
+#define PACING_H
+
+#include <stdint.h>
+
+#define PACING_REALTIME 0
+#define PACING_TURBO    1
+
+extern int pacing_mode;
+extern int pacing_frameskip;
+extern int pacing_skip;
+
+void pacing_vblank(uint64_t frame_ns);
+
+#endif
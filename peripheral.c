@@ -1,11 +1,183 @@
 #include <stdint.h>
 #include "memory.h"
+#include "peripheral.h"
+#include "interrupt.h"
+#include "scheduler.h"
+#include "input.h"
+#include "memcard.h"
+#include "latency.h"
+
+// JOY port at 0x1F801040. A byte written to TX is exchanged with the
+// selected device straight away, the /ACK for bytes that expect more
+// follows one byte time later as IRQ7. The serial port at 0x1F801050 is
+// not connected to anything.
+#define PERIPHERAL_STAT_TX_READY  0x0005
+#define PERIPHERAL_STAT_RX_READY  0x0002
+#define PERIPHERAL_STAT_ACK       0x0080
+#define PERIPHERAL_STAT_IRQ       0x0200
+
+#define PERIPHERAL_CONTROL_SELECT 0x0002
+#define PERIPHERAL_CONTROL_ACK    0x0010
+#define PERIPHERAL_CONTROL_RESET  0x0040
+#define PERIPHERAL_CONTROL_IRQ    0x1000
+#define PERIPHERAL_CONTROL_PORT   0x2000
+
+enum {PERIPHERAL_NONE, PERIPHERAL_PAD, PERIPHERAL_CARD, PERIPHERAL_DONE};
+
+uint16_t peripheral_mode, peripheral_control, peripheral_baud;
+uint32_t peripheral_stat;
+uint8_t peripheral_rx;
+int peripheral_device;
+uint32_t peripheral_step;
+
+void peripheral_reset() {
+  scheduler_cancel(SCHEDULER_PERIPHERAL);
+  peripheral_mode = 0;
+  peripheral_control = 0;
+  peripheral_baud = 0;
+  peripheral_stat = 0;
+  peripheral_device = PERIPHERAL_NONE;
+}
+
+// Cycles for one byte, BAUD times the MODE prescaler per bit
+uint32_t peripheral_byte_cycles() {
+  const uint32_t factors[4] = {1, 1, 16, 64};
+  uint32_t bit = (peripheral_baud * factors[peripheral_mode & 3]) & ~1;
+  return((bit ? bit : 1) * 8);
+}
+
+void peripheral_ack() {
+  peripheral_stat |= PERIPHERAL_STAT_ACK;
+  if(peripheral_control & PERIPHERAL_CONTROL_IRQ) {
+    peripheral_stat |= PERIPHERAL_STAT_IRQ;
+    interrupt_request(IRQ_PERIPHERAL);
+  }
+}
+
+// Digital pad, or analog with the sticks after the buttons
+uint8_t peripheral_pad(uint8_t byte, int *ack) {
+  uint32_t step = ++peripheral_step;
+  uint16_t buttons = ~input_buttons;
+  *ack = 1;
+  switch(step) {
+    case 1:
+      if(byte != 0x42) break;
+      return(input_analog ? 0x73 : 0x41);
+    case 2: return(0x5a);
+    case 3:
+      latency_read();
+      return(buttons);
+    case 4:
+      *ack = input_analog;
+      return(buttons >> 8);
+    case 5 ... 8:
+      if(!input_analog) break;
+      *ack = step < 8;
+      return(input_axes[step - 5]);
+  }
+  *ack = 0;
+  return(0xff);
+}
+
+void peripheral_transmit(uint8_t byte) {
+  int port = (peripheral_control & PERIPHERAL_CONTROL_PORT) != 0;
+  uint8_t response = 0xff;
+  int ack = 0;
+  if(peripheral_control & PERIPHERAL_CONTROL_SELECT) {
+    switch(peripheral_device) {
+      case PERIPHERAL_NONE:
+        // The first byte addresses a device, which answers with high-z
+        if(byte == 0x01 && port == 0) {
+          peripheral_device = PERIPHERAL_PAD;
+          peripheral_step = 0;
+          ack = 1;
+        } else if(byte == 0x81 && memcard_present(port)) {
+          peripheral_device = PERIPHERAL_CARD;
+          memcard_select(port);
+          ack = 1;
+        }
+        break;
+      case PERIPHERAL_PAD:
+        response = peripheral_pad(byte, &ack);
+        break;
+      case PERIPHERAL_CARD:
+        response = memcard_transfer(port, byte, &ack);
+        break;
+    }
+    if(!ack) peripheral_device = PERIPHERAL_DONE;
+  }
+  peripheral_rx = response;
+  peripheral_stat = (peripheral_stat & ~PERIPHERAL_STAT_ACK) | PERIPHERAL_STAT_RX_READY;
+  if(ack)
+    scheduler_schedule(SCHEDULER_PERIPHERAL, scheduler_cycles + peripheral_byte_cycles(), peripheral_ack);
+}
+
+void peripheral_write_control(uint16_t value) {
+  if(value & PERIPHERAL_CONTROL_RESET) {
+    peripheral_reset();
+    return;
+  }
+  if(value & PERIPHERAL_CONTROL_ACK)
+    peripheral_stat &= ~PERIPHERAL_STAT_IRQ;
+  // Releasing the select line or switching ports ends the command
+  if(!(value & PERIPHERAL_CONTROL_SELECT) || ((value ^ peripheral_control) & PERIPHERAL_CONTROL_PORT))
+    peripheral_device = PERIPHERAL_NONE;
+  peripheral_control = value & ~(PERIPHERAL_CONTROL_ACK | PERIPHERAL_CONTROL_RESET);
+}
+
+uint8_t peripheral_receive() {
+  peripheral_stat &= ~PERIPHERAL_STAT_RX_READY;
+  return(peripheral_rx);
+}
+
+uint16_t peripheral_load_16(uint32_t address) {
+  switch(address & 0x1f) {
+    case 0x0: return(peripheral_receive());
+    case 0x4: return(peripheral_stat | PERIPHERAL_STAT_TX_READY);
+    case 0x8: return(peripheral_mode);
+    case 0xa: return(peripheral_control);
+    case 0xe: return(peripheral_baud);
+  }
+  return(0);
+}
+
+uint32_t peripheral_load_32(uint32_t address) {
+  if((address & 0x1f) == 0x0) return(peripheral_receive());
+  return(peripheral_load_16(address) | peripheral_load_16(address + 2) << 16);
+}
+
+uint8_t peripheral_load_8(uint32_t address) {
+  if((address & 0x1f) == 0x0) return(peripheral_receive());
+  return(peripheral_load_16(address & ~1) >> ((address & 1) * 8));
+}
+
+void peripheral_store_16(uint32_t address, uint16_t value) {
+  switch(address & 0x1f) {
+    case 0x0: peripheral_transmit(value); break;
+    case 0x8: peripheral_mode = value; break;
+    case 0xa: peripheral_write_control(value); break;
+    case 0xe: peripheral_baud = value; break;
+  }
+}
+
+void peripheral_store_32(uint32_t address, uint32_t value) {
+  if((address & 0x1f) == 0x0) {
+    peripheral_transmit(value);
+    return;
+  }
+  peripheral_store_16(address, value);
+  peripheral_store_16(address + 2, value >> 16);
+}
+
+void peripheral_store_8(uint32_t address, uint8_t value) {
+  if((address & 0x1f) == 0x0) peripheral_transmit(value);
+}
 
  memory_accessor_t peripheral_accessor = {
-  .load_32 = memory_dummy_load_32,
-  .load_16 = memory_dummy_load_16,
-  .load_8 = memory_dummy_load_8,
-  .store_32 = memory_dummy_store_32,
-  .store_16 = memory_dummy_store_16,
-  .store_8 = memory_dummy_store_8,
+  .load_32 = peripheral_load_32,
+  .load_16 = peripheral_load_16,
+  .load_8 = peripheral_load_8,
+  .store_32 = peripheral_store_32,
+  .store_16 = peripheral_store_16,
+  .store_8 = peripheral_store_8,
 };
@@ -0,0 +1,6 @@
+#ifndef PERIPHERAL_H
+#define PERIPHERAL_H
+
+void peripheral_reset();
+
+#endif
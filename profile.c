@@ -0,0 +1,337 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "profile.h"
+#include "cpu.h"
+#include "scheduler.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+// Samples are counted in an open-addressed table keyed by PC and $ra. It
+// is allocated up front because with a host timer samples are taken from a
+// signal handler, which is directed at the emulation thread so nothing else
+// ever touches the table while a run is going.
+#define PROFILE_DEFAULT_CYCLES (CPU_CLOCK / 10000)
+#define PROFILE_SLOTS          (1 << 18)
+#define PROFILE_PROBES         64
+#define PROFILE_EMPTY          UINT64_MAX
+#define PROFILE_TOP            25
+
+typedef struct profile_slot_t {
+  uint64_t key;
+  uint64_t count;
+} profile_slot_t;
+
+typedef struct profile_symbol_t {
+  uint32_t address;
+  char *name;
+} profile_symbol_t;
+
+const char *profile_region_names[PROFILE_REGIONS] = { "RAM", "scratchpad", "BIOS ROM", "other" };
+
+int profile_enabled;
+FILE *profile_file;
+uint32_t profile_cycles = PROFILE_DEFAULT_CYCLES;
+uint32_t profile_hz;
+timer_t profile_timer;
+int profile_timer_armed;
+profile_slot_t *profile_slots;
+uint64_t profile_samples, profile_dropped, profile_regions[PROFILE_REGIONS];
+profile_symbol_t *profile_symbol_table;
+uint32_t profile_symbol_count;
+
+int profile_region(uint32_t pc) {
+  uint32_t physical = pc & 0x1fffffff;
+  if(physical < 0x00800000) return(PROFILE_RAM);
+  if(physical >= 0x1f800000 && physical < 0x1f800400) return(PROFILE_SCRATCHPAD);
+  if(physical >= 0x1fc00000 && physical < 0x1fc80000) return(PROFILE_BIOS);
+  return(PROFILE_OTHER);
+}
+
+void profile_sample() {
+  uint32_t pc = cpu.current_pc, ra = cpu.reg[31];
+  profile_samples++;
+  profile_regions[profile_region(pc)]++;
+  uint64_t key = (uint64_t)pc << 32 | ra;
+  uint32_t slot = (key * 0x9e3779b97f4a7c15ull) >> 46;
+  for(int probe = 0; probe < PROFILE_PROBES; probe++) {
+    profile_slot_t *entry = &profile_slots[(slot + probe) & (PROFILE_SLOTS - 1)];
+    if(entry->key == key) {
+      entry->count++;
+      return;
+    }
+    if(entry->key == PROFILE_EMPTY) {
+      entry->key = key;
+      entry->count = 1;
+      return;
+    }
+  }
+  profile_dropped++;
+}
+
+void profile_event() {
+  profile_sample();
+  scheduler_schedule(SCHEDULER_PROFILE, scheduler_cycles + profile_cycles, profile_event);
+}
+
+void profile_signal(int signal) {
+  profile_sample();
+}
+
+// file[:rate], rate is cycles of guest time between samples, or a host
+// CPU time rate such as 1000hz
+void profile_open(const char *spec) {
+  char path[256];
+  snprintf(path, sizeof(path), "%s", spec);
+  char *rate = strrchr(path, ':');
+  if(rate) {
+    *rate++ = 0;
+    size_t length = strlen(rate);
+    if(length > 2 && !strcmp(rate + length - 2, "hz")) profile_hz = atoi(rate);
+    else profile_cycles = atoi(rate);
+    if((!profile_hz && !profile_cycles) || profile_hz > 100000) {
+      printf("Invalid profile rate: %s\n", rate);
+      exit(1);
+    }
+  }
+  profile_file = fopen(path, "w");
+  if(!profile_file) {
+    printf("Failed to open profile: %s\n", path);
+    exit(1);
+  }
+  profile_slots = malloc(PROFILE_SLOTS * sizeof(profile_slot_t));
+  memset(profile_slots, 0xff, PROFILE_SLOTS * sizeof(profile_slot_t));
+  profile_enabled = 1;
+  atexit(profile_close);
+}
+
+int profile_compare_symbols(const void *a, const void *b) {
+  uint32_t x = ((profile_symbol_t *)a)->address, y = ((profile_symbol_t *)b)->address;
+  return((x > y) - (x < y));
+}
+
+// One symbol per line, a hex address first and the name last, so both
+// "80010000 main" and nm output ("80010000 T main") work
+void profile_symbols(const char *path) {
+  FILE *file = fopen(path, "r");
+  if(!file) {
+    printf("Failed to open symbol map: %s\n", path);
+    exit(1);
+  }
+  char line[512];
+  uint32_t capacity = 0;
+  while(fgets(line, sizeof(line), file)) {
+    char *end;
+    uint32_t address = strtoul(line, &end, 16);
+    if(end == line) continue;
+    char *name = 0;
+    for(char *token = strtok(end, " \t\r\n"); token; token = strtok(0, " \t\r\n"))
+      name = token;
+    if(!name) continue;
+    if(profile_symbol_count == capacity) {
+      capacity = capacity ? capacity * 2 : 1024;
+      profile_symbol_table = realloc(profile_symbol_table, capacity * sizeof(profile_symbol_t));
+    }
+    profile_symbol_table[profile_symbol_count].address = address;
+    profile_symbol_table[profile_symbol_count].name = strdup(name);
+    profile_symbol_count++;
+  }
+  fclose(file);
+  qsort(profile_symbol_table, profile_symbol_count, sizeof(profile_symbol_t), profile_compare_symbols);
+}
+
+profile_symbol_t *profile_lookup(uint32_t address) {
+  uint32_t low = 0, high = profile_symbol_count;
+  while(low < high) {
+    uint32_t middle = (low + high) / 2;
+    if(profile_symbol_table[middle].address <= address) low = middle + 1;
+    else high = middle;
+  }
+  return(low ? &profile_symbol_table[low - 1] : 0);
+}
+
+// The function containing address, or the address itself without symbols
+void profile_function(uint32_t address, char *out, size_t size) {
+  profile_symbol_t *symbol = profile_lookup(address);
+  if(symbol) snprintf(out, size, "%s", symbol->name);
+  else snprintf(out, size, "%08x", address);
+}
+
+void profile_describe(uint32_t address, char *out, size_t size) {
+  profile_symbol_t *symbol = profile_lookup(address);
+  if(symbol) snprintf(out, size, "%s+0x%x", symbol->name, address - symbol->address);
+  else snprintf(out, size, "%s", profile_region_names[profile_region(address)]);
+}
+
+void profile_reset() {
+  if(!profile_enabled) return;
+  if(!profile_hz) {
+    scheduler_schedule(SCHEDULER_PROFILE, scheduler_cycles + profile_cycles, profile_event);
+    return;
+  }
+  // Host CPU time of the emulation thread, so time spent sleeping to pace
+  // the emulator isn't sampled
+  struct sigaction action = {0};
+  action.sa_handler = profile_signal;
+  action.sa_flags = SA_RESTART;
+  sigaction(SIGPROF, &action, 0);
+  struct sigevent event = {0};
+  event.sigev_notify = SIGEV_THREAD_ID;
+  event.sigev_signo = SIGPROF;
+  event.sigev_notify_thread_id = syscall(SYS_gettid);
+  if(timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &profile_timer)) {
+    printf("Failed to create the profile timer\n");
+    exit(1);
+  }
+  struct itimerspec interval = {0};
+  uint64_t period = 1000000000ull / profile_hz;
+  interval.it_interval.tv_sec = period / 1000000000;
+  interval.it_interval.tv_nsec = period % 1000000000;
+  interval.it_value = interval.it_interval;
+  timer_settime(profile_timer, 0, &interval, 0);
+  profile_timer_armed = 1;
+}
+
+typedef struct profile_entry_t {
+  uint32_t address;
+  uint64_t count;
+} profile_entry_t;
+
+int profile_compare_addresses(const void *a, const void *b) {
+  uint32_t x = ((profile_entry_t *)a)->address, y = ((profile_entry_t *)b)->address;
+  return((x > y) - (x < y));
+}
+
+int profile_compare_entries(const void *a, const void *b) {
+  uint64_t x = ((profile_entry_t *)a)->count, y = ((profile_entry_t *)b)->count;
+  return((x < y) - (x > y));
+}
+
+// Sums counts by address, keyed by PC or by containing function
+uint32_t profile_collect(profile_entry_t *entries, int functions) {
+  uint32_t count = 0;
+  for(uint32_t n = 0; n < PROFILE_SLOTS; n++) {
+    if(profile_slots[n].key == PROFILE_EMPTY) continue;
+    uint32_t address = profile_slots[n].key >> 32;
+    if(functions) {
+      profile_symbol_t *symbol = profile_lookup(address);
+      if(!symbol) continue;
+      address = symbol->address;
+    }
+    entries[count].address = address;
+    entries[count].count = profile_slots[n].count;
+    count++;
+  }
+  if(!count) return(0);
+  // Merge equal addresses
+  qsort(entries, count, sizeof(profile_entry_t), profile_compare_addresses);
+  uint32_t merged = 0;
+  for(uint32_t n = 1; n < count; n++) {
+    if(entries[n].address == entries[merged].address) entries[merged].count += entries[n].count;
+    else entries[++merged] = entries[n];
+  }
+  count = merged + 1;
+  qsort(entries, count, sizeof(profile_entry_t), profile_compare_entries);
+  return(count);
+}
+
+void profile_report(const char *title, profile_entry_t *entries, uint32_t count, int functions) {
+  printf("%s:\n", title);
+  for(uint32_t n = 0; n < count && n < PROFILE_TOP; n++) {
+    char name[128];
+    if(functions) profile_function(entries[n].address, name, sizeof(name));
+    else profile_describe(entries[n].address, name, sizeof(name));
+    printf("  %6.2f%%  %08x  %s\n", 100.0 * entries[n].count / profile_samples, entries[n].address, name);
+  }
+}
+
+// The start of the function containing address, or address itself
+uint32_t profile_frame(uint32_t address) {
+  profile_symbol_t *symbol = profile_lookup(address);
+  return(symbol ? symbol->address : address);
+}
+
+int profile_compare_keys(const void *a, const void *b) {
+  uint64_t x = ((profile_slot_t *)a)->key, y = ((profile_slot_t *)b)->key;
+  return((x > y) - (x < y));
+}
+
+int profile_compare_counts(const void *a, const void *b) {
+  uint64_t x = ((profile_slot_t *)a)->count, y = ((profile_slot_t *)b)->count;
+  return((x < y) - (x > y));
+}
+
+// Call edges, caller frame in the high half of the key and the sampled
+// frame in the low half, summed and sorted by count
+uint32_t profile_edges(profile_slot_t *edges) {
+  uint32_t count = 0;
+  for(uint32_t n = 0; n < PROFILE_SLOTS; n++) {
+    if(profile_slots[n].key == PROFILE_EMPTY) continue;
+    // $ra points past the delay slot of the call
+    uint32_t caller = profile_frame((uint32_t)profile_slots[n].key - 8);
+    uint32_t function = profile_frame(profile_slots[n].key >> 32);
+    edges[count].key = (uint64_t)caller << 32 | function;
+    edges[count].count = profile_slots[n].count;
+    count++;
+  }
+  if(!count) return(0);
+  qsort(edges, count, sizeof(profile_slot_t), profile_compare_keys);
+  uint32_t merged = 0;
+  for(uint32_t n = 1; n < count; n++) {
+    if(edges[n].key == edges[merged].key) edges[merged].count += edges[n].count;
+    else edges[++merged] = edges[n];
+  }
+  count = merged + 1;
+  qsort(edges, count, sizeof(profile_slot_t), profile_compare_counts);
+  return(count);
+}
+
+void profile_close() {
+  if(!profile_enabled) return;
+  if(profile_timer_armed) {
+    timer_delete(profile_timer);
+    profile_timer_armed = 0;
+  }
+  profile_enabled = 0;
+
+  // Folded stacks, "caller;function count", for flamegraph.pl and friends
+  profile_slot_t *edges = malloc(PROFILE_SLOTS * sizeof(profile_slot_t));
+  uint32_t edge_count = profile_edges(edges);
+  for(uint32_t n = 0; n < edge_count; n++) {
+    char caller[128], function[128];
+    profile_function(edges[n].key >> 32, caller, sizeof(caller));
+    profile_function(edges[n].key, function, sizeof(function));
+    fprintf(profile_file, "%s;%s %lu\n", caller, function, edges[n].count);
+  }
+  fclose(profile_file);
+
+  if(profile_samples) {
+    printf("Profile: %lu samples", profile_samples);
+    if(profile_dropped) printf(", %lu not attributed to a PC", profile_dropped);
+    printf("\n");
+    for(int n = 0; n < PROFILE_REGIONS; n++)
+      if(profile_regions[n])
+        printf("  %6.2f%%  %s\n", 100.0 * profile_regions[n] / profile_samples, profile_region_names[n]);
+    profile_entry_t *entries = malloc(PROFILE_SLOTS * sizeof(profile_entry_t));
+    profile_report("Hot PCs", entries, profile_collect(entries, 0), 0);
+    if(profile_symbol_count)
+      profile_report("Hot functions", entries, profile_collect(entries, 1), 1);
+    free(entries);
+    printf("Hot call edges:\n");
+    for(uint32_t n = 0; n < edge_count && n < PROFILE_TOP; n++) {
+      char caller[128], function[128];
+      profile_function(edges[n].key >> 32, caller, sizeof(caller));
+      profile_function(edges[n].key, function, sizeof(function));
+      printf("  %6.2f%%  %s -> %s\n", 100.0 * edges[n].count / profile_samples, caller, function);
+    }
+  }
+  free(edges);
+}
@@ -0,0 +1,25 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+// Guest sampling profiler. Each sample takes the PC and $ra, so the folded
+// stacks it writes are two frames deep: the caller found through $ra and
+// the sampled function. $ra is stale once a function has made calls of its
+// own, which shows up as a few implausible callers rather than wrong totals.
+enum {
+  PROFILE_RAM,
+  PROFILE_SCRATCHPAD,
+  PROFILE_BIOS,
+  PROFILE_OTHER,
+  PROFILE_REGIONS,
+};
+
+extern int profile_enabled;
+
+void profile_open(const char *spec);
+void profile_symbols(const char *path);
+void profile_reset();
+void profile_close();
+
+#endif
@@ -1,20 +1,208 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include "cpu.h"
 #include "memory.h"
 #include "dma.h"
 #include "rom.h"
 #include "gpu.h"
+#include "gpu_capture.h"
+#include "scheduler.h"
+#include "pacing.h"
+#include "record.h"
+#include "export.h"
+#include "timers.h"
+#include "cdrom.h"
+#include "disc.h"
+#include "spu.h"
+#include "audio.h"
+#include "mdec.h"
+#include "peripheral.h"
+#include "memcard.h"
+#include "input.h"
+#include "movie.h"
+#include "lockstep.h"
+#include "trace.h"
+#include "profile.h"
+#include "stats.h"
+#include "telemetry.h"
+#include "gpu_stats.h"
+#include "latency.h"
+#include "block_cache.h"
+#include "timing.h"
+#include "search.h"
+#include "debug.h"
 
 #include <SDL2/SDL.h>
 
-int main() {
+void usage(const char *name) {
+  printf("Usage: %s [options]\n", name);
+  printf("  -H       Headless, render into VRAM with the software rasterizer\n");
+  printf("  -C file  Capture the GPU command stream for gpu-replay\n");
+  printf("  -T       Turbo, run uncapped instead of at real-time speed\n");
+  printf("  -F       Skip rendering frames when behind (or, with -T, beyond one per real-time frame)\n");
+  printf("  -V file  Record video, Y4M if the name ends in .y4m, raw RGB24 otherwise\n");
+  printf("  -A file  Record audio as WAV\n");
+  printf("  -B       Stall emulation rather than drop frames when the recorder falls behind\n");
+  printf("  -X name  Export VRAM and the display frame in POSIX shared memory\n");
+  printf("  -D file  Insert a disc image, a CUE sheet or a single track BIN\n");
+  printf("  -N       No audio output (headless runs never open a device)\n");
+  printf("  -M file  Insert a memory card, created if missing, the second -M goes in slot 2\n");
+  printf("  -I file  Drive the pad from an input script instead of the keyboard\n");
+  printf("  -R file  Record the pad input of every frame as a movie\n");
+  printf("  -P file  Replay a movie, headless and uncapped, exits at the end\n");
+  printf("  -S file  Log per-frame hashes of VRAM and the CPU registers\n");
+  printf("  -K file  Check per-frame hashes against a log, stopping at the first divergence\n");
+  printf("  -L name[:n]  Run CPU engine name in lockstep with the interpreter, checking every nth block\n");
+  printf("  -t file[:n]  Trace execution into file, keeping the last n records (needs a -DTRACE build)\n");
+  printf("  -p file[:rate]  Profile guest code into file as folded stacks, sampling every rate cycles or at rate hz of host CPU time\n");
+  printf("  -y file  Resolve profiled addresses with a symbol map\n");
+  printf("  -j file  Write hot path counters as JSON at exit and on SIGUSR1 (needs a -DSTATS build)\n");
+  printf("  -m path  Publish Prometheus metrics every frame to a file, or to a socket given as unix:path\n");
+  printf("  -O       Show the frame time overlay, F3 toggles it\n");
+  printf("  -g file  Log per-frame GPU statistics as CSV\n");
+  printf("  -E       Measure input-to-photon latency, reporting percentiles at exit\n");
+  printf("  -e name  Run the CPU with engine name, a block at a time\n");
+  printf("  -c file  Keep the block engine's blocks in file across runs, implies -e block\n");
+  printf("  -w       Model instruction timing: memory wait states, the instruction cache and multiply/divide latency\n");
+  printf("  -s file  Run a memory search and watch script, watches are published with -m\n");
+  printf("  -b addr  Set a breakpoint, hits are logged or, with -d, pause until continued\n");
+  printf("  -d path  Take debugger commands on a Unix socket: break, watch, delete, list, pause, continue, regs, peek\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  int opt;
+  // Breakpoints set by the options go into the page tables
+  memory_reset();
+  while((opt = getopt(argc, argv, "HC:TFV:A:BX:D:NM:I:R:P:S:K:L:t:p:y:j:m:Og:Ee:c:ws:b:d:")) != -1) {
+    switch(opt) {
+      case 'H':
+        gpu_headless = 1;
+        break;
+      case 'C':
+        gpu_capture_open(optarg);
+        break;
+      case 'T':
+        pacing_mode = PACING_TURBO;
+        break;
+      case 'F':
+        pacing_frameskip = 1;
+        break;
+      case 'V':
+        record_open_video(optarg);
+        break;
+      case 'A':
+        record_open_audio(optarg);
+        break;
+      case 'B':
+        record_block = 1;
+        break;
+      case 'X':
+        export_open(optarg);
+        break;
+      case 'D':
+        disc_open(optarg);
+        break;
+      case 'N':
+        audio_disabled = 1;
+        break;
+      case 'M':
+        memcard_open(optarg);
+        break;
+      case 'I':
+        input_open_script(optarg);
+        break;
+      case 'R':
+        movie_record(optarg);
+        break;
+      case 'P':
+        movie_replay(optarg);
+        gpu_headless = 1;
+        pacing_mode = PACING_TURBO;
+        break;
+      case 'S':
+        movie_write_hashes(optarg);
+        break;
+      case 'K':
+        movie_check_hashes(optarg);
+        break;
+      case 'L':
+        lockstep_open(optarg);
+        break;
+      case 't':
+        trace_open(optarg);
+        break;
+      case 'p':
+        profile_open(optarg);
+        break;
+      case 'y':
+        profile_symbols(optarg);
+        break;
+      case 'j':
+        stats_open(optarg);
+        break;
+      case 'm':
+        telemetry_open(optarg);
+        break;
+      case 'O':
+        gpu_stats_overlay = 1;
+        break;
+      case 'g':
+        gpu_stats_open_csv(optarg);
+        break;
+      case 'E':
+        latency_open();
+        break;
+      case 'e':
+        cpu_engine = cpu_find_engine(optarg);
+        break;
+      case 'c':
+        block_cache_open(optarg);
+        if(!cpu_engine) cpu_engine = cpu_find_engine("block");
+        break;
+      case 'w':
+        timing_open();
+        break;
+      case 's':
+        search_open_script(optarg);
+        break;
+      case 'b':
+        debug_break(strtoul(optarg, 0, 16));
+        break;
+      case 'd':
+        debug_open(optarg);
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  // Skipped frames aren't rasterized headless, a replay needs every one
+  if(movie_replaying) pacing_frameskip = 0;
+
   rom_load_bios();
+  scheduler_reset();
   cpu_reset();
   dma_reset();
+  timers_reset();
+  cdrom_reset();
+  spu_reset();
+  mdec_reset();
+  peripheral_reset();
+  profile_reset();
   gpu_init();
+  if(lockstep_enabled) lockstep_run();
+  if(cpu_engine) {
+    while(1) {
+      if(cpu_irq_pending) cpu_interrupt();
+      cpu_engine->run_block(UINT32_MAX);
+      if(scheduler_cycles >= scheduler_deadline) scheduler_run();
+    }
+  }
   while(1) {
     cpu_fetch_execute();
+    if(scheduler_cycles >= scheduler_deadline) scheduler_run();
   }
   return(0);
 }
@@ -1,8 +1,20 @@
 #include <stdint.h>
 #include "cpu.h"
 #include "memory.h"
+#include "timing.h"
 
 uint8_t ram[1024*2048];
+uint32_t ram_generation[RAM_PAGES];
+
+// For writes that don't go through the accessor, a range may wrap around
+void ram_written(uint32_t address, uint32_t bytes) {
+  if(!bytes) return;
+  if(bytes > 0x200000) bytes = 0x200000;
+  address &= 0x1FFFFF;
+  uint32_t last = (address + bytes - 1) >> RAM_PAGE_BITS;
+  for(uint32_t page = address >> RAM_PAGE_BITS; page <= last; page++)
+    ram_generation[page % RAM_PAGES]++;
+}
 
 uint32_t ram_load_32(uint32_t address) {
   return *(uint32_t*)(ram + (address & 0x1FFFFF));
@@ -14,16 +26,28 @@ uint8_t ram_load_8(uint32_t address) {
   return *(uint8_t*)(ram + (address & 0x1FFFFF));
 }
 void ram_store_32(uint32_t address, uint32_t value) {
-  if((cpu.cop0_registers.sr & (1<<16)) == 0)
+  if((cpu.cop0_registers.sr & (1<<16)) == 0) {
     *(uint32_t*)(ram + (address & 0x1FFFFF)) = value;
+    ram_generation[(address & 0x1FFFFF) >> RAM_PAGE_BITS]++;
+  } else if(timing_enabled) {
+    timing_invalidate(address);
+  }
 }
 void ram_store_16(uint32_t address, uint16_t value) {
-  if((cpu.cop0_registers.sr & (1<<16)) == 0)
+  if((cpu.cop0_registers.sr & (1<<16)) == 0) {
     *(uint16_t*)(ram + (address & 0x1FFFFF)) = value;
+    ram_generation[(address & 0x1FFFFF) >> RAM_PAGE_BITS]++;
+  } else if(timing_enabled) {
+    timing_invalidate(address);
+  }
 }
 void ram_store_8(uint32_t address, uint8_t value) {
-  if((cpu.cop0_registers.sr & (1<<16)) == 0)
+  if((cpu.cop0_registers.sr & (1<<16)) == 0) {
     *(uint8_t*)(ram + (address & 0x1FFFFF)) = value;
+    ram_generation[(address & 0x1FFFFF) >> RAM_PAGE_BITS]++;
+  } else if(timing_enabled) {
+    timing_invalidate(address);
+  }
 }
  memory_accessor_t ram_accessor = {
   .load_32 = ram_load_32,
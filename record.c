@@ -0,0 +1,281 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "record.h"
+#include "ring.h"
+
+// Frames are copied into pre-allocated slots on the emulation thread and
+// handed to a writer thread through a pair of lock-free rings: ready slots
+// one way, free slots back. Conversion and file I/O only happen on the
+// writer thread.
+#define RECORD_SLOTS      8
+#define RECORD_SLOT_SIZE  (RECORD_MAX_WIDTH * RECORD_MAX_HEIGHT * 4)
+#define RECORD_REPEAT     0xff
+#define RECORD_AUDIO_RING (1 << 20)
+
+int recording_video;
+int recording_audio;
+// Stall the emulator instead of dropping frames when the writer falls behind
+int record_block;
+
+typedef struct record_slot_t {
+  uint32_t width, height;
+  int format;
+  uint64_t frame_ns;
+  uint8_t *data;
+} record_slot_t;
+
+record_slot_t record_slots[RECORD_SLOTS];
+uint8_t record_free_data[16], record_ready_data[16];
+ring_t record_free, record_ready;
+uint8_t record_current = RECORD_REPEAT;
+
+uint8_t *record_audio_data;
+ring_t record_audio_ring;
+
+FILE *record_video_file, *record_audio_file;
+int record_y4m;
+uint32_t record_width, record_height;
+uint64_t record_frames, record_dropped, record_audio_bytes, record_audio_dropped;
+
+pthread_t record_thread;
+sem_t record_wake;
+_Atomic int record_stop;
+int record_running;
+
+void record_rgb(record_slot_t *slot, uint8_t *rgb) {
+  memset(rgb, 0, record_width * record_height * 3);
+  uint32_t width = slot->width < record_width ? slot->width : record_width;
+  uint32_t height = slot->height < record_height ? slot->height : record_height;
+  for(uint32_t y = 0; y < height; y++) {
+    uint8_t *out = rgb + y * record_width * 3;
+    switch(slot->format) {
+      case RECORD_RGB555: {
+        uint16_t *in = (uint16_t *)slot->data + y * slot->width;
+        for(uint32_t x = 0; x < width; x++) {
+          out[x*3+0] = (in[x] & 0x1f) << 3;
+          out[x*3+1] = ((in[x] >> 5) & 0x1f) << 3;
+          out[x*3+2] = ((in[x] >> 10) & 0x1f) << 3;
+        }
+        break;
+      }
+      case RECORD_RGB888:
+        memcpy(out, slot->data + y * slot->width * 3, width * 3);
+        break;
+      case RECORD_RGBA_FLIP: {
+        uint8_t *in = slot->data + (slot->height - 1 - y) * slot->width * 4;
+        for(uint32_t x = 0; x < width; x++) {
+          out[x*3+0] = in[x*4+0];
+          out[x*3+1] = in[x*4+1];
+          out[x*3+2] = in[x*4+2];
+        }
+        break;
+      }
+    }
+  }
+}
+
+void record_write_y4m(uint8_t *rgb, uint8_t *yuv) {
+  uint32_t pixels = record_width * record_height;
+  for(uint32_t n = 0; n < pixels; n++) {
+    int r = rgb[n*3+0], g = rgb[n*3+1], b = rgb[n*3+2];
+    yuv[n]            = 16  + ((66 * r + 129 * g + 25 * b + 128) >> 8);
+    yuv[pixels + n]   = 128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8);
+    yuv[2*pixels + n] = 128 + ((112 * r - 94 * g - 18 * b + 128) >> 8);
+  }
+  fputs("FRAME\n", record_video_file);
+  fwrite(yuv, 1, pixels * 3, record_video_file);
+}
+
+void record_drain_audio() {
+  uint8_t buffer[16384];
+  uint32_t bytes;
+  while((bytes = ring_read(&record_audio_ring, buffer, sizeof(buffer)))) {
+    fwrite(buffer, 1, bytes, record_audio_file);
+    record_audio_bytes += bytes;
+  }
+}
+
+void *record_writer(void *arg) {
+  uint8_t *rgb = malloc(RECORD_MAX_WIDTH * RECORD_MAX_HEIGHT * 3);
+  uint8_t *yuv = malloc(RECORD_MAX_WIDTH * RECORD_MAX_HEIGHT * 3);
+  while(1) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += 100000000;
+    if(ts.tv_nsec >= 1000000000) { ts.tv_sec++; ts.tv_nsec -= 1000000000; }
+    sem_timedwait(&record_wake, &ts);
+
+    uint8_t index;
+    while(ring_read(&record_ready, &index, 1)) {
+      if(index != RECORD_REPEAT) {
+        record_slot_t *slot = &record_slots[index];
+        if(!record_width) {
+          // The output size is fixed by the first frame, later frames are cropped or padded
+          record_width = slot->width;
+          record_height = slot->height;
+          if(record_y4m)
+            fprintf(record_video_file, "YUV4MPEG2 W%u H%u F1000000000:%lu Ip A1:1 C444\n", record_width, record_height, slot->frame_ns);
+        }
+        record_rgb(slot, rgb);
+        ring_write(&record_free, &index, 1);
+      }
+      if(record_width) {
+        if(record_y4m)
+          record_write_y4m(rgb, yuv);
+        else
+          fwrite(rgb, 1, record_width * record_height * 3, record_video_file);
+      }
+    }
+    if(record_audio_file)
+      record_drain_audio();
+    if(atomic_load(&record_stop) && !ring_used(&record_ready))
+      break;
+  }
+  free(rgb);
+  free(yuv);
+  return(0);
+}
+
+void record_start() {
+  if(record_running) return;
+  for(int n = 0; n < RECORD_SLOTS; n++) {
+    record_slots[n].data = malloc(RECORD_SLOT_SIZE);
+    if(!record_slots[n].data) {
+      printf("Failed to allocate recording buffers!\n");
+      exit(1);
+    }
+  }
+  ring_init(&record_free, record_free_data, sizeof(record_free_data));
+  ring_init(&record_ready, record_ready_data, sizeof(record_ready_data));
+  for(uint8_t n = 0; n < RECORD_SLOTS; n++)
+    ring_write(&record_free, &n, 1);
+  record_audio_data = malloc(RECORD_AUDIO_RING);
+  ring_init(&record_audio_ring, record_audio_data, RECORD_AUDIO_RING);
+  sem_init(&record_wake, 0, 0);
+  pthread_create(&record_thread, 0, record_writer, 0);
+  record_running = 1;
+  atexit(record_close);
+}
+
+void record_open_video(const char *path) {
+  record_video_file = fopen(path, "wb");
+  if(!record_video_file) {
+    printf("Failed to open video recording: %s\n", path);
+    exit(1);
+  }
+  size_t length = strlen(path);
+  record_y4m = length > 4 && !strcmp(path + length - 4, ".y4m");
+  recording_video = 1;
+  record_start();
+}
+
+void record_wav_header(uint32_t data_bytes) {
+  struct __attribute__((packed)) {
+    char riff[4];
+    uint32_t riff_size;
+    char wave[4];
+    char fmt[4];
+    uint32_t fmt_size;
+    uint16_t format, channels;
+    uint32_t rate, byte_rate;
+    uint16_t block_align, bits;
+    char data[4];
+    uint32_t data_size;
+  } header = {
+    "RIFF", 36 + data_bytes, "WAVE", "fmt ", 16,
+    1, 2, RECORD_AUDIO_RATE, RECORD_AUDIO_RATE * 4, 4, 16,
+    "data", data_bytes,
+  };
+  fwrite(&header, sizeof(header), 1, record_audio_file);
+}
+
+void record_open_audio(const char *path) {
+  record_audio_file = fopen(path, "wb");
+  if(!record_audio_file) {
+    printf("Failed to open audio recording: %s\n", path);
+    exit(1);
+  }
+  record_wav_header(0);
+  recording_audio = 1;
+  record_start();
+}
+
+// Returns a buffer to copy the frame into, or 0 when it has to be dropped
+uint8_t *record_begin_frame(uint32_t width, uint32_t height, int format, uint64_t frame_ns) {
+  uint8_t index;
+  while(!ring_read(&record_free, &index, 1)) {
+    if(!record_block) {
+      record_dropped++;
+      return(0);
+    }
+    sched_yield();
+  }
+  record_slot_t *slot = &record_slots[index];
+  slot->width = width;
+  slot->height = height;
+  slot->format = format;
+  slot->frame_ns = frame_ns;
+  record_current = index;
+  return(slot->data);
+}
+
+void record_end_frame() {
+  ring_write(&record_ready, &record_current, 1);
+  record_frames++;
+  sem_post(&record_wake);
+}
+
+// Repeats the previous frame, used when a frame was skipped
+void record_repeat_frame() {
+  uint8_t index = RECORD_REPEAT;
+  if(!ring_write(&record_ready, &index, 1)) {
+    record_dropped++;
+    return;
+  }
+  record_frames++;
+  sem_post(&record_wake);
+}
+
+// Interleaved stereo samples at RECORD_AUDIO_RATE
+void record_audio(const int16_t *samples, uint32_t frames) {
+  uint32_t bytes = frames * 4;
+  while(1) {
+    uint32_t written = ring_write(&record_audio_ring, samples, bytes);
+    samples += written / 2;
+    bytes -= written;
+    if(!bytes) return;
+    if(!record_block) {
+      record_audio_dropped += bytes;
+      return;
+    }
+    sched_yield();
+  }
+}
+
+void record_close() {
+  if(!record_running) return;
+  atomic_store(&record_stop, 1);
+  sem_post(&record_wake);
+  pthread_join(record_thread, 0);
+  record_running = 0;
+  if(record_video_file) {
+    fclose(record_video_file);
+    printf("Recorded %lu frames, dropped %lu\n", record_frames, record_dropped);
+  }
+  if(record_audio_file) {
+    fseek(record_audio_file, 0, SEEK_SET);
+    record_wav_header(record_audio_bytes);
+    fclose(record_audio_file);
+    if(record_audio_dropped)
+      printf("Dropped %lu bytes of recorded audio\n", record_audio_dropped);
+  }
+  recording_video = 0;
+  recording_audio = 0;
+}
@@ -0,0 +1,27 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdint.h>
+
+// Pixel formats handed to record_begin_frame
+#define RECORD_RGB555    0 // 15-bit VRAM display area
+#define RECORD_RGB888    1 // 24-bit VRAM display area
+#define RECORD_RGBA_FLIP 2 // GL backbuffer, bottom row first
+
+#define RECORD_MAX_WIDTH  1280
+#define RECORD_MAX_HEIGHT 960
+#define RECORD_AUDIO_RATE 44100
+
+extern int recording_video;
+extern int recording_audio;
+extern int record_block;
+
+void record_open_video(const char *path);
+void record_open_audio(const char *path);
+uint8_t *record_begin_frame(uint32_t width, uint32_t height, int format, uint64_t frame_ns);
+void record_end_frame();
+void record_repeat_frame();
+void record_audio(const int16_t *samples, uint32_t frames);
+void record_close();
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+
+// Wait-free single producer, single consumer byte ring. head and tail are
+// free-running counters, size must be a power of two.
+typedef struct ring_t {
+  uint8_t *data;
+  uint32_t size;
+  _Atomic uint32_t head;
+  _Atomic uint32_t tail;
+} ring_t;
+
+static inline void ring_init(ring_t *ring, uint8_t *data, uint32_t size) {
+  ring->data = data;
+  ring->size = size;
+  atomic_store(&ring->head, 0);
+  atomic_store(&ring->tail, 0);
+}
+
+static inline uint32_t ring_used(ring_t *ring) {
+  return(atomic_load_explicit(&ring->head, memory_order_acquire) - atomic_load_explicit(&ring->tail, memory_order_acquire));
+}
+
+static inline uint32_t ring_free(ring_t *ring) {
+  return(ring->size - ring_used(ring));
+}
+
+// Producer side, copies as much of src as fits and returns the byte count
+static inline uint32_t ring_write(ring_t *ring, const void *src, uint32_t bytes) {
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  uint32_t space = ring->size - (head - tail);
+  if(bytes > space) bytes = space;
+  uint32_t offset = head & (ring->size - 1);
+  uint32_t first = ring->size - offset < bytes ? ring->size - offset : bytes;
+  memcpy(ring->data + offset, src, first);
+  memcpy(ring->data, (const uint8_t *)src + first, bytes - first);
+  atomic_store_explicit(&ring->head, head + bytes, memory_order_release);
+  return(bytes);
+}
+
+// Consumer side, copies up to bytes into dst and returns the byte count
+static inline uint32_t ring_read(ring_t *ring, void *dst, uint32_t bytes) {
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  if(bytes > head - tail) bytes = head - tail;
+  uint32_t offset = tail & (ring->size - 1);
+  uint32_t first = ring->size - offset < bytes ? ring->size - offset : bytes;
+  memcpy(dst, ring->data + offset, first);
+  memcpy((uint8_t *)dst + first, ring->data, bytes - first);
+  atomic_store_explicit(&ring->tail, tail + bytes, memory_order_release);
+  return(bytes);
+}
+
+#endif
@@ -0,0 +1,52 @@
+#include <stdint.h>
+#include "scheduler.h"
+
+// Guest time in CPU cycles, and the earliest cycle at which an event is due.
+// The main loop only compares the two, so events cost nothing until they fire.
+uint64_t scheduler_cycles;
+uint64_t scheduler_deadline;
+
+struct {
+  uint64_t when;
+  void (*callback)();
+} scheduler_events[SCHEDULER_EVENTS];
+
+void scheduler_update_deadline() {
+  scheduler_deadline = UINT64_MAX;
+  for(int n = 0; n < SCHEDULER_EVENTS; n++)
+    if(scheduler_events[n].when < scheduler_deadline)
+      scheduler_deadline = scheduler_events[n].when;
+}
+
+void scheduler_reset() {
+  scheduler_cycles = 0;
+  for(int n = 0; n < SCHEDULER_EVENTS; n++)
+    scheduler_events[n].when = UINT64_MAX;
+  scheduler_update_deadline();
+}
+
+void scheduler_schedule(int event, uint64_t when, void (*callback)()) {
+  scheduler_events[event].when = when;
+  scheduler_events[event].callback = callback;
+  if(when < scheduler_deadline)
+    scheduler_deadline = when;
+}
+
+void scheduler_cancel(int event) {
+  scheduler_events[event].when = UINT64_MAX;
+  scheduler_update_deadline();
+}
+
+void scheduler_run() {
+  while(scheduler_deadline <= scheduler_cycles) {
+    for(int n = 0; n < SCHEDULER_EVENTS; n++) {
+      if(scheduler_events[n].when == scheduler_deadline) {
+        // Callbacks usually reschedule themselves, so clear the slot first
+        scheduler_events[n].when = UINT64_MAX;
+        scheduler_events[n].callback();
+        break;
+      }
+    }
+    scheduler_update_deadline();
+  }
+}
@@ -0,0 +1,30 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+
+#define CPU_CLOCK 33868800
+
+enum {
+  SCHEDULER_VBLANK,
+  SCHEDULER_TIMER0,
+  SCHEDULER_TIMER1,
+  SCHEDULER_TIMER2,
+  SCHEDULER_CDROM,
+  SCHEDULER_CDROM_READ,
+  SCHEDULER_SPU,
+  SCHEDULER_MDEC,
+  SCHEDULER_PERIPHERAL,
+  SCHEDULER_PROFILE,
+  SCHEDULER_EVENTS,
+};
+
+extern uint64_t scheduler_cycles;
+extern uint64_t scheduler_deadline;
+
+void scheduler_reset();
+void scheduler_schedule(int event, uint64_t when, void (*callback)());
+void scheduler_cancel(int event);
+void scheduler_run();
+
+#endif
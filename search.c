@@ -0,0 +1,303 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "search.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#define SEARCH_REPORT_MAX 32
+
+typedef uint32_t (*search_filter_fn)(uint32_t *candidates, const uint8_t *now, const uint8_t *before, uint32_t size, int width, int op, uint32_t value);
+
+#define SEARCH_ISA scalar
+#define SEARCH_VECTOR 16
+#define SEARCH_TARGET
+#define SEARCH_MOVEMASK(v) ({ \
+  uint32_t bits = 0; \
+  for(int lane = 0; lane < SEARCH_VECTOR; lane++) bits |= (uint32_t)((v)[lane] >> 7) << lane; \
+  bits; })
+#include "search_scan.h"
+#undef SEARCH_ISA
+#undef SEARCH_VECTOR
+#undef SEARCH_TARGET
+#undef SEARCH_MOVEMASK
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SEARCH_ISA sse2
+#define SEARCH_VECTOR 16
+#define SEARCH_TARGET __attribute__((target("sse2")))
+#define SEARCH_MOVEMASK(v) _mm_movemask_epi8((__m128i)(v))
+#include "search_scan.h"
+#undef SEARCH_ISA
+#undef SEARCH_VECTOR
+#undef SEARCH_TARGET
+#undef SEARCH_MOVEMASK
+
+#define SEARCH_ISA avx2
+#define SEARCH_VECTOR 32
+#define SEARCH_TARGET __attribute__((target("avx2")))
+#define SEARCH_MOVEMASK(v) _mm256_movemask_epi8((__m256i)(v))
+#include "search_scan.h"
+#undef SEARCH_ISA
+#undef SEARCH_VECTOR
+#undef SEARCH_TARGET
+#undef SEARCH_MOVEMASK
+#endif
+
+enum {
+  SEARCH_START,
+  SEARCH_FILTER,
+  SEARCH_REPORT,
+  SEARCH_WATCH,
+  SEARCH_UNWATCH,
+};
+
+typedef struct search_step_t {
+  uint64_t frame;
+  int command;
+  int op;
+  uint32_t width;
+  uint32_t value;
+  char name[32];
+} search_step_t;
+
+typedef struct search_region_t {
+  uint8_t *memory;
+  // Guest address of the first byte
+  uint32_t base;
+  uint32_t size;
+  uint32_t *candidates;
+  uint8_t *snapshot;
+} search_region_t;
+
+extern uint8_t ram[];
+extern uint8_t scratchpad[];
+
+search_region_t search_regions[] = {
+  { .memory = ram, .base = 0x80000000, .size = 1024 * 2048 },
+  { .memory = scratchpad, .base = 0x1f800000, .size = 1024 },
+};
+#define SEARCH_REGIONS (sizeof(search_regions) / sizeof(search_regions[0]))
+
+const char *search_op_names[SEARCH_OPS] = {
+  "eq", "ne", "gt", "lt", "changed", "unchanged", "increased", "decreased",
+};
+
+search_filter_fn search_kernel = search_filter_scalar;
+const char *search_kernel_isa = "scalar";
+uint32_t search_width;
+uint32_t search_candidates;
+
+search_watch_t search_watches[SEARCH_WATCHES];
+uint32_t search_watch_count;
+uint32_t search_watch_values[SEARCH_WATCHES];
+
+search_step_t *search_script;
+uint32_t search_script_length, search_script_position;
+uint64_t search_frames;
+
+void search_init() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")) {
+    search_kernel = search_filter_avx2;
+    search_kernel_isa = "avx2";
+  } else {
+    search_kernel = search_filter_sse2;
+    search_kernel_isa = "sse2";
+  }
+#endif
+}
+
+const char *search_isa() {
+  return(search_kernel_isa);
+}
+
+search_region_t *search_region(uint32_t address, uint32_t *offset) {
+  switch(address) {
+    case 0x00000000 ... 0x001FFFFF:
+    case 0x80000000 ... 0x801FFFFF:
+    case 0xA0000000 ... 0xA01FFFFF:
+      *offset = address & 0x1FFFFF;
+      return(&search_regions[0]);
+    case 0x1F800000 ... 0x1F8003FF:
+    case 0x8F800000 ... 0x8F8003FF:
+    case 0xAF800000 ... 0xAF8003FF:
+      *offset = address & 0x3FF;
+      return(&search_regions[1]);
+  }
+  return(0);
+}
+
+uint32_t search_read(search_region_t *region, uint32_t offset, uint32_t width) {
+  uint32_t value = 0;
+  memcpy(&value, region->memory + offset, width);
+  return(value);
+}
+
+void search_start(int width) {
+  // The bit of each location's lowest byte
+  uint32_t pattern = width == 1 ? 0xffffffff : width == 2 ? 0x55555555 : 0x11111111;
+  search_width = width;
+  search_candidates = 0;
+  for(uint32_t n = 0; n < SEARCH_REGIONS; n++) {
+    search_region_t *region = &search_regions[n];
+    if(!region->candidates) {
+      region->candidates = malloc(region->size / 8);
+      region->snapshot = malloc(region->size);
+    }
+    for(uint32_t word = 0; word < region->size / 32; word++)
+      region->candidates[word] = pattern;
+    memcpy(region->snapshot, region->memory, region->size);
+    search_candidates += region->size / width;
+  }
+}
+
+uint32_t search_filter(int op, uint32_t value) {
+  if(!search_width) search_start(4);
+  search_candidates = 0;
+  for(uint32_t n = 0; n < SEARCH_REGIONS; n++) {
+    search_region_t *region = &search_regions[n];
+    search_candidates += search_kernel(region->candidates, region->memory, region->snapshot, region->size, search_width, op, value);
+    memcpy(region->snapshot, region->memory, region->size);
+  }
+  return(search_candidates);
+}
+
+void search_report() {
+  if(!search_width) {
+    printf("Search: nothing searched yet\n");
+    return;
+  }
+  printf("Search: %u candidates of %u bits", search_candidates, search_width * 8);
+  if(search_candidates > SEARCH_REPORT_MAX) printf(", showing the first %u", SEARCH_REPORT_MAX);
+  printf("\n");
+  uint32_t shown = 0;
+  for(uint32_t n = 0; n < SEARCH_REGIONS && shown < SEARCH_REPORT_MAX; n++) {
+    search_region_t *region = &search_regions[n];
+    for(uint32_t word = 0; word < region->size / 32 && shown < SEARCH_REPORT_MAX; word++) {
+      for(uint32_t bits = region->candidates[word]; bits && shown < SEARCH_REPORT_MAX; bits &= bits - 1) {
+        uint32_t offset = word * 32 + __builtin_ctz(bits);
+        printf("  %08x = %u\n", region->base + offset, search_read(region, offset, search_width));
+        shown++;
+      }
+    }
+  }
+}
+
+void search_watch(const char *name, uint32_t address, uint32_t width) {
+  uint32_t offset;
+  if(!search_region(address, &offset) || address % width) {
+    printf("Can't watch %s at %08x, only aligned RAM and scratchpad locations can be watched\n", name, address);
+    return;
+  }
+  search_unwatch(name);
+  if(search_watch_count == SEARCH_WATCHES) {
+    printf("Can't watch %s, there are already %u watches\n", name, SEARCH_WATCHES);
+    return;
+  }
+  search_watch_t *watch = &search_watches[search_watch_count++];
+  snprintf(watch->name, sizeof(watch->name), "%s", name);
+  watch->address = address;
+  watch->width = width;
+}
+
+void search_unwatch(const char *name) {
+  for(uint32_t n = 0; n < search_watch_count; n++) {
+    if(strcmp(search_watches[n].name, name)) continue;
+    memmove(&search_watches[n], &search_watches[n + 1], (search_watch_count - n - 1) * sizeof(search_watch_t));
+    search_watch_count--;
+    return;
+  }
+}
+
+int search_parse_op(const char *name) {
+  for(int op = 0; op < SEARCH_OPS; op++)
+    if(!strcmp(search_op_names[op], name)) return(op);
+  return(-1);
+}
+
+int search_parse_width(uint32_t bits) {
+  if(bits != 8 && bits != 16 && bits != 32) return(0);
+  return(bits / 8);
+}
+
+void search_open_script(const char *path) {
+  FILE *file = fopen(path, "r");
+  if(!file) {
+    printf("Failed to open search script: %s\n", path);
+    exit(1);
+  }
+  search_init();
+  char line[256];
+  uint32_t capacity = 0, number = 0;
+  while(fgets(line, sizeof(line), file)) {
+    number++;
+    search_step_t step = {0};
+    char command[16], argument[32];
+    long value, address;
+    uint32_t bits;
+    int fields = sscanf(line, "%lu %15s %31s", &step.frame, command, argument);
+    if(fields <= 0 || line[0] == '#') continue;
+    int valid = fields >= 2;
+    if(valid && !strcmp(command, "start")) {
+      step.command = SEARCH_START;
+      valid = fields == 3 && (step.width = search_parse_width(atoi(argument)));
+    } else if(valid && !strcmp(command, "filter")) {
+      step.command = SEARCH_FILTER;
+      step.op = fields == 3 ? search_parse_op(argument) : -1;
+      // Comparisons against a value take one, the others compare with the last step
+      valid = step.op >= 0;
+      if(valid && step.op < SEARCH_CHANGED) {
+        valid = sscanf(line, "%*u %*s %*s %li", &value) == 1;
+        step.value = value;
+      }
+    } else if(valid && !strcmp(command, "report")) {
+      step.command = SEARCH_REPORT;
+    } else if(valid && !strcmp(command, "watch")) {
+      step.command = SEARCH_WATCH;
+      valid = sscanf(line, "%*u %*s %31s %li %u", step.name, &address, &bits) == 3 && (step.width = search_parse_width(bits));
+      step.value = address;
+    } else if(valid && !strcmp(command, "unwatch")) {
+      step.command = SEARCH_UNWATCH;
+      valid = fields == 3;
+      snprintf(step.name, sizeof(step.name), "%s", argument);
+    } else {
+      valid = 0;
+    }
+    if(!valid) {
+      printf("Bad search script line %u: %s", number, line);
+      exit(1);
+    }
+    if(search_script_length == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      search_script = realloc(search_script, capacity * sizeof(search_step_t));
+    }
+    search_script[search_script_length++] = step;
+  }
+  fclose(file);
+  printf("Memory search: %u script steps, %s scans\n", search_script_length, search_isa());
+}
+
+// Called once per VBlank
+void search_frame() {
+  search_frames++;
+  while(search_script_position < search_script_length && search_script[search_script_position].frame <= search_frames) {
+    search_step_t *step = &search_script[search_script_position++];
+    switch(step->command) {
+      case SEARCH_START: search_start(step->width); break;
+      case SEARCH_FILTER: search_filter(step->op, step->value); break;
+      case SEARCH_REPORT: search_report(); break;
+      case SEARCH_WATCH: search_watch(step->name, step->value, step->width); break;
+      case SEARCH_UNWATCH: search_unwatch(step->name); break;
+    }
+  }
+  for(uint32_t n = 0; n < search_watch_count; n++) {
+    uint32_t offset;
+    search_region_t *region = search_region(search_watches[n].address, &offset);
+    search_watch_values[n] = search_read(region, offset, search_watches[n].width);
+  }
+}
@@ -0,0 +1,54 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdint.h>
+
+// Searches and watches over guest RAM and the scratchpad, for finding where
+// a game keeps a value and then following it. A search starts with every
+// aligned location of one width as a candidate, each filter keeps those
+// passing a comparison against a value or against memory as it was at the
+// previous step. Watches are named locations read once per frame and
+// published with the telemetry. Both are driven by a script of frame
+// numbered commands:
+//
+//   600  start 16
+//   660  filter eq 3
+//   720  filter decreased
+//   720  report
+//   720  watch lives 0x800a1234 16
+//   900  unwatch lives
+#define SEARCH_WATCHES 64
+
+enum {
+  SEARCH_EQUAL,
+  SEARCH_NOT_EQUAL,
+  SEARCH_GREATER,
+  SEARCH_LESS,
+  SEARCH_CHANGED,
+  SEARCH_UNCHANGED,
+  SEARCH_INCREASED,
+  SEARCH_DECREASED,
+  SEARCH_OPS,
+};
+
+typedef struct search_watch_t {
+  char name[32];
+  uint32_t address;
+  uint32_t width;
+} search_watch_t;
+
+extern search_watch_t search_watches[SEARCH_WATCHES];
+extern uint32_t search_watch_count;
+extern uint32_t search_watch_values[SEARCH_WATCHES];
+extern uint32_t search_candidates;
+
+void search_open_script(const char *path);
+void search_start(int width);
+uint32_t search_filter(int op, uint32_t value);
+void search_report();
+void search_watch(const char *name, uint32_t address, uint32_t width);
+void search_unwatch(const char *name);
+void search_frame();
+const char *search_isa();
+
+#endif
@@ -0,0 +1,84 @@
+// Search kernel template, included by search.c once per instruction set.
+// The includer defines SEARCH_ISA (name suffix), SEARCH_VECTOR (bytes per
+// step, 16 or 32), SEARCH_TARGET (function attribute) and
+// SEARCH_MOVEMASK(v), which turns a vector of byte lanes into a bit per
+// byte from the top bit of each.
+//
+// Candidates are a bit per byte of memory whatever the width, so one
+// bitmap word covers 32 bytes and a comparison mask maps straight onto it.
+// Only the bit of a location's lowest byte is ever set. Every width and
+// comparison gets its own loop, with no branches on either inside it.
+
+#define SEARCH_JOIN2(a, b) a##_##b
+#define SEARCH_JOIN(a, b) SEARCH_JOIN2(a, b)
+#define SEARCH_FN(name) SEARCH_JOIN(name, SEARCH_ISA)
+
+typedef uint8_t SEARCH_FN(v8) __attribute__((vector_size(SEARCH_VECTOR)));
+typedef uint16_t SEARCH_FN(v16) __attribute__((vector_size(SEARCH_VECTOR)));
+typedef uint32_t SEARCH_FN(v32) __attribute__((vector_size(SEARCH_VECTOR)));
+
+#define SEARCH_COMPARE(bits) \
+static inline __attribute__((always_inline)) SEARCH_TARGET \
+SEARCH_FN(v8) SEARCH_FN(search_compare##bits)(const uint8_t *now, const uint8_t *before, int op, uint##bits##_t value) { \
+  SEARCH_FN(v##bits) a, b, r; \
+  memcpy(&a, now, SEARCH_VECTOR); \
+  memcpy(&b, before, SEARCH_VECTOR); \
+  switch(op) { \
+    case SEARCH_EQUAL:     r = (SEARCH_FN(v##bits))(a == value); break; \
+    case SEARCH_NOT_EQUAL: r = (SEARCH_FN(v##bits))(a != value); break; \
+    case SEARCH_GREATER:   r = (SEARCH_FN(v##bits))(a > value); break; \
+    case SEARCH_LESS:      r = (SEARCH_FN(v##bits))(a < value); break; \
+    case SEARCH_CHANGED:   r = (SEARCH_FN(v##bits))(a != b); break; \
+    case SEARCH_UNCHANGED: r = (SEARCH_FN(v##bits))(a == b); break; \
+    case SEARCH_INCREASED: r = (SEARCH_FN(v##bits))(a > b); break; \
+    default:               r = (SEARCH_FN(v##bits))(a < b); break; \
+  } \
+  return((SEARCH_FN(v8))r); \
+}
+SEARCH_COMPARE(8)
+SEARCH_COMPARE(16)
+SEARCH_COMPARE(32)
+#undef SEARCH_COMPARE
+
+static inline __attribute__((always_inline)) SEARCH_TARGET
+uint32_t SEARCH_FN(search_loop)(uint32_t *candidates, const uint8_t *now, const uint8_t *before, uint32_t size, int width, int op, uint32_t value) {
+  uint32_t count = 0;
+  for(uint32_t offset = 0; offset < size; offset += 32) {
+    uint32_t *word = &candidates[offset / 32];
+    if(!*word) continue;
+    uint32_t bits = 0;
+    for(uint32_t part = 0; part < 32; part += SEARCH_VECTOR) {
+      SEARCH_FN(v8) mask;
+      switch(width) {
+        case 1: mask = SEARCH_FN(search_compare8)(now + offset + part, before + offset + part, op, value); break;
+        case 2: mask = SEARCH_FN(search_compare16)(now + offset + part, before + offset + part, op, value); break;
+        default: mask = SEARCH_FN(search_compare32)(now + offset + part, before + offset + part, op, value); break;
+      }
+      bits |= (uint32_t)SEARCH_MOVEMASK(mask) << part;
+    }
+    *word &= bits;
+    count += __builtin_popcount(*word);
+  }
+  return(count);
+}
+
+#define SEARCH_CASE(width, op) \
+  case width * SEARCH_OPS + op: return(SEARCH_FN(search_loop)(candidates, now, before, size, width, op, value));
+#define SEARCH_CASES(width) \
+  SEARCH_CASE(width, SEARCH_EQUAL) SEARCH_CASE(width, SEARCH_NOT_EQUAL) \
+  SEARCH_CASE(width, SEARCH_GREATER) SEARCH_CASE(width, SEARCH_LESS) \
+  SEARCH_CASE(width, SEARCH_CHANGED) SEARCH_CASE(width, SEARCH_UNCHANGED) \
+  SEARCH_CASE(width, SEARCH_INCREASED) SEARCH_CASE(width, SEARCH_DECREASED)
+
+// Keeps the candidates passing op, returns how many are left. size is a multiple of 32.
+static SEARCH_TARGET
+uint32_t SEARCH_FN(search_filter)(uint32_t *candidates, const uint8_t *now, const uint8_t *before, uint32_t size, int width, int op, uint32_t value) {
+  switch(width * SEARCH_OPS + op) {
+    SEARCH_CASES(1)
+    SEARCH_CASES(2)
+    SEARCH_CASES(4)
+  }
+  return(0);
+}
+#undef SEARCH_CASES
+#undef SEARCH_CASE
@@ -1,11 +1,662 @@
 #include <stdint.h>
+#include <string.h>
 #include "memory.h"
+#include "spu.h"
+#include "cdaudio.h"
+#include "interrupt.h"
+#include "scheduler.h"
+#include "record.h"
+#include "audio.h"
+
+// The SPU runs in batches from a scheduler event rather than alongside the
+// CPU. Register writes land in the register file straight away and take
+// effect at the start of the next batch, at most SPU_BATCH samples later.
+//
+// Per-sample voice work (pitch counters, interpolation, envelope and volume
+// scaling, the mix) is done on voices in vector lanes, SPU_LANES at a time.
+// ADPCM block decode and the ADSR state machines are scalar, but only run
+// once per 28 samples or when an envelope step is due.
+#define SPU_VOICES      24
+#define SPU_LANES       8
+#define SPU_GROUPS      (SPU_VOICES / SPU_LANES)
+#define SPU_BATCH       32
+#define SPU_SAMPLE_CYCLES (CPU_CLOCK / SPU_RATE)
+#define SPU_RAM_SIZE    (512 * 1024)
+
+// Register offsets from 0x1F801C00
+#define SPU_MAIN_VOLUME_L 0x180
+#define SPU_MAIN_VOLUME_R 0x182
+#define SPU_REVERB_OUT_L  0x184
+#define SPU_REVERB_OUT_R  0x186
+#define SPU_KON           0x188
+#define SPU_KOFF          0x18c
+#define SPU_PMON          0x190
+#define SPU_NON           0x194
+#define SPU_EON           0x198
+#define SPU_ENDX          0x19c
+#define SPU_REVERB_BASE   0x1a2
+#define SPU_IRQ_ADDRESS   0x1a4
+#define SPU_TRANSFER_ADDR 0x1a6
+#define SPU_TRANSFER_FIFO 0x1a8
+#define SPU_CONTROL       0x1aa
+#define SPU_STATUS        0x1ae
+#define SPU_CD_VOLUME_L   0x1b0
+#define SPU_CD_VOLUME_R   0x1b2
+#define SPU_CURRENT_MAIN  0x1b8
+#define SPU_REVERB        0x1c0
+#define SPU_CURRENT_VOLUME 0x200
+
+#define SPU_CONTROL_CD         0x0001
+#define SPU_CONTROL_CD_REVERB  0x0004
+#define SPU_CONTROL_IRQ        0x0040
+#define SPU_CONTROL_REVERB     0x0080
+#define SPU_CONTROL_UNMUTE     0x4000
+#define SPU_CONTROL_ENABLE     0x8000
+
+enum {SPU_OFF, SPU_ATTACK, SPU_DECAY, SPU_SUSTAIN, SPU_RELEASE};
+
+typedef int32_t spu_v8 __attribute__((vector_size(4 * SPU_LANES)));
+
+typedef struct spu_voice_t {
+  uint32_t address;
+  uint32_t repeat;
+  uint8_t flags;
+  int phase;
+  int32_t wait;
+  int32_t old, older;
+  // Three samples of the previous block for the interpolator, then this block
+  int16_t decoded[3 + 28];
+} spu_voice_t;
+
+uint8_t spu_ram[SPU_RAM_SIZE];
+uint16_t spu_regs[0x200];
+spu_voice_t spu_voices[SPU_VOICES];
+
+// Lane state, one entry per voice
+int32_t spu_counter[SPU_VOICES] __attribute__((aligned(32)));
+int32_t spu_level[SPU_VOICES] __attribute__((aligned(32)));
+int32_t spu_volume_l[SPU_VOICES] __attribute__((aligned(32)));
+int32_t spu_volume_r[SPU_VOICES] __attribute__((aligned(32)));
+// Samples until each volume sweep's next step
+int32_t spu_sweep_l[SPU_VOICES], spu_sweep_r[SPU_VOICES];
+// Voice outputs shifted by one, so a load at voice n yields voice n-1 for
+// pitch modulation
+int32_t spu_output[SPU_VOICES + 1];
+
+uint32_t spu_kon, spu_koff, spu_endx;
+uint32_t spu_transfer;
+int spu_irq_flag;
+int32_t spu_main_l, spu_main_r;
+int32_t spu_main_sweep_l, spu_main_sweep_r;
+int32_t spu_noise_timer;
+int16_t spu_noise;
+uint32_t spu_reverb_address;
+int32_t spu_reverb_l, spu_reverb_r;
+uint32_t spu_capture;
+uint64_t spu_cycles;
+uint64_t spu_samples;
+
+// Interpolation weights from the hardware table, 0x000-0x0ff for distances
+// 2 down to 1 and 0x100-0x1ff for 1 down to 0. The four taps at any phase
+// sum to 0x7f7f-0x7f81.
+static const int16_t spu_gauss[512] = {
+  -0x001, -0x001, -0x001, -0x001, -0x001, -0x001, -0x001, -0x001,
+  -0x001, -0x001, -0x001, -0x001, -0x001, -0x001, -0x001, -0x001,
+  0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0001,
+  0x0001, 0x0001, 0x0001, 0x0002, 0x0002, 0x0002, 0x0003, 0x0003,
+  0x0003, 0x0004, 0x0004, 0x0005, 0x0005, 0x0006, 0x0007, 0x0007,
+  0x0008, 0x0009, 0x0009, 0x000a, 0x000b, 0x000c, 0x000d, 0x000e,
+  0x000f, 0x0010, 0x0011, 0x0012, 0x0013, 0x0015, 0x0016, 0x0018,
+  0x0019, 0x001b, 0x001c, 0x001e, 0x0020, 0x0021, 0x0023, 0x0025,
+  0x0027, 0x0029, 0x002c, 0x002e, 0x0030, 0x0033, 0x0035, 0x0038,
+  0x003a, 0x003d, 0x0040, 0x0043, 0x0046, 0x0049, 0x004d, 0x0050,
+  0x0054, 0x0057, 0x005b, 0x005f, 0x0063, 0x0067, 0x006b, 0x006f,
+  0x0074, 0x0078, 0x007d, 0x0082, 0x0087, 0x008c, 0x0091, 0x0096,
+  0x009c, 0x00a1, 0x00a7, 0x00ad, 0x00b3, 0x00ba, 0x00c0, 0x00c7,
+  0x00cd, 0x00d4, 0x00db, 0x00e3, 0x00ea, 0x00f2, 0x00fa, 0x0101,
+  0x010a, 0x0112, 0x011b, 0x0123, 0x012c, 0x0135, 0x013f, 0x0148,
+  0x0152, 0x015c, 0x0166, 0x0171, 0x017b, 0x0186, 0x0191, 0x019c,
+  0x01a8, 0x01b4, 0x01c0, 0x01cc, 0x01d9, 0x01e5, 0x01f2, 0x0200,
+  0x020d, 0x021b, 0x0229, 0x0237, 0x0246, 0x0255, 0x0264, 0x0273,
+  0x0283, 0x0293, 0x02a3, 0x02b4, 0x02c4, 0x02d6, 0x02e7, 0x02f9,
+  0x030b, 0x031d, 0x0330, 0x0343, 0x0356, 0x036a, 0x037e, 0x0392,
+  0x03a7, 0x03bc, 0x03d1, 0x03e7, 0x03fc, 0x0413, 0x042a, 0x0441,
+  0x0458, 0x0470, 0x0488, 0x04a0, 0x04b9, 0x04d2, 0x04ec, 0x0506,
+  0x0520, 0x053b, 0x0556, 0x0572, 0x058e, 0x05aa, 0x05c7, 0x05e4,
+  0x0601, 0x061f, 0x063e, 0x065c, 0x067c, 0x069b, 0x06bb, 0x06dc,
+  0x06fd, 0x071e, 0x0740, 0x0762, 0x0784, 0x07a7, 0x07cb, 0x07ef,
+  0x0813, 0x0838, 0x085d, 0x0883, 0x08a9, 0x08d0, 0x08f7, 0x091e,
+  0x0946, 0x096f, 0x0998, 0x09c1, 0x09eb, 0x0a16, 0x0a40, 0x0a6c,
+  0x0a98, 0x0ac4, 0x0af1, 0x0b1e, 0x0b4c, 0x0b7a, 0x0ba9, 0x0bd8,
+  0x0c07, 0x0c38, 0x0c68, 0x0c99, 0x0ccb, 0x0cfd, 0x0d30, 0x0d63,
+  0x0d97, 0x0dcb, 0x0e00, 0x0e35, 0x0e6b, 0x0ea1, 0x0ed7, 0x0f0f,
+  0x0f46, 0x0f7f, 0x0fb7, 0x0ff1, 0x102a, 0x1065, 0x109f, 0x10db,
+  0x1116, 0x1153, 0x118f, 0x11cd, 0x120b, 0x1249, 0x1288, 0x12c7,
+  0x1307, 0x1347, 0x1388, 0x13c9, 0x140b, 0x144d, 0x1490, 0x14d4,
+  0x1517, 0x155c, 0x15a0, 0x15e6, 0x162c, 0x1672, 0x16b9, 0x1700,
+  0x1747, 0x1790, 0x17d8, 0x1821, 0x186b, 0x18b5, 0x1900, 0x194b,
+  0x1996, 0x19e2, 0x1a2e, 0x1a7b, 0x1ac8, 0x1b16, 0x1b64, 0x1bb3,
+  0x1c02, 0x1c51, 0x1ca1, 0x1cf1, 0x1d42, 0x1d93, 0x1de5, 0x1e37,
+  0x1e89, 0x1edc, 0x1f2f, 0x1f82, 0x1fd6, 0x202a, 0x207f, 0x20d4,
+  0x2129, 0x217f, 0x21d5, 0x222c, 0x2282, 0x22da, 0x2331, 0x2389,
+  0x23e1, 0x2439, 0x2492, 0x24eb, 0x2545, 0x259e, 0x25f8, 0x2653,
+  0x26ad, 0x2708, 0x2763, 0x27be, 0x281a, 0x2876, 0x28d2, 0x292e,
+  0x298b, 0x29e7, 0x2a44, 0x2aa1, 0x2aff, 0x2b5c, 0x2bba, 0x2c18,
+  0x2c76, 0x2cd4, 0x2d33, 0x2d91, 0x2df0, 0x2e4f, 0x2eae, 0x2f0d,
+  0x2f6c, 0x2fcc, 0x302b, 0x308b, 0x30ea, 0x314a, 0x31aa, 0x3209,
+  0x3269, 0x32c9, 0x3329, 0x3389, 0x33e9, 0x3449, 0x34a9, 0x3509,
+  0x3569, 0x35c9, 0x3629, 0x3689, 0x36e8, 0x3748, 0x37a8, 0x3807,
+  0x3867, 0x38c6, 0x3926, 0x3985, 0x39e4, 0x3a43, 0x3aa2, 0x3b00,
+  0x3b5f, 0x3bbd, 0x3c1b, 0x3c79, 0x3cd7, 0x3d35, 0x3d92, 0x3def,
+  0x3e4c, 0x3ea9, 0x3f05, 0x3f62, 0x3fbd, 0x4019, 0x4074, 0x40d0,
+  0x412a, 0x4185, 0x41df, 0x4239, 0x4292, 0x42eb, 0x4344, 0x439c,
+  0x43f4, 0x444c, 0x44a3, 0x44fa, 0x4550, 0x45a6, 0x45fc, 0x4651,
+  0x46a6, 0x46fa, 0x474e, 0x47a1, 0x47f4, 0x4846, 0x4898, 0x48e9,
+  0x493a, 0x498a, 0x49d9, 0x4a29, 0x4a77, 0x4ac5, 0x4b13, 0x4b5f,
+  0x4bac, 0x4bf7, 0x4c42, 0x4c8d, 0x4cd7, 0x4d20, 0x4d68, 0x4db0,
+  0x4df7, 0x4e3e, 0x4e84, 0x4ec9, 0x4f0e, 0x4f52, 0x4f95, 0x4fd7,
+  0x5019, 0x505a, 0x509a, 0x50da, 0x5118, 0x5156, 0x5194, 0x51d0,
+  0x520c, 0x5247, 0x5281, 0x52ba, 0x52f3, 0x532a, 0x5361, 0x5397,
+  0x53cc, 0x5401, 0x5434, 0x5467, 0x5499, 0x54ca, 0x54fa, 0x5529,
+  0x5558, 0x5585, 0x55b2, 0x55de, 0x5609, 0x5632, 0x565b, 0x5684,
+  0x56ab, 0x56d1, 0x56f6, 0x571b, 0x573e, 0x5761, 0x5782, 0x57a3,
+  0x57c3, 0x57e2, 0x57ff, 0x581c, 0x5838, 0x5853, 0x586d, 0x5886,
+  0x589e, 0x58b5, 0x58cb, 0x58e0, 0x58f4, 0x5907, 0x5919, 0x592a,
+  0x593a, 0x5949, 0x5958, 0x5965, 0x5971, 0x597c, 0x5986, 0x598f,
+  0x5997, 0x599e, 0x59a4, 0x59a9, 0x59ad, 0x59b0, 0x59b2, 0x59b3,
+};
+
+static const int32_t spu_filter_pos[5] = {0, 60, 115, 98, 122};
+static const int32_t spu_filter_neg[5] = {0, 0, -52, -55, -60};
+
+static inline int32_t spu_clamp(int32_t sample) {
+  if(sample > 32767) return(32767);
+  if(sample < -32768) return(-32768);
+  return(sample);
+}
+
+static inline int16_t spu_ram_16(uint32_t address) {
+  return(*(int16_t *)(spu_ram + (address & (SPU_RAM_SIZE - 2))));
+}
+
+void spu_check_irq(uint32_t address, uint32_t length) {
+  uint32_t irq = spu_regs[SPU_IRQ_ADDRESS >> 1] * 8;
+  if(!(spu_regs[SPU_CONTROL >> 1] & SPU_CONTROL_IRQ) || spu_irq_flag) return;
+  if(irq - address < length) {
+    spu_irq_flag = 1;
+    interrupt_request(IRQ_SPU);
+  }
+}
+
+void spu_decode_block(int v) {
+  spu_voice_t *voice = &spu_voices[v];
+  const uint8_t *block = spu_ram + (voice->address & (SPU_RAM_SIZE - 16));
+  spu_check_irq(voice->address, 16);
+  int shift = block[0] & 0xf;
+  if(shift > 12) shift = 9;
+  int filter = (block[0] >> 4) & 7;
+  if(filter > 4) filter = 4;
+  voice->flags = block[1];
+  if(voice->flags & 4) voice->repeat = voice->address;
+
+  memmove(voice->decoded, voice->decoded + 28, 3 * sizeof(int16_t));
+  int32_t old = voice->old, older = voice->older;
+  for(int n = 0; n < 28; n++) {
+    int32_t sample = (int16_t)((block[2 + n / 2] >> ((n & 1) * 4)) << 12) >> shift;
+    sample = spu_clamp(sample + ((old * spu_filter_pos[filter] + older * spu_filter_neg[filter] + 32) >> 6));
+    older = old;
+    old = sample;
+    voice->decoded[3 + n] = sample;
+  }
+  voice->old = old;
+  voice->older = older;
+}
+
+// Called when a voice has played the 28 samples of its block
+void spu_next_block(int v) {
+  spu_voice_t *voice = &spu_voices[v];
+  voice->address += 16;
+  if(voice->flags & 1) {
+    spu_endx |= 1 << v;
+    voice->address = voice->repeat;
+    if(!(voice->flags & 2)) {
+      voice->phase = SPU_OFF;
+      spu_level[v] = 0;
+    }
+  }
+  spu_decode_block(v);
+}
+
+void spu_key_on(int v) {
+  spu_voice_t *voice = &spu_voices[v];
+  uint16_t *regs = spu_regs + v * 8;
+  voice->address = regs[3] * 8;
+  voice->repeat = regs[7] * 8;
+  voice->old = voice->older = 0;
+  memset(voice->decoded, 0, sizeof(voice->decoded));
+  voice->phase = SPU_ATTACK;
+  voice->wait = 0;
+  spu_level[v] = 0;
+  spu_counter[v] = 0;
+  spu_endx &= ~(1 << v);
+  spu_decode_block(v);
+}
+
+// Moves an envelope or sweep level by one step, returning the samples until
+// the next
+int32_t spu_step(int32_t *level, int exponential, int decrease, int shift, int step) {
+  int32_t cycles = 1 << (shift > 11 ? shift - 11 : 0);
+  step <<= shift < 11 ? 11 - shift : 0;
+  if(exponential && !decrease && *level > 0x6000) cycles *= 4;
+  if(exponential && decrease) step = step * *level >> 15;
+  *level += step;
+  if(*level > 0x7fff) *level = 0x7fff;
+  if(*level < 0) *level = 0;
+  return(cycles);
+}
+
+// One envelope step when its wait runs out
+void spu_envelope(int v) {
+  spu_voice_t *voice = &spu_voices[v];
+  if(voice->phase == SPU_OFF || --voice->wait > 0) return;
+  uint32_t adsr = spu_regs[v * 8 + 4] | spu_regs[v * 8 + 5] << 16;
+  int exponential, decrease, shift, step;
+  int32_t level = spu_level[v];
+  switch(voice->phase) {
+    case SPU_ATTACK:
+      exponential = (adsr >> 15) & 1;
+      decrease = 0;
+      shift = (adsr >> 10) & 0x1f;
+      step = 7 - ((adsr >> 8) & 3);
+      break;
+    case SPU_DECAY:
+      exponential = 1;
+      decrease = 1;
+      shift = (adsr >> 4) & 0xf;
+      step = -8;
+      break;
+    case SPU_SUSTAIN:
+      exponential = (adsr >> 31) & 1;
+      decrease = (adsr >> 30) & 1;
+      shift = (adsr >> 24) & 0x1f;
+      step = decrease ? -8 + ((adsr >> 22) & 3) : 7 - ((adsr >> 22) & 3);
+      break;
+    default:
+      exponential = (adsr >> 21) & 1;
+      decrease = 1;
+      shift = (adsr >> 16) & 0x1f;
+      step = -8;
+      break;
+  }
+  voice->wait = spu_step(&level, exponential, decrease, shift, step);
+
+  switch(voice->phase) {
+    case SPU_ATTACK:
+      if(level == 0x7fff) voice->phase = SPU_DECAY;
+      break;
+    case SPU_DECAY:
+      if(level <= (int32_t)((adsr & 0xf) + 1) * 0x800) voice->phase = SPU_SUSTAIN;
+      break;
+    case SPU_RELEASE:
+      if(level == 0) voice->phase = SPU_OFF;
+      break;
+  }
+  spu_level[v] = level;
+}
+
+void spu_noise_step() {
+  uint16_t control = spu_regs[SPU_CONTROL >> 1];
+  int shift = (control >> 10) & 0xf;
+  int step = 4 - ((control >> 8) & 3);
+  spu_noise_timer -= step;
+  if(spu_noise_timer < 0) {
+    int parity = ((spu_noise >> 15) ^ (spu_noise >> 12) ^ (spu_noise >> 11) ^ (spu_noise >> 10) ^ 1) & 1;
+    spu_noise = spu_noise * 2 + parity;
+    spu_noise_timer += 0x20000 >> shift;
+    if(spu_noise_timer < 0) spu_noise_timer += 0x20000 >> shift;
+  }
+}
+
+// Fixed volumes are stored halved. Sweeps step the current volume toward
+// 0 or 0x7fff like an envelope, all of a batch's steps at its start, and
+// negative phase inverts it.
+void spu_volume(uint16_t value, int32_t *volume, int32_t *wait, uint32_t count) {
+  if(!(value & 0x8000)) {
+    *volume = (int16_t)(value << 1);
+    *wait = 0;
+    return;
+  }
+  int exponential = (value >> 14) & 1;
+  int decrease = (value >> 13) & 1;
+  int shift = (value >> 2) & 0x1f;
+  int step = decrease ? -8 + (value & 3) : 7 - (value & 3);
+  int32_t level = *volume < 0 ? -*volume : *volume;
+  if(level > 0x7fff) level = 0x7fff;
+  for(uint32_t n = 0; n < count && level != (decrease ? 0 : 0x7fff); n++)
+    if(--*wait <= 0) *wait = spu_step(&level, exponential, decrease, shift, step);
+  *volume = value & 0x1000 ? -level : level;
+}
+
+uint32_t spu_reverb_wrap(int32_t offset) {
+  uint32_t base = spu_regs[SPU_REVERB_BASE >> 1] * 8;
+  uint32_t size = SPU_RAM_SIZE - base;
+  if(!size) return(0);
+  int64_t relative = ((int64_t)spu_reverb_address - base + offset) % size;
+  if(relative < 0) relative += size;
+  return(base + relative);
+}
+
+static inline int32_t spu_reverb_load(int reg, int32_t adjust) {
+  return(spu_ram_16(spu_reverb_wrap(spu_regs[(SPU_REVERB >> 1) + reg] * 8 + adjust)));
+}
+
+static inline void spu_reverb_store(int reg, int32_t adjust, int32_t value) {
+  *(int16_t *)(spu_ram + spu_reverb_wrap(spu_regs[(SPU_REVERB >> 1) + reg] * 8 + adjust)) = spu_clamp(value);
+}
+
+#define R(n) ((int32_t)(int16_t)spu_regs[(SPU_REVERB >> 1) + (n)])
+
+// The hardware reverb, run at 22.05 kHz on both channels
+void spu_reverb(int32_t input_l, int32_t input_r) {
+  int32_t l = input_l * R(30) >> 15;
+  int32_t r = input_r * R(31) >> 15;
+  int32_t iir = R(2), wall = R(7);
+  int32_t same_l = spu_reverb_load(10, -2), same_r = spu_reverb_load(11, -2);
+  int32_t diff_l = spu_reverb_load(18, -2), diff_r = spu_reverb_load(19, -2);
+  spu_reverb_store(10, 0, ((l + (spu_reverb_load(16, 0) * wall >> 15) - same_l) * iir >> 15) + same_l);
+  spu_reverb_store(11, 0, ((r + (spu_reverb_load(17, 0) * wall >> 15) - same_r) * iir >> 15) + same_r);
+  spu_reverb_store(18, 0, ((l + (spu_reverb_load(25, 0) * wall >> 15) - diff_l) * iir >> 15) + diff_l);
+  spu_reverb_store(19, 0, ((r + (spu_reverb_load(24, 0) * wall >> 15) - diff_r) * iir >> 15) + diff_r);
+
+  int32_t out_l = (R(3) * spu_reverb_load(12, 0) + R(4) * spu_reverb_load(14, 0) +
+                   R(5) * spu_reverb_load(20, 0) + R(6) * spu_reverb_load(22, 0)) >> 15;
+  int32_t out_r = (R(3) * spu_reverb_load(13, 0) + R(4) * spu_reverb_load(15, 0) +
+                   R(5) * spu_reverb_load(21, 0) + R(6) * spu_reverb_load(23, 0)) >> 15;
+
+  int32_t apf1 = R(0) * 8, apf2 = R(1) * 8;
+  int32_t t = spu_reverb_load(26, -apf1);
+  out_l = spu_clamp(out_l - (R(8) * t >> 15));
+  spu_reverb_store(26, 0, out_l);
+  out_l = (out_l * R(8) >> 15) + t;
+  t = spu_reverb_load(27, -apf1);
+  out_r = spu_clamp(out_r - (R(8) * t >> 15));
+  spu_reverb_store(27, 0, out_r);
+  out_r = (out_r * R(8) >> 15) + t;
+
+  t = spu_reverb_load(28, -apf2);
+  out_l = spu_clamp(out_l - (R(9) * t >> 15));
+  spu_reverb_store(28, 0, out_l);
+  out_l = (out_l * R(9) >> 15) + t;
+  t = spu_reverb_load(29, -apf2);
+  out_r = spu_clamp(out_r - (R(9) * t >> 15));
+  spu_reverb_store(29, 0, out_r);
+  out_r = (out_r * R(9) >> 15) + t;
+
+  spu_reverb_l = spu_clamp(out_l) * (int16_t)spu_regs[SPU_REVERB_OUT_L >> 1] >> 15;
+  spu_reverb_r = spu_clamp(out_r) * (int16_t)spu_regs[SPU_REVERB_OUT_R >> 1] >> 15;
+
+  uint32_t base = spu_regs[SPU_REVERB_BASE >> 1] * 8;
+  spu_reverb_address = (spu_reverb_address + 2) & (SPU_RAM_SIZE - 2);
+  if(spu_reverb_address < base) spu_reverb_address = base;
+}
+
+#undef R
+
+// Sound RAM 0x000-0xfff holds what the mixer heard: CD left and right, then
+// voices 1 and 3
+void spu_capture_sample(int32_t cd_l, int32_t cd_r) {
+  uint32_t offset = spu_capture * 2;
+  *(int16_t *)(spu_ram + 0x000 + offset) = cd_l;
+  *(int16_t *)(spu_ram + 0x400 + offset) = cd_r;
+  *(int16_t *)(spu_ram + 0x800 + offset) = spu_output[2];
+  *(int16_t *)(spu_ram + 0xc00 + offset) = spu_output[4];
+  spu_capture = (spu_capture + 1) & 0x1ff;
+}
+
+// Mixes a batch of samples. The voice loop keeps SPU_LANES voices per
+// vector, only the fetches from each voice's decoded block are scalar.
+__attribute__((target_clones("avx2", "default")))
+void spu_mix(int16_t *frames, uint32_t count, const int16_t *cd) {
+  uint16_t control = spu_regs[SPU_CONTROL >> 1];
+  uint32_t pmon = (spu_regs[SPU_PMON >> 1] | spu_regs[(SPU_PMON >> 1) + 1] << 16) & ~1;
+  uint32_t non = spu_regs[SPU_NON >> 1] | spu_regs[(SPU_NON >> 1) + 1] << 16;
+  uint32_t eon = spu_regs[SPU_EON >> 1] | spu_regs[(SPU_EON >> 1) + 1] << 16;
+  spu_v8 pitch[SPU_GROUPS], pmon_mask[SPU_GROUPS], noise_mask[SPU_GROUPS], reverb_mask[SPU_GROUPS];
+  int active[SPU_GROUPS];
+  for(int g = 0; g < SPU_GROUPS; g++) {
+    active[g] = 0;
+    for(int lane = 0; lane < SPU_LANES; lane++) {
+      int v = g * SPU_LANES + lane;
+      int32_t step = spu_regs[v * 8 + 2];
+      pitch[g][lane] = step > 0x4000 ? 0x4000 : step;
+      pmon_mask[g][lane] = -((pmon >> v) & 1);
+      noise_mask[g][lane] = -((non >> v) & 1);
+      reverb_mask[g][lane] = -((eon >> v) & 1);
+      active[g] |= spu_voices[v].phase != SPU_OFF;
+    }
+  }
+
+  for(uint32_t s = 0; s < count; s++) {
+    spu_noise_step();
+    spu_v8 mix_l = {0}, mix_r = {0}, send_l = {0}, send_r = {0};
+    for(int g = 0; g < SPU_GROUPS; g++) {
+      if(!active[g]) continue;
+      int first = g * SPU_LANES;
+      for(int v = first; v < first + SPU_LANES; v++)
+        spu_envelope(v);
+
+      spu_v8 counter, s0, s1, s2, s3, w0, w1, w2, w3;
+      memcpy(&counter, spu_counter + first, sizeof(counter));
+      for(int lane = 0; lane < SPU_LANES; lane++) {
+        int v = first + lane;
+        if(counter[lane] >= 28 << 12) {
+          counter[lane] -= 28 << 12;
+          spu_next_block(v);
+        }
+        const int16_t *decoded = spu_voices[v].decoded + (counter[lane] >> 12);
+        int phase = (counter[lane] >> 4) & 0xff;
+        s0[lane] = decoded[0];
+        s1[lane] = decoded[1];
+        s2[lane] = decoded[2];
+        s3[lane] = decoded[3];
+        w0[lane] = spu_gauss[0x0ff - phase];
+        w1[lane] = spu_gauss[0x1ff - phase];
+        w2[lane] = spu_gauss[0x100 + phase];
+        w3[lane] = spu_gauss[phase];
+      }
+      spu_v8 sample = ((s0 * w0) >> 15) + ((s1 * w1) >> 15) + ((s2 * w2) >> 15) + ((s3 * w3) >> 15);
+      spu_v8 noise = (spu_v8){} + spu_noise;
+      sample = (sample & ~noise_mask[g]) | (noise & noise_mask[g]);
+
+      spu_v8 level, volume_l, volume_r, modulator;
+      memcpy(&level, spu_level + first, sizeof(level));
+      memcpy(&volume_l, spu_volume_l + first, sizeof(volume_l));
+      memcpy(&volume_r, spu_volume_r + first, sizeof(volume_r));
+      sample = (sample * level) >> 15;
+      memcpy(spu_output + first + 1, &sample, sizeof(sample));
+      spu_v8 l = (sample * volume_l) >> 15;
+      spu_v8 r = (sample * volume_r) >> 15;
+      mix_l += l;
+      mix_r += r;
+      send_l += l & reverb_mask[g];
+      send_r += r & reverb_mask[g];
+
+      // Pitch modulation by the previous voice's output
+      memcpy(&modulator, spu_output + first, sizeof(modulator));
+      spu_v8 step = pitch[g];
+      step = (step & ~pmon_mask[g]) | (((step * (modulator + 0x8000)) >> 15) & pmon_mask[g]);
+      counter += step;
+      memcpy(spu_counter + first, &counter, sizeof(counter));
+    }
+
+    int32_t l = 0, r = 0, reverb_l = 0, reverb_r = 0;
+    for(int lane = 0; lane < SPU_LANES; lane++) {
+      l += mix_l[lane];
+      r += mix_r[lane];
+      reverb_l += send_l[lane];
+      reverb_r += send_r[lane];
+    }
+    int32_t cd_l = 0, cd_r = 0;
+    if(control & SPU_CONTROL_CD) {
+      cd_l = cd[s * 2] * (int16_t)spu_regs[SPU_CD_VOLUME_L >> 1] >> 15;
+      cd_r = cd[s * 2 + 1] * (int16_t)spu_regs[SPU_CD_VOLUME_R >> 1] >> 15;
+      l += cd_l;
+      r += cd_r;
+      if(control & SPU_CONTROL_CD_REVERB) {
+        reverb_l += cd_l;
+        reverb_r += cd_r;
+      }
+    }
+    spu_capture_sample(cd_l, cd_r);
+
+    if((control & SPU_CONTROL_REVERB) && (spu_samples & 1))
+      spu_reverb(spu_clamp(reverb_l), spu_clamp(reverb_r));
+    spu_samples++;
+
+    l = (spu_clamp(l) * spu_main_l >> 15) + spu_reverb_l;
+    r = (spu_clamp(r) * spu_main_r >> 15) + spu_reverb_r;
+    if(!(control & SPU_CONTROL_UNMUTE)) l = r = 0;
+    frames[s * 2] = spu_clamp(l);
+    frames[s * 2 + 1] = spu_clamp(r);
+  }
+}
+
+void spu_batch(uint32_t count) {
+  int16_t frames[SPU_BATCH * 2];
+  int16_t cd[SPU_BATCH * 2];
+  // Key on and off requests take effect together at the start of a batch
+  for(int v = 0; v < SPU_VOICES; v++) {
+    if(spu_koff & (1 << v))
+      if(spu_voices[v].phase != SPU_OFF) spu_voices[v].phase = SPU_RELEASE;
+    if(spu_kon & (1 << v)) spu_key_on(v);
+    spu_volume(spu_regs[v * 8 + 0], &spu_volume_l[v], &spu_sweep_l[v], count);
+    spu_volume(spu_regs[v * 8 + 1], &spu_volume_r[v], &spu_sweep_r[v], count);
+  }
+  spu_kon = 0;
+  spu_koff = 0;
+  spu_volume(spu_regs[SPU_MAIN_VOLUME_L >> 1], &spu_main_l, &spu_main_sweep_l, count);
+  spu_volume(spu_regs[SPU_MAIN_VOLUME_R >> 1], &spu_main_r, &spu_main_sweep_r, count);
+
+  uint32_t got = cdaudio_read(cd, count);
+  memset(cd + got * 2, 0, (count - got) * 4);
+  spu_mix(frames, count, cd);
+  audio_output(frames, count);
+  if(recording_audio) record_audio(frames, count);
+}
+
+void spu_event() {
+  spu_batch(SPU_BATCH);
+  spu_cycles += SPU_BATCH * SPU_SAMPLE_CYCLES;
+  scheduler_schedule(SCHEDULER_SPU, spu_cycles, spu_event);
+}
+
+void spu_reset() {
+  memset(spu_voices, 0, sizeof(spu_voices));
+  memset(spu_regs, 0, sizeof(spu_regs));
+  memset(spu_level, 0, sizeof(spu_level));
+  memset(spu_counter, 0, sizeof(spu_counter));
+  memset(spu_volume_l, 0, sizeof(spu_volume_l));
+  memset(spu_volume_r, 0, sizeof(spu_volume_r));
+  memset(spu_sweep_l, 0, sizeof(spu_sweep_l));
+  memset(spu_sweep_r, 0, sizeof(spu_sweep_r));
+  spu_kon = spu_koff = spu_endx = 0;
+  spu_irq_flag = 0;
+  spu_main_l = spu_main_r = 0;
+  spu_main_sweep_l = spu_main_sweep_r = 0;
+  spu_reverb_l = spu_reverb_r = 0;
+  spu_cycles = scheduler_cycles + SPU_BATCH * SPU_SAMPLE_CYCLES;
+  scheduler_schedule(SCHEDULER_SPU, spu_cycles, spu_event);
+}
+
+// Transfers move halfwords through the transfer address, manual writes
+// skip the hardware FIFO and go straight to RAM
+void spu_transfer_write(uint16_t value) {
+  spu_check_irq(spu_transfer, 2);
+  *(uint16_t *)(spu_ram + spu_transfer) = value;
+  spu_transfer = (spu_transfer + 2) & (SPU_RAM_SIZE - 2);
+}
+
+uint16_t spu_transfer_read() {
+  spu_check_irq(spu_transfer, 2);
+  uint16_t value = *(uint16_t *)(spu_ram + spu_transfer);
+  spu_transfer = (spu_transfer + 2) & (SPU_RAM_SIZE - 2);
+  return(value);
+}
+
+void spu_dma_write(uint32_t word) {
+  spu_transfer_write(word);
+  spu_transfer_write(word >> 16);
+}
+
+uint32_t spu_dma_read() {
+  uint32_t word = spu_transfer_read();
+  return(word | spu_transfer_read() << 16);
+}
+
+uint16_t spu_load_16(uint32_t address) {
+  uint32_t reg = address & 0x3fe;
+  if(reg < 0x180 && (reg & 0xf) == 0xc)
+    return(spu_level[reg >> 4]);
+  // Sweeps are polled through the current volumes
+  if(reg >= SPU_CURRENT_VOLUME && reg < SPU_CURRENT_VOLUME + SPU_VOICES * 4)
+    return((reg & 2 ? spu_volume_r : spu_volume_l)[(reg - SPU_CURRENT_VOLUME) >> 2]);
+  switch(reg) {
+    case SPU_CURRENT_MAIN: return(spu_main_l);
+    case SPU_CURRENT_MAIN + 2: return(spu_main_r);
+    case SPU_ENDX: return(spu_endx);
+    case SPU_ENDX + 2: return(spu_endx >> 16);
+    case SPU_TRANSFER_FIFO: return(spu_transfer_read());
+    case SPU_STATUS: {
+      uint16_t control = spu_regs[SPU_CONTROL >> 1];
+      return((control & 0x3f) | spu_irq_flag << 6 | (control & 0x20) << 2);
+    }
+  }
+  return(spu_regs[reg >> 1]);
+}
+uint32_t spu_load_32(uint32_t address) {
+  return(spu_load_16(address) | spu_load_16(address + 2) << 16);
+}
+uint8_t spu_load_8(uint32_t address) {
+  return(spu_load_16(address & ~1) >> ((address & 1) * 8));
+}
+
+void spu_store_16(uint32_t address, uint16_t value) {
+  uint32_t reg = address & 0x3fe;
+  if(reg < 0x180 && (reg & 0xf) == 0xc) {
+    spu_level[reg >> 4] = value & 0x7fff;
+    return;
+  }
+  if(reg < 0x180 && (reg & 0xf) == 0xe)
+    spu_voices[reg >> 4].repeat = value * 8;
+  switch(reg) {
+    case SPU_KON: spu_kon |= value; break;
+    case SPU_KON + 2: spu_kon |= value << 16; break;
+    case SPU_KOFF: spu_koff |= value; break;
+    case SPU_KOFF + 2: spu_koff |= value << 16; break;
+    case SPU_ENDX: case SPU_ENDX + 2: return;
+    case SPU_TRANSFER_ADDR: spu_transfer = value * 8; break;
+    case SPU_TRANSFER_FIFO: spu_transfer_write(value); return;
+    case SPU_CONTROL:
+      // Clearing the IRQ enable acknowledges the IRQ
+      if(!(value & SPU_CONTROL_IRQ)) spu_irq_flag = 0;
+      break;
+    case SPU_REVERB_BASE: spu_reverb_address = value * 8; break;
+  }
+  spu_regs[reg >> 1] = value;
+}
+void spu_store_32(uint32_t address, uint32_t value) {
+  spu_store_16(address, value);
+  spu_store_16(address + 2, value >> 16);
+}
+void spu_store_8(uint32_t address, uint8_t value) {
+  spu_store_16(address & ~1, value);
+}
 
  memory_accessor_t spu_accessor = {
-  .load_32 = memory_dummy_load_32,
-  .load_16 = memory_dummy_load_16,
-  .load_8 = memory_dummy_load_8,
-  .store_32 = memory_dummy_store_32,
-  .store_16 = memory_dummy_store_16,
-  .store_8 = memory_dummy_store_8,
+  .load_32 = spu_load_32,
+  .load_16 = spu_load_16,
+  .load_8 = spu_load_8,
+  .store_32 = spu_store_32,
+  .store_16 = spu_store_16,
+  .store_8 = spu_store_8,
 };
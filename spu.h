@@ -0,0 +1,12 @@
+#ifndef SPU_H
+#define SPU_H
+
+#include <stdint.h>
+
+#define SPU_RATE 44100
+
+void spu_reset();
+void spu_dma_write(uint32_t word);
+uint32_t spu_dma_read();
+
+#endif
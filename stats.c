@@ -0,0 +1,175 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include "stats.h"
+#include "cpu.h"
+#include "memory.h"
+
+char stats_path[256] = "ps1-stats.json";
+
+#ifdef STATS
+// The last entry collects anything not in the table
+struct {
+  memory_accessor_t *accessor;
+  const char *name;
+} stats_devices[STATS_DEVICES] = {
+  { &ram_accessor, "ram" },
+  { &rom_accessor, "rom" },
+  { &scratchpad_accessor, "scratchpad" },
+  { &gpu_accessor, "gpu" },
+  { &spu_accessor, "spu" },
+  { &dma_accessor, "dma" },
+  { &interrupt_accessor, "interrupt" },
+  { &timers_accessor, "timers" },
+  { &cdrom_accessor, "cdrom" },
+  { &mdec_accessor, "mdec" },
+  { &peripheral_accessor, "peripheral" },
+  { &memory_control_accessor, "memory_control" },
+  { &expansion_accessor, "expansion" },
+  [STATS_DEVICES - 1] = { 0, "other" },
+};
+
+const char *stats_kind_names[STATS_KINDS] = { "fetch", "load", "store" };
+const char *stats_width_names[STATS_WIDTHS] = { "32", "16", "8" };
+const char *stats_exception_names[32] = {
+  "Int", "Mod", "TLBL", "TLBS", "AdEL", "AdES", "IBE", "DBE",
+  "Syscall", "Bp", "RI", "CpU", "Ov",
+};
+
+__thread stats_t *stats_local;
+_Atomic(stats_t *) stats_threads;
+sem_t stats_wake;
+pthread_t stats_thread;
+pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int stats_device(memory_accessor_t *accessor) {
+  for(int n = 0; n < STATS_DEVICES - 1; n++)
+    if(stats_devices[n].accessor == accessor) return(n);
+  return(STATS_DEVICES - 1);
+}
+
+void stats_sum(stats_t *total) {
+  memset(total, 0, sizeof(stats_t));
+  for(stats_t *thread = atomic_load(&stats_threads); thread; thread = thread->next) {
+    uint64_t *in = (uint64_t *)thread, *out = (uint64_t *)total;
+    for(size_t n = 0; n < offsetof(stats_t, next) / 8; n++)
+      out[n] += in[n];
+  }
+}
+
+// Prints a JSON object of the nonzero counters, separator tracks the comma
+void stats_field(FILE *file, int *separator, const char *name, uint64_t value) {
+  if(!value) return;
+  fprintf(file, "%s\"%s\": %lu", *separator ? ", " : "", name, value);
+  *separator = 1;
+}
+
+void stats_dump() {
+  stats_t *total = aligned_alloc(64, sizeof(stats_t));
+  stats_sum(total);
+  pthread_mutex_lock(&stats_lock);
+  FILE *file = fopen(stats_path, "w");
+  if(!file) {
+    printf("Failed to write stats: %s\n", stats_path);
+    pthread_mutex_unlock(&stats_lock);
+    free(total);
+    return;
+  }
+  char name[32];
+  int separator = 0;
+  fprintf(file, "{\n  \"opcodes\": {");
+  stats_field(file, &separator, "nop", total->nops);
+  for(int n = 0; n < 64; n++) {
+    if(opcode_names[n]) snprintf(name, sizeof(name), "%s", opcode_names[n]);
+    else snprintf(name, sizeof(name), "0x%02x", n);
+    stats_field(file, &separator, name, total->opcodes[n]);
+  }
+  fprintf(file, "},\n  \"special_opcodes\": {");
+  separator = 0;
+  for(int n = 0; n < 64; n++) {
+    if(special_opcode_names[n]) snprintf(name, sizeof(name), "%s", special_opcode_names[n]);
+    else snprintf(name, sizeof(name), "0x%02x", n);
+    stats_field(file, &separator, name, total->special_opcodes[n]);
+  }
+  fprintf(file, "},\n  \"memory\": {");
+  int devices = 0;
+  for(int device = 0; device < STATS_DEVICES; device++) {
+    if(!stats_devices[device].name) continue;
+    separator = 0;
+    for(int kind = 0; kind < STATS_KINDS; kind++) {
+      for(int width = 0; width < STATS_WIDTHS; width++) {
+        uint64_t value = total->memory[device][kind][width];
+        if(!value) continue;
+        if(!separator) fprintf(file, "%s\n    \"%s\": {", devices++ ? "," : "", stats_devices[device].name);
+        snprintf(name, sizeof(name), "%s%s", stats_kind_names[kind], stats_width_names[width]);
+        stats_field(file, &separator, name, value);
+      }
+    }
+    if(separator) fprintf(file, "}");
+  }
+  fprintf(file, "%s},\n  \"unaligned\": {", devices ? "\n  " : "");
+  separator = 0;
+  for(int kind = 0; kind < STATS_KINDS; kind++)
+    stats_field(file, &separator, stats_kind_names[kind], total->unaligned[kind]);
+  fprintf(file, "},\n  \"exceptions\": {");
+  separator = 0;
+  for(int n = 0; n < 32; n++) {
+    if(stats_exception_names[n]) snprintf(name, sizeof(name), "%s", stats_exception_names[n]);
+    else snprintf(name, sizeof(name), "%d", n);
+    stats_field(file, &separator, name, total->exceptions[n]);
+  }
+  fprintf(file, "}\n}\n");
+  fclose(file);
+  pthread_mutex_unlock(&stats_lock);
+  free(total);
+}
+
+// Signal handlers can't do file I/O, SIGUSR1 only wakes this thread.
+// Counters are read while other threads update them, a dump is a snapshot
+// that can be a few increments behind.
+void *stats_dumper(void *arg) {
+  while(1) {
+    while(sem_wait(&stats_wake));
+    stats_dump();
+  }
+  return(0);
+}
+
+void stats_signal(int signal) {
+  sem_post(&stats_wake);
+}
+
+stats_t *stats_thread_open() {
+  stats_local = aligned_alloc(64, sizeof(stats_t));
+  memset(stats_local, 0, sizeof(stats_t));
+  stats_t *head = atomic_load(&stats_threads);
+  do stats_local->next = head;
+  while(!atomic_compare_exchange_weak(&stats_threads, &head, stats_local));
+  // The first thread to count sets up dumping
+  if(!head) {
+    sem_init(&stats_wake, 0, 0);
+    pthread_create(&stats_thread, 0, stats_dumper, 0);
+    struct sigaction action = {0};
+    action.sa_handler = stats_signal;
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, 0);
+    atexit(stats_dump);
+  }
+  return(stats_local);
+}
+#endif
+
+void stats_open(const char *path) {
+#ifndef STATS
+  printf("Statistics are compiled out, rebuild with -DSTATS\n");
+  exit(1);
+#endif
+  snprintf(stats_path, sizeof(stats_path), "%s", path);
+}
@@ -0,0 +1,50 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include "memory.h"
+
+// Hot path counters, compiled in with -DSTATS and free otherwise. Every
+// thread counts into its own cache line aligned block, the blocks are only
+// summed when the counters are dumped as JSON, at exit or on SIGUSR1.
+#define STATS_DEVICES 16
+
+enum {
+  STATS_FETCH,
+  STATS_LOAD,
+  STATS_STORE,
+  STATS_KINDS,
+};
+
+enum {
+  STATS_32,
+  STATS_16,
+  STATS_8,
+  STATS_WIDTHS,
+};
+
+typedef struct __attribute__((aligned(64))) stats_t {
+  uint64_t nops;
+  uint64_t opcodes[64];
+  uint64_t special_opcodes[64];
+  uint64_t memory[STATS_DEVICES][STATS_KINDS][STATS_WIDTHS];
+  uint64_t unaligned[STATS_KINDS];
+  uint64_t exceptions[32];
+  struct stats_t *next;
+} stats_t;
+
+void stats_open(const char *path);
+
+#ifdef STATS
+extern __thread stats_t *stats_local;
+stats_t *stats_thread_open();
+int stats_device(memory_accessor_t *accessor);
+
+#define STATS_COUNT(field) ((stats_local ? stats_local : stats_thread_open())->field++)
+#define STATS_MEMORY(accessor, kind, width) STATS_COUNT(memory[stats_device(accessor)][kind][width])
+#else
+#define STATS_COUNT(field) do {} while(0)
+#define STATS_MEMORY(accessor, kind, width) do {} while(0)
+#endif
+
+#endif
@@ -0,0 +1,225 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include "telemetry.h"
+#include "cpu.h"
+#include "dma.h"
+#include "gpu.h"
+#include "scheduler.h"
+#include "search.h"
+#include "unix_socket.h"
+
+// Metrics in the Prometheus text exposition format. The emulation thread
+// copies its counters into a snapshot once per frame under a sequence
+// count, never waiting on anything. A publisher thread formats the latest
+// snapshot, rewriting a file for a textfile collector, or answering every
+// connection to a Unix socket (unix:path) with it.
+#define TELEMETRY_SPEED_WINDOW 1000000000
+
+typedef struct telemetry_snapshot_t {
+  uint64_t cycles;
+  uint64_t instructions;
+  uint64_t frames;
+  double speed;
+  uint64_t dma_bytes[DMA_CHANNELS];
+  uint64_t gp0_words;
+  uint64_t primitives;
+  uint64_t frame_gp0_words;
+  uint64_t frame_primitives;
+  uint64_t vram_upload_bytes;
+  uint64_t cpu_ns;
+  uint64_t gpu_ns;
+  uint64_t dma_ns;
+  uint64_t idle_ns;
+  uint32_t search_candidates;
+  uint32_t watch_count;
+  search_watch_t watches[SEARCH_WATCHES];
+  uint32_t watch_values[SEARCH_WATCHES];
+} telemetry_snapshot_t;
+
+uint64_t telemetry_dma_ns;
+uint64_t telemetry_gpu_ns;
+uint64_t telemetry_idle_ns;
+
+int telemetry_enabled;
+char telemetry_path[256];
+int telemetry_socket = -1;
+telemetry_snapshot_t telemetry_snapshot;
+_Atomic uint32_t telemetry_sequence;
+pthread_t telemetry_thread;
+sem_t telemetry_wake;
+_Atomic int telemetry_stop;
+
+uint64_t telemetry_start_ns, telemetry_frames;
+uint64_t telemetry_window_ns, telemetry_window_cycles;
+uint64_t telemetry_last_gp0_words, telemetry_last_primitives;
+double telemetry_speed;
+
+void telemetry_read(telemetry_snapshot_t *snapshot) {
+  while(1) {
+    uint32_t sequence = atomic_load_explicit(&telemetry_sequence, memory_order_acquire);
+    if(!(sequence & 1)) {
+      memcpy(snapshot, &telemetry_snapshot, sizeof(telemetry_snapshot_t));
+      atomic_thread_fence(memory_order_acquire);
+      if(atomic_load_explicit(&telemetry_sequence, memory_order_relaxed) == sequence) return;
+    }
+    sched_yield();
+  }
+}
+
+void telemetry_metric(FILE *file, const char *name, const char *type, const char *help) {
+  fprintf(file, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void telemetry_format(FILE *file) {
+  telemetry_snapshot_t snapshot;
+  telemetry_read(&snapshot);
+  telemetry_metric(file, "ps1_guest_cycles_total", "counter", "Emulated CPU cycles.");
+  fprintf(file, "ps1_guest_cycles_total %lu\n", snapshot.cycles);
+  telemetry_metric(file, "ps1_instructions_total", "counter", "Emulated CPU instructions.");
+  fprintf(file, "ps1_instructions_total %lu\n", snapshot.instructions);
+  telemetry_metric(file, "ps1_frames_total", "counter", "Emulated VBlanks.");
+  fprintf(file, "ps1_frames_total %lu\n", snapshot.frames);
+  telemetry_metric(file, "ps1_speed_ratio", "gauge", "Guest time over host time for the last second, below 1 is slower than realtime.");
+  fprintf(file, "ps1_speed_ratio %.4f\n", snapshot.speed);
+  telemetry_metric(file, "ps1_dma_bytes_total", "counter", "Bytes moved by DMA, per channel.");
+  for(int n = 0; n < DMA_CHANNELS; n++)
+    fprintf(file, "ps1_dma_bytes_total{channel=\"%d\"} %lu\n", n, snapshot.dma_bytes[n]);
+  telemetry_metric(file, "ps1_gp0_words_total", "counter", "Words written to GP0.");
+  fprintf(file, "ps1_gp0_words_total %lu\n", snapshot.gp0_words);
+  telemetry_metric(file, "ps1_gp0_words_frame", "gauge", "Words written to GP0 during the last frame.");
+  fprintf(file, "ps1_gp0_words_frame %lu\n", snapshot.frame_gp0_words);
+  telemetry_metric(file, "ps1_primitives_total", "counter", "GPU primitives drawn.");
+  fprintf(file, "ps1_primitives_total %lu\n", snapshot.primitives);
+  telemetry_metric(file, "ps1_primitives_frame", "gauge", "GPU primitives drawn during the last frame.");
+  fprintf(file, "ps1_primitives_frame %lu\n", snapshot.frame_primitives);
+  telemetry_metric(file, "ps1_vram_upload_bytes_total", "counter", "Bytes copied from the CPU into VRAM.");
+  fprintf(file, "ps1_vram_upload_bytes_total %lu\n", snapshot.vram_upload_bytes);
+  telemetry_metric(file, "ps1_host_seconds_total", "counter", "Host time by activity, dma includes the GPU commands it carries.");
+  fprintf(file, "ps1_host_seconds_total{part=\"cpu\"} %.6f\n", snapshot.cpu_ns / 1e9);
+  fprintf(file, "ps1_host_seconds_total{part=\"gpu\"} %.6f\n", snapshot.gpu_ns / 1e9);
+  fprintf(file, "ps1_host_seconds_total{part=\"dma\"} %.6f\n", snapshot.dma_ns / 1e9);
+  fprintf(file, "ps1_host_seconds_total{part=\"idle\"} %.6f\n", snapshot.idle_ns / 1e9);
+  telemetry_metric(file, "ps1_search_candidates", "gauge", "Locations left in the current memory search.");
+  fprintf(file, "ps1_search_candidates %u\n", snapshot.search_candidates);
+  telemetry_metric(file, "ps1_watch", "gauge", "Watched guest memory locations, read once per frame.");
+  for(uint32_t n = 0; n < snapshot.watch_count; n++)
+    fprintf(file, "ps1_watch{name=\"%s\",address=\"%08x\"} %u\n",
+      snapshot.watches[n].name, snapshot.watches[n].address, snapshot.watch_values[n]);
+}
+
+// Rewritten through a temporary file so readers never see half of it
+void telemetry_write_file() {
+  char path[280];
+  snprintf(path, sizeof(path), "%s.tmp", telemetry_path);
+  FILE *file = fopen(path, "w");
+  if(!file) return;
+  telemetry_format(file);
+  fclose(file);
+  rename(path, telemetry_path);
+}
+
+void *telemetry_publisher(void *arg) {
+  while(!atomic_load(&telemetry_stop)) {
+    if(telemetry_socket >= 0) {
+      int client = accept(telemetry_socket, 0, 0);
+      if(client < 0) continue;
+      char *text;
+      size_t length;
+      FILE *file = open_memstream(&text, &length);
+      telemetry_format(file);
+      fclose(file);
+      unix_socket_send(client, text, length);
+      free(text);
+      close(client);
+    } else {
+      while(sem_wait(&telemetry_wake));
+      // Frames that arrived while the last write was going are folded into this one
+      while(!sem_trywait(&telemetry_wake));
+      telemetry_write_file();
+    }
+  }
+  return(0);
+}
+
+void telemetry_open(const char *path) {
+  if(!strncmp(path, "unix:", 5)) {
+    telemetry_socket = unix_socket_listen(path + 5, 4, "telemetry");
+    snprintf(telemetry_path, sizeof(telemetry_path), "%s", path + 5);
+  } else {
+    snprintf(telemetry_path, sizeof(telemetry_path), "%s", path);
+  }
+  sem_init(&telemetry_wake, 0, 0);
+  telemetry_start_ns = telemetry_now();
+  telemetry_window_ns = telemetry_start_ns;
+  telemetry_enabled = 1;
+  pthread_create(&telemetry_thread, 0, telemetry_publisher, 0);
+  atexit(telemetry_close);
+}
+
+void telemetry_frame() {
+  if(!telemetry_enabled) return;
+  uint64_t now = telemetry_now();
+  telemetry_frames++;
+  // Until the first window is complete the speed covers whatever there is
+  uint64_t elapsed = now - telemetry_window_ns;
+  if(elapsed && (elapsed >= TELEMETRY_SPEED_WINDOW || !telemetry_speed))
+    telemetry_speed = (double)(scheduler_cycles - telemetry_window_cycles) / CPU_CLOCK * 1e9 / elapsed;
+  if(elapsed >= TELEMETRY_SPEED_WINDOW) {
+    telemetry_window_ns = now;
+    telemetry_window_cycles = scheduler_cycles;
+  }
+
+  uint32_t sequence = atomic_load_explicit(&telemetry_sequence, memory_order_relaxed);
+  atomic_store_explicit(&telemetry_sequence, sequence + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  telemetry_snapshot.cycles = scheduler_cycles;
+  telemetry_snapshot.instructions = cpu_instructions;
+  telemetry_snapshot.frames = telemetry_frames;
+  telemetry_snapshot.speed = telemetry_speed;
+  memcpy(telemetry_snapshot.dma_bytes, dma_bytes, sizeof(dma_bytes));
+  telemetry_snapshot.gp0_words = gpu_gp0_words;
+  telemetry_snapshot.primitives = gpu_primitives;
+  telemetry_snapshot.frame_gp0_words = gpu_gp0_words - telemetry_last_gp0_words;
+  telemetry_snapshot.frame_primitives = gpu_primitives - telemetry_last_primitives;
+  telemetry_snapshot.vram_upload_bytes = gpu_vram_upload_bytes;
+  telemetry_snapshot.gpu_ns = telemetry_gpu_ns;
+  telemetry_snapshot.dma_ns = telemetry_dma_ns;
+  telemetry_snapshot.idle_ns = telemetry_idle_ns;
+  telemetry_snapshot.search_candidates = search_candidates;
+  telemetry_snapshot.watch_count = search_watch_count;
+  memcpy(telemetry_snapshot.watches, search_watches, search_watch_count * sizeof(search_watch_t));
+  memcpy(telemetry_snapshot.watch_values, search_watch_values, search_watch_count * sizeof(uint32_t));
+  telemetry_snapshot.cpu_ns = now - telemetry_start_ns - telemetry_gpu_ns - telemetry_dma_ns - telemetry_idle_ns;
+  atomic_store_explicit(&telemetry_sequence, sequence + 2, memory_order_release);
+  telemetry_last_gp0_words = gpu_gp0_words;
+  telemetry_last_primitives = gpu_primitives;
+
+  if(telemetry_socket < 0) sem_post(&telemetry_wake);
+}
+
+void telemetry_close() {
+  if(!telemetry_enabled) return;
+  telemetry_enabled = 0;
+  atomic_store(&telemetry_stop, 1);
+  if(telemetry_socket >= 0) {
+    // Wakes the publisher out of accept()
+    shutdown(telemetry_socket, SHUT_RDWR);
+    pthread_join(telemetry_thread, 0);
+    close(telemetry_socket);
+    unlink(telemetry_path);
+  } else {
+    sem_post(&telemetry_wake);
+    pthread_join(telemetry_thread, 0);
+    telemetry_write_file();
+  }
+}
@@ -0,0 +1,22 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Host time spent outside the CPU, DMA includes the GPU commands it feeds
+extern uint64_t telemetry_dma_ns;
+extern uint64_t telemetry_gpu_ns;
+extern uint64_t telemetry_idle_ns;
+
+void telemetry_open(const char *path);
+void telemetry_frame();
+void telemetry_close();
+
+static inline uint64_t telemetry_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+#endif
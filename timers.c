@@ -1,11 +1,244 @@
 #include <stdint.h>
 #include "memory.h"
+#include "timers.h"
+#include "interrupt.h"
+#include "scheduler.h"
+#include "gpu.h"
+
+// Counter mode bits
+#define TIMER_SYNC_ENABLE  0x0001
+#define TIMER_RESET_TARGET 0x0008
+#define TIMER_IRQ_TARGET   0x0010
+#define TIMER_IRQ_FFFF     0x0020
+#define TIMER_IRQ_REPEAT   0x0040
+#define TIMER_IRQ_TOGGLE   0x0080
+
+// Counters are never ticked. Each one remembers the value it was set to and
+// the cycle it was set at, and the current value is derived from
+// scheduler_cycles when read. Only IRQs need a scheduler event.
+typedef struct root_counter_t {
+  uint16_t mode;
+  uint16_t target;
+  uint16_t start;
+  uint64_t base;
+  // Counter ticks per CPU cycle, as num/den
+  uint32_t num, den;
+  int stopped;
+  // Target and 0xffff hits already reflected in mode bits 11 and 12
+  uint64_t target_seen, ffff_seen;
+  int reached_target, reached_ffff;
+  int irq_line;
+  int irq_fired;
+} root_counter_t;
+
+root_counter_t timers[3];
+
+uint64_t timers_ticks(root_counter_t *t) {
+  if(t->stopped) return(0);
+  return((scheduler_cycles - t->base) * t->num / t->den);
+}
+
+uint32_t timers_period(root_counter_t *t) {
+  if((t->mode & TIMER_RESET_TARGET) && t->start <= t->target)
+    return(t->target + 1);
+  return(0x10000);
+}
+
+uint16_t timers_value(root_counter_t *t) {
+  return((t->start + timers_ticks(t)) % timers_period(t));
+}
+
+// Tick count at which the counter reaches `value` for the nth time (from 0)
+uint64_t timers_hit_tick(root_counter_t *t, uint32_t value, uint64_t n) {
+  uint32_t period = timers_period(t);
+  uint64_t first = value > t->start ? value : value + period;
+  return(first - t->start + n * period);
+}
+
+// Number of times the counter has reached `value` since it was last set
+uint64_t timers_hits(root_counter_t *t, uint32_t value) {
+  uint32_t period = timers_period(t);
+  if(value >= period) return(0);
+  uint64_t ticks = timers_ticks(t);
+  uint64_t first = timers_hit_tick(t, value, 0);
+  if(ticks < first) return(0);
+  return((ticks - first) / period + 1);
+}
+
+// Fold hits since the last mode read into the sticky flags, then restart
+// counting from the current value
+void timers_rebase(root_counter_t *t) {
+  if(timers_hits(t, t->target) > t->target_seen) t->reached_target = 1;
+  if(timers_hits(t, 0xffff) > t->ffff_seen) t->reached_ffff = 1;
+  t->start = timers_value(t);
+  t->base = scheduler_cycles;
+  t->target_seen = 0;
+  t->ffff_seen = 0;
+}
+
+void timers_rate(int n) {
+  root_counter_t *t = &timers[n];
+  uint32_t source = (t->mode >> 8) & 3;
+  t->num = 1;
+  t->den = 1;
+  if(n == 0 && (source & 1)) {
+    // Dot clock, the GPU runs at 11/7 of the CPU clock
+    t->num = 11;
+    t->den = 7 * gpu_dotclock_divider();
+  } else if(n == 1 && (source & 1)) {
+    t->num = 11;
+    t->den = 7 * gpu_line_clocks();
+  } else if(n == 2 && (source & 2)) {
+    t->den = 8;
+  }
+  // Counter 2 sync modes 0 and 3 stop the counter
+  uint32_t sync = (t->mode >> 1) & 3;
+  t->stopped = n == 2 && (t->mode & TIMER_SYNC_ENABLE) && (sync == 0 || sync == 3);
+}
+
+void timers_event(int n);
+void timers_event_0() { timers_event(0); }
+void timers_event_1() { timers_event(1); }
+void timers_event_2() { timers_event(2); }
+void (*timers_events[3])() = {timers_event_0, timers_event_1, timers_event_2};
+
+// Schedule the next target or 0xffff hit that raises an IRQ
+void timers_schedule(int n) {
+  root_counter_t *t = &timers[n];
+  int event = SCHEDULER_TIMER0 + n;
+  if(t->stopped || !(t->mode & (TIMER_IRQ_TARGET | TIMER_IRQ_FFFF)) ||
+     (t->irq_fired && !(t->mode & TIMER_IRQ_REPEAT))) {
+    scheduler_cancel(event);
+    return;
+  }
+  uint64_t ticks = UINT64_MAX;
+  uint32_t period = timers_period(t);
+  if((t->mode & TIMER_IRQ_TARGET) && t->target < period) {
+    uint64_t hit = timers_hit_tick(t, t->target, timers_hits(t, t->target));
+    if(hit < ticks) ticks = hit;
+  }
+  if((t->mode & TIMER_IRQ_FFFF) && period == 0x10000) {
+    uint64_t hit = timers_hit_tick(t, 0xffff, timers_hits(t, 0xffff));
+    if(hit < ticks) ticks = hit;
+  }
+  if(ticks == UINT64_MAX) {
+    scheduler_cancel(event);
+    return;
+  }
+  // First cycle at which the tick count reaches the hit
+  uint64_t when = t->base + (ticks * t->den + t->num - 1) / t->num;
+  scheduler_schedule(event, when, timers_events[n]);
+}
+
+void timers_event(int n) {
+  root_counter_t *t = &timers[n];
+  if(!t->irq_fired || (t->mode & TIMER_IRQ_REPEAT)) {
+    t->irq_fired = 1;
+    if(t->mode & TIMER_IRQ_TOGGLE) {
+      t->irq_line ^= 1;
+      if(!t->irq_line) interrupt_request(IRQ_TIMER0 + n);
+    } else {
+      // Pulse mode, the line drops for a few cycles and reads back as 1
+      interrupt_request(IRQ_TIMER0 + n);
+    }
+  }
+  timers_schedule(n);
+}
+
+void timers_reset() {
+  for(int n = 0; n < 3; n++) {
+    timers[n] = (root_counter_t){.irq_line = 1};
+    timers_rate(n);
+    scheduler_cancel(SCHEDULER_TIMER0 + n);
+  }
+}
+
+// Counter 1 sync modes 1 and 2 reset the counter at vblank. Pausing during
+// blanking is not modelled, those modes free-run.
+void timers_vblank() {
+  root_counter_t *t = &timers[1];
+  uint32_t sync = (t->mode >> 1) & 3;
+  if((t->mode & TIMER_SYNC_ENABLE) && (sync == 1 || sync == 2)) {
+    timers_rebase(t);
+    t->start = 0;
+    timers_schedule(1);
+  }
+}
+
+uint32_t timers_load_32(uint32_t address) {
+  int n = (address >> 4) & 3;
+  if(n > 2) return(0);
+  root_counter_t *t = &timers[n];
+  switch(address & 0xc) {
+    case 0x0:
+      return(timers_value(t));
+    case 0x4: {
+      uint64_t target_hits = timers_hits(t, t->target);
+      uint64_t ffff_hits = timers_hits(t, 0xffff);
+      uint32_t mode = t->mode | (t->irq_line << 10);
+      if(t->reached_target || target_hits > t->target_seen) mode |= 1 << 11;
+      if(t->reached_ffff || ffff_hits > t->ffff_seen) mode |= 1 << 12;
+      // Reading the mode acknowledges the reached flags
+      t->reached_target = 0;
+      t->reached_ffff = 0;
+      t->target_seen = target_hits;
+      t->ffff_seen = ffff_hits;
+      return(mode);
+    }
+    case 0x8:
+      return(t->target);
+    default:
+      return(0);
+  }
+}
+uint16_t timers_load_16(uint32_t address) {
+  return(timers_load_32(address & ~3) >> ((address & 2) * 8));
+}
+uint8_t timers_load_8(uint32_t address) {
+  return(timers_load_32(address & ~3) >> ((address & 3) * 8));
+}
+
+void timers_store_32(uint32_t address, uint32_t value) {
+  int n = (address >> 4) & 3;
+  if(n > 2) return;
+  root_counter_t *t = &timers[n];
+  switch(address & 0xc) {
+    case 0x0:
+      timers_rebase(t);
+      t->start = value;
+      break;
+    case 0x4:
+      // Writing the mode resets the counter and the IRQ state
+      timers_rebase(t);
+      t->mode = value & 0x3ff;
+      t->start = 0;
+      t->irq_line = 1;
+      t->irq_fired = 0;
+      timers_rate(n);
+      break;
+    case 0x8:
+      timers_rebase(t);
+      t->target = value;
+      break;
+    default:
+      return;
+  }
+  timers_schedule(n);
+}
+void timers_store_16(uint32_t address, uint16_t value) {
+  if(address & 2) return;
+  timers_store_32(address, value);
+}
+void timers_store_8(uint32_t address, uint8_t value) {
+  if(address & 3) return;
+  timers_store_32(address, value);
+}
 
  memory_accessor_t timers_accessor = {
-  .load_32 = memory_dummy_load_32,
-  .load_16 = memory_dummy_load_16,
-  .load_8 = memory_dummy_load_8,
-  .store_32 = memory_dummy_store_32,
-  .store_16 = memory_dummy_store_16,
-  .store_8 = memory_dummy_store_8,
+  .load_32 = timers_load_32,
+  .load_16 = timers_load_16,
+  .load_8 = timers_load_8,
+  .store_32 = timers_store_32,
+  .store_16 = timers_store_16,
+  .store_8 = timers_store_8,
 };
@@ -0,0 +1,7 @@
+#ifndef TIMERS_H
+#define TIMERS_H
+
+void timers_reset();
+void timers_vblank();
+
+#endif
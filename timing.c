@@ -0,0 +1,114 @@
+#include <stdint.h>
+#include "timing.h"
+#include "scheduler.h"
+
+// Cycles a read waits on top of the instruction's own
+#define TIMING_RAM_CYCLES 5
+#define TIMING_IO_CYCLES  2
+#define TIMING_DIV_CYCLES 36
+
+// Regions whose speed is programmed through memory_control, in register order
+enum {
+  TIMING_EXP1,
+  TIMING_EXP3,
+  TIMING_BIOS,
+  TIMING_SPU,
+  TIMING_CDROM,
+  TIMING_EXP2,
+  TIMING_REGIONS,
+};
+
+extern uint32_t memory_control[9];
+extern uint32_t memory_control_cache;
+
+int timing_enabled;
+timing_state_t timing_state;
+// Indexed by region then by access size: byte, halfword, word
+uint32_t timing_region_cycles[TIMING_REGIONS][3];
+
+void timing_open() {
+  timing_enabled = 1;
+  timing_update();
+}
+
+// Recomputes the region speeds after a memory_control write. A delay/size
+// register holds the access time in bits 4-7, which of the COM_DELAY times
+// to add in bits 8-11 and the bus width in bit 12. Halfwords and words
+// take several accesses on an 8-bit bus.
+void timing_update() {
+  uint32_t com = memory_control[8];
+  for(int region = 0; region < TIMING_REGIONS; region++) {
+    uint32_t delay = memory_control[2 + region];
+    int32_t first = 0, sequential = 0, minimum = 0;
+    if(delay & (1 << 8)) {
+      first += (com & 0xf) - 1;
+      sequential += (com & 0xf) - 1;
+    }
+    if(delay & (1 << 10)) {
+      first += (com >> 8) & 0xf;
+      sequential += (com >> 8) & 0xf;
+    }
+    if(delay & (1 << 11)) minimum = (com >> 12) & 0xf;
+    if(first < 6) first++;
+    first += ((delay >> 4) & 0xf) + 2;
+    sequential += ((delay >> 4) & 0xf) + 2;
+    if(first < minimum + 6) first = minimum + 6;
+    if(sequential < minimum + 2) sequential = minimum + 2;
+    int wide = delay & (1 << 12);
+    timing_region_cycles[region][0] = first - 1;
+    timing_region_cycles[region][1] = (wide ? first : first + sequential) - 1;
+    timing_region_cycles[region][2] = (wide ? first + sequential : first + sequential * 3) - 1;
+  }
+}
+
+uint32_t timing_load(uint32_t address, uint32_t bytes) {
+  int region;
+  switch(address & 0x1fffffff) {
+    case 0x00000000 ... 0x007FFFFF: return(TIMING_RAM_CYCLES);
+    case 0x1F800000 ... 0x1F8003FF: return(0);
+    case 0x1F000000 ... 0x1F7FFFFF: region = TIMING_EXP1; break;
+    case 0x1F801800 ... 0x1F80180F: region = TIMING_CDROM; break;
+    case 0x1F801C00 ... 0x1F801FFF: region = TIMING_SPU; break;
+    case 0x1F802000 ... 0x1F803FFF: region = TIMING_EXP2; break;
+    case 0x1FA00000 ... 0x1FBFFFFF: region = TIMING_EXP3; break;
+    case 0x1FC00000 ... 0x1FC7FFFF: region = TIMING_BIOS; break;
+    default: return(TIMING_IO_CYCLES);
+  }
+  return(timing_region_cycles[region][bytes >> 1]);
+}
+
+uint32_t timing_fetch(uint32_t address) {
+  if(address >= 0xa0000000 || !(memory_control_cache & (1 << 11)))
+    return(timing_load(address, 4));
+  timing_line_t *line = &timing_state.icache[(address >> 4) % TIMING_ICACHE_LINES];
+  uint32_t tag = address & 0x1ffffff0;
+  uint32_t word = (address >> 2) & 3;
+  if(line->tag != tag) {
+    line->tag = tag;
+    line->valid = 0;
+  }
+  if(line->valid & (1 << word)) return(0);
+  // A miss fills the line from the word fetched to its end
+  line->valid |= 0xf & (0xf << word);
+  return(TIMING_RAM_CYCLES + 3 - word);
+}
+
+// Stores with the cache isolated are how the BIOS flushes the instruction cache
+void timing_invalidate(uint32_t address) {
+  timing_state.icache[(address >> 4) % TIMING_ICACHE_LINES].valid = 0;
+}
+
+// Multiplies finish early when the first operand is small
+void timing_multiply(uint32_t operand) {
+  uint32_t cycles = operand < 0x800 ? 6 : operand < 0x100000 ? 9 : 13;
+  timing_state.muldiv_ready = scheduler_cycles + cycles;
+}
+
+void timing_divide() {
+  timing_state.muldiv_ready = scheduler_cycles + TIMING_DIV_CYCLES;
+}
+
+void timing_muldiv_wait() {
+  if(scheduler_cycles < timing_state.muldiv_ready)
+    scheduler_cycles = timing_state.muldiv_ready;
+}
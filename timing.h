@@ -0,0 +1,40 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+
+// Guest timing beyond a flat cost per instruction, enabled with -w. Every
+// instruction takes a cycle, plus whatever its fetch and data loads wait
+// for the memory they read, at the speeds the memory_control registers
+// program. KSEG0 and KUSEG fetches go through a 4KB instruction cache when
+// it's enabled, and mfhi/mflo wait for a multiply or divide still running.
+// Stores go through the write buffer for free. Costs are added at each
+// fetch and load rather than summed per block, so events and interrupts
+// fall on the same instruction whichever engine runs. The block engine
+// only looks up the instruction cache once per line.
+#define TIMING_ICACHE_LINES 256
+
+typedef struct timing_line_t {
+  uint32_t tag;
+  uint32_t valid;
+} timing_line_t;
+
+// Everything the model carries from one instruction to the next
+typedef struct timing_state_t {
+  uint64_t muldiv_ready;
+  timing_line_t icache[TIMING_ICACHE_LINES];
+} timing_state_t;
+
+extern int timing_enabled;
+extern timing_state_t timing_state;
+
+void timing_open();
+void timing_update();
+uint32_t timing_fetch(uint32_t address);
+uint32_t timing_load(uint32_t address, uint32_t bytes);
+void timing_invalidate(uint32_t address);
+void timing_multiply(uint32_t operand);
+void timing_divide();
+void timing_muldiv_wait();
+
+#endif
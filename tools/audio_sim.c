@@ -0,0 +1,96 @@
+// audio-sim: run the audio rate controller and ring against a simulated
+// sound device, no real device needed. For each clock skew between the
+// emulator and the host, SPU batches arrive in bursts of a video frame
+// and the device drains the ring on a jittery callback. After settling
+// the ring must average close to its target, as the producer sees it,
+// with no underruns or overruns. Exits non-zero on the first skew that
+// fails.
+//
+//   cc -O2 -I. tools/audio_sim.c audio.c -lSDL2 -lm -o audio-sim
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "audio.h"
+#include "ring.h"
+#include "spu.h"
+
+#define SIM_SECONDS     120
+#define SIM_SETTLE      10
+#define SIM_BATCH       32
+#define SIM_DEVICE      512
+#define SIM_TARGET      (SPU_RATE * 32 / 1000)
+// How far the average fill may stray from the target once settled. The
+// fill itself swings by a frame's burst and a device callback either side.
+#define SIM_TOLERANCE   (SIM_TARGET / 5)
+
+extern ring_t audio_ring;
+extern uint64_t audio_underruns, audio_overruns;
+void audio_start();
+void audio_callback(void *userdata, uint8_t *stream, int length);
+
+uint64_t sim_random = 0x9e3779b97f4a7c15ull;
+
+// Uniform in [-1, 1)
+double sim_jitter() {
+  sim_random ^= sim_random << 13;
+  sim_random ^= sim_random >> 7;
+  sim_random ^= sim_random << 17;
+  return((sim_random >> 11) * (2.0 / (1ull << 53)) - 1);
+}
+
+// skew is the emulator's speed relative to the host
+int sim_run(double skew) {
+  audio_start();
+  audio_underruns = audio_overruns = 0;
+  int16_t batch[SIM_BATCH * 2];
+  static uint8_t device[SIM_DEVICE * 4];
+  double now = 0, next_callback = 0, phase = 0;
+  uint32_t produced = 0, callbacks = 0, low = UINT32_MAX, high = 0;
+  uint64_t total = 0, samples = 0;
+  uint64_t settled_underruns = 0, settled_overruns = 0;
+  double frame = 1.0 / 60 / skew;
+  while(now < SIM_SECONDS) {
+    // A video frame's worth of batches at once, as the paced emulator makes them
+    uint32_t due = (uint32_t)((now + frame) * skew * SPU_RATE) - produced;
+    for(; due >= SIM_BATCH; due -= SIM_BATCH) {
+      for(int n = 0; n < SIM_BATCH; n++) {
+        batch[n * 2] = batch[n * 2 + 1] = 8000 * sin(phase);
+        phase += 0.03;
+      }
+      audio_output(batch, SIM_BATCH);
+      produced += SIM_BATCH;
+      if(now < SIM_SETTLE) continue;
+      uint32_t fill = ring_used(&audio_ring) / 4;
+      if(fill < low) low = fill;
+      if(fill > high) high = fill;
+      total += fill;
+      samples++;
+    }
+    now += frame;
+    while(next_callback <= now) {
+      audio_callback(0, device, sizeof(device));
+      // Late or early around the device's own steady clock
+      next_callback = ++callbacks * (double)SIM_DEVICE / SPU_RATE + 0.002 * sim_jitter();
+    }
+    if(now < SIM_SETTLE) {
+      settled_underruns = audio_underruns;
+      settled_overruns = audio_overruns;
+    }
+  }
+  uint64_t underruns = audio_underruns - settled_underruns;
+  uint64_t overruns = audio_overruns - settled_overruns;
+  double average = (double)total / samples;
+  int ok = !underruns && !overruns && fabs(average - SIM_TARGET) <= SIM_TOLERANCE;
+  printf("skew %.4f: fill %u-%u frames, average %.0f, target %u, underruns %lu, overruns %lu: %s\n",
+    skew, low, high, average, SIM_TARGET, underruns, overruns, ok ? "ok" : "FAILED");
+  return(ok);
+}
+
+int main(void) {
+  double skews[] = {0.996, 0.998, 0.999, 1.0, 1.001, 1.002, 1.004};
+  for(uint32_t n = 0; n < sizeof(skews) / sizeof(skews[0]); n++)
+    if(!sim_run(skews[n])) return(1);
+  return(0);
+}
@@ -0,0 +1,101 @@
+// disc-pack: convert a CUE/BIN disc image into a packed image that ps1 -D
+// reads through its shared hunk cache. Hunks are compressed with zlib, or
+// xz with -x, and stored raw where compression does not help.
+//
+// Build alongside every emulator source except ps1.c, e.g.
+//   cc -O2 -I. tools/disc_pack.c $(ls *.c | grep -v ps1.c) -lSDL2 -lGLEW -lGL -lz -llzma -o disc-pack
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <lzma.h>
+#include "../disc.h"
+
+#define PACK_HUNK_SECTORS 16
+
+int main(int argc, char **argv) {
+  int codec = DISC_CODEC_ZLIB;
+  uint32_t hunk_sectors = PACK_HUNK_SECTORS;
+  int opt;
+  while((opt = getopt(argc, argv, "xh:")) != -1) {
+    switch(opt) {
+      case 'x':
+        codec = DISC_CODEC_LZMA;
+        break;
+      case 'h':
+        hunk_sectors = atoi(optarg);
+        break;
+      default:
+        printf("Usage: %s [-x] [-h hunk_sectors] input.cue output\n", argv[0]);
+        return(1);
+    }
+  }
+  if(argc - optind != 2 || !hunk_sectors) {
+    printf("Usage: %s [-x] [-h hunk_sectors] input.cue output\n", argv[0]);
+    return(1);
+  }
+  disc_open(argv[optind]);
+  FILE *out = fopen(argv[optind + 1], "wb");
+  if(!out) {
+    printf("Failed to open output: %s\n", argv[optind + 1]);
+    return(1);
+  }
+
+  disc_packed_header_t header = {
+    .magic = DISC_PACKED_MAGIC,
+    .version = DISC_PACKED_VERSION,
+    .sectors = disc_sectors,
+    .hunk_sectors = hunk_sectors,
+    .hunk_count = (disc_sectors + hunk_sectors - 1) / hunk_sectors,
+    .track_count = disc_track_count,
+  };
+  memcpy(header.track_start, disc_track_start, sizeof(header.track_start));
+  memcpy(header.track_audio, disc_track_audio, sizeof(header.track_audio));
+  disc_packed_hunk_t *hunks = calloc(header.hunk_count, sizeof(disc_packed_hunk_t));
+  uint64_t offset = sizeof(header) + (uint64_t)header.hunk_count * sizeof(disc_packed_hunk_t);
+  fseek(out, offset, SEEK_SET);
+
+  size_t raw_size = hunk_sectors * DISC_SECTOR_SIZE;
+  size_t packed_size = compressBound(raw_size) + lzma_stream_buffer_bound(raw_size);
+  uint8_t *raw = malloc(raw_size);
+  uint8_t *packed = malloc(packed_size);
+  for(uint32_t hunk = 0; hunk < header.hunk_count; hunk++) {
+    uint32_t first = hunk * hunk_sectors;
+    uint32_t sectors = disc_sectors - first < hunk_sectors ? disc_sectors - first : hunk_sectors;
+    for(uint32_t n = 0; n < sectors; n++)
+      disc_copy(first + n, raw + n * DISC_SECTOR_SIZE);
+    size_t size = sectors * DISC_SECTOR_SIZE;
+
+    size_t length = 0;
+    int ok;
+    if(codec == DISC_CODEC_ZLIB) {
+      uLongf zlength = packed_size;
+      ok = compress2(packed, &zlength, raw, size, 9) == Z_OK;
+      length = zlength;
+    } else {
+      ok = lzma_easy_buffer_encode(6, LZMA_CHECK_NONE, 0, raw, size, packed, &length, packed_size) == LZMA_OK;
+    }
+    hunks[hunk].offset = offset;
+    if(ok && length < size) {
+      hunks[hunk].codec = codec;
+      hunks[hunk].length = length;
+      fwrite(packed, 1, length, out);
+    } else {
+      hunks[hunk].codec = DISC_CODEC_STORED;
+      hunks[hunk].length = size;
+      fwrite(raw, 1, size, out);
+    }
+    offset += hunks[hunk].length;
+  }
+
+  fseek(out, 0, SEEK_SET);
+  fwrite(&header, sizeof(header), 1, out);
+  fwrite(hunks, sizeof(disc_packed_hunk_t), header.hunk_count, out);
+  fclose(out);
+  printf("%u sectors in %u hunks, %lu -> %lu bytes\n", disc_sectors, header.hunk_count,
+    (uint64_t)disc_sectors * DISC_SECTOR_SIZE, offset);
+  return(0);
+}
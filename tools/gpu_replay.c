@@ -0,0 +1,104 @@
+// gpu-replay: feed a GPU capture (ps1 -C) back through the software
+// rasterizer with no CPU or BIOS, reporting a VRAM hash per frame and
+// the overall replay speed.
+//
+// Build alongside every emulator source except ps1.c, e.g.
+//   cc -O2 -I. tools/gpu_replay.c $(ls *.c | grep -v ps1.c) -lSDL2 -lGLEW -lGL -o gpu-replay
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../gpu.h"
+#include "../gpu_capture.h"
+#include "../gpu_raster.h"
+#include "../hash.h"
+
+double replay_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+int main(int argc, char **argv) {
+  int quiet = 0;
+  int opt;
+  while((opt = getopt(argc, argv, "q")) != -1) {
+    switch(opt) {
+      case 'q':
+        quiet = 1;
+        break;
+      default:
+        printf("Usage: %s [-q] capture\n", argv[0]);
+        return(1);
+    }
+  }
+  if(optind >= argc) {
+    printf("Usage: %s [-q] capture\n", argv[0]);
+    return(1);
+  }
+
+  int fd = open(argv[optind], O_RDONLY);
+  struct stat st;
+  if(fd < 0 || fstat(fd, &st) < 0) {
+    printf("Failed to open capture: %s\n", argv[optind]);
+    return(1);
+  }
+  size_t size = st.st_size;
+  uint8_t *data = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(data == MAP_FAILED) {
+    printf("Failed to map capture: %s\n", argv[optind]);
+    return(1);
+  }
+  madvise(data, size, MADV_SEQUENTIAL);
+  gpu_capture_header_t *header = (gpu_capture_header_t *)data;
+  if(size < sizeof(*header) || header->magic != GPU_CAPTURE_MAGIC || header->version != GPU_CAPTURE_VERSION) {
+    printf("Not a GPU capture: %s\n", argv[optind]);
+    return(1);
+  }
+
+  gpu_headless = 1;
+  gpu_init();
+
+  uint64_t frames = 0, words = 0;
+  double start = replay_now();
+  size_t offset = sizeof(*header);
+  while(offset + sizeof(gpu_capture_record_t) <= size) {
+    gpu_capture_record_t *record = (gpu_capture_record_t *)(data + offset);
+    uint32_t count = record->tag & 0xffffff;
+    uint32_t *payload = (uint32_t *)(data + offset + sizeof(*record));
+    offset += sizeof(*record) + count * sizeof(uint32_t);
+    if(offset > size) {
+      printf("Truncated capture record at frame %lu\n", frames);
+      break;
+    }
+    switch(record->tag >> 24) {
+      case GPU_CAPTURE_GP0:
+        for(uint32_t n = 0; n < count; n++) gpu_gp0(payload[n]);
+        words += count;
+        break;
+      case GPU_CAPTURE_GP1:
+        for(uint32_t n = 0; n < count; n++) gpu_gp1(payload[n]);
+        words += count;
+        break;
+      case GPU_CAPTURE_FRAME:
+        gpu_present();
+        if(!quiet)
+          printf("frame %lu %016lx\n", frames, hash_bytes(vram, 1024*1024, HASH_SEED));
+        frames++;
+        break;
+      default:
+        printf("Unknown capture record %08x\n", record->tag);
+        return(1);
+    }
+  }
+  double elapsed = replay_now() - start;
+
+  printf("%lu frames, %lu words in %.3fs: %.1f frames/sec (%s rasterizer)\n",
+    frames, words, elapsed, frames / elapsed, raster_isa());
+  return(0);
+}
@@ -0,0 +1,74 @@
+// shm-grab: read the latest display frame from a running instance's
+// shared memory export (ps1 -X name) and write it as a PPM.
+//
+//   cc -O2 -I. tools/shm_grab.c -o shm-grab -lrt
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "../export.h"
+
+int main(int argc, char **argv) {
+  if(argc != 3) {
+    printf("Usage: %s name output.ppm\n", argv[0]);
+    return(1);
+  }
+  char name[256];
+  snprintf(name, sizeof(name), "%s%s", argv[1][0] == '/' ? "" : "/", argv[1]);
+  int fd = shm_open(name, O_RDONLY, 0);
+  if(fd < 0) {
+    printf("No such export: %s\n", name);
+    return(1);
+  }
+  uint8_t *base = mmap(0, EXPORT_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(base == MAP_FAILED) {
+    printf("Failed to map export: %s\n", name);
+    return(1);
+  }
+  export_header_t *header = (export_header_t *)base;
+  if(header->magic != EXPORT_MAGIC || header->version != EXPORT_VERSION) {
+    printf("Not a PS1 export: %s\n", name);
+    return(1);
+  }
+
+  static uint8_t frame[EXPORT_FRAME_SIZE];
+  uint32_t width, height, format;
+  uint64_t number;
+  uint32_t sequence;
+  do {
+    while((sequence = atomic_load_explicit(&header->sequence, memory_order_acquire)) & 1);
+    width = header->frame_width;
+    height = header->frame_height;
+    format = header->frame_format;
+    number = header->frame_number;
+    memcpy(frame, base + header->frame_offset[header->frame_index], EXPORT_FRAME_SIZE);
+    atomic_thread_fence(memory_order_acquire);
+  } while(atomic_load_explicit(&header->sequence, memory_order_relaxed) != sequence);
+
+  FILE *out = fopen(argv[2], "wb");
+  if(!out) {
+    printf("Failed to open %s\n", argv[2]);
+    return(1);
+  }
+  fprintf(out, "P6\n%u %u\n255\n", width, height);
+  for(uint32_t n = 0; n < width * height; n++) {
+    uint8_t rgb[3];
+    if(format == EXPORT_FORMAT_RGB888) {
+      memcpy(rgb, frame + n * 3, 3);
+    } else {
+      uint16_t pixel = frame[n * 2] | (frame[n * 2 + 1] << 8);
+      rgb[0] = (pixel & 0x1f) << 3;
+      rgb[1] = ((pixel >> 5) & 0x1f) << 3;
+      rgb[2] = ((pixel >> 10) & 0x1f) << 3;
+    }
+    fwrite(rgb, 1, 3, out);
+  }
+  fclose(out);
+  printf("Frame %lu, %ux%u\n", number, width, height);
+  return(0);
+}
@@ -0,0 +1,158 @@
+// trace-decode: print an execution trace written by a -DTRACE build
+// (ps1 -t file), oldest record first. Works on the file of a crashed run
+// as well, the ring is always consistent up to the header's head count.
+//
+// Build alongside every emulator source except ps1.c, e.g.
+//   cc -O2 -I. tools/trace_decode.c $(ls *.c | grep -v ps1.c) -lSDL2 -lGLEW -lGL -o trace-decode
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../cpu.h"
+#include "../trace.h"
+
+void disassemble(uint32_t pc, uint32_t instruction, char *out, size_t size) {
+  uint32_t op = instruction >> 26, rs = (instruction >> 21) & 0x1f;
+  uint32_t rt = (instruction >> 16) & 0x1f, rd = (instruction >> 11) & 0x1f;
+  uint32_t shift = (instruction >> 6) & 0x1f, function = instruction & 0x3f;
+  int16_t immediate = instruction & 0xffff;
+  const char *name = opcode_names[op];
+  if(instruction == 0) {
+    snprintf(out, size, "nop");
+  } else if(op == 0) {
+    name = function < 64 ? special_opcode_names[function] : 0;
+    if(!name) snprintf(out, size, "illegal");
+    else if(function < 4) snprintf(out, size, "%s %s, %s, %u", name, register_names[rd], register_names[rt], shift);
+    else if(function < 8) snprintf(out, size, "%s %s, %s, %s", name, register_names[rd], register_names[rt], register_names[rs]);
+    else if(function == 8) snprintf(out, size, "jr %s", register_names[rs]);
+    else if(function == 9) snprintf(out, size, "jalr %s, %s", register_names[rd], register_names[rs]);
+    else if(function < 16) snprintf(out, size, "%s", name);
+    else if(function == 16 || function == 18) snprintf(out, size, "%s %s", name, register_names[rd]);
+    else if(function < 20) snprintf(out, size, "%s %s", name, register_names[rs]);
+    else if(function < 32) snprintf(out, size, "%s %s, %s", name, register_names[rs], register_names[rt]);
+    else snprintf(out, size, "%s %s, %s, %s", name, register_names[rd], register_names[rs], register_names[rt]);
+  } else if(op == 1) {
+    snprintf(out, size, "%s%s %s, %08x", rt & 1 ? "bgez" : "bltz", (rt & 0x1e) == 0x10 ? "al" : "",
+      register_names[rs], pc + 4 + (immediate << 2));
+  } else if(op == 2 || op == 3) {
+    snprintf(out, size, "%s %08x", name, ((pc + 4) & 0xf0000000) | ((instruction & 0x3ffffff) << 2));
+  } else if(op >= 16 && op < 20) {
+    if(rs == 0) snprintf(out, size, "mfc%u %s, %s", op & 3, register_names[rt], op == 16 ? cop_register_names[rd] : "");
+    else if(rs == 4) snprintf(out, size, "mtc%u %s, %s", op & 3, register_names[rt], op == 16 ? cop_register_names[rd] : "");
+    else if(rs == 2) snprintf(out, size, "cfc%u %s, %u", op & 3, register_names[rt], rd);
+    else if(rs == 6) snprintf(out, size, "ctc%u %s, %u", op & 3, register_names[rt], rd);
+    else if(op == 16 && function == 0x10) snprintf(out, size, "rfe");
+    else snprintf(out, size, "cop%u %07x", op & 3, instruction & 0x1ffffff);
+  } else if(!name) {
+    snprintf(out, size, "illegal");
+  } else if(op < 6) {
+    snprintf(out, size, "%s %s, %s, %08x", name, register_names[rs], register_names[rt], pc + 4 + (immediate << 2));
+  } else if(op < 8) {
+    snprintf(out, size, "%s %s, %08x", name, register_names[rs], pc + 4 + (immediate << 2));
+  } else if(op == 15) {
+    snprintf(out, size, "lui %s, %04x", register_names[rt], instruction & 0xffff);
+  } else if(op < 16) {
+    snprintf(out, size, "%s %s, %s, %d", name, register_names[rt], register_names[rs], op >= 12 ? (int)(instruction & 0xffff) : (int)immediate);
+  } else if(op >= 48) {
+    snprintf(out, size, "%s %u, %d(%s)", name, rt, immediate, register_names[rs]);
+  } else {
+    snprintf(out, size, "%s %s, %d(%s)", name, register_names[rt], immediate, register_names[rs]);
+  }
+}
+
+void print_record(trace_record_t *record) {
+  char text[64];
+  printf("%10u ", record->cycle);
+  switch(record->type) {
+    case TRACE_INSTRUCTION:
+      disassemble(record->a, record->b, text, sizeof(text));
+      printf("%08x: %08x  %s\n", record->a, record->b, text);
+      break;
+    case TRACE_REGISTER:
+      printf("            %s = %08x\n", register_names[record->arg & 31], record->b);
+      break;
+    case TRACE_HILO:
+      printf("            hi = %08x lo = %08x\n", record->a, record->b);
+      break;
+    case TRACE_COP0:
+      printf("            %s = %08x\n", cop_register_names[record->arg & 63], record->b);
+      break;
+    case TRACE_EXCEPTION:
+      printf("exception %u, epc %08x, handler %08x\n", record->arg, record->a, record->b);
+      break;
+    case TRACE_LOAD:
+      printf("            load%u [%08x] -> %0*x\n", record->arg, record->a, record->arg / 4, record->b);
+      break;
+    case TRACE_STORE:
+      printf("            store%u [%08x] <- %0*x\n", record->arg, record->a, record->arg / 4, record->b);
+      break;
+    case TRACE_DMA:
+      printf("dma%u start, base %08x, control %08x\n", record->arg, record->a, record->b);
+      break;
+    case TRACE_GP0:
+      printf("gp0 %08x\n", record->b);
+      break;
+    case TRACE_GP1:
+      printf("gp1 %08x\n", record->b);
+      break;
+    case TRACE_IRQ:
+      printf("irq %u\n", record->arg);
+      break;
+    default:
+      printf("unknown record type %u\n", record->type);
+  }
+}
+
+int main(int argc, char **argv) {
+  uint64_t last = 0;
+  int opt;
+  while((opt = getopt(argc, argv, "n:")) != -1) {
+    switch(opt) {
+      case 'n':
+        last = strtoull(optarg, 0, 0);
+        break;
+      default:
+        printf("Usage: %s [-n records] trace\n", argv[0]);
+        exit(1);
+    }
+  }
+  if(optind >= argc) {
+    printf("Usage: %s [-n records] trace\n", argv[0]);
+    exit(1);
+  }
+
+  int fd = open(argv[optind], O_RDONLY);
+  struct stat st;
+  if(fd < 0 || fstat(fd, &st) || st.st_size < (off_t)sizeof(trace_header_t)) {
+    printf("Failed to open trace: %s\n", argv[optind]);
+    exit(1);
+  }
+  uint8_t *map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) {
+    printf("Failed to map trace: %s\n", argv[optind]);
+    exit(1);
+  }
+  trace_header_t *header = (trace_header_t *)map;
+  trace_record_t *records = (trace_record_t *)(map + sizeof(trace_header_t));
+  if(header->magic != TRACE_MAGIC || header->version != TRACE_VERSION) {
+    printf("Not a trace file: %s\n", argv[optind]);
+    exit(1);
+  }
+  if(sizeof(trace_header_t) + (uint64_t)header->capacity * sizeof(trace_record_t) > (uint64_t)st.st_size) {
+    printf("Truncated trace: %s\n", argv[optind]);
+    exit(1);
+  }
+
+  uint64_t head = header->head;
+  uint64_t first = head > header->capacity ? head - header->capacity : 0;
+  if(last && head - first > last) first = head - last;
+  if(first) printf("Skipping %lu older records\n", first);
+  for(uint64_t n = first; n < head; n++)
+    print_record(&records[n & (header->capacity - 1)]);
+  return(0);
+}
@@ -0,0 +1,60 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include "trace.h"
+
+// The first thread to record writes to the trace path itself, later ones
+// to path.1, path.2 and so on
+char trace_path[256] = "ps1.trace";
+uint32_t trace_capacity = TRACE_RECORDS;
+_Atomic uint32_t trace_threads;
+
+__thread trace_header_t *trace_header;
+__thread trace_record_t *trace_records;
+
+// path[:records], records is rounded up to a power of two
+void trace_open(const char *spec) {
+#ifndef TRACE
+  printf("Tracing is compiled out, rebuild with -DTRACE\n");
+  exit(1);
+#endif
+  snprintf(trace_path, sizeof(trace_path), "%s", spec);
+  char *records = strrchr(trace_path, ':');
+  if(records) {
+    *records++ = 0;
+    uint32_t count = atoi(records);
+    trace_capacity = 1;
+    while(trace_capacity < count) trace_capacity <<= 1;
+  }
+}
+
+void trace_thread_open() {
+  uint32_t thread = atomic_fetch_add(&trace_threads, 1);
+  char path[280];
+  if(thread) snprintf(path, sizeof(path), "%s.%u", trace_path, thread);
+  else snprintf(path, sizeof(path), "%s", trace_path);
+  size_t size = sizeof(trace_header_t) + (size_t)trace_capacity * sizeof(trace_record_t);
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0 || ftruncate(fd, size)) {
+    printf("Failed to create trace file: %s\n", path);
+    exit(1);
+  }
+  uint8_t *map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) {
+    printf("Failed to map trace file: %s\n", path);
+    exit(1);
+  }
+  trace_header = (trace_header_t *)map;
+  trace_header->magic = TRACE_MAGIC;
+  trace_header->version = TRACE_VERSION;
+  trace_header->capacity = trace_capacity;
+  trace_header->thread = thread;
+  trace_header->head = 0;
+  trace_records = (trace_record_t *)(map + sizeof(trace_header_t));
+}
@@ -0,0 +1,69 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Binary execution trace, compiled in with -DTRACE and free otherwise.
+// Each thread records into its own ring of fixed-size records in an mmap'd
+// file, the header's head counter is updated with every record so the
+// file is usable after a crash without any dump step. tools/trace_decode.c
+// prints a trace.
+#define TRACE_MAGIC    0x43525450 // "PTRC"
+#define TRACE_VERSION  1
+#define TRACE_RECORDS  (1 << 20)
+
+enum {
+  TRACE_INSTRUCTION, // a = pc, b = instruction word
+  TRACE_REGISTER,    // arg = register, b = value
+  TRACE_HILO,        // a = hi, b = lo
+  TRACE_COP0,        // arg = register, b = value
+  TRACE_EXCEPTION,   // arg = cause, a = epc, b = handler
+  TRACE_LOAD,        // arg = bits, a = address, b = value
+  TRACE_STORE,       // arg = bits, a = address, b = value
+  TRACE_DMA,         // arg = channel, a = base address, b = control
+  TRACE_GP0,         // b = word
+  TRACE_GP1,         // b = word
+  TRACE_IRQ,         // arg = interrupt
+};
+
+typedef struct __attribute__((packed)) trace_record_t {
+  uint8_t type;
+  uint8_t arg;
+  uint16_t reserved;
+  uint32_t cycle;
+  uint32_t a;
+  uint32_t b;
+} trace_record_t;
+
+typedef struct __attribute__((packed)) trace_header_t {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t capacity;
+  uint32_t thread;
+  // Records written, the ring holds the last capacity of them
+  uint64_t head;
+  uint8_t reserved[40];
+} trace_header_t;
+
+void trace_open(const char *spec);
+
+#ifdef TRACE
+#include "scheduler.h"
+
+extern __thread trace_header_t *trace_header;
+extern __thread trace_record_t *trace_records;
+void trace_thread_open();
+
+static inline void trace_event(uint8_t type, uint8_t arg, uint32_t a, uint32_t b) {
+  if(!trace_header) trace_thread_open();
+  uint64_t head = trace_header->head;
+  trace_records[head & (trace_header->capacity - 1)] = (trace_record_t){type, arg, 0, scheduler_cycles, a, b};
+  trace_header->head = head + 1;
+}
+
+#define TRACE_EVENT(type, arg, a, b) trace_event(type, arg, a, b)
+#else
+#define TRACE_EVENT(type, arg, a, b) do {} while(0)
+#endif
+
+#endif
@@ -0,0 +1,29 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "unix_socket.h"
+
+// Replaces whatever is left at path from an earlier run, exits on failure
+int unix_socket_listen(const char *path, int backlog, const char *name) {
+  struct sockaddr_un address = {0};
+  address.sun_family = AF_UNIX;
+  snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+  unlink(address.sun_path);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0 || bind(fd, (struct sockaddr *)&address, sizeof(address)) || listen(fd, backlog)) {
+    printf("Failed to open %s socket: %s\n", name, path);
+    exit(1);
+  }
+  return(fd);
+}
+
+void unix_socket_send(int client, const void *data, size_t length) {
+  // A client hanging up early mustn't raise SIGPIPE
+  for(size_t sent = 0; sent < length;) {
+    ssize_t written = send(client, (const char *)data + sent, length - sent, MSG_NOSIGNAL);
+    if(written <= 0) break;
+    sent += written;
+  }
+}
@@ -0,0 +1,10 @@
+#ifndef UNIX_SOCKET_H
+#define UNIX_SOCKET_H
+
+#include <stddef.h>
+
+// Listening Unix sockets for the telemetry and debug servers
+int unix_socket_listen(const char *path, int backlog, const char *name);
+void unix_socket_send(int client, const void *data, size_t length);
+
+#endif